@@ -0,0 +1,135 @@
+"""
+standalone benchmark runner, report throughput of encode, decode and round-trip.
+
+python benchmark/bench.py
+python benchmark/bench.py --filter scrape --save baseline.json
+python benchmark/bench.py --compare baseline.json --tolerance 0.1
+python benchmark/bench.py --dump ./payloads  # input files for native microbenchmark
+"""
+
+from __future__ import annotations
+
+import argparse
+import json
+import sys
+import time
+from pathlib import Path
+from typing import Any, Callable, Dict
+
+sys.path.insert(0, str(Path(__file__).parent))
+
+from payloads import PAYLOADS, count_objects  # noqa: E402
+
+from bencode_c import bdecode, bencode  # noqa: E402
+
+
+def measure(fn: Callable[[], Any], min_time: float, rounds: int) -> float:
+    """best seconds per call"""
+    # calibrate
+    n = 1
+    while True:
+        start = time.perf_counter()
+        for _ in range(n):
+            fn()
+        elapsed = time.perf_counter() - start
+        if elapsed >= min_time / rounds:
+            break
+        n *= 2
+
+    best = elapsed / n
+    for _ in range(rounds - 1):
+        start = time.perf_counter()
+        for _ in range(n):
+            fn()
+        best = min(best, (time.perf_counter() - start) / n)
+
+    return best
+
+
+def run(args: argparse.Namespace) -> Dict[str, Dict[str, float]]:
+    results: Dict[str, Dict[str, float]] = {}
+
+    print(
+        f"{'payload':<12} {'case':<10} {'size':>10} {'time':>12}"
+        f" {'MB/s':>10} {'objects/s':>12}"
+    )
+    for name, generate in PAYLOADS.items():
+        if args.filter and args.filter not in name:
+            continue
+
+        value = generate()
+        raw = bencode(value)
+        objects = count_objects(value)
+
+        cases = {
+            "decode": lambda: bdecode(raw),
+            "encode": lambda: bencode(value),
+            "roundtrip": lambda: bencode(bdecode(raw)),
+        }
+
+        for case, fn in cases.items():
+            seconds = measure(fn, args.min_time, args.rounds)
+            mb = len(raw) / seconds / 1e6
+            ops = objects / seconds
+            results[f"{name}/{case}"] = {
+                "seconds": seconds,
+                "mb/s": mb,
+                "objects/s": ops,
+            }
+            print(
+                f"{name:<12} {case:<10} {len(raw):>10} {seconds * 1e6:>10.1f}us"
+                f" {mb:>10.1f} {ops:>12.0f}"
+            )
+
+    return results
+
+
+def compare(
+    results: Dict[str, Dict[str, float]], baseline_path: str, tolerance: float
+) -> int:
+    baseline = json.loads(Path(baseline_path).read_text())
+    regressions = 0
+    for key, current in results.items():
+        if key not in baseline:
+            continue
+        ratio = current["seconds"] / baseline[key]["seconds"]
+        if ratio > 1 + tolerance:
+            regressions += 1
+            print(f"REGRESSION {key}: {ratio:.2f}x slower than baseline")
+
+    return 1 if regressions else 0
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--filter", help="only run payloads with name containing this")
+    parser.add_argument("--min-time", type=float, default=1.0, help="seconds per case")
+    parser.add_argument("--rounds", type=int, default=5)
+    parser.add_argument("--save", help="save results as json")
+    parser.add_argument("--compare", help="compare with results saved by --save")
+    parser.add_argument("--tolerance", type=float, default=0.1)
+    parser.add_argument(
+        "--dump", help="write encoded payloads to this directory and exit"
+    )
+    args = parser.parse_args()
+
+    if args.dump:
+        out = Path(args.dump)
+        out.mkdir(parents=True, exist_ok=True)
+        for name, generate in PAYLOADS.items():
+            out.joinpath(f"{name}.bencode").write_bytes(bencode(generate()))
+        return 0
+
+    results = run(args)
+
+    if args.save:
+        Path(args.save).write_text(json.dumps(results, indent=2))
+
+    if args.compare:
+        return compare(results, args.compare, args.tolerance)
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
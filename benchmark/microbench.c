@@ -0,0 +1,133 @@
+// native microbenchmark, call bdecode/bencode of the statically linked extension in a tight
+// loop without python interpreter overhead.
+//
+// bencode_microbench [-n iterations] file.bencode...
+//
+// input files can be generated by `python benchmark/bench.py --dump DIR`.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <Python.h>
+
+PyMODINIT_FUNC PyInit__bencode(void);
+
+static double now(void) {
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static PyObject *readFile(const char *path) {
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) {
+    PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+    return NULL;
+  }
+
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+
+  char *buf = malloc(size);
+  if (buf == NULL || fread(buf, 1, size, f) != (size_t)size) {
+    free(buf);
+    fclose(f);
+    PyErr_SetString(PyExc_OSError, "failed to read file");
+    return NULL;
+  }
+  fclose(f);
+
+  PyObject *b = PyBytes_FromStringAndSize(buf, size);
+  free(buf);
+  return b;
+}
+
+// best seconds per call
+static double measure(PyObject *fn, PyObject *arg, long iterations, int rounds) {
+  double best = -1;
+  for (int r = 0; r < rounds; r++) {
+    double start = now();
+    for (long i = 0; i < iterations; i++) {
+      PyObject *res = PyObject_CallFunctionObjArgs(fn, arg, NULL);
+      if (res == NULL) {
+        return -1;
+      }
+      Py_DECREF(res);
+    }
+    double elapsed = (now() - start) / iterations;
+    if (best < 0 || elapsed < best) {
+      best = elapsed;
+    }
+  }
+  return best;
+}
+
+int main(int argc, char **argv) {
+  long iterations = 100;
+  int first = 1;
+  if (argc > 2 && strcmp(argv[1], "-n") == 0) {
+    iterations = strtol(argv[2], NULL, 10);
+    first = 3;
+  }
+
+  if (first >= argc || iterations <= 0) {
+    fprintf(stderr, "usage: %s [-n iterations] file.bencode...\n", argv[0]);
+    return 2;
+  }
+
+  PyImport_AppendInittab("_bencode", PyInit__bencode);
+  Py_Initialize();
+
+  int exitCode = 1;
+  PyObject *m = PyImport_ImportModule("_bencode");
+  if (m == NULL) {
+    goto __Exit;
+  }
+
+  PyObject *bdecode = PyObject_GetAttrString(m, "bdecode");
+  PyObject *bencode = PyObject_GetAttrString(m, "bencode");
+  Py_DECREF(m);
+  if (bdecode == NULL || bencode == NULL) {
+    goto __Exit;
+  }
+
+  printf("%-32s %-8s %12s %12s %10s\n", "file", "case", "size", "time", "MB/s");
+  for (int i = first; i < argc; i++) {
+    PyObject *raw = readFile(argv[i]);
+    if (raw == NULL) {
+      goto __Exit;
+    }
+
+    PyObject *value = PyObject_CallFunctionObjArgs(bdecode, raw, NULL);
+    if (value == NULL) {
+      Py_DECREF(raw);
+      goto __Exit;
+    }
+
+    double size = (double)PyBytes_Size(raw);
+    double decode = measure(bdecode, raw, iterations, 5);
+    double encode = measure(bencode, value, iterations, 5);
+    Py_DECREF(value);
+    Py_DECREF(raw);
+    if (decode < 0 || encode < 0) {
+      goto __Exit;
+    }
+
+    printf("%-32s %-8s %12.0f %10.1fus %10.1f\n", argv[i], "decode", size, decode * 1e6,
+           size / decode / 1e6);
+    printf("%-32s %-8s %12.0f %10.1fus %10.1f\n", argv[i], "encode", size, encode * 1e6,
+           size / encode / 1e6);
+  }
+
+  exitCode = 0;
+
+__Exit:
+  if (PyErr_Occurred()) {
+    PyErr_Print();
+  }
+  Py_Finalize();
+  return exitCode;
+}
@@ -0,0 +1,120 @@
+"""synthetic payloads for benchmark, all generators are deterministic."""
+
+from __future__ import annotations
+
+import hashlib
+import random
+from pathlib import Path
+from typing import Any, Callable, Dict
+
+FIXTURES = Path(__file__).parent.parent.joinpath("tests", "fixtures")
+
+
+def _hash(r: random.Random) -> bytes:
+    return r.getrandbits(160).to_bytes(20, "big")
+
+
+def huge_pieces() -> Any:
+    """single file torrent with a 4 MiB `pieces` blob"""
+    r = random.Random(1)
+    return {
+        b"announce": b"https://tracker.example.com/announce",
+        b"creation date": 1700000000,
+        b"info": {
+            b"length": 200_000 * 2**18,
+            b"name": b"large.iso",
+            b"piece length": 2**18,
+            b"pieces": b"".join(_hash(r) for _ in range(200_000)),
+        },
+    }
+
+
+def file_list() -> Any:
+    """multi files torrent with 100k entries in `info.files`"""
+    r = random.Random(2)
+    files = [
+        {
+            b"length": r.randint(0, 2**32),
+            b"path": [b"dir-%d" % (i // 1000), b"file-%d.bin" % i],
+        }
+        for i in range(100_000)
+    ]
+    return {
+        b"announce": b"https://tracker.example.com/announce",
+        b"info": {
+            b"files": files,
+            b"name": b"dataset",
+            b"piece length": 2**22,
+            b"pieces": b"".join(_hash(r) for _ in range(1000)),
+        },
+    }
+
+
+def nested() -> Any:
+    """deeply nested dicts, a 200 levels chain and a tree with fanout 5 and depth 6"""
+
+    def tree(depth: int) -> Any:
+        if depth == 0:
+            return {b"leaf": 1, b"value": b"x"}
+        return {b"child-%d" % i: tree(depth - 1) for i in range(5)}
+
+    chain: Any = {b"end": 0}
+    for i in range(200):
+        chain = {b"level": i, b"next": chain}
+
+    return {b"chain": chain, b"tree": tree(6)}
+
+
+def scrape() -> Any:
+    """int heavy tracker scrape response of 10k torrents"""
+    r = random.Random(3)
+    return {
+        b"files": {
+            hashlib.sha1(b"%d" % i).digest(): {
+                b"complete": r.randint(0, 10_000),
+                b"downloaded": r.randint(0, 2**40),
+                b"incomplete": r.randint(0, 10_000),
+            }
+            for i in range(10_000)
+        }
+    }
+
+
+def announce() -> Any:
+    """tiny tracker announce response with 50 compact peers"""
+    r = random.Random(4)
+    return {
+        b"complete": 20,
+        b"incomplete": 3,
+        b"interval": 1800,
+        b"min interval": 60,
+        b"peers": bytes(r.getrandbits(8) for _ in range(6 * 50)),
+    }
+
+
+def real_torrent() -> Any:
+    """real world torrent from tests/fixtures"""
+    from bencode_c import bdecode
+
+    return bdecode(
+        FIXTURES.joinpath("ubuntu-22.04.2-desktop-amd64.iso.torrent.bin").read_bytes()
+    )
+
+
+PAYLOADS: Dict[str, Callable[[], Any]] = {
+    "pieces": huge_pieces,
+    "files-100k": file_list,
+    "nested": nested,
+    "scrape": scrape,
+    "announce": announce,
+    "torrent": real_torrent,
+}
+
+
+def count_objects(value: Any) -> int:
+    """number of bencode values in payload, including containers and dict keys"""
+    if isinstance(value, dict):
+        return 1 + sum(1 + count_objects(v) for v in value.values())
+    if isinstance(value, (list, tuple)):
+        return 1 + sum(count_objects(v) for v in value)
+    return 1
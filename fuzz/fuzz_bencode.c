@@ -0,0 +1,177 @@
+// libFuzzer entry point, drive bdecode and bencode of the statically linked extension.
+//
+// property checked for every input:
+//   - bdecode either returns a value or raises BencodeDecodeError, never crash or raise others.
+//   - decoder only accepts canonical bencode, so bencode(bdecode(x)) == x,
+//     also with str_key=True and str_value=True.
+//   - bcanonicalize either raises BencodeDecodeError or returns canonical bencode,
+//     which is input itself if input is canonical.
+//   - decode_krpc only accepts valid bencode, and encode_krpc of its result decode to same message.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <Python.h>
+
+PyMODINIT_FUNC PyInit__bencode(void);
+
+static PyObject *bdecode;
+static PyObject *bencode;
+static PyObject *decodeError;
+static PyObject *strOptions;
+static PyObject *bcanonicalize;
+static PyObject *decodeKrpc;
+static PyObject *encodeKrpc;
+
+int LLVMFuzzerInitialize(int *argc, char ***argv) {
+  PyImport_AppendInittab("_bencode", PyInit__bencode);
+  Py_Initialize();
+
+  PyObject *m = PyImport_ImportModule("_bencode");
+  if (m == NULL) {
+    PyErr_Print();
+    abort();
+  }
+
+  bdecode = PyObject_GetAttrString(m, "bdecode");
+  bencode = PyObject_GetAttrString(m, "bencode");
+  bcanonicalize = PyObject_GetAttrString(m, "bcanonicalize");
+  decodeKrpc = PyObject_GetAttrString(m, "decode_krpc");
+  encodeKrpc = PyObject_GetAttrString(m, "encode_krpc");
+  decodeError = PyObject_GetAttrString(m, "BencodeDecodeError");
+  strOptions = Py_BuildValue("{s:O,s:O}", "str_key", Py_True, "str_value", Py_True);
+  Py_DECREF(m);
+  if (bdecode == NULL || bencode == NULL || bcanonicalize == NULL || decodeKrpc == NULL ||
+      encodeKrpc == NULL || decodeError == NULL || strOptions == NULL) {
+    PyErr_Print();
+    abort();
+  }
+
+  return 0;
+}
+
+static void checkRoundTrip(PyObject *raw, PyObject *kwargs) {
+  PyObject *args = PyTuple_Pack(1, raw);
+  if (args == NULL) {
+    PyErr_Print();
+    abort();
+  }
+
+  PyObject *value = PyObject_Call(bdecode, args, kwargs);
+  Py_DECREF(args);
+  if (value == NULL) {
+    if (!PyErr_ExceptionMatches(decodeError)) {
+      PyErr_Print();
+      abort();
+    }
+    PyErr_Clear();
+    return;
+  }
+
+  PyObject *encoded = PyObject_CallFunctionObjArgs(bencode, value, NULL);
+  Py_DECREF(value);
+  if (encoded == NULL) {
+    PyErr_Print();
+    abort();
+  }
+
+  if (PyBytes_Size(encoded) != PyBytes_Size(raw) ||
+      memcmp(PyBytes_AsString(encoded), PyBytes_AsString(raw), PyBytes_Size(raw)) != 0) {
+    fprintf(stderr, "round trip mismatch\n");
+    abort();
+  }
+
+  Py_DECREF(encoded);
+}
+
+static int bytesEqual(PyObject *a, PyObject *b) {
+  return PyBytes_Size(a) == PyBytes_Size(b) &&
+         memcmp(PyBytes_AsString(a), PyBytes_AsString(b), PyBytes_Size(a)) == 0;
+}
+
+static void checkCanonicalize(PyObject *raw) {
+  PyObject *canonical = PyObject_CallFunctionObjArgs(bcanonicalize, raw, NULL);
+  if (canonical == NULL) {
+    if (!PyErr_ExceptionMatches(decodeError)) {
+      PyErr_Print();
+      abort();
+    }
+    PyErr_Clear();
+    return;
+  }
+
+  // canonical output must be accepted by strict decoder and be stable.
+  PyObject *again = PyObject_CallFunctionObjArgs(bcanonicalize, canonical, NULL);
+  PyObject *value = PyObject_CallFunctionObjArgs(bdecode, canonical, NULL);
+  if (again == NULL || value == NULL || !bytesEqual(again, canonical)) {
+    PyErr_Print();
+    fprintf(stderr, "bcanonicalize output is not canonical\n");
+    abort();
+  }
+  Py_DECREF(again);
+  Py_DECREF(value);
+
+  // canonical input is not changed.
+  value = PyObject_CallFunctionObjArgs(bdecode, raw, NULL);
+  if (value == NULL) {
+    PyErr_Clear();
+  } else if (!bytesEqual(raw, canonical)) {
+    fprintf(stderr, "bcanonicalize changed canonical input\n");
+    abort();
+  }
+  Py_XDECREF(value);
+  Py_DECREF(canonical);
+}
+
+static void checkKrpc(PyObject *raw) {
+  PyObject *msg = PyObject_CallFunctionObjArgs(decodeKrpc, raw, NULL);
+  if (msg == NULL) {
+    if (!PyErr_ExceptionMatches(decodeError)) {
+      PyErr_Print();
+      abort();
+    }
+    PyErr_Clear();
+    return;
+  }
+
+  PyObject *value = PyObject_CallFunctionObjArgs(bdecode, raw, NULL);
+  if (value == NULL) {
+    PyErr_Print();
+    fprintf(stderr, "decode_krpc accepted invalid bencode\n");
+    abort();
+  }
+  Py_DECREF(value);
+
+  // unknown keys are dropped, so compare decoded messages instead of bytes.
+  PyObject *encoded = PyObject_CallFunctionObjArgs(encodeKrpc, msg, NULL);
+  PyObject *again = NULL;
+  if (encoded != NULL) {
+    again = PyObject_CallFunctionObjArgs(decodeKrpc, encoded, NULL);
+  }
+  if (again == NULL || PyObject_RichCompareBool(msg, again, Py_EQ) != 1) {
+    PyErr_Print();
+    fprintf(stderr, "krpc round trip mismatch\n");
+    abort();
+  }
+  Py_DECREF(again);
+  Py_DECREF(encoded);
+  Py_DECREF(msg);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  PyObject *raw = PyBytes_FromStringAndSize((const char *)data, (Py_ssize_t)size);
+  if (raw == NULL) {
+    PyErr_Print();
+    abort();
+  }
+
+  checkRoundTrip(raw, NULL);
+  checkRoundTrip(raw, strOptions);
+  checkCanonicalize(raw);
+  checkKrpc(raw);
+
+  Py_DECREF(raw);
+  return 0;
+}
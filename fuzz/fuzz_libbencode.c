@@ -0,0 +1,78 @@
+// libFuzzer entry point of libbencode, without python.
+//
+// property checked for every input:
+//   - bencodeSkip and bencodeParse accept same inputs and stop at same index.
+//   - parsed events written back by BencodeWriter is same as the input,
+//     parser only accepts canonical bencode.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libbencode.h"
+
+static int onInt(void *user, const BencodeInt *value) {
+  BencodeWriter *w = user;
+  int64_t v;
+  if (!bencodeIntToInt64(value, &v)) {
+    return bencodeWriteInt(w, v);
+  }
+
+  return bencodeWriteRaw(w, "i", 1) || bencodeWriteRaw(w, value->body, value->bodyLen) ||
+         bencodeWriteRaw(w, "e", 1);
+}
+
+static int onString(void *user, const char *s, size_t len) {
+  return bencodeWriteString(user, s, len);
+}
+
+static int onListBegin(void *user) { return bencodeWriteListBegin(user); }
+
+static int onDictBegin(void *user) { return bencodeWriteDictBegin(user); }
+
+static int onEnd(void *user) { return bencodeWriteEnd(user); }
+
+static const BencodeHandler handler = {
+    .onInt = onInt,
+    .onString = onString,
+    .onListBegin = onListBegin,
+    .onDictBegin = onDictBegin,
+    // key is written by onString.
+    .onDictKey = onString,
+    .onEnd = onEnd,
+};
+
+int LLVMFuzzerInitialize(int *argc, char ***argv) { return 0; }
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  if (size == 0) {
+    return 0;
+  }
+
+  const char *buf = (const char *)data;
+  BencodeError err;
+
+  size_t skipped = 0;
+  int skipErr = bencodeSkip(buf, size, &skipped, 0, &err);
+
+  BencodeWriter w;
+  if (bencodeWriterInit(&w, size)) {
+    abort();
+  }
+
+  size_t index = 0;
+  int parseErr = bencodeParse(buf, size, &index, &handler, &w, &err);
+  if (parseErr != skipErr || (!parseErr && index != skipped)) {
+    fprintf(stderr, "skip and parse disagree, %d %zu, %d %zu\n", skipErr, skipped, parseErr, index);
+    abort();
+  }
+
+  if (!parseErr && (w.len != index || memcmp(w.buf, buf, index) != 0)) {
+    fprintf(stderr, "written %zu bytes is different from input %zu bytes\n", w.len, index);
+    abort();
+  }
+
+  bencodeWriterFree(&w);
+  return 0;
+}
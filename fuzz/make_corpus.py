@@ -0,0 +1,53 @@
+"""write seed corpus for fuzz targets.
+
+from tests/fixtures and small hand written cases.
+"""
+
+import sys
+from pathlib import Path
+
+from bencode_c import bdecode, bencode
+
+root = Path(__file__).parent.parent
+
+SEEDS = [
+    b"i0e",
+    b"i-1e",
+    b"i170141183460469231731687303715884105728e",
+    b"0:",
+    b"4:spam",
+    b"le",
+    b"l4:spami42ee",
+    b"de",
+    b"d3:cow3:moo4:spam4:eggse",
+    b"d1:ad2:id20:abcdefghij0123456789e1:q4:ping1:t2:aa1:y1:qe",
+    b"d1:ad2:id20:abcdefghij012345678912:implied_porti1e9:info_hash20:"
+    b"mnopqrstuvwxyz1234564:porti6881e5:token8:aoeusnthe1:q13:announce_peer"
+    b"1:t2:aa1:y1:qe",
+    b"d1:rd2:id20:0123456789abcdefghij5:nodes26:abcdefghij0123456789\x01\x02\x03\x04"
+    b"\x1a\xe16:nodes638:abcdefghij0123456789" + b"\x00" * 15 + b"\x01\x1a\xe1"
+    b"5:token8:aoeusnth6:valuesl6:axje.u18:" + b"\x20\x01" + b"\x00" * 16 + b"ee"
+    b"1:t2:aa1:v4:UT011:y1:re",
+    b"d1:eli201e23:A Generic Error Ocurrede1:t2:aa1:y1:ee",
+    b"d4:name6:\xe4\xbd\xa0\xe5\xa5\xbd4:pathl1:a1:bee",
+]
+
+
+def main() -> None:
+    out = Path(sys.argv[1] if len(sys.argv) > 1 else "corpus")
+    out.mkdir(parents=True, exist_ok=True)
+
+    for i, seed in enumerate(SEEDS):
+        out.joinpath(f"seed-{i}").write_bytes(seed)
+
+    for fixture in root.joinpath("tests", "fixtures").iterdir():
+        raw = fixture.read_bytes()
+        out.joinpath(fixture.name).write_bytes(raw)
+        # sub dicts are smaller inputs for fuzzer to mutate.
+        for key, value in bdecode(raw).items():
+            name = key.decode(errors="replace").replace(" ", "-")
+            out.joinpath(f"{fixture.name}.{name}").write_bytes(bencode(value))
+
+
+if __name__ == "__main__":
+    main()
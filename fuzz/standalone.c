@@ -0,0 +1,60 @@
+// main() for building fuzz target without libFuzzer, for AFL++ and replaying crashes.
+//
+// fuzz_bencode_standalone file...   run each file
+// fuzz_bencode_standalone           read one input from stdin (afl-fuzz ... -- ./target)
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+int LLVMFuzzerInitialize(int *argc, char ***argv);
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+static int runFile(FILE *f) {
+  size_t cap = 4096, size = 0;
+  uint8_t *buf = malloc(cap);
+  if (buf == NULL) {
+    return 1;
+  }
+
+  size_t n;
+  while ((n = fread(buf + size, 1, cap - size, f)) > 0) {
+    size += n;
+    if (size == cap) {
+      cap *= 2;
+      uint8_t *tmp = realloc(buf, cap);
+      if (tmp == NULL) {
+        free(buf);
+        return 1;
+      }
+      buf = tmp;
+    }
+  }
+
+  LLVMFuzzerTestOneInput(buf, size);
+  free(buf);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  LLVMFuzzerInitialize(&argc, &argv);
+
+  if (argc < 2) {
+    return runFile(stdin);
+  }
+
+  for (int i = 1; i < argc; i++) {
+    FILE *f = fopen(argv[i], "rb");
+    if (f == NULL) {
+      perror(argv[i]);
+      return 1;
+    }
+    int err = runFile(f);
+    fclose(f);
+    if (err) {
+      return err;
+    }
+  }
+
+  return 0;
+}
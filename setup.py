@@ -25,6 +25,14 @@ if os.environ.get("BENCODE_DEBUG") == "1":
     # if sys.platform == 'win32':
     #     extra_compile_args = ['/Z7', '/DEBUG']
 
+# counters for `stats()`
+if os.environ.get("BENCODE_STATS") == "1":
+    macro.append(("BENCODE_STATS", "1"))
+
+# USDT probes, need sys/sdt.h (systemtap-sdt-dev)
+if os.environ.get("BENCODE_USDT") == "1":
+    macro.append(("BENCODE_USDT", "1"))
+
 module = Extension(
     "bencode_c._bencode",
     sources=glob("./src/bencode_c/*.c"),
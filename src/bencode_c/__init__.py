@@ -1,13 +1,57 @@
 from bencode_c._bencode import (
     bdecode,
+    Decoder,
+    bdecode_prefix,
+    bdecode_select,
+    bdecode_columns,
+    bcanonicalize,
+    bpatch,
     bencode,
+    EncodeCache,
+    bencode_segments,
+    bencode_iter,
+    compile_template,
+    EncodeTemplate,
+    decode_krpc,
+    encode_krpc,
+    KrpcMessage,
+    pack_peers,
+    unpack_peers,
+    CompactPeers,
+    stats,
+    reset_stats,
     BencodeDecodeError,
     BencodeEncodeError,
 )
+from bencode_c._lazy import bload, LazyDict, LazyList
+from bencode_c._torrent import make_torrent
 
 __all__ = [
     "bdecode",
+    "Decoder",
+    "bdecode_prefix",
+    "bdecode_select",
+    "bdecode_columns",
+    "bcanonicalize",
+    "bpatch",
     "bencode",
+    "EncodeCache",
+    "bencode_segments",
+    "bencode_iter",
+    "compile_template",
+    "EncodeTemplate",
+    "bload",
+    "LazyDict",
+    "LazyList",
+    "decode_krpc",
+    "encode_krpc",
+    "KrpcMessage",
+    "pack_peers",
+    "unpack_peers",
+    "CompactPeers",
+    "make_torrent",
+    "stats",
+    "reset_stats",
     "BencodeDecodeError",
     "BencodeEncodeError",
 ]
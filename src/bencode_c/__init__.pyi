@@ -1,7 +1,212 @@
-from typing import Any
+import os
+from typing import (
+    Any,
+    Callable,
+    Dict,
+    Iterable,
+    Iterator,
+    List,
+    Mapping,
+    Optional,
+    Sequence,
+    Tuple,
+    TypeVar,
+    Union,
+)
 
-def bdecode(b: bytes, /) -> Any: ...
-def bencode(v: Any, /) -> bytes: ...
+from bencode_c._lazy import LazyDict as LazyDict, LazyList as LazyList
+
+def bdecode(
+    b: bytes,
+    /,
+    *,
+    str_key: bool = False,
+    str_value: Union[bool, Iterable[Union[str, bytes]]] = False,
+    bytes_as_memoryview: bool = False,
+    memoryview_threshold: int = 0,
+    strict: bool = True,
+) -> Any: ...
+class Decoder:
+    """bdecode with fixed options and a LRU cache of results keyed by input bytes."""
+
+    def __init__(
+        self,
+        cache_size: int = 128,
+        *,
+        frozen: bool = False,
+        str_key: bool = False,
+        str_value: Union[bool, Iterable[Union[str, bytes]]] = False,
+        bytes_as_memoryview: bool = False,
+        memoryview_threshold: int = 0,
+        strict: bool = True,
+    ) -> None: ...
+    def __len__(self) -> int: ...
+    @property
+    def hits(self) -> int: ...
+    @property
+    def misses(self) -> int: ...
+    def decode(self, b: bytes, /) -> Any: ...
+    def clear(self) -> None: ...
+
+def bdecode_prefix(
+    b: bytes,
+    offset: int = 0,
+    /,
+    *,
+    str_key: bool = False,
+    str_value: Union[bool, Iterable[Union[str, bytes]]] = False,
+    bytes_as_memoryview: bool = False,
+    memoryview_threshold: int = 0,
+    strict: bool = True,
+) -> Tuple[Any, int]: ...
+def bdecode_select(
+    b: bytes,
+    paths: Iterable[Sequence[Union[bytes, str, int, "ellipsis"]]],
+    /,
+) -> List[Any]: ...
+def bdecode_columns(
+    b: bytes,
+    path: Sequence[Union[bytes, str, int, "ellipsis"]],
+    fields: Mapping[Union[bytes, str], Union[type, Tuple[type, Any]]],
+    /,
+) -> Dict[Union[bytes, str], Any]: ...
+def bcanonicalize(b: bytes, /) -> bytes: ...
+def bpatch(
+    b: bytes,
+    patches: Mapping[Union[bytes, str, Sequence[Union[bytes, str]]], Any],
+    /,
+    *,
+    delete: Iterable[Union[bytes, str, Sequence[Union[bytes, str]]]] = (),
+) -> bytes: ...
+_T = TypeVar("_T")
+
+class EncodeCache:
+    """encoded output of immutable sub objects, for `bencode(cache=...)`."""
+
+    def __init__(
+        self, maxsize: int = 1024, *, max_bytes: int = 1048576, min_bytes: int = 64
+    ) -> None: ...
+    def __len__(self) -> int: ...
+    @property
+    def hits(self) -> int: ...
+    @property
+    def misses(self) -> int: ...
+    @property
+    def nbytes(self) -> int: ...
+    def mark(self, obj: _T, /) -> _T: ...
+    def unmark(self, obj: Any, /) -> None: ...
+    def clear(self) -> None: ...
+
+def bencode(
+    v: Any,
+    /,
+    *,
+    default: Optional[Callable[[Any], Any]] = None,
+    size_hint: int = 0,
+    check_circular: bool = True,
+    cache: Optional[EncodeCache] = None,
+) -> bytes: ...
+def bencode_segments(
+    v: Any,
+    /,
+    threshold: int = 65536,
+    *,
+    default: Optional[Callable[[Any], Any]] = None,
+    check_circular: bool = True,
+) -> List[Union[bytes, memoryview]]: ...
+def bencode_iter(
+    v: Any,
+    /,
+    chunk_size: int = 65536,
+    *,
+    default: Optional[Callable[[Any], Any]] = None,
+    check_circular: bool = True,
+) -> Iterator[bytes]: ...
+class EncodeTemplate:
+    """dict encoder of fixed keys, created by `compile_template`."""
+
+    @property
+    def keys(self) -> Tuple[Union[str, bytes], ...]: ...
+    def encode(
+        self, values: Union[Sequence[Any], Dict[Union[str, bytes], Any]], /
+    ) -> bytes: ...
+
+def compile_template(
+    keys: Iterable[Union[str, bytes]],
+    /,
+    *,
+    default: Optional[Callable[[Any], Any]] = None,
+    check_circular: bool = True,
+) -> EncodeTemplate: ...
+def bload(path: Union[str, "os.PathLike[str]"]) -> Any: ...
+class KrpcMessage(Tuple[Any, ...]):
+    """DHT KRPC message, fields not in message are None."""
+
+    @property
+    def t(self) -> bytes: ...
+    @property
+    def y(self) -> bytes: ...
+    @property
+    def q(self) -> Optional[bytes]: ...
+    @property
+    def id(self) -> Optional[bytes]: ...
+    @property
+    def target(self) -> Optional[bytes]: ...
+    @property
+    def info_hash(self) -> Optional[bytes]: ...
+    @property
+    def token(self) -> Optional[bytes]: ...
+    @property
+    def port(self) -> Optional[int]: ...
+    @property
+    def implied_port(self) -> Optional[int]: ...
+    @property
+    def nodes(self) -> Optional[List[Tuple[bytes, str, int]]]: ...
+    @property
+    def nodes6(self) -> Optional[List[Tuple[bytes, str, int]]]: ...
+    @property
+    def values(self) -> Optional[List[Tuple[str, int]]]: ...
+    @property
+    def error(self) -> Optional[Tuple[int, bytes]]: ...
+    @property
+    def v(self) -> Optional[bytes]: ...
+
+def decode_krpc(b: bytes, /) -> KrpcMessage: ...
+def encode_krpc(msg: Optional[KrpcMessage] = None, /, **fields: Any) -> bytes: ...
+def make_torrent(
+    path: Union[str, "os.PathLike[str]"],
+    piece_length: int,
+    *,
+    version: Union[int, str] = 1,
+    name: Optional[str] = None,
+    threads: Optional[int] = None,
+    announce: Optional[str] = None,
+    announce_list: Optional[Sequence[Sequence[str]]] = None,
+    comment: Optional[str] = None,
+    created_by: Optional[str] = None,
+    creation_date: Optional[int] = None,
+    private: bool = False,
+    source: Optional[str] = None,
+    url_list: Optional[Sequence[str]] = None,
+) -> bytes: ...
+def pack_peers(peers: Sequence[Tuple[str, int]], /, *, ipv6: bool = False) -> bytes: ...
+def unpack_peers(b: bytes, /, *, ipv6: bool = False) -> List[Tuple[str, int]]: ...
+
+class CompactPeers:
+    """peer list encoded as compact peer string by bencode."""
+
+    def __init__(
+        self, peers: Sequence[Tuple[str, int]], /, *, ipv6: bool = False
+    ) -> None: ...
+    def __len__(self) -> int: ...
+    def __bytes__(self) -> bytes: ...
+    @property
+    def peers(self) -> Sequence[Tuple[str, int]]: ...
+    @property
+    def ipv6(self) -> bool: ...
+
+def stats() -> Dict[str, int]: ...
+def reset_stats() -> None: ...
 
 class BencodeDecodeError(Exception): ...
 class BencodeEncodeError(Exception): ...
@@ -0,0 +1,176 @@
+"""lazy decoding of memory mapped files, see `bload`."""
+
+import mmap
+import os
+from typing import Any, Iterator, List, Mapping, Optional, Sequence, Tuple, Union
+
+from bencode_c._bencode import (
+    BencodeDecodeError,
+    bdecode,
+    _lazy_children,
+    __BUILD_PY_MINOR_VERSION__,
+)
+
+# extension only accept buffer objects on 3.11+, read whole file on older python.
+_MMAP = __BUILD_PY_MINOR_VERSION__ >= 11
+
+_DICT = ord("d")
+_LIST = ord("l")
+_INT = ord("i")
+
+
+def _value(src: Any, buf: memoryview, start: int, end: int) -> Any:
+    c = buf[start]
+    if c == _DICT:
+        return LazyDict(src, buf, start)
+    if c == _LIST:
+        return LazyList(src, buf, start)
+    if c == _INT:
+        return bdecode(bytes(buf[start:end]))
+
+    # max length of py_ssize_t is 19 digits.
+    colon = bytes(buf[start : min(end, start + 21)]).index(b":")
+    return buf[start + colon + 1 : end]
+
+
+class LazyDict(Mapping[bytes, Any]):
+    """dict in a bencode buffer, values are decoded when accessed.
+
+    strings are memoryview into the buffer,
+    lists and dicts are `LazyList` and `LazyDict`.
+    """
+
+    __slots__ = ("_src", "_buf", "_start", "_children", "_cache")
+
+    def __init__(
+        self,
+        src: Any,
+        buf: memoryview,
+        start: int,
+        children: Optional[List[Tuple[bytes, int, int]]] = None,
+    ):
+        self._src = src
+        self._buf = buf
+        self._start = start
+        self._children = (
+            None if children is None else {k: (s, e) for k, s, e in children}
+        )
+        self._cache = {}
+
+    def _spans(self):
+        if self._children is None:
+            # bload validated the whole file, nested values only need their spans.
+            _, children = _lazy_children(self._src, self._start, False)
+            self._children = {k: (s, e) for k, s, e in children}
+        return self._children
+
+    def __getitem__(self, key: bytes) -> Any:
+        try:
+            return self._cache[key]
+        except KeyError:
+            pass
+
+        start, end = self._spans()[key]
+        value = _value(self._src, self._buf, start, end)
+        self._cache[key] = value
+        return value
+
+    def __iter__(self) -> Iterator[bytes]:
+        return iter(self._spans())
+
+    def __len__(self) -> int:
+        return len(self._spans())
+
+    def raw(self, key: bytes) -> memoryview:
+        """encoded value of key, `hashlib.sha1(torrent.raw(b"info"))` is info hash."""
+        start, end = self._spans()[key]
+        return self._buf[start:end]
+
+    def __repr__(self) -> str:
+        return f"LazyDict(keys={list(self._spans())!r})"
+
+
+class LazyList(Sequence[Any]):
+    """list in a bencode buffer, items are decoded when accessed."""
+
+    __slots__ = ("_src", "_buf", "_start", "_children", "_cache")
+
+    def __init__(
+        self,
+        src: Any,
+        buf: memoryview,
+        start: int,
+        children: Optional[List[Tuple[int, int]]] = None,
+    ):
+        self._src = src
+        self._buf = buf
+        self._start = start
+        self._children = children
+        self._cache = {}
+
+    def _spans(self) -> List[Tuple[int, int]]:
+        if self._children is None:
+            # bload validated the whole file, nested values only need their spans.
+            _, self._children = _lazy_children(self._src, self._start, False)
+        return self._children
+
+    def __getitem__(self, index):  # type: ignore[override]
+        spans = self._spans()
+        if isinstance(index, slice):
+            return [self[i] for i in range(*index.indices(len(spans)))]
+
+        if index < 0:
+            index += len(spans)
+        try:
+            return self._cache[index]
+        except KeyError:
+            pass
+
+        start, end = spans[index]
+        value = _value(self._src, self._buf, start, end)
+        self._cache[index] = value
+        return value
+
+    def __len__(self) -> int:
+        return len(self._spans())
+
+    def raw(self, index: int) -> memoryview:
+        """encoded item at index."""
+        start, end = self._spans()[index]
+        return self._buf[start:end]
+
+    def __repr__(self) -> str:
+        return f"LazyList(len={len(self)})"
+
+
+def bload(path: Union[str, "os.PathLike[str]"]) -> Any:
+    """memory map a bencode file and decode it lazily.
+
+    structure of whole file is validated,
+    content of strings are not read until accessed.
+    strings are memoryview into the mapping,
+    dicts and lists are `LazyDict` and `LazyList`.
+    the mapping is closed when all of them are released.
+    """
+    with open(path, "rb") as f:
+        if os.fstat(f.fileno()).st_size == 0:
+            raise BencodeDecodeError("can't decode empty bytes")
+        if _MMAP:
+            src: Any = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+        else:
+            src = f.read()
+
+    buf = memoryview(src)
+    end, children = _lazy_children(src, 0)
+    if end != len(buf):
+        raise BencodeDecodeError(
+            f"invalid bencode data, parse end at index {end} "
+            f"but total bytes length {len(buf)}"
+        )
+
+    c = buf[0]
+    if c == _DICT:
+        return LazyDict(src, buf, 0, children)
+    if c == _LIST:
+        return LazyList(src, buf, 0, children)
+    return _value(src, buf, 0, end)
@@ -0,0 +1,97 @@
+"""create .torrent files, see `make_torrent`."""
+
+import os
+from typing import Any, Dict, List, Optional, Sequence, Tuple, Union
+
+from bencode_c._bencode import _make_torrent
+
+_VERSIONS = {1: 1, 2: 2, "hybrid": 3}
+
+
+def _walk(root: str) -> List[Tuple[str, List[str], int]]:
+    files = []
+    stack = [(root, [])]
+    while stack:
+        path, parts = stack.pop()
+        with os.scandir(path) as it:
+            for entry in it:
+                if entry.is_dir(follow_symlinks=False):
+                    stack.append((entry.path, parts + [entry.name]))
+                elif entry.is_file():
+                    size = entry.stat().st_size
+                    files.append((entry.path, parts + [entry.name], size))
+
+    # same order as keys of v2 'file tree',
+    # v1 and v2 pieces of hybrid torrent must match.
+    files.sort(key=lambda f: [p.encode("utf-8", "surrogateescape") for p in f[1]])
+    return files
+
+
+def make_torrent(
+    path: Union[str, "os.PathLike[str]"],
+    piece_length: int,
+    *,
+    version: Union[int, str] = 1,
+    name: Optional[str] = None,
+    threads: Optional[int] = None,
+    announce: Optional[str] = None,
+    announce_list: Optional[Sequence[Sequence[str]]] = None,
+    comment: Optional[str] = None,
+    created_by: Optional[str] = None,
+    creation_date: Optional[int] = None,
+    private: bool = False,
+    source: Optional[str] = None,
+    url_list: Optional[Sequence[str]] = None,
+) -> bytes:
+    """create a torrent of a file or directory, return encoded .torrent content.
+
+    pieces are hashed by native threads without holding GIL,
+    `threads` default to number of CPUs.
+
+    `version` is 1 (BEP 3), 2 (BEP 52) or "hybrid" (both, files are padded to pieces).
+    `piece_length` must be a power of 2 and at least 16 KiB.
+
+    files in a directory are sorted by path, symlinks to directories are not followed.
+    output has no 'creation date' unless it's given, so same input make same torrent.
+    """
+    if version not in _VERSIONS:
+        raise ValueError(f"version must be 1, 2 or 'hybrid', got {version!r}")
+
+    path = os.fspath(path)
+    if os.path.isdir(path):
+        files = _walk(path)
+    else:
+        files = [(path, [], os.stat(path).st_size)]
+
+    if name is None:
+        name = os.path.basename(os.path.abspath(path))
+
+    fields: Dict[str, Any] = {}
+    if announce is not None:
+        fields["announce"] = announce
+    if announce_list is not None:
+        fields["announce-list"] = [list(tier) for tier in announce_list]
+    if comment is not None:
+        fields["comment"] = comment
+    if created_by is not None:
+        fields["created by"] = created_by
+    if creation_date is not None:
+        fields["creation date"] = creation_date
+    if url_list is not None:
+        fields["url-list"] = list(url_list)
+
+    info: Dict[str, Any] = {}
+    if private:
+        info["private"] = 1
+    if source is not None:
+        info["source"] = source
+
+    return _make_torrent(
+        files,
+        name,
+        piece_length,
+        version=_VERSIONS[version],
+        threads=threads or os.cpu_count() or 1,
+        fields=fields,
+        info=info,
+    )
@@ -1,12 +1,37 @@
 #include "common.h"
 
 extern HPy errTypeMessage;
+extern HPy MappingABC;
+extern HPy SequenceABC;
+extern HPy EnumType;
+extern HPy IOBaseType;
+extern HPy AbcCacheToken;
 extern PyMethodDef encodeImpl[];
+extern PyType_Spec encodeIteratorSpec;
+extern HPy EncodeIteratorType;
+extern PyType_Spec encodeTemplateSpec;
+extern HPy EncodeTemplateType;
+extern PyType_Spec encodeCacheSpec;
+extern HPy EncodeCacheType;
 extern HPy BencodeEncodeError;
 
 extern PyMethodDef decodeImpl[];
+extern PyType_Spec decoderSpec;
+extern HPy DecoderType;
 extern HPy BencodeDecodeError;
 
+extern PyMethodDef statsImpl[];
+
+extern PyMethodDef krpcImpl[];
+extern int krpcInit(HPy m);
+
+extern PyMethodDef torrentImpl[];
+
+extern PyMethodDef peersImpl[];
+extern int peersInit(HPy m);
+
+extern PyMethodDef patchImpl[];
+
 static PyModuleDef moduleDef = {
     .m_base = PyModuleDef_HEAD_INIT,
     .m_name = "_bencode",
@@ -32,6 +57,26 @@ PyMODINIT_FUNC PyInit__bencode(void) {
     return NULL;
   }
 
+  if (PyModule_AddFunctions(m, statsImpl)) {
+    return NULL;
+  }
+
+  if (PyModule_AddFunctions(m, krpcImpl)) {
+    return NULL;
+  }
+
+  if (PyModule_AddFunctions(m, torrentImpl)) {
+    return NULL;
+  }
+
+  if (PyModule_AddFunctions(m, peersImpl)) {
+    return NULL;
+  }
+
+  if (PyModule_AddFunctions(m, patchImpl)) {
+    return NULL;
+  }
+
   errTypeMessage = PyUnicode_FromString(NON_SUPPORTED_TYPE_MESSAGE);
   Py_XINCREF(errTypeMessage);
   if (errTypeMessage == NULL) {
@@ -39,6 +84,95 @@ PyMODINIT_FUNC PyInit__bencode(void) {
     return NULL;
   }
 
+  HPy abc = PyImport_ImportModule("collections.abc");
+  if (abc == NULL) {
+    Py_DECREF(m);
+    return NULL;
+  }
+  MappingABC = PyObject_GetAttrString(abc, "Mapping");
+  SequenceABC = PyObject_GetAttrString(abc, "Sequence");
+  Py_DECREF(abc);
+  if (MappingABC == NULL || SequenceABC == NULL) {
+    Py_DECREF(m);
+    return NULL;
+  }
+
+  HPy enumModule = PyImport_ImportModule("enum");
+  if (enumModule == NULL) {
+    Py_DECREF(m);
+    return NULL;
+  }
+  EnumType = PyObject_GetAttrString(enumModule, "Enum");
+  Py_DECREF(enumModule);
+  if (EnumType == NULL) {
+    Py_DECREF(m);
+    return NULL;
+  }
+
+  HPy abcModule = PyImport_ImportModule("abc");
+  if (abcModule == NULL) {
+    Py_DECREF(m);
+    return NULL;
+  }
+  AbcCacheToken = PyObject_GetAttrString(abcModule, "get_cache_token");
+  Py_DECREF(abcModule);
+  if (AbcCacheToken == NULL) {
+    Py_DECREF(m);
+    return NULL;
+  }
+
+  HPy ioModule = PyImport_ImportModule("io");
+  if (ioModule == NULL) {
+    Py_DECREF(m);
+    return NULL;
+  }
+  IOBaseType = PyObject_GetAttrString(ioModule, "IOBase");
+  Py_DECREF(ioModule);
+  if (IOBaseType == NULL) {
+    Py_DECREF(m);
+    return NULL;
+  }
+
+  EncodeIteratorType = PyType_FromSpec(&encodeIteratorSpec);
+  if (EncodeIteratorType == NULL) {
+    Py_DECREF(m);
+    return NULL;
+  }
+
+  EncodeTemplateType = PyType_FromSpec(&encodeTemplateSpec);
+  Py_XINCREF(EncodeTemplateType);
+  if (PyModule_AddObject(m, "EncodeTemplate", EncodeTemplateType) < 0) {
+    Py_XDECREF(EncodeTemplateType);
+    Py_DECREF(m);
+    return NULL;
+  }
+
+  EncodeCacheType = PyType_FromSpec(&encodeCacheSpec);
+  Py_XINCREF(EncodeCacheType);
+  if (PyModule_AddObject(m, "EncodeCache", EncodeCacheType) < 0) {
+    Py_XDECREF(EncodeCacheType);
+    Py_DECREF(m);
+    return NULL;
+  }
+
+  DecoderType = PyType_FromSpec(&decoderSpec);
+  Py_XINCREF(DecoderType);
+  if (PyModule_AddObject(m, "Decoder", DecoderType) < 0) {
+    Py_XDECREF(DecoderType);
+    Py_DECREF(m);
+    return NULL;
+  }
+
+  if (krpcInit(m)) {
+    Py_DECREF(m);
+    return NULL;
+  }
+
+  if (peersInit(m)) {
+    Py_DECREF(m);
+    return NULL;
+  }
+
   BencodeDecodeError = PyErr_NewException("bencode_c.BencodeDecodeError", NULL, NULL);
   Py_XINCREF(BencodeDecodeError);
   if (PyModule_AddObject(m, "BencodeDecodeError", BencodeDecodeError) < 0) {
@@ -8,7 +8,8 @@
 #define NON_SUPPORTED_TYPE_MESSAGE                                                                 \
   "invalid type '%s', "                                                                            \
   "bencode only support bytes, str, "                                                              \
-  "int, list, tuple, dict and bool(encoded as 0/1, decoded as int)"
+  "int, list, tuple, dict, bool(encoded as 0/1, decoded as int) "                                  \
+  "and objects support buffer protocol"
 
 #ifdef _MSC_VER
 #pragma warning(disable : 4996)
@@ -1,19 +1,106 @@
 #pragma once
 
 #include "common.h"
+#include "libbencode.h"
+#include "stats.h"
 
 #include "khash.h"
 KHASH_SET_INIT_INT64(PTR);
 
+// how to encode objects of a type not in fast path.
+typedef struct typeEntry {
+  // weak reference to type, dead if address may be reused by another type.
+  HPy type;
+  int kind;
+  // dataclass fields
+  HPy fields;
+} TypeEntry;
+
+KHASH_MAP_INIT_INT64(TYPE, TypeEntry);
+
+#define returnIfError(o)                                                                           \
+  do {                                                                                             \
+    int _err = (o);                                                                                \
+    if (_err) {                                                                                    \
+      return _err;                                                                                 \
+    }                                                                                              \
+  } while (0)
+
 #define defaultBufferSize 4096
+#define minBufferSize 256
+#define maxInitialBufferSize (16 * 1024 * 1024)
+
+// objects on first levels of current path are compared linearly, deeper ones are put in hash set.
+#define circularInlineDepth 32
+// without circular reference check, a cycle would recurse until stack overflow.
+#define encodeMaxDepth 1000
+
+#if defined(_MSC_VER)
+#define threadLocal __declspec(thread)
+#else
+#define threadLocal _Thread_local
+#endif
+
+// moving average of recent bencode() output sizes of current thread,
+// used as initial buffer size,
+// so large outputs don't realloc from 4k and small ones don't over allocate.
+static threadLocal size_t recentOutputSize = defaultBufferSize;
+
+static void recordOutputSize(size_t size) {
+  // weight 1/8, a single large output doesn't inflate buffers of following small ones too much.
+  recentOutputSize = recentOutputSize - recentOutputSize / 8 + size / 8;
+}
+
+// initial buffer size for output of expected size, 0 means use recent outputs.
+static size_t initialBufferSize(size_t sizeHint) {
+  size_t size = sizeHint;
+  if (size == 0) {
+    // some room for variance, so output of same size as average doesn't realloc at the end.
+    size = recentOutputSize + recentOutputSize / 4;
+    if (size > maxInitialBufferSize) {
+      size = maxInitialBufferSize;
+    }
+  } else {
+    // bufferGrow keep 1 extra byte.
+    size = size + 1;
+  }
+
+  if (size < minBufferSize) {
+    size = minBufferSize;
+  }
+
+  return size;
+}
 
 typedef struct ctx {
-  char *buf;
-  size_t index;
-  size_t cap;
+  // encoded bytes, `len` is the current write position.
+  BencodeWriter out;
+
+  // lists, dicts and other containers on current path, for circular reference check.
+  HPy path[circularInlineDepth];
+  HPy_ssize_t depth;
+  // path deeper than circularInlineDepth, created on first use.
   khash_t(PTR) * seen;
+  // `check_circular=False`, only limit depth.
+  int noCircularCheck;
+
+  // scatter-gather output, list of bytes or buffer objects. NULL if output to buf only.
+  HPy segments;
+  // strings larger than this are put in segments by reference instead of copying to buf.
+  HPy_ssize_t segmentThreshold;
+  // total size of segments, not including content still in buf.
+  size_t segmentBytes;
+
+  // `default` hook for unsupported objects, borrowed.
+  HPy defaultHook;
+
+  // `cache` of bencode, borrowed, see encodeCached.
+  struct encodeCache *cache;
 } Context;
 
+// writer of a value not built as python object, see encodeDictWithValue.
+typedef int (*writeValueFunc)(Context *ctx, void *arg);
+
 #ifdef _MSC_VER
 static int bufferWriteFormat(Context *ctx, _Printf_format_string_ const char *format, ...);
 #else
@@ -22,21 +109,15 @@ static int bufferWriteFormat(Context *buf, const char *format, ...)
 #endif
 
 // TODO: reuse Context
-static Context newContext(int *res) {
+static Context newContext(int *res, size_t cap) {
   //  Context b = {.seen = NULL};
   Context b = {};
 
-  b.buf = (char *)malloc(defaultBufferSize);
-  if (b.buf == NULL) {
+  if (bencodeWriterInit(&b.out, cap)) {
     PyErr_SetNone(PyExc_MemoryError);
     *res = 1;
-    return b;
   }
 
-  b.index = 0;
-  b.cap = defaultBufferSize;
-  b.seen = kh_init(PTR);
-
   return b;
 }
 
@@ -44,18 +125,19 @@ static void freeContext(Context ctx) {
   if (ctx.seen != NULL) {
     kh_destroy(PTR, ctx.seen);
   }
-  free(ctx.buf);
+  bencodeWriterFree(&ctx.out);
 }
 
 static int bufferGrow(Context *ctx, HPy_ssize_t size) {
-  if (size + ctx->index + 1 >= ctx->cap) {
-    void *tmp = realloc(ctx->buf, ctx->cap * 2 + size);
-    if (tmp == NULL) {
-      PyErr_SetString(PyExc_MemoryError, "failed to grow buffer");
-      return 1;
-    }
-    ctx->cap = ctx->cap * 2 + size;
-    ctx->buf = (void *)tmp;
+  size_t cap = ctx->out.cap;
+  // 1 extra byte for the terminating null of vsnprintf.
+  if (bencodeWriterReserve(&ctx->out, size + 1)) {
+    PyErr_SetString(PyExc_MemoryError, "failed to grow buffer");
+    return 1;
+  }
+  if (ctx->out.cap != cap) {
+    statsInc(buffer_grow);
+    statsAdd(buffer_grow_bytes, ctx->out.cap - cap);
   }
 
   return 0;
@@ -66,9 +148,9 @@ static int bufferWrite(Context *ctx, const char *data, HPy_ssize_t size) {
     return 1;
   }
 
-  memcpy(ctx->buf + ctx->index, data, size);
+  memcpy(ctx->out.buf + ctx->out.len, data, size);
 
-  ctx->index = ctx->index + size;
+  ctx->out.len = ctx->out.len + size;
 
   return 0;
 }
@@ -78,8 +160,8 @@ static int bufferWriteChar(Context *buf, const char c) {
   if (bufferGrow(buf, 1)) {
     return 1;
   }
-  buf->buf[buf->index] = c;
-  buf->index = buf->index + 1;
+  buf->out.buf[buf->out.len] = c;
+  buf->out.len = buf->out.len + 1;
   return 0;
 }
 
@@ -96,7 +178,7 @@ static int bufferWriteFormat(Context *ctx, const char *format, ...) {
     return 1;
   }
 
-  size = vsnprintf(&ctx->buf[ctx->index], size + 1, format, args2);
+  size = vsnprintf(&ctx->out.buf[ctx->out.len], size + 1, format, args2);
   if (size < 0) {
     va_end(args);
     va_end(args2);
@@ -106,7 +188,7 @@ static int bufferWriteFormat(Context *ctx, const char *format, ...) {
   va_end(args);
   va_end(args2);
 
-  ctx->index += size;
+  ctx->out.len += size;
 
   return 0;
 }
@@ -114,3 +196,26 @@ static int bufferWriteFormat(Context *ctx, const char *format, ...) {
 static inline int bufferWriteLongLong(Context *ctx, long long val) {
   return bufferWriteFormat(ctx, "%lld", val);
 }
+
+// move current buffer content to segments as a bytes object, buffer is reused after this.
+static int bufferFlushSegment(Context *ctx) {
+  if (ctx->out.len == 0) {
+    return 0;
+  }
+
+  HPy b = PyBytes_FromStringAndSize(ctx->out.buf, ctx->out.len);
+  if (b == NULL) {
+    return 1;
+  }
+
+  int err = PyList_Append(ctx->segments, b);
+  Py_DecRef(b);
+  if (err) {
+    return 1;
+  }
+
+  statsInc(encode_segments);
+  ctx->segmentBytes += ctx->out.len;
+  ctx->out.len = 0;
+  return 0;
+}
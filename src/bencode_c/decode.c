@@ -1,26 +1,144 @@
 #include <stdint.h>
 
 #include "common.h"
+#include "decode.h"
+#include "libbencode.h"
 #include "overflow.h"
+#include "stats.h"
 #include "str.h"
 
-static HPy bdecode(HPy mod, HPy obj);
+#ifdef __GNUC__
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-function"
+#pragma GCC diagnostic ignored "-Wunused-variable"
+#endif
+
+#include "ctx.h"
+
+#ifdef __GNUC__
+#pragma GCC diagnostic pop
+#endif
+
+static HPy bdecode(HPy mod, HPy args, HPy kwargs);
+static HPy bdecode_prefix(HPy mod, HPy args, HPy kwargs);
+static HPy lazy_children(HPy self, HPy args);
+static HPy bdecode_select(HPy self, HPy args);
+static HPy bdecode_columns(HPy self, HPy args);
+static HPy bcanonicalize(HPy self, HPy b);
 
 // module level variable
 PyObject *BencodeDecodeError;
-PyDoc_STRVAR(__bdecode_doc__, "bdecode(b: bytes, /) -> Any\n"
-                              "--\n\n"
-                              "decode bytes to python object");
+PyDoc_STRVAR(__bdecode_doc__,
+             "bdecode(b, /, *, str_key=False, str_value=False, bytes_as_memoryview=False, "
+             "memoryview_threshold=0, strict=True)\n"
+             "--\n\n"
+             "decode bytes to python object.\n\n"
+             "strings are decoded as bytes by default.\n"
+             "str_key: decode dict keys as str if they are valid utf-8.\n"
+             "str_value: True to decode all string values as str if they are valid utf-8,\n"
+             "    or a collection of dict keys, only values under these keys are decoded as str.\n"
+             "bytes_as_memoryview: return string values as read-only memoryview slices of b "
+             "instead of copying them,\n"
+             "    dict keys are still bytes.\n"
+             "memoryview_threshold: only values not shorter than this are returned as "
+             "memoryview.\n"
+             "strict: False to accept non-canonical input, leading zeros in int and string length, "
+             "unsorted dict keys (kept in input order) and duplicated dict keys (last one win).");
+PyDoc_STRVAR(__bdecode_prefix_doc__,
+             "bdecode_prefix(b, offset=0, /, *, str_key=False, str_value=False, "
+             "bytes_as_memoryview=False, memoryview_threshold=0, strict=True) -> tuple[Any, int]\n"
+             "--\n\n"
+             "decode one value starting at offset, and return it with the offset where it ends.\n\n"
+             "data after the value is not parsed, for messages like BEP 9 metadata data which is "
+             "a dict followed by raw payload, `b[end:]`.\n"
+             "b can be any buffer object on python 3.11+, bytes only on older python.\n"
+             "options are same as bdecode.");
+PyDoc_STRVAR(__bdecode_select_doc__,
+             "bdecode_select(b, paths, /) -> list\n"
+             "--\n\n"
+             "decode only values at paths, other values are validated and skipped without "
+             "creating python objects.\n\n"
+             "a path is a sequence of dict keys (bytes or str) and list indexes (int), "
+             "`...` matches any list item or dict value.\n"
+             "return a list of values in the same order of paths, None if the path doesn't exist, "
+             "or a list of all matched values if the path contains `...`.");
+PyDoc_STRVAR(__bdecode_columns_doc__,
+             "bdecode_columns(b, path, fields, /) -> dict\n"
+             "--\n\n"
+             "decode a list of dicts at path, like `info.files`, to columns without building a "
+             "dict for each item.\n\n"
+             "path is same as bdecode_select, lists matched by `...` are concatenated.\n"
+             "fields is a mapping of dict key to column type or (type, default), "
+             "`int` column is an `array('q')`, `bytes`, `str` and `object` columns are lists.\n"
+             "return a dict of same keys, missing fields are default, or 0 in int columns and None "
+             "in others if not given, columns are empty if path doesn't exist.");
+PyDoc_STRVAR(__bcanonicalize_doc__,
+             "bcanonicalize(b, /) -> bytes\n"
+             "--\n\n"
+             "rewrite possibly non-canonical bencode to canonical form without building python "
+             "objects.\n\n"
+             "leading zeros in int and string length are removed, '-0' become 0, "
+             "dict keys are sorted and only last value of duplicated keys is kept.");
 PyMethodDef decodeImpl[] = {{
                                 .ml_name = "bdecode",
-                                .ml_meth = bdecode,
-                                .ml_flags = METH_O,
+                                .ml_meth = (PyCFunction)(void (*)(void))bdecode,
+                                .ml_flags = METH_VARARGS | METH_KEYWORDS,
                                 .ml_doc = __bdecode_doc__,
                             },
+                            {
+                                .ml_name = "bdecode_prefix",
+                                .ml_meth = (PyCFunction)(void (*)(void))bdecode_prefix,
+                                .ml_flags = METH_VARARGS | METH_KEYWORDS,
+                                .ml_doc = __bdecode_prefix_doc__,
+                            },
+                            {
+                                .ml_name = "bdecode_select",
+                                .ml_meth = (PyCFunction)(void (*)(void))bdecode_select,
+                                .ml_flags = METH_VARARGS,
+                                .ml_doc = __bdecode_select_doc__,
+                            },
+                            {
+                                .ml_name = "bdecode_columns",
+                                .ml_meth = (PyCFunction)(void (*)(void))bdecode_columns,
+                                .ml_flags = METH_VARARGS,
+                                .ml_doc = __bdecode_columns_doc__,
+                            },
+                            {
+                                .ml_name = "bcanonicalize",
+                                .ml_meth = (PyCFunction)(void (*)(void))bcanonicalize,
+                                .ml_flags = METH_O,
+                                .ml_doc = __bcanonicalize_doc__,
+                            },
+                            {
+                                .ml_name = "_lazy_children",
+                                .ml_meth = (PyCFunction)(void (*)(void))lazy_children,
+                                .ml_flags = METH_VARARGS,
+                                .ml_doc = NULL,
+                            },
                             {NULL, NULL, 0, NULL}};
 // module level variable
 
-static PyObject *decodeAny(const char *buf, Py_ssize_t *index, Py_ssize_t size);
+typedef struct decodeContext {
+  // decode dict keys as str.
+  int strKey;
+  // tuple of bytes, values under these dict keys are decoded as str.
+  HPy strValueKeys;
+  // > 0 if current value is in a subtree that should be decoded as str.
+  int strScope;
+  // nesting level of current list/dict.
+  int depth;
+  // memoryview of input if bytes_as_memoryview, string values are sliced from it instead of copied.
+  HPy view;
+  // only strings not shorter than this are sliced.
+  Py_ssize_t viewThreshold;
+  // accept non-canonical input, unsorted or duplicated dict keys and leading zeros.
+  int lenient;
+} DecodeContext;
+
+#define decodeMaxDepth bencodeMaxDepth
+
+static PyObject *decodeAny(const char *buf, Py_ssize_t *index, Py_ssize_t size,
+                           DecodeContext *ctx);
 
 static inline PyObject *formatError(HPy err, const char *format, ...) {
   va_list args;
@@ -46,184 +164,245 @@ static inline PyObject *formatError(HPy err, const char *format, ...) {
     formatError(BencodeDecodeError, format, ##__VA_ARGS__);                                        \
   } while (0)
 
-static PyObject *decodeInt(const char *buf, Py_ssize_t *index, Py_ssize_t size) {
-  Py_ssize_t index_e = 0;
-  for (Py_ssize_t i = *index + 1; i < size; i++) {
-    if (buf[i] == 'e') {
-      index_e = i;
-      break;
-    }
+#define bigIntChunkDigits 18
+#define bigIntChunkBase 1000000000000000000ULL
+
+#ifdef BENCODE_HAS_INT128
+// build PyLong from abs value and sign, python doesn't have a PyLong_FromInt128 in limited api.
+static PyObject *pyLongFromU128(uint128_t val, int negative) {
+  PyObject *high = PyLong_FromUnsignedLongLong((uint64_t)(val >> 64));
+  if (high == NULL) {
+    return NULL;
+  }
+
+  PyObject *shift = PyLong_FromLong(64);
+  if (shift == NULL) {
+    Py_DecRef(high);
+    return NULL;
   }
 
-  if (index_e == 0) {
-    decodingError("invalid int, missing 'e': %zd", *index);
+  PyObject *shifted = PyNumber_Lshift(high, shift);
+  Py_DecRef(high);
+  Py_DecRef(shift);
+  if (shifted == NULL) {
     return NULL;
   }
 
-  // malformed 'ie'
-  if (*index + 1 == index_e) {
-    decodingError("invalid int, found 'ie': %zd", index_e);
+  PyObject *low = PyLong_FromUnsignedLongLong((uint64_t)val);
+  if (low == NULL) {
+    Py_DecRef(shifted);
     return NULL;
   }
 
-  int sign = 1;
+  PyObject *r = PyNumber_Or(shifted, low);
+  Py_DecRef(shifted);
+  Py_DecRef(low);
 
-  // i1234e
-  // i-1234e
-  //  ^ index
-  *index = *index + 1;
+  if (r == NULL || !negative) {
+    return r;
+  }
 
-  if (buf[*index] == '-') {
-    if (buf[*index + 1] == '0') {
-      decodingError("invalid int, '-0' found at %zd", *index);
-      return NULL;
-    }
+  PyObject *neg = PyNumber_Negative(r);
+  Py_DecRef(r);
+  return neg;
+}
+#endif
 
-    sign = -1;
-  } else if (buf[*index] == '0') {
-    if (*index + 1 != index_e) {
-      decodingError("invalid int, non-zero int should not start with '0'. found at %zd", *index);
-      return NULL;
-    }
+static uint64_t parseDigits(const char *buf, Py_ssize_t len) {
+  uint64_t val = 0;
+  for (Py_ssize_t i = 0; i < len; i++) {
+    val = val * 10 + (buf[i] - '0');
   }
+  return val;
+}
 
-  if (sign > 0) {
-    uint64_t val = 0;
-    for (Py_ssize_t i = *index; i < index_e; i++) {
-      char c = buf[i] - '0';
-      if (c < 0 || c > 9) {
-        decodingError("invalid int, '%c' found at %zd", c, i);
-        return NULL;
-      }
+// int overflow int64/uint64.
+// buf[start:end] is the int body (without 'i' and 'e'), may start with '-'.
+// digits are parsed in 128 bits int when possible, otherwise in base 10^18 chunks,
+// without copying them into a NULL-terminated string for PyLong_FromString.
+static PyObject *decodeBigInt(const char *buf, Py_ssize_t start, Py_ssize_t end) {
+  statsInc(decode_bigint);
+  int negative = 0;
+  if (buf[start] == '-') {
+    negative = 1;
+    start = start + 1;
+  }
 
-      // val = val * 10 + (buf[i] - '0')
-      // but with overflow check
+  for (Py_ssize_t i = start; i < end; i++) {
+    if (buf[i] < '0' || buf[i] > '9') {
+      decodingError("invalid int, '%c' found at %zd", buf[i], i);
+      return NULL;
+    }
+  }
 
-      int of = _u64_mul_overflow(val, 10, &val);
-      of = of || _u64_add_overflow(val, c, &val);
+  Py_ssize_t digits = end - start;
 
-      if (of) {
-        goto __OverFlow;
-      }
+#ifdef BENCODE_HAS_INT128
+  // 10^38 - 1 < 2^128 - 1
+  if (digits <= 38) {
+    uint128_t val = 0;
+    for (Py_ssize_t i = start; i < end; i++) {
+      val = val * 10 + (buf[i] - '0');
     }
+    return pyLongFromU128(val, negative);
+  }
+#endif
 
-    *index = index_e + 1;
+  PyObject *base = PyLong_FromUnsignedLongLong(bigIntChunkBase);
+  if (base == NULL) {
+    return NULL;
+  }
 
-    return PyLong_FromUnsignedLongLong(val);
-  } else {
-    int64_t val = 0;
-    int of;
-    for (Py_ssize_t i = *index + 1; i < index_e; i++) {
-      char c = buf[i] - '0';
-      if (c < 0 || c > 9) {
-        decodingError("invalid int, '%c' found at %zd", c, i);
-        return NULL;
-      }
+  // first chunk may be shorter, so all following chunks have exactly 18 digits.
+  Py_ssize_t first = digits % bigIntChunkDigits;
+  if (first == 0) {
+    first = bigIntChunkDigits;
+  }
 
-      of = _i64_mul_overflow(val, 10, &val);
-      of = of || _i64_add_overflow(val, c, &val);
+  PyObject *r = PyLong_FromUnsignedLongLong(parseDigits(&buf[start], first));
+  if (r == NULL) {
+    Py_DecRef(base);
+    return NULL;
+  }
 
-      if (of) {
-        goto __OverFlow;
-      }
+  for (Py_ssize_t i = start + first; i < end; i += bigIntChunkDigits) {
+    PyObject *chunk = PyLong_FromUnsignedLongLong(parseDigits(&buf[i], bigIntChunkDigits));
+    if (chunk == NULL) {
+      goto __Error;
     }
 
-    if (_i64_mul_overflow(val, sign, &val)) {
-      goto __OverFlow;
+    PyObject *tmp = PyNumber_Multiply(r, base);
+    Py_DecRef(r);
+    r = NULL;
+    if (tmp == NULL) {
+      Py_DecRef(chunk);
+      goto __Error;
     }
 
-    *index = index_e + 1;
-    return PyLong_FromLongLong(val);
+    r = PyNumber_Add(tmp, chunk);
+    Py_DecRef(tmp);
+    Py_DecRef(chunk);
+    if (r == NULL) {
+      goto __Error;
+    }
   }
 
-  // i1234e
-  // i-1234e
-  //  ^ index
-
-// bencode int overflow u128 or i128, build a PyLong object from Str directly.
-__OverFlow:;
-  const size_t n = index_e - *index + 1;
-  char *s = (char *)malloc(n);
-  if (s == NULL) {
-    PyErr_SetString(PyExc_MemoryError, "failed to memory");
+  Py_DecRef(base);
 
-    return NULL;
+  if (!negative) {
+    return r;
   }
 
-  strncpy(s, &buf[*index], n);
+  PyObject *neg = PyNumber_Negative(r);
+  Py_DecRef(r);
+  return neg;
 
-  *index = index_e + 1;
+__Error:
+  Py_XDECREF(r);
+  Py_DecRef(base);
+  return NULL;
+}
 
-  s[n - 1] = 0;
+// lenient: accept leading zeros and '-0'.
+HPy decodeInt(const char *buf, Py_ssize_t *index, Py_ssize_t size, int lenient) {
+  size_t i = *index;
+  BencodeInt v;
+  BencodeError err;
+  if (bencodeParseInt(buf, size, &i, lenient, &v, &err)) {
+    decodingError("%s", err.message);
+    return NULL;
+  }
+  *index = i;
 
-  HPy i = PyLong_FromString(s, NULL, 10);
+  // bencode int overflow u64 or i64, build a PyLong object from buffer directly.
+  if (v.overflow) {
+    return decodeBigInt(v.body, 0, v.bodyLen);
+  }
 
-  free(s);
+  if (!v.negative) {
+    return PyLong_FromUnsignedLongLong(v.magnitude);
+  }
 
-  return i;
+  int64_t val;
+  bencodeIntToInt64(&v, &val);
+  return PyLong_FromLongLong(val);
 }
 
 // // there is no bytes/Str in bencode, they only have 1 type for both of them.
-static PyObject *decodeBytes(const char *buf, Py_ssize_t *index, Py_ssize_t size) {
-  Py_ssize_t index_sep = 0;
-  for (Py_ssize_t i = *index; i < size; i++) {
-    if (buf[i] == ':') {
-      index_sep = i;
-      break;
-    }
+// parse string header, set *start and *len to the span of string content in buf.
+// lenient: accept leading zeros in length.
+int decodeBytesSpan(const char *buf, Py_ssize_t *index, Py_ssize_t size, Py_ssize_t *start,
+                    Py_ssize_t *len, int lenient) {
+  size_t i = *index;
+  size_t s, l;
+  BencodeError err;
+  if (bencodeParseString(buf, size, &i, lenient, &s, &l, &err)) {
+    decodingError("%s", err.message);
+    return 1;
   }
 
-  if (index_sep == 0) {
-    decodingError("invalid string, missing length: index %zd", *index);
-    return NULL;
-  }
+  *index = i;
+  *start = s;
+  *len = l;
+  return 0;
+}
 
-  if (buf[*index] == '0' && *index + 1 != index_sep) {
-    decodingError("invalid bytes length, found at %zd", *index);
-    return NULL;
+// build str if asked and content is valid utf-8, otherwise bytes.
+static PyObject *decodeString(const char *s, Py_ssize_t len, int asStr) {
+  statsInc(decode_str);
+  if (asStr && isValidUTF8(s, len)) {
+    return PyUnicode_DecodeUTF8(s, len, NULL);
   }
 
-  Py_ssize_t len = 0;
-  for (Py_ssize_t i = *index; i < index_sep; i++) {
-    if (buf[i] < '0' || buf[i] > '9') {
-      decodingError("invalid bytes length, found '%c' at %zd", buf[i], i);
-      return NULL;
-    }
-    len = len * 10 + (buf[i] - '0');
-  }
+  return PyBytes_FromStringAndSize(s, len);
+}
 
-  if (index_sep + len >= size) {
-    decodingError("bytes length overflow, index %zd", *index);
+static PyObject *decodeBytes(const char *buf, Py_ssize_t *index, Py_ssize_t size,
+                             DecodeContext *ctx) {
+  Py_ssize_t start, len;
+  if (decodeBytesSpan(buf, index, size, &start, &len, ctx->lenient)) {
     return NULL;
   }
 
-  *index = index_sep + len + 1;
+  int asStr = ctx->strScope > 0;
+  if (ctx->view != NULL && len >= ctx->viewThreshold && !(asStr && isValidUTF8(&buf[start], len))) {
+    statsInc(decode_str);
+    return PySequence_GetSlice(ctx->view, start, start + len);
+  }
 
-  return PyBytes_FromStringAndSize(&buf[index_sep + 1], len);
+  return decodeString(&buf[start], len, asStr);
 }
 
-static PyObject *decodeList(const char *buf, Py_ssize_t *index, Py_ssize_t size) {
+static PyObject *decodeList(const char *buf, Py_ssize_t *index, Py_ssize_t size,
+                            DecodeContext *ctx) {
   *index = *index + 1;
 
   PyObject *l = PyList_New(0);
+  if (l == NULL) {
+    return NULL;
+  }
 
   while (1) {
+    if (*index >= size) {
+      Py_DecRef(l);
+      decodingError("bytes end when decoding list");
+      return NULL;
+    }
+
     if (buf[*index] == 'e') {
       break;
     }
 
-    PyObject *obj = decodeAny(buf, index, size);
+    PyObject *obj = decodeAny(buf, index, size, ctx);
     if (obj == NULL) {
       Py_DecRef(l);
       return NULL;
     }
 
-    PyList_Append(l, obj);
-
+    int err = PyList_Append(l, obj);
     Py_DecRef(obj);
-
-    if (*index >= size) {
-      decodingError("bytes end when decoding list");
+    if (err) {
+      Py_DecRef(l);
       return NULL;
     }
   }
@@ -233,51 +412,83 @@ static PyObject *decodeList(const char *buf, Py_ssize_t *index, Py_ssize_t size)
   return l;
 }
 
-static int decodeDict(const char *buf, Py_ssize_t *index, Py_ssize_t size, PyObject *d) {
+// if values under this key should be decoded as str.
+static int isStrValueKey(DecodeContext *ctx, const char *key, Py_ssize_t keyLen) {
+  if (ctx->strValueKeys == NULL) {
+    return 0;
+  }
+
+  Py_ssize_t count = PyTuple_Size(ctx->strValueKeys);
+  for (Py_ssize_t i = 0; i < count; i++) {
+    HPy k = PyTuple_GetItem(ctx->strValueKeys, i);
+    if (PyBytes_Size(k) == keyLen && memcmp(PyBytes_AsString(k), key, keyLen) == 0) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+// dict keys must be sorted and unique, lastKey is NULL for first key.
+int checkKeyOrder(const char *lastKey, Py_ssize_t lastKeyLen, const char *currentKey,
+                  Py_ssize_t currentKeyLen, Py_ssize_t index) {
+  BencodeError err;
+  if (bencodeCheckKeyOrder(lastKey, lastKeyLen, currentKey, currentKeyLen, index, &err)) {
+    decodingError("%s", err.message);
+    return 1;
+  }
+
+  return 0;
+}
+
+static int decodeDict(const char *buf, Py_ssize_t *index, Py_ssize_t size, PyObject *d,
+                      DecodeContext *ctx) {
   *index = *index + 1;
   const char *lastKey = NULL;
   Py_ssize_t lastKeyLen = 0;
-  const char *currentKey;
+  Py_ssize_t keyStart;
   Py_ssize_t currentKeyLen;
 
   while (1) {
+    if (*index >= size) {
+      decodingError("bytes end when decoding dict");
+      return 1;
+    }
+
     if (buf[*index] == 'e') {
       break;
     }
 
-    PyObject *key = decodeBytes(buf, index, size);
+    if (decodeBytesSpan(buf, index, size, &keyStart, &currentKeyLen, ctx->lenient)) {
+      return 1;
+    }
+
+    const char *currentKey = &buf[keyStart];
+    // lenient: keep keys in input order, last one win for duplicated keys.
+    if (!ctx->lenient && checkKeyOrder(lastKey, lastKeyLen, currentKey, currentKeyLen, *index)) {
+      return 1;
+    }
+    lastKey = currentKey;
+    lastKeyLen = currentKeyLen;
+
+    PyObject *key = decodeString(currentKey, currentKeyLen, ctx->strKey);
     if (key == NULL) {
       return 1;
     }
 
-    PyObject *obj = decodeAny(buf, index, size);
+    int strValue = isStrValueKey(ctx, currentKey, currentKeyLen);
+    ctx->strScope += strValue;
+    PyObject *obj = decodeAny(buf, index, size, ctx);
+    ctx->strScope -= strValue;
     if (obj == NULL) {
       Py_DecRef(key);
       return 1;
     }
-    currentKeyLen = PyBytes_Size(key);
-    currentKey = PyBytes_AsString(key);
-    // skip first key
-    if (lastKey != NULL) {
-      int keyCmp = strCompare(currentKey, currentKeyLen, lastKey, lastKeyLen);
-      if (keyCmp < 0) {
-        decodingError("invalid dict, key not sorted. index %zd", *index);
-        return 1;
-      }
-      if (keyCmp == 0) {
-        decodingError("invalid dict, find duplicated keys %.*s. index %zd", currentKeyLen,
-                      currentKey, *index);
-        return 1;
-      }
-    }
-    lastKey = currentKey;
-    lastKeyLen = currentKeyLen;
-    PyDict_SetItem(d, key, obj);
+
+    int err = PyDict_SetItem(d, key, obj);
     Py_DecRef(key);
     Py_DecRef(obj);
-
-    if (*index >= size) {
-      decodingError("bytes end when decoding dict");
+    if (err) {
       return 1;
     }
   }
@@ -287,43 +498,291 @@ static int decodeDict(const char *buf, Py_ssize_t *index, Py_ssize_t size, PyObj
   return 0;
 }
 
-static PyObject *decodeAny(const char *buf, Py_ssize_t *index, Py_ssize_t size) {
+static PyObject *decodeAny(const char *buf, Py_ssize_t *index, Py_ssize_t size,
+                           DecodeContext *ctx) {
   // int
   if (buf[*index] == 'i') {
-    return decodeInt(buf, index, size);
+    statsInc(decode_int);
+    return decodeInt(buf, index, size, ctx->lenient);
   }
 
   // bytes
   if (buf[*index] >= '0' && buf[*index] <= '9') {
-    return decodeBytes(buf, index, size);
+    return decodeBytes(buf, index, size, ctx);
+  }
+
+  if (buf[*index] != 'l' && buf[*index] != 'd') {
+    decodingError("invalid bencode prefix '%c', index %zd", buf[*index], *index);
+    return NULL;
   }
 
+  // untrusted input may nest deep enough to overflow C stack.
+  if (ctx->depth >= decodeMaxDepth) {
+    decodingError("max nesting depth %d exceeded, index %zd", decodeMaxDepth, *index);
+    return NULL;
+  }
+
+  ctx->depth++;
+  PyObject *r;
+
   // list
   if (buf[*index] == 'l') {
-    return decodeList(buf, index, size);
+    statsInc(decode_list);
+    r = decodeList(buf, index, size, ctx);
+  } else {
+    // dict
+    statsInc(decode_dict);
+    r = PyDict_New();
+    if (r != NULL && decodeDict(buf, index, size, r, ctx)) {
+      Py_DecRef(r);
+      r = NULL;
+    }
   }
 
-  // dict
-  if (buf[*index] == 'd') {
-    PyObject *dict = PyDict_New();
-    if (dict == NULL) {
-      Py_DecRef(dict);
-      return NULL;
+  ctx->depth--;
+  return r;
+}
+
+// move index to end of value, validate it without building python objects except int.
+// content of strings are not read, so pages of large strings are not touched for mmap.
+int skipAny(const char *buf, Py_ssize_t *index, Py_ssize_t size, int depth) {
+  size_t i = *index;
+  BencodeError err;
+  if (bencodeSkip(buf, size, &i, depth, &err)) {
+    decodingError("%s", err.message);
+    return 1;
+  }
+
+  *index = i;
+  return 0;
+}
+
+// move index to end of a value already validated by skipAny, only bounds are checked.
+static int skipValidated(const char *buf, Py_ssize_t *index, Py_ssize_t size) {
+  size_t i = *index;
+  BencodeError err;
+  if (bencodeSkipValidated(buf, size, &i, &err)) {
+    decodingError("%s", err.message);
+    return 1;
+  }
+
+  *index = i;
+  return 0;
+}
+
+// (start, end) of children of list, or (key, start, end) of dict at index.
+// without validate, the value must have been validated before and only bounds are checked.
+static HPy lazyChildren(const char *buf, Py_ssize_t *index, Py_ssize_t size, int validate) {
+  int isDict = buf[*index] == 'd';
+  const char *lastKey = NULL;
+  Py_ssize_t lastKeyLen = 0;
+
+  HPy children = PyList_New(0);
+  if (children == NULL) {
+    return NULL;
+  }
+
+  *index = *index + 1;
+  while (1) {
+    if (*index >= size) {
+      decodingError("bytes end when decoding %s", isDict ? "dict" : "list");
+      goto __Error;
     }
 
-    if (decodeDict(buf, index, size, dict)) {
-      Py_DecRef(dict);
-      return NULL;
+    if (buf[*index] == 'e') {
+      break;
+    }
+
+    HPy key = NULL;
+    if (isDict) {
+      Py_ssize_t keyStart, keyLen;
+      if (decodeBytesSpan(buf, index, size, &keyStart, &keyLen, 0)) {
+        goto __Error;
+      }
+      if (validate && checkKeyOrder(lastKey, lastKeyLen, &buf[keyStart], keyLen, *index)) {
+        goto __Error;
+      }
+      lastKey = &buf[keyStart];
+      lastKeyLen = keyLen;
+
+      key = PyBytes_FromStringAndSize(lastKey, lastKeyLen);
+      if (key == NULL) {
+        goto __Error;
+      }
+    }
+
+    Py_ssize_t start = *index;
+    if (validate ? skipAny(buf, index, size, 1) : skipValidated(buf, index, size)) {
+      Py_XDECREF(key);
+      goto __Error;
     }
 
-    return dict;
+    HPy child;
+    if (isDict) {
+      child = Py_BuildValue("(Nnn)", key, start, *index);
+    } else {
+      child = Py_BuildValue("(nn)", start, *index);
+    }
+    if (child == NULL) {
+      goto __Error;
+    }
+
+    int err = PyList_Append(children, child);
+    Py_DecRef(child);
+    if (err) {
+      goto __Error;
+    }
   }
 
-  decodingError("invalid bencode prefix '%c', index %zd", buf[*index], *index);
+  *index = *index + 1;
+  return children;
+
+__Error:
+  Py_DecRef(children);
   return NULL;
 }
 
-static PyObject *bdecode(PyObject *self, PyObject *b) {
+// _lazy_children(buf, offset, validate=True) -> (end, children)
+// validate value at offset, children is list of spans if it's a list or dict, otherwise None.
+// validate=False is for nested values of a buffer already validated as a whole.
+static HPy lazy_children(HPy self, HPy args) {
+  HPy obj;
+  Py_ssize_t offset;
+  int validate = 1;
+  if (!PyArg_ParseTuple(args, "On|p:_lazy_children", &obj, &offset, &validate)) {
+    return NULL;
+  }
+
+#if PY_MINOR_VERSION >= 11
+  Py_buffer view;
+  if (PyObject_GetBuffer(obj, &view, PyBUF_SIMPLE)) {
+    return NULL;
+  }
+  const char *buf = view.buf;
+  Py_ssize_t size = view.len;
+#else
+  // buffer protocol is not in limited api before 3.11.
+  if (!PyBytes_Check(obj)) {
+    PyErr_SetString(PyExc_TypeError, "can only decode bytes");
+    return NULL;
+  }
+  const char *buf = PyBytes_AsString(obj);
+  Py_ssize_t size = PyBytes_Size(obj);
+#endif
+
+  HPy res = NULL;
+  if (offset < 0 || offset >= size) {
+    decodingError("offset %zd out of range, bytes length %zd", offset, size);
+    goto __CLEAN_UP;
+  }
+
+  Py_ssize_t index = offset;
+  if (buf[index] == 'l' || buf[index] == 'd') {
+    HPy children = lazyChildren(buf, &index, size, validate);
+    if (children != NULL) {
+      res = Py_BuildValue("(nN)", index, children);
+    }
+  } else if (!(validate ? skipAny(buf, &index, size, 0) : skipValidated(buf, &index, size))) {
+    res = Py_BuildValue("(nO)", index, Py_None);
+  }
+
+__CLEAN_UP:
+#if PY_MINOR_VERSION >= 11
+  PyBuffer_Release(&view);
+#endif
+  return res;
+}
+
+// str_value=True means all strings, otherwise it's a iterable of dict keys (bytes or str).
+static int parseStrValueOption(DecodeContext *ctx, HPy strValue) {
+  if (strValue == NULL || strValue == Py_False || strValue == Py_None) {
+    return 0;
+  }
+
+  if (strValue == Py_True) {
+    ctx->strScope = 1;
+    return 0;
+  }
+
+  HPy iter = PyObject_GetIter(strValue);
+  if (iter == NULL) {
+    return 1;
+  }
+
+  HPy keys = PyList_New(0);
+  if (keys == NULL) {
+    Py_DecRef(iter);
+    return 1;
+  }
+
+  HPy item;
+  while ((item = PyIter_Next(iter)) != NULL) {
+    HPy key = NULL;
+    if (PyUnicode_Check(item)) {
+      key = PyUnicode_AsUTF8String(item);
+    } else if (PyBytes_Check(item)) {
+      key = item;
+      Py_INCREF(key);
+    } else {
+      PyErr_SetString(PyExc_TypeError, "str_value keys must be str or bytes");
+    }
+    Py_DecRef(item);
+
+    if (key == NULL || PyList_Append(keys, key)) {
+      Py_XDECREF(key);
+      goto __Error;
+    }
+    Py_DecRef(key);
+  }
+
+  if (PyErr_Occurred()) {
+    goto __Error;
+  }
+
+  Py_DecRef(iter);
+  ctx->strValueKeys = PyList_AsTuple(keys);
+  Py_DecRef(keys);
+  return ctx->strValueKeys == NULL;
+
+__Error:
+  Py_DecRef(iter);
+  Py_DecRef(keys);
+  return 1;
+}
+
+// keyword options of bdecode and bdecode_prefix.
+typedef struct decodeOptions {
+  int strKey;
+  HPy strValue;
+  int asMemoryView;
+  Py_ssize_t viewThreshold;
+  int strict;
+} DecodeOptions;
+
+// ctx of options, strValueKeys should be released by caller.
+static int prepareDecodeContext(DecodeContext *ctx, DecodeOptions *opt) {
+  *ctx = (DecodeContext){
+      .strKey = opt->strKey, .viewThreshold = opt->viewThreshold, .lenient = !opt->strict};
+  return parseStrValueOption(ctx, opt->strValue);
+}
+
+// decode value at index of buf, which is content of b.
+static PyObject *decodeWithContext(HPy b, const char *buf, Py_ssize_t *index, Py_ssize_t size,
+                                   DecodeContext ctx, int asMemoryView) {
+  if (asMemoryView) {
+    ctx.view = PyMemoryView_FromObject(b);
+    if (ctx.view == NULL) {
+      return NULL;
+    }
+  }
+
+  PyObject *r = decodeAny(buf, index, size, &ctx);
+  Py_XDECREF(ctx.view);
+  return r;
+}
+
+// decode bytes object b as a whole.
+static PyObject *decodeWhole(HPy b, DecodeContext ctx, int asMemoryView) {
   if (!PyBytes_Check(b)) {
     PyErr_SetString(PyExc_TypeError, "can only decode bytes");
     return NULL;
@@ -336,20 +795,1439 @@ static PyObject *bdecode(PyObject *self, PyObject *b) {
   }
   const char *buf = PyBytes_AsString(b);
 
+  statsInc(decode_calls);
+  statsAdd(decode_bytes, size);
+  probe1(decode__entry, size);
+
   Py_ssize_t index = 0;
-  PyObject *r = decodeAny(buf, &index, size);
-  if (r == NULL) {
-    // failed to parse
-    return NULL;
-  }
+  PyObject *r = decodeWithContext(b, buf, &index, size, ctx, asMemoryView);
 
-  if (index != size) {
-    Py_XDECREF(r);
+  if (r != NULL && index != size) {
+    Py_DecRef(r);
+    r = NULL;
 
     decodingError("invalid bencode data, parse end at index %zd but total bytes length %zd", index,
                   size);
+  }
+
+  if (r == NULL) {
+    statsInc(decode_errors);
+  }
+  probe2(decode__return, size, r != NULL);
+
+  return r;
+}
+
+static PyObject *bdecode(PyObject *self, PyObject *args, PyObject *kwargs) {
+  static char *kwlist[] = {
+      "", "str_key", "str_value", "bytes_as_memoryview", "memoryview_threshold", "strict", NULL};
+
+  HPy b;
+  DecodeOptions opt = {.strict = 1};
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|$pOpnp:bdecode", kwlist, &b, &opt.strKey,
+                                   &opt.strValue, &opt.asMemoryView, &opt.viewThreshold,
+                                   &opt.strict)) {
+    return NULL;
+  }
+
+  DecodeContext ctx;
+  if (prepareDecodeContext(&ctx, &opt)) {
     return NULL;
   }
 
+  PyObject *r = decodeWhole(b, ctx, opt.asMemoryView);
+  Py_XDECREF(ctx.strValueKeys);
   return r;
 }
+
+static PyObject *bdecode_prefix(PyObject *self, PyObject *args, PyObject *kwargs) {
+  static char *kwlist[] = {"", "", "str_key", "str_value", "bytes_as_memoryview",
+                           "memoryview_threshold", "strict", NULL};
+
+  HPy b;
+  Py_ssize_t offset = 0;
+  DecodeOptions opt = {.strict = 1};
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|n$pOpnp:bdecode_prefix", kwlist, &b, &offset,
+                                   &opt.strKey, &opt.strValue, &opt.asMemoryView,
+                                   &opt.viewThreshold, &opt.strict)) {
+    return NULL;
+  }
+
+#if PY_MINOR_VERSION >= 11
+  Py_buffer view;
+  if (PyObject_GetBuffer(b, &view, PyBUF_SIMPLE)) {
+    return NULL;
+  }
+  const char *buf = view.buf;
+  Py_ssize_t size = view.len;
+#else
+  // buffer protocol is not in limited api before 3.11.
+  if (!PyBytes_Check(b)) {
+    PyErr_SetString(PyExc_TypeError, "can only decode bytes");
+    return NULL;
+  }
+  const char *buf = PyBytes_AsString(b);
+  Py_ssize_t size = PyBytes_Size(b);
+#endif
+
+  HPy res = NULL;
+  if (offset < 0 || offset >= size) {
+    decodingError("offset %zd out of range, bytes length %zd", offset, size);
+    goto __CLEAN_UP;
+  }
+
+  statsInc(decode_calls);
+  statsAdd(decode_bytes, size - offset);
+  probe1(decode__entry, size - offset);
+
+  DecodeContext ctx;
+  Py_ssize_t index = offset;
+  HPy value = NULL;
+  if (!prepareDecodeContext(&ctx, &opt)) {
+    value = decodeWithContext(b, buf, &index, size, ctx, opt.asMemoryView);
+  }
+  Py_XDECREF(ctx.strValueKeys);
+  if (value != NULL) {
+    res = Py_BuildValue("(Nn)", value, index);
+  }
+
+  if (res == NULL) {
+    statsInc(decode_errors);
+  }
+  probe2(decode__return, size - offset, res != NULL);
+
+__CLEAN_UP:
+#if PY_MINOR_VERSION >= 11
+  PyBuffer_Release(&view);
+#endif
+  return res;
+}
+
+// Decoder, bdecode with fixed options and a LRU cache of results keyed by input bytes.
+// python hash of bytes is cached in the object and equal keys are compared by content,
+// so a hit is always a result of same input.
+
+typedef struct decoder {
+  PyObject_HEAD;
+  // options, strValueKeys is owned.
+  DecodeContext ctx;
+  int asMemoryView;
+  // return dict as types.MappingProxyType and list as tuple, so results can be shared.
+  int frozen;
+  Py_ssize_t cacheSize;
+  // bytes -> result, least recently used first.
+  HPy cache;
+  Py_ssize_t hits;
+  Py_ssize_t misses;
+} Decoder;
+
+// set by module init.
+HPy DecoderType;
+
+// replace dict and list in value with read-only MappingProxyType and tuple, steal value.
+static HPy freezeValue(HPy value) {
+  if (PyList_Check(value)) {
+    for (Py_ssize_t i = 0; i < PyList_Size(value); i++) {
+      HPy item = PyList_GetItem(value, i);
+      Py_INCREF(item);
+      item = freezeValue(item);
+      if (item == NULL) {
+        Py_DecRef(value);
+        return NULL;
+      }
+      PyList_SetItem(value, i, item);
+    }
+
+    HPy t = PyList_AsTuple(value);
+    Py_DecRef(value);
+    return t;
+  }
+
+  if (PyDict_Check(value)) {
+    Py_ssize_t pos = 0;
+    HPy key;
+    HPy item;
+    // only values of existing keys are replaced, it's safe when iterating.
+    while (PyDict_Next(value, &pos, &key, &item)) {
+      if (!PyList_Check(item) && !PyDict_Check(item)) {
+        continue;
+      }
+      Py_INCREF(item);
+      item = freezeValue(item);
+      if (item == NULL || PyDict_SetItem(value, key, item)) {
+        Py_XDECREF(item);
+        Py_DecRef(value);
+        return NULL;
+      }
+      Py_DecRef(item);
+    }
+
+    HPy proxy = PyDictProxy_New(value);
+    Py_DecRef(value);
+    return proxy;
+  }
+
+  return value;
+}
+
+// copy dict and list in value, other values are immutable and shared.
+static HPy copyValue(HPy value) {
+  if (PyList_Check(value)) {
+    Py_ssize_t size = PyList_Size(value);
+    HPy l = PyList_New(size);
+    if (l == NULL) {
+      return NULL;
+    }
+    for (Py_ssize_t i = 0; i < size; i++) {
+      HPy item = copyValue(PyList_GetItem(value, i));
+      if (item == NULL) {
+        Py_DecRef(l);
+        return NULL;
+      }
+      PyList_SetItem(l, i, item);
+    }
+    return l;
+  }
+
+  if (PyDict_Check(value)) {
+    HPy d = PyDict_New();
+    if (d == NULL) {
+      return NULL;
+    }
+    Py_ssize_t pos = 0;
+    HPy key;
+    HPy item;
+    while (PyDict_Next(value, &pos, &key, &item)) {
+      HPy copied = copyValue(item);
+      if (copied == NULL || PyDict_SetItem(d, key, copied)) {
+        Py_XDECREF(copied);
+        Py_DecRef(d);
+        return NULL;
+      }
+      Py_DecRef(copied);
+    }
+    return d;
+  }
+
+  Py_INCREF(value);
+  return value;
+}
+
+// result of a cached value, cached is borrowed.
+static HPy decoderResult(Decoder *d, HPy cached) {
+  if (d->frozen) {
+    Py_INCREF(cached);
+    return cached;
+  }
+  return copyValue(cached);
+}
+
+static HPy decoderDecode(HPy self, HPy b) {
+  Decoder *d = (Decoder *)self;
+  if (d->cacheSize == 0) {
+    HPy r = decodeWhole(b, d->ctx, d->asMemoryView);
+    return d->frozen && r != NULL ? freezeValue(r) : r;
+  }
+
+  if (!PyBytes_Check(b)) {
+    PyErr_SetString(PyExc_TypeError, "can only decode bytes");
+    return NULL;
+  }
+
+  HPy cached = PyDict_GetItemWithError(d->cache, b);
+  if (cached != NULL) {
+    d->hits++;
+    // move to the end as most recently used.
+    Py_INCREF(cached);
+    int err = PyDict_DelItem(d->cache, b) || PyDict_SetItem(d->cache, b, cached);
+    HPy r = err ? NULL : decoderResult(d, cached);
+    Py_DecRef(cached);
+    return r;
+  }
+  if (PyErr_Occurred()) {
+    return NULL;
+  }
+
+  d->misses++;
+  HPy value = decodeWhole(b, d->ctx, d->asMemoryView);
+  if (value != NULL && d->frozen) {
+    value = freezeValue(value);
+  }
+  if (value == NULL) {
+    return NULL;
+  }
+
+  while (PyDict_Size(d->cache) >= d->cacheSize) {
+    Py_ssize_t pos = 0;
+    HPy key;
+    HPy unused;
+    PyDict_Next(d->cache, &pos, &key, &unused);
+    Py_INCREF(key);
+    int err = PyDict_DelItem(d->cache, key);
+    Py_DecRef(key);
+    if (err) {
+      Py_DecRef(value);
+      return NULL;
+    }
+  }
+
+  HPy r = PyDict_SetItem(d->cache, b, value) ? NULL : decoderResult(d, value);
+  Py_DecRef(value);
+  return r;
+}
+
+static HPy decoderNew(PyTypeObject *type, HPy args, HPy kwargs) {
+  static char *kwlist[] = {"cache_size", "frozen", "str_key", "str_value", "bytes_as_memoryview",
+                           "memoryview_threshold", "strict", NULL};
+
+  Py_ssize_t cacheSize = 128;
+  int frozen = 0;
+  DecodeOptions opt = {.strict = 1};
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|n$ppOpnp:Decoder", kwlist, &cacheSize, &frozen,
+                                   &opt.strKey, &opt.strValue, &opt.asMemoryView,
+                                   &opt.viewThreshold, &opt.strict)) {
+    return NULL;
+  }
+
+  if (cacheSize < 0) {
+    PyErr_SetString(PyExc_ValueError, "cache_size must not be negative");
+    return NULL;
+  }
+
+  allocfunc alloc = (allocfunc)PyType_GetSlot(type, Py_tp_alloc);
+  Decoder *d = (Decoder *)alloc(type, 0);
+  if (d == NULL) {
+    return NULL;
+  }
+
+  d->asMemoryView = opt.asMemoryView;
+  d->frozen = frozen;
+  d->cacheSize = cacheSize;
+  d->cache = PyDict_New();
+  if (d->cache == NULL || prepareDecodeContext(&d->ctx, &opt)) {
+    Py_DecRef((HPy)d);
+    return NULL;
+  }
+
+  return (HPy)d;
+}
+
+static void decoderDealloc(HPy self) {
+  Decoder *d = (Decoder *)self;
+  Py_XDECREF(d->cache);
+  Py_XDECREF(d->ctx.strValueKeys);
+
+  PyTypeObject *tp = Py_TYPE(self);
+  freefunc tp_free = (freefunc)PyType_GetSlot(tp, Py_tp_free);
+  tp_free(self);
+  Py_DecRef((HPy)tp);
+}
+
+static HPy decoderClear(HPy self, HPy unused) {
+  PyDict_Clear(((Decoder *)self)->cache);
+  Py_RETURN_NONE;
+}
+
+static Py_ssize_t decoderLen(HPy self) { return PyDict_Size(((Decoder *)self)->cache); }
+
+static HPy decoderGetHits(HPy self, void *closure) {
+  return PyLong_FromSsize_t(((Decoder *)self)->hits);
+}
+
+static HPy decoderGetMisses(HPy self, void *closure) {
+  return PyLong_FromSsize_t(((Decoder *)self)->misses);
+}
+
+static PyMethodDef decoderMethods[] = {
+    {
+        .ml_name = "decode",
+        .ml_meth = (PyCFunction)(void (*)(void))decoderDecode,
+        .ml_flags = METH_O,
+        .ml_doc = "decode(b: bytes, /) -> Any\n"
+                  "--\n\n"
+                  "bdecode with options of decoder, result of same bytes is taken from cache.",
+    },
+    {
+        .ml_name = "clear",
+        .ml_meth = (PyCFunction)(void (*)(void))decoderClear,
+        .ml_flags = METH_NOARGS,
+        .ml_doc = "clear() -> None\n"
+                  "--\n\n"
+                  "drop all cached results.",
+    },
+    {NULL, NULL, 0, NULL},
+};
+
+static PyGetSetDef decoderGetSet[] = {
+    {"hits", (getter)decoderGetHits, NULL, "decode calls returned from cache", NULL},
+    {"misses", (getter)decoderGetMisses, NULL, "decode calls not in cache", NULL},
+    {NULL},
+};
+
+static PyType_Slot decoderSlots[] = {
+    {Py_tp_doc, "Decoder(cache_size: int = 128, *, frozen: bool = False, str_key=False, "
+                "str_value=False, bytes_as_memoryview=False, memoryview_threshold=0, "
+                "strict=True)\n"
+                "--\n\n"
+                "bdecode with fixed options and a LRU cache of results of last cache_size "
+                "inputs, keyed by input bytes.\n\n"
+                "frozen: return dicts as types.MappingProxyType and lists as tuples, "
+                "cached results are returned as is. "
+                "otherwise dicts and lists of cached results are copied, "
+                "values in them are shared.\n"
+                "other options are same as bdecode."},
+    {Py_tp_new, decoderNew},
+    {Py_tp_dealloc, decoderDealloc},
+    {Py_sq_length, decoderLen},
+    {Py_tp_methods, decoderMethods},
+    {Py_tp_getset, decoderGetSet},
+    {0, NULL},
+};
+
+PyType_Spec decoderSpec = {
+    .name = "bencode_c.Decoder",
+    .basicsize = sizeof(Decoder),
+    .itemsize = 0,
+    .flags = Py_TPFLAGS_DEFAULT,
+    .slots = decoderSlots,
+};
+
+enum selectStepKind { stepKey, stepIndex, stepAny };
+
+typedef struct selectStep {
+  int kind;
+  const char *key;
+  Py_ssize_t keyLen;
+  Py_ssize_t index;
+} SelectStep;
+
+typedef struct selectPath {
+  SelectStep *steps;
+  Py_ssize_t len;
+  // path has wildcard, result is a list of all matched values.
+  int multi;
+  HPy result;
+} SelectPath;
+
+typedef struct selectContext {
+  SelectPath *paths;
+  Py_ssize_t count;
+  // active paths of each depth, count * (max path length + 1) items.
+  Py_ssize_t *active;
+  // own encoded str keys.
+  HPy keys;
+  // set by bdecode_columns, list at end of path is decoded to columns.
+  struct columnsContext *columns;
+} SelectContext;
+
+static void freeSelectContext(SelectContext *s) {
+  if (s->paths != NULL) {
+    for (Py_ssize_t i = 0; i < s->count; i++) {
+      free(s->paths[i].steps);
+      Py_XDECREF(s->paths[i].result);
+    }
+    free(s->paths);
+  }
+  free(s->active);
+  Py_XDECREF(s->keys);
+}
+
+static int stepMatchKey(SelectStep *step, const char *key, Py_ssize_t keyLen) {
+  if (step->kind == stepAny) {
+    return 1;
+  }
+
+  return step->kind == stepKey && step->keyLen == keyLen && memcmp(step->key, key, keyLen) == 0;
+}
+
+static int parseSelectStep(SelectContext *s, SelectStep *step, HPy o) {
+  if (o == Py_Ellipsis) {
+    step->kind = stepAny;
+    return 0;
+  }
+
+  if (PyLong_Check(o)) {
+    step->kind = stepIndex;
+    step->index = PyLong_AsSsize_t(o);
+    if (step->index == -1 && PyErr_Occurred()) {
+      return 1;
+    }
+    if (step->index < 0) {
+      PyErr_SetString(PyExc_ValueError, "negative index is not supported in path");
+      return 1;
+    }
+    return 0;
+  }
+
+  HPy key;
+  if (PyBytes_Check(o)) {
+    Py_INCREF(o);
+    key = o;
+  } else if (PyUnicode_Check(o)) {
+    key = PyUnicode_AsUTF8String(o);
+    if (key == NULL) {
+      return 1;
+    }
+  } else {
+    PyErr_Format(PyExc_TypeError, "path item must be bytes, str, int or ..., got %R", o);
+    return 1;
+  }
+
+  int err = PyList_Append(s->keys, key);
+  Py_DecRef(key);
+  if (err) {
+    return 1;
+  }
+
+  step->kind = stepKey;
+  step->key = PyBytes_AsString(key);
+  step->keyLen = PyBytes_Size(key);
+  return 0;
+}
+
+static int parseSelectPaths(SelectContext *s, HPy paths) {
+  HPy seq = PySequence_List(paths);
+  if (seq == NULL) {
+    return 1;
+  }
+
+  s->count = PyList_Size(seq);
+  s->keys = PyList_New(0);
+  s->paths = calloc(s->count + 1, sizeof(SelectPath));
+  if (s->keys == NULL || s->paths == NULL) {
+    if (s->paths == NULL) {
+      PyErr_SetNone(PyExc_MemoryError);
+    }
+    goto __Error;
+  }
+
+  Py_ssize_t maxLen = 0;
+  for (Py_ssize_t i = 0; i < s->count; i++) {
+    HPy path = PySequence_Tuple(PyList_GetItem(seq, i));
+    if (path == NULL) {
+      goto __Error;
+    }
+
+    SelectPath *p = &s->paths[i];
+    p->len = PyTuple_Size(path);
+    p->steps = calloc(p->len + 1, sizeof(SelectStep));
+    if (p->steps == NULL) {
+      Py_DecRef(path);
+      PyErr_SetNone(PyExc_MemoryError);
+      goto __Error;
+    }
+
+    for (Py_ssize_t j = 0; j < p->len; j++) {
+      if (parseSelectStep(s, &p->steps[j], PyTuple_GetItem(path, j))) {
+        Py_DecRef(path);
+        goto __Error;
+      }
+      p->multi = p->multi || p->steps[j].kind == stepAny;
+    }
+    Py_DecRef(path);
+
+    if (p->multi) {
+      p->result = PyList_New(0);
+      if (p->result == NULL) {
+        goto __Error;
+      }
+    }
+
+    if (p->len > maxLen) {
+      maxLen = p->len;
+    }
+  }
+
+  if (maxLen >= decodeMaxDepth) {
+    decodingError("path is longer than max nesting depth %d", decodeMaxDepth);
+    goto __Error;
+  }
+
+  s->active = malloc(sizeof(Py_ssize_t) * (s->count + 1) * (maxLen + 2));
+  if (s->active == NULL) {
+    PyErr_SetNone(PyExc_MemoryError);
+    goto __Error;
+  }
+  for (Py_ssize_t i = 0; i < s->count; i++) {
+    s->active[i] = i;
+  }
+
+  Py_DecRef(seq);
+  return 0;
+
+__Error:
+  Py_DecRef(seq);
+  return 1;
+}
+
+static int columnsList(struct columnsContext *c, const char *buf, Py_ssize_t *index,
+                       Py_ssize_t size, int depth);
+
+static int selectSetResult(SelectPath *p, HPy value) {
+  if (p->multi) {
+    return PyList_Append(p->result, value);
+  }
+
+  Py_INCREF(value);
+  p->result = value;
+  return 0;
+}
+
+// walk value at index with paths matched to this depth, values at end of paths are decoded,
+// subtrees not matched by any path are skipped without creating python objects.
+static int selectAny(SelectContext *s, const char *buf, Py_ssize_t *index, Py_ssize_t size,
+                     Py_ssize_t depth, Py_ssize_t *active, Py_ssize_t activeCount) {
+  Py_ssize_t start = *index;
+  int deeper = 0;
+  HPy value = NULL;
+
+  for (Py_ssize_t i = 0; i < activeCount; i++) {
+    SelectPath *p = &s->paths[active[i]];
+    if (p->len != depth) {
+      deeper = 1;
+      continue;
+    }
+
+    if (s->columns != NULL) {
+      return columnsList(s->columns, buf, index, size, (int)depth);
+    }
+
+    if (value == NULL) {
+      DecodeContext ctx = {.depth = (int)depth};
+      value = decodeAny(buf, index, size, &ctx);
+      if (value == NULL) {
+        return 1;
+      }
+    }
+
+    if (selectSetResult(p, value)) {
+      Py_DecRef(value);
+      return 1;
+    }
+  }
+
+  if (value != NULL) {
+    Py_DecRef(value);
+    if (!deeper) {
+      return 0;
+    }
+    *index = start;
+  }
+
+  if (buf[*index] != 'l' && buf[*index] != 'd') {
+    // scalar can't match rest of paths.
+    return skipAny(buf, index, size, (int)depth);
+  }
+
+  int isDict = buf[*index] == 'd';
+  const char *lastKey = NULL;
+  Py_ssize_t lastKeyLen = 0;
+  Py_ssize_t *next = s->active + (depth + 1) * (s->count + 1);
+
+  *index = *index + 1;
+  for (Py_ssize_t n = 0;; n++) {
+    if (*index >= size) {
+      decodingError("bytes end when decoding %s", isDict ? "dict" : "list");
+      return 1;
+    }
+
+    if (buf[*index] == 'e') {
+      break;
+    }
+
+    Py_ssize_t keyStart = 0, keyLen = 0;
+    if (isDict) {
+      if (decodeBytesSpan(buf, index, size, &keyStart, &keyLen, 0)) {
+        return 1;
+      }
+      if (checkKeyOrder(lastKey, lastKeyLen, &buf[keyStart], keyLen, *index)) {
+        return 1;
+      }
+      lastKey = &buf[keyStart];
+      lastKeyLen = keyLen;
+    }
+
+    Py_ssize_t nextCount = 0;
+    for (Py_ssize_t i = 0; i < activeCount; i++) {
+      SelectPath *p = &s->paths[active[i]];
+      if (p->len <= depth) {
+        continue;
+      }
+
+      SelectStep *step = &p->steps[depth];
+      int match = isDict ? stepMatchKey(step, &buf[keyStart], keyLen)
+                         : (step->kind == stepAny || (step->kind == stepIndex && step->index == n));
+      if (match) {
+        next[nextCount++] = active[i];
+      }
+    }
+
+    if (nextCount == 0) {
+      if (skipAny(buf, index, size, (int)depth + 1)) {
+        return 1;
+      }
+    } else if (selectAny(s, buf, index, size, depth + 1, next, nextCount)) {
+      return 1;
+    }
+  }
+
+  *index = *index + 1;
+  return 0;
+}
+
+static HPy bdecode_select(HPy self, HPy args) {
+  HPy b;
+  HPy paths;
+  if (!PyArg_ParseTuple(args, "OO:bdecode_select", &b, &paths)) {
+    return NULL;
+  }
+
+  if (!PyBytes_Check(b)) {
+    PyErr_SetString(PyExc_TypeError, "can only decode bytes");
+    return NULL;
+  }
+
+  Py_ssize_t size = PyBytes_Size(b);
+  if (size == 0) {
+    decodingError("can't decode empty bytes");
+    return NULL;
+  }
+  const char *buf = PyBytes_AsString(b);
+
+  SelectContext s = {};
+  HPy res = NULL;
+  if (parseSelectPaths(&s, paths)) {
+    goto __CLEAN_UP;
+  }
+
+  statsInc(decode_calls);
+  statsAdd(decode_bytes, size);
+
+  Py_ssize_t index = 0;
+  if (selectAny(&s, buf, &index, size, 0, s.active, s.count)) {
+    statsInc(decode_errors);
+    goto __CLEAN_UP;
+  }
+
+  if (index != size) {
+    statsInc(decode_errors);
+    decodingError("invalid bencode data, parse end at index %zd but total bytes length %zd", index,
+                  size);
+    goto __CLEAN_UP;
+  }
+
+  res = PyList_New(s.count);
+  if (res == NULL) {
+    goto __CLEAN_UP;
+  }
+
+  for (Py_ssize_t i = 0; i < s.count; i++) {
+    HPy value = s.paths[i].result;
+    if (value == NULL) {
+      value = Py_None;
+      Py_INCREF(value);
+    }
+    s.paths[i].result = NULL;
+    PyList_SetItem(res, i, value);
+  }
+
+__CLEAN_UP:
+  freeSelectContext(&s);
+  return res;
+}
+
+enum columnKind { columnInt, columnBytes, columnStr, columnObject };
+
+typedef struct column {
+  int kind;
+  const char *key;
+  Py_ssize_t keyLen;
+  // values of int column, one for each row.
+  int64_t *ints;
+  // list of other columns.
+  HPy values;
+  // value of rows missing key, borrowed from ColumnsContext.items.
+  HPy defaultValue;
+  int64_t defaultInt;
+  // key is found in current row.
+  int seen;
+} Column;
+
+typedef struct columnsContext {
+  Column *columns;
+  Py_ssize_t count;
+  Py_ssize_t rows;
+  // capacity of int columns.
+  Py_ssize_t cap;
+  // list of (key, type) from fields, own encoded str keys.
+  HPy items;
+  HPy keys;
+} ColumnsContext;
+
+static void freeColumnsContext(ColumnsContext *c) {
+  if (c->columns != NULL) {
+    for (Py_ssize_t i = 0; i < c->count; i++) {
+      free(c->columns[i].ints);
+      Py_XDECREF(c->columns[i].values);
+    }
+    free(c->columns);
+  }
+  Py_XDECREF(c->items);
+  Py_XDECREF(c->keys);
+}
+
+static int parseColumnsFields(ColumnsContext *c, HPy fields) {
+  c->items = PyMapping_Items(fields);
+  c->keys = PyList_New(0);
+  if (c->items == NULL || c->keys == NULL) {
+    return 1;
+  }
+
+  c->count = PyList_Size(c->items);
+  c->columns = calloc(c->count + 1, sizeof(Column));
+  if (c->columns == NULL) {
+    PyErr_SetNone(PyExc_MemoryError);
+    return 1;
+  }
+
+  for (Py_ssize_t i = 0; i < c->count; i++) {
+    HPy item = PyList_GetItem(c->items, i);
+    HPy o = PyTuple_GetItem(item, 0);
+    HPy type = PyTuple_GetItem(item, 1);
+    Column *col = &c->columns[i];
+
+    // (type, default) to tell missing fields from real 0 or None.
+    col->defaultValue = Py_None;
+    int hasDefault = PyTuple_Check(type) && PyTuple_Size(type) == 2;
+    if (hasDefault) {
+      col->defaultValue = PyTuple_GetItem(type, 1);
+      type = PyTuple_GetItem(type, 0);
+    }
+
+    HPy key;
+    if (PyBytes_Check(o)) {
+      Py_INCREF(o);
+      key = o;
+    } else if (PyUnicode_Check(o)) {
+      key = PyUnicode_AsUTF8String(o);
+      if (key == NULL) {
+        return 1;
+      }
+    } else {
+      PyErr_Format(PyExc_TypeError, "field must be bytes or str, got %R", o);
+      return 1;
+    }
+
+    int err = PyList_Append(c->keys, key);
+    Py_DecRef(key);
+    if (err) {
+      return 1;
+    }
+    col->key = PyBytes_AsString(key);
+    col->keyLen = PyBytes_Size(key);
+    for (Py_ssize_t j = 0; j < i; j++) {
+      if (c->columns[j].keyLen == col->keyLen &&
+          memcmp(c->columns[j].key, col->key, col->keyLen) == 0) {
+        PyErr_Format(PyExc_ValueError, "duplicated field %R", o);
+        return 1;
+      }
+    }
+
+    if (type == (HPy)&PyLong_Type) {
+      col->kind = columnInt;
+      if (!hasDefault) {
+        continue;
+      }
+      if (!PyLong_Check(col->defaultValue)) {
+        PyErr_Format(PyExc_TypeError, "default of int column %R must be int, got %R", o,
+                     col->defaultValue);
+        return 1;
+      }
+      col->defaultInt = PyLong_AsLongLong(col->defaultValue);
+      if (col->defaultInt == -1 && PyErr_Occurred()) {
+        return 1;
+      }
+      continue;
+    }
+
+    if (type == (HPy)&PyBytes_Type) {
+      col->kind = columnBytes;
+    } else if (type == (HPy)&PyUnicode_Type) {
+      col->kind = columnStr;
+    } else if (type == (HPy)&PyBaseObject_Type) {
+      col->kind = columnObject;
+    } else {
+      PyErr_Format(PyExc_TypeError, "column type of %R must be int, bytes, str or object, got %R",
+                   o, type);
+      return 1;
+    }
+
+    col->values = PyList_New(0);
+    if (col->values == NULL) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+// canonical int to int64 without building python int.
+static int decodeInt64(const char *buf, Py_ssize_t *index, Py_ssize_t size, int64_t *out) {
+  size_t i = *index;
+  BencodeInt v;
+  BencodeError err;
+  if (bencodeParseInt(buf, size, &i, 0, &v, &err)) {
+    decodingError("%s", err.message);
+    return 1;
+  }
+
+  if (bencodeIntToInt64(&v, out)) {
+    PyErr_Format(PyExc_OverflowError, "int at %zd overflow int64 column", *index);
+    return 1;
+  }
+
+  *index = i;
+  return 0;
+}
+
+static int columnsValue(Column *col, const char *buf, Py_ssize_t *index, Py_ssize_t size,
+                        int64_t *slot, int depth) {
+  if (col->kind == columnInt) {
+    if (buf[*index] != 'i') {
+      decodingError("expect int for field '%s', index %zd", col->key, *index);
+      return 1;
+    }
+    return decodeInt64(buf, index, size, slot);
+  }
+
+  HPy value;
+  if (col->kind == columnObject) {
+    DecodeContext ctx = {.depth = depth};
+    value = decodeAny(buf, index, size, &ctx);
+  } else {
+    Py_ssize_t start, len;
+    if (buf[*index] < '0' || buf[*index] > '9') {
+      decodingError("expect string for field '%s', index %zd", col->key, *index);
+      return 1;
+    }
+    if (decodeBytesSpan(buf, index, size, &start, &len, 0)) {
+      return 1;
+    }
+    value = decodeString(&buf[start], len, col->kind == columnStr);
+  }
+
+  if (value == NULL) {
+    return 1;
+  }
+  int err = PyList_Append(col->values, value);
+  Py_DecRef(value);
+  return err;
+}
+
+// one row of columns, fields not in any column are skipped.
+static int columnsRow(ColumnsContext *c, const char *buf, Py_ssize_t *index, Py_ssize_t size,
+                      int depth) {
+  if (buf[*index] != 'd') {
+    decodingError("expect dict for item of columns, index %zd", *index);
+    return 1;
+  }
+
+  if (c->rows == c->cap) {
+    Py_ssize_t cap = c->cap ? c->cap * 2 : 64;
+    for (Py_ssize_t i = 0; i < c->count; i++) {
+      Column *col = &c->columns[i];
+      if (col->kind != columnInt) {
+        continue;
+      }
+      int64_t *ints = realloc(col->ints, sizeof(int64_t) * cap);
+      if (ints == NULL) {
+        PyErr_SetNone(PyExc_MemoryError);
+        return 1;
+      }
+      col->ints = ints;
+    }
+    c->cap = cap;
+  }
+
+  for (Py_ssize_t i = 0; i < c->count; i++) {
+    c->columns[i].seen = 0;
+    if (c->columns[i].kind == columnInt) {
+      c->columns[i].ints[c->rows] = c->columns[i].defaultInt;
+    }
+  }
+
+  const char *lastKey = NULL;
+  Py_ssize_t lastKeyLen = 0;
+
+  *index = *index + 1;
+  while (1) {
+    if (*index >= size) {
+      decodingError("bytes end when decoding dict");
+      return 1;
+    }
+
+    if (buf[*index] == 'e') {
+      break;
+    }
+
+    Py_ssize_t keyStart, keyLen;
+    if (decodeBytesSpan(buf, index, size, &keyStart, &keyLen, 0)) {
+      return 1;
+    }
+    if (checkKeyOrder(lastKey, lastKeyLen, &buf[keyStart], keyLen, *index)) {
+      return 1;
+    }
+    lastKey = &buf[keyStart];
+    lastKeyLen = keyLen;
+
+    if (*index >= size) {
+      decodingError("bytes end when decoding dict");
+      return 1;
+    }
+
+    Column *col = NULL;
+    for (Py_ssize_t i = 0; i < c->count; i++) {
+      if (c->columns[i].keyLen == keyLen &&
+          memcmp(c->columns[i].key, &buf[keyStart], keyLen) == 0) {
+        col = &c->columns[i];
+        break;
+      }
+    }
+
+    if (col == NULL) {
+      if (skipAny(buf, index, size, depth + 1)) {
+        return 1;
+      }
+      continue;
+    }
+
+    col->seen = 1;
+    int64_t *slot = col->kind == columnInt ? &col->ints[c->rows] : NULL;
+    if (columnsValue(col, buf, index, size, slot, depth + 1)) {
+      return 1;
+    }
+  }
+
+  for (Py_ssize_t i = 0; i < c->count; i++) {
+    Column *col = &c->columns[i];
+    if (!col->seen && col->kind != columnInt && PyList_Append(col->values, col->defaultValue)) {
+      return 1;
+    }
+  }
+
+  c->rows++;
+  *index = *index + 1;
+  return 0;
+}
+
+static int columnsList(ColumnsContext *c, const char *buf, Py_ssize_t *index, Py_ssize_t size,
+                       int depth) {
+  if (buf[*index] != 'l') {
+    decodingError("expect list at end of path, index %zd", *index);
+    return 1;
+  }
+
+  if (depth >= decodeMaxDepth) {
+    decodingError("max nesting depth %d exceeded, index %zd", decodeMaxDepth, *index);
+    return 1;
+  }
+
+  *index = *index + 1;
+  while (1) {
+    if (*index >= size) {
+      decodingError("bytes end when decoding list");
+      return 1;
+    }
+
+    if (buf[*index] == 'e') {
+      break;
+    }
+
+    if (columnsRow(c, buf, index, size, depth + 1)) {
+      return 1;
+    }
+  }
+
+  *index = *index + 1;
+  return 0;
+}
+
+static HPy intColumn(HPy arrayType, ColumnsContext *c, Column *col) {
+  HPy b = PyBytes_FromStringAndSize((const char *)col->ints, sizeof(int64_t) * c->rows);
+  if (b == NULL) {
+    return NULL;
+  }
+
+  HPy r = PyObject_CallFunction(arrayType, "sO", "q", b);
+  Py_DecRef(b);
+  return r;
+}
+
+static HPy bdecode_columns(HPy self, HPy args) {
+  HPy b;
+  HPy path;
+  HPy fields;
+  if (!PyArg_ParseTuple(args, "OOO:bdecode_columns", &b, &path, &fields)) {
+    return NULL;
+  }
+
+  if (!PyBytes_Check(b)) {
+    PyErr_SetString(PyExc_TypeError, "can only decode bytes");
+    return NULL;
+  }
+
+  Py_ssize_t size = PyBytes_Size(b);
+  if (size == 0) {
+    decodingError("can't decode empty bytes");
+    return NULL;
+  }
+  const char *buf = PyBytes_AsString(b);
+
+  ColumnsContext c = {};
+  SelectContext s = {.columns = &c};
+  HPy paths = NULL;
+  HPy arrayType = NULL;
+  HPy res = NULL;
+
+  paths = PyTuple_Pack(1, path);
+  if (paths == NULL || parseSelectPaths(&s, paths) || parseColumnsFields(&c, fields)) {
+    goto __CLEAN_UP;
+  }
+
+  statsInc(decode_calls);
+  statsAdd(decode_bytes, size);
+
+  Py_ssize_t index = 0;
+  if (selectAny(&s, buf, &index, size, 0, s.active, s.count)) {
+    statsInc(decode_errors);
+    goto __CLEAN_UP;
+  }
+
+  if (index != size) {
+    statsInc(decode_errors);
+    decodingError("invalid bencode data, parse end at index %zd but total bytes length %zd", index,
+                  size);
+    goto __CLEAN_UP;
+  }
+
+  HPy array = PyImport_ImportModule("array");
+  if (array == NULL) {
+    goto __CLEAN_UP;
+  }
+  arrayType = PyObject_GetAttrString(array, "array");
+  Py_DecRef(array);
+  if (arrayType == NULL) {
+    goto __CLEAN_UP;
+  }
+
+  res = PyDict_New();
+  if (res == NULL) {
+    goto __CLEAN_UP;
+  }
+
+  for (Py_ssize_t i = 0; i < c.count; i++) {
+    Column *col = &c.columns[i];
+    HPy column = col->values;
+    if (col->kind == columnInt) {
+      column = intColumn(arrayType, &c, col);
+      if (column == NULL) {
+        Py_CLEAR(res);
+        goto __CLEAN_UP;
+      }
+    } else {
+      Py_INCREF(column);
+    }
+
+    int err = PyDict_SetItem(res, PyTuple_GetItem(PyList_GetItem(c.items, i), 0), column);
+    Py_DecRef(column);
+    if (err) {
+      Py_CLEAR(res);
+      goto __CLEAN_UP;
+    }
+  }
+
+__CLEAN_UP:
+  Py_XDECREF(paths);
+  Py_XDECREF(arrayType);
+  freeSelectContext(&s);
+  freeColumnsContext(&c);
+  return res;
+}
+
+// dict entry written to output, offsets are relative to start of dict content in output.
+typedef struct canonEntry {
+  const char *key;
+  Py_ssize_t keyOffset;
+  Py_ssize_t keyLen;
+  Py_ssize_t start;
+  Py_ssize_t end;
+  Py_ssize_t order;
+} CanonEntry;
+
+static int sortCanonEntry(const void *a, const void *b) {
+  const CanonEntry *x = a;
+  const CanonEntry *y = b;
+  int r = strCompare(x->key, x->keyLen, y->key, y->keyLen);
+  if (r != 0) {
+    return r;
+  }
+  // stable for duplicated keys, last one is kept.
+  return x->order < y->order ? -1 : 1;
+}
+
+static int canonAny(const char *buf, Py_ssize_t *index, Py_ssize_t size, Context *out, int depth);
+
+static int canonInt(const char *buf, Py_ssize_t *index, Py_ssize_t size, Context *out) {
+  Py_ssize_t i = *index + 1;
+  int negative = i < size && buf[i] == '-';
+  if (negative) {
+    i++;
+  }
+
+  Py_ssize_t digits = i;
+  while (i < size && buf[i] >= '0' && buf[i] <= '9') {
+    i++;
+  }
+
+  if (i == size || buf[i] != 'e' || i == digits) {
+    decodingError("invalid int at %zd", *index);
+    return 1;
+  }
+
+  Py_ssize_t end = i;
+  while (digits < end - 1 && buf[digits] == '0') {
+    digits++;
+  }
+
+  if (bufferWriteChar(out, 'i')) {
+    return 1;
+  }
+  if (negative && buf[digits] != '0' && bufferWriteChar(out, '-')) {
+    return 1;
+  }
+  if (bufferWrite(out, &buf[digits], end - digits) || bufferWriteChar(out, 'e')) {
+    return 1;
+  }
+
+  *index = end + 1;
+  return 0;
+}
+
+// len is set to length of string content.
+static int canonString(const char *buf, Py_ssize_t *index, Py_ssize_t size, Context *out,
+                       Py_ssize_t *len) {
+  Py_ssize_t header = *index;
+  Py_ssize_t start;
+  if (decodeBytesSpan(buf, index, size, &start, len, 1)) {
+    return 1;
+  }
+
+  // length without leading zeros, copy as is.
+  if (buf[header] != '0' || start - header == 2) {
+    return bufferWrite(out, &buf[header], *index - header);
+  }
+
+  if (bufferWriteFormat(out, "%zd:", *len)) {
+    return 1;
+  }
+  return bufferWrite(out, &buf[start], *len);
+}
+
+// entries are written in input order first,
+// output is only rewritten if keys are not sorted or duplicated.
+static int canonDict(const char *buf, Py_ssize_t *index, Py_ssize_t size, Context *out, int depth) {
+  if (bufferWriteChar(out, 'd')) {
+    return 1;
+  }
+
+  Py_ssize_t base = out->out.len;
+  Py_ssize_t count = 0;
+  Py_ssize_t cap = 8;
+  int sorted = 1;
+  char *tmp = NULL;
+  CanonEntry *entries = malloc(cap * sizeof(CanonEntry));
+  if (entries == NULL) {
+    PyErr_SetNone(PyExc_MemoryError);
+    return 1;
+  }
+
+  *index = *index + 1;
+  while (1) {
+    if (*index >= size) {
+      decodingError("bytes end when decoding dict");
+      goto __Error;
+    }
+
+    if (buf[*index] == 'e') {
+      break;
+    }
+
+    if (count == cap) {
+      cap *= 2;
+      CanonEntry *p = realloc(entries, cap * sizeof(CanonEntry));
+      if (p == NULL) {
+        PyErr_SetNone(PyExc_MemoryError);
+        goto __Error;
+      }
+      entries = p;
+    }
+
+    if (buf[*index] < '0' || buf[*index] > '9') {
+      decodingError("invalid dict key at %zd", *index);
+      goto __Error;
+    }
+
+    CanonEntry *e = &entries[count];
+    e->order = count;
+    e->start = out->out.len - base;
+    if (canonString(buf, index, size, out, &e->keyLen)) {
+      goto __Error;
+    }
+    // key content is at the end of written string.
+    e->keyOffset = out->out.len - base - e->keyLen;
+
+    if (count > 0) {
+      CanonEntry *last = &entries[count - 1];
+      if (strCompare(out->out.buf + base + e->keyOffset, e->keyLen,
+                     out->out.buf + base + last->keyOffset, last->keyLen) <= 0) {
+        sorted = 0;
+      }
+    }
+
+    if (canonAny(buf, index, size, out, depth + 1)) {
+      goto __Error;
+    }
+    e->end = out->out.len - base;
+    count++;
+  }
+  *index = *index + 1;
+
+  if (!sorted) {
+    Py_ssize_t len = out->out.len - base;
+    tmp = malloc(len);
+    if (tmp == NULL) {
+      PyErr_SetNone(PyExc_MemoryError);
+      goto __Error;
+    }
+    memcpy(tmp, out->out.buf + base, len);
+
+    for (Py_ssize_t i = 0; i < count; i++) {
+      entries[i].key = tmp + entries[i].keyOffset;
+    }
+    qsort(entries, count, sizeof(CanonEntry), sortCanonEntry);
+
+    out->out.len = base;
+    for (Py_ssize_t i = 0; i < count; i++) {
+      CanonEntry *e = &entries[i];
+      if (i + 1 < count && strCompare(e->key, e->keyLen, entries[i + 1].key,
+                                      entries[i + 1].keyLen) == 0) {
+        continue;
+      }
+      if (bufferWrite(out, tmp + e->start, e->end - e->start)) {
+        goto __Error;
+      }
+    }
+    free(tmp);
+  }
+
+  free(entries);
+  return bufferWriteChar(out, 'e');
+
+__Error:
+  free(tmp);
+  free(entries);
+  return 1;
+}
+
+static int canonAny(const char *buf, Py_ssize_t *index, Py_ssize_t size, Context *out, int depth) {
+  if (*index >= size) {
+    decodingError("bytes end unexpectedly, index %zd", *index);
+    return 1;
+  }
+
+  char c = buf[*index];
+  if (c == 'i') {
+    return canonInt(buf, index, size, out);
+  }
+
+  if (c >= '0' && c <= '9') {
+    Py_ssize_t len;
+    return canonString(buf, index, size, out, &len);
+  }
+
+  if (c != 'l' && c != 'd') {
+    decodingError("invalid bencode prefix '%c', index %zd", c, *index);
+    return 1;
+  }
+
+  if (depth >= decodeMaxDepth) {
+    decodingError("max nesting depth %d exceeded, index %zd", decodeMaxDepth, *index);
+    return 1;
+  }
+
+  if (c == 'd') {
+    return canonDict(buf, index, size, out, depth);
+  }
+
+  if (bufferWriteChar(out, 'l')) {
+    return 1;
+  }
+
+  *index = *index + 1;
+  while (1) {
+    if (*index >= size) {
+      decodingError("bytes end when decoding list");
+      return 1;
+    }
+
+    if (buf[*index] == 'e') {
+      break;
+    }
+
+    if (canonAny(buf, index, size, out, depth + 1)) {
+      return 1;
+    }
+  }
+  *index = *index + 1;
+
+  return bufferWriteChar(out, 'e');
+}
+
+static HPy bcanonicalize(HPy self, HPy b) {
+  if (!PyBytes_Check(b)) {
+    PyErr_SetString(PyExc_TypeError, "can only decode bytes");
+    return NULL;
+  }
+
+  Py_ssize_t size = PyBytes_Size(b);
+  if (size == 0) {
+    decodingError("can't decode empty bytes");
+    return NULL;
+  }
+  const char *buf = PyBytes_AsString(b);
+
+  // canonical form is never longer than input.
+  int err = 0;
+  Context out = newContext(&err, size + 1);
+  if (err) {
+    return NULL;
+  }
+
+  HPy res = NULL;
+  Py_ssize_t index = 0;
+  if (canonAny(buf, &index, size, &out, 0)) {
+    goto __CLEAN_UP;
+  }
+
+  if (index != size) {
+    decodingError("invalid bencode data, parse end at index %zd but total bytes length %zd", index,
+                  size);
+    goto __CLEAN_UP;
+  }
+
+  res = PyBytes_FromStringAndSize(out.out.buf, out.out.len);
+
+__CLEAN_UP:
+  freeContext(out);
+  return res;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include "common.h"
+
+// helpers of decode.c shared with other decoders, errors are raised as BencodeDecodeError.
+
+HPy decodeInt(const char *buf, Py_ssize_t *index, Py_ssize_t size, int lenient);
+int decodeBytesSpan(const char *buf, Py_ssize_t *index, Py_ssize_t size, Py_ssize_t *start,
+                    Py_ssize_t *len, int lenient);
+int checkKeyOrder(const char *lastKey, Py_ssize_t lastKeyLen, const char *currentKey,
+                  Py_ssize_t currentKeyLen, Py_ssize_t index);
+int skipAny(const char *buf, Py_ssize_t *index, Py_ssize_t size, int depth);
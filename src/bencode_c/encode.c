@@ -9,33 +9,99 @@
 
 #include "common.h"
 #include "ctx.h"
+#include "overflow.h"
+#include "stats.h"
 #include "str.h"
 
 #ifdef __GNUC__
 #pragma GCC diagnostic pop
 #endif
 
-#define returnIfError(o)                                                                           \
-  if (o)                                                                                           \
-  return o
+static HPy bencode(HPy mod, HPy args, HPy kwargs);
+static HPy bencode_segments(HPy mod, HPy args, HPy kwargs);
+static HPy bencode_iter(HPy mod, HPy args, HPy kwargs);
+static HPy compile_template(HPy mod, HPy args, HPy kwargs);
 
-static HPy bencode(HPy mod, HPy obj);
+#define defaultSegmentThreshold 65536
 
 // module level variable
 PyObject *BencodeEncodeError;
-PyDoc_STRVAR(__bencode_doc__, "bencode(v: Any, /) -> bytes\n"
-                              "--\n\n"
-                              "encode python object to bytes");
+PyDoc_STRVAR(__bencode_doc__,
+             "bencode(v: Any, /, *, default: Callable[[Any], Any] | None = None, "
+             "size_hint: int = 0, "
+             "check_circular: bool = True, cache: EncodeCache | None = None) -> bytes\n"
+             "--\n\n"
+             "encode python object to bytes.\n\n"
+             "dataclass, enum.Enum, collections.abc.Mapping and collections.abc.Sequence objects "
+             "are encoded as dict, value or list, iterators as list except files (io.IOBase).\n"
+             "default: called with objects that can't be encoded, "
+             "should return an object that can be encoded.\n"
+             "size_hint: expected output size, initial buffer size is estimated from recent "
+             "outputs if 0.\n"
+             "check_circular: raise ValueError on circular reference. if False, "
+             "RecursionError is raised when nesting depth exceed 1000.\n"
+             "cache: EncodeCache to reuse encoded output of immutable sub objects, "
+             "should be used with same default.");
+PyDoc_STRVAR(__bencode_segments_doc__,
+             "bencode_segments(v: Any, /, threshold: int = 65536, *, default=None, "
+             "check_circular=True) -> "
+             "list[bytes | memoryview]\n"
+             "--\n\n"
+             "encode python object to a list of segments, to be used with socket.sendmsg or "
+             "os.writev.\n\n"
+             "bytes-like values not smaller than threshold are referenced instead of copied, "
+             "bytes are included as is, other buffer objects as memoryview. "
+             "they must not be modified before segments are consumed.");
+PyDoc_STRVAR(__bencode_iter_doc__,
+             "bencode_iter(v: Any, /, chunk_size: int = 65536, *, default=None, "
+             "check_circular=True) -> "
+             "Iterator[bytes]\n"
+             "--\n\n"
+             "encode python object incrementally, yield chunks of about chunk_size bytes.\n\n"
+             "lists, tuples, dicts and iterators (like generator, but not io.IOBase) are "
+             "encoded lazily, "
+             "so iterators are only consumed as chunks are requested. "
+             "containers must not be modified before iteration ends.");
+PyDoc_STRVAR(__compile_template_doc__,
+             "compile_template(keys: Iterable[str | bytes], /, *, default=None, "
+             "check_circular=True) -> EncodeTemplate\n"
+             "--\n\n"
+             "compile an encoder of dicts with fixed keys.\n\n"
+             "keys are sorted and rendered once, EncodeTemplate.encode only write values.");
 PyMethodDef encodeImpl[] = {{
                                 .ml_name = "bencode",
-                                .ml_meth = bencode,
-                                .ml_flags = METH_O,
+                                .ml_meth = (PyCFunction)(void (*)(void))bencode,
+                                .ml_flags = METH_VARARGS | METH_KEYWORDS,
                                 .ml_doc = __bencode_doc__,
                             },
+                            {
+                                .ml_name = "bencode_segments",
+                                .ml_meth = (PyCFunction)(void (*)(void))bencode_segments,
+                                .ml_flags = METH_VARARGS | METH_KEYWORDS,
+                                .ml_doc = __bencode_segments_doc__,
+                            },
+                            {
+                                .ml_name = "bencode_iter",
+                                .ml_meth = (PyCFunction)(void (*)(void))bencode_iter,
+                                .ml_flags = METH_VARARGS | METH_KEYWORDS,
+                                .ml_doc = __bencode_iter_doc__,
+                            },
+                            {
+                                .ml_name = "compile_template",
+                                .ml_meth = (PyCFunction)(void (*)(void))compile_template,
+                                .ml_flags = METH_VARARGS | METH_KEYWORDS,
+                                .ml_doc = __compile_template_doc__,
+                            },
                             {NULL, NULL, 0, NULL}};
 // module level variable
 
 HPy errTypeMessage;
+HPy MappingABC;
+HPy SequenceABC;
+HPy EnumType;
+HPy IOBaseType;
+// abc.get_cache_token
+HPy AbcCacheToken;
 
 static inline void runtimeError(const char *data) {
   PyErr_SetString(PyExc_RuntimeError, data);
@@ -49,6 +115,10 @@ static inline HPy bencodeError(const char *data) {
 
 static int encodeAny(Context *ctx, HPy obj);
 
+// peers.c
+extern HPy CompactPeersType;
+extern int encodeCompactPeers(Context *ctx, HPy obj);
+
 typedef struct keyValuePair {
   char *key;
   Py_ssize_t keylen;
@@ -69,12 +139,41 @@ static void freeKeyValueList(KeyValuePair *list, HPy_ssize_t len) {
     debug_print("1 %lld", i);
     debug_print("key 0x%p", list[i].pyKey);
     Py_XDECREF(list[i].pyKey);
+    Py_XDECREF(list[i].value);
   }
 
   debug_print("free list");
   free(list);
 }
 
+// key must be str or bytes.
+// pair holds references to key and value, encoding values may call python code which mutate
+// the container.
+static int setKeyValuePair(KeyValuePair *pair, HPy key, HPy value) {
+  HPy keyAsBytes;
+  if (PyUnicode_Check(key)) {
+    keyAsBytes = PyUnicode_AsUTF8String(key);
+    if (keyAsBytes == NULL) {
+      return 1;
+    }
+  } else if (PyBytes_Check(key)) {
+    keyAsBytes = key;
+    Py_INCREF(keyAsBytes);
+  } else {
+    bencodeError("dict key must be str or bytes");
+    return 1;
+  }
+
+  pair->key = PyBytes_AsString(keyAsBytes);
+  pair->keylen = PyBytes_Size(keyAsBytes);
+  pair->pyKey = keyAsBytes;
+
+  Py_INCREF(value);
+  pair->value = value;
+
+  return 0;
+}
+
 static int checkKeys(KeyValuePair *pp, HPy_ssize_t size) {
   // check duplicated keys
   const char *lastKey = pp[0].key;
@@ -90,7 +189,7 @@ static int checkKeys(KeyValuePair *pp, HPy_ssize_t size) {
 
     if (lastKeylen == currentKeylen) {
       debug_print("lastKey=%s, currentKey=%s", lastKey, currentKey);
-      if (strncmp(lastKey, currentKey, lastKeylen) == 0) {
+      if (memcmp(lastKey, currentKey, lastKeylen) == 0) {
         bencodeError("find duplicated keys with str and bytes in dict");
         return 1;
       }
@@ -110,8 +209,11 @@ static int buildDictKeyList(HPy obj, struct keyValuePair **pairs, HPy_ssize_t *c
     return 0;
   }
 
-  //  KeyValuePair *pp = calloc((*count), (sizeof(KeyValuePair)));
-  KeyValuePair *pp = malloc((*count) * (sizeof(KeyValuePair)));
+  KeyValuePair *pp = calloc((*count), (sizeof(KeyValuePair)));
+  if (pp == NULL) {
+    PyErr_SetNone(PyExc_MemoryError);
+    return 1;
+  }
   *pairs = pp;
 
   HPy keys = PyDict_Keys(obj);
@@ -128,15 +230,6 @@ static int buildDictKeyList(HPy obj, struct keyValuePair **pairs, HPy_ssize_t *c
       return 1;
     }
 
-    HPy keyAsBytes = NULL;
-    if (PyUnicode_Check(key)) {
-      keyAsBytes = PyUnicode_AsUTF8String(key);
-    } else if (!PyBytes_Check(key)) {
-      bencodeError("dict key must be str or bytes");
-      Py_DecRef(keys);
-      return 1;
-    }
-
     HPy value = PyDict_GetItem(obj, key);
     if (value == NULL) {
       Py_DecRef(keys);
@@ -144,29 +237,69 @@ static int buildDictKeyList(HPy obj, struct keyValuePair **pairs, HPy_ssize_t *c
       return 1;
     }
 
-    if (keyAsBytes != NULL) {
-      pp[i].key = PyBytes_AsString(keyAsBytes);
-      pp[i].keylen = PyBytes_Size(keyAsBytes);
-      pp[i].pyKey = keyAsBytes;
-      //      Py_DecRef(keyAsBytes);
-    } else {
-      pp[i].key = PyBytes_AsString(key);
-      pp[i].keylen = PyBytes_Size(key);
-      pp[i].pyKey = NULL;
+    if (setKeyValuePair(&pp[i], key, value)) {
+      Py_DecRef(keys);
+      return 1;
     }
-
-    pp[i].value = value;
   }
 
   Py_DecRef(keys);
 
+  if (*count > 1) {
+    statsInc(encode_dict_sort);
+  }
   qsort(pp, *count, sizeof(KeyValuePair), sortKeyValuePair);
 
   return checkKeys(pp, *count);
 }
 
+// write sorted key value pairs of a dict, without leading 'd' and ending 'e'.
+static int encodeKeyValuePairs(Context *ctx, KeyValuePair *list, HPy_ssize_t count) {
+  for (HPy_ssize_t i = 0; i < count; i++) {
+    debug_print("encode key[%zd]", i);
+
+    struct keyValuePair keyValue = list[i];
+
+    statsInc(encode_str);
+    returnIfError(bufferWriteFormat(ctx, "%zd", keyValue.keylen));
+    returnIfError(bufferWriteChar(ctx, ':'));
+    returnIfError(bufferWrite(ctx, keyValue.key, keyValue.keylen));
+    returnIfError(encodeAny(ctx, keyValue.value));
+  }
+
+  return 0;
+}
+
+// write string header and content, if output is scatter-gather and content is large,
+// reference obj in segments instead of copying content into buffer.
+static int bufferWriteString(Context *ctx, HPy obj, const char *data, HPy_ssize_t size) {
+  returnIfError(bufferWriteFormat(ctx, "%zd", size));
+  returnIfError(bufferWriteChar(ctx, ':'));
+
+  if (ctx->segments == NULL || size < ctx->segmentThreshold) {
+    return bufferWrite(ctx, data, size);
+  }
+
+  returnIfError(bufferFlushSegment(ctx));
+
+  statsInc(encode_segments);
+  ctx->segmentBytes += size;
+
+  if (PyBytes_Check(obj)) {
+    return PyList_Append(ctx->segments, obj);
+  }
+
+  HPy view = PyMemoryView_FromObject(obj);
+  if (view == NULL) {
+    return 1;
+  }
+
+  int err = PyList_Append(ctx->segments, view);
+  Py_DecRef(view);
+  return err;
+}
+
 #if PY_MINOR_VERSION >= 10
-// TODO: use py buffer >= 3.11
 static int encodeBytes(Context *ctx, HPy obj) {
   HPy_ssize_t size;
   char *data;
@@ -174,9 +307,7 @@ static int encodeBytes(Context *ctx, HPy obj) {
     return 1;
   }
 
-  int err = bufferWriteFormat(ctx, "%zd", size);
-  err = err || bufferWriteChar(ctx, ':');
-  return err || bufferWrite(ctx, data, size);
+  return bufferWriteString(ctx, obj, data, size);
 }
 
 static int encodeStr(Context *ctx, HPy obj) {
@@ -202,9 +333,7 @@ static int encodeBytes(Context *ctx, HPy obj) {
 
   HPy_ssize_t size = PyBytes_Size(obj);
 
-  int err = bufferWriteFormat(ctx, "%zd", size);
-  err = err || bufferWriteChar(ctx, ':');
-  return err || bufferWrite(ctx, data, size);
+  return bufferWriteString(ctx, obj, data, size);
 }
 
 static int encodeStr(Context *ctx, HPy obj) {
@@ -217,6 +346,48 @@ static int encodeStr(Context *ctx, HPy obj) {
 
 #endif
 
+#if PY_MINOR_VERSION >= 11
+// objects support buffer protocol, memoryview, array.array, mmap.mmap...
+// write buffer content directly without copying it to a bytes object.
+static int encodeBuffer(Context *ctx, HPy obj) {
+  Py_buffer view;
+  if (PyObject_GetBuffer(obj, &view, PyBUF_SIMPLE)) {
+    return 1;
+  }
+
+  int err = bufferWriteString(ctx, obj, view.buf, view.len);
+
+  PyBuffer_Release(&view);
+  return err;
+}
+
+#else
+
+// buffer protocol is not in limited api before 3.11, copy content to bytes.
+// return -1 if obj doesn't support buffer protocol.
+static int encodeBuffer(Context *ctx, HPy obj) {
+  HPy view = PyMemoryView_FromObject(obj);
+  if (view == NULL) {
+    if (PyErr_ExceptionMatches(PyExc_TypeError)) {
+      PyErr_Clear();
+      return -1;
+    }
+    return 1;
+  }
+
+  HPy b = PyBytes_FromObject(view);
+  Py_DecRef(view);
+  if (b == NULL) {
+    return 1;
+  }
+
+  int err = encodeBytes(ctx, b);
+  Py_DecRef(b);
+  return err;
+}
+
+#endif
+
 static int encodeDict(Context *ctx, HPy obj) {
   returnIfError(bufferWrite(ctx, "d", 1));
 
@@ -224,7 +395,7 @@ static int encodeDict(Context *ctx, HPy obj) {
   HPy_ssize_t count = 0;
   if (buildDictKeyList(obj, &list, &count)) {
     if (list != NULL) {
-      free(list);
+      freeKeyValueList(list, count);
     }
     return 1;
   }
@@ -233,32 +404,54 @@ static int encodeDict(Context *ctx, HPy obj) {
     return bufferWrite(ctx, "e", 1);
   }
 
-  for (HPy_ssize_t i = 0; i < count; i++) {
-    debug_print("encode key[%zd]", i);
+  if (encodeKeyValuePairs(ctx, list, count)) {
+    debug_print("failed");
+    freeKeyValueList(list, count);
+    return 1;
+  }
 
-    struct keyValuePair keyValue = list[i];
-    int err = 0;
+  freeKeyValueList(list, count);
+
+  return bufferWrite(ctx, "e", 1);
+}
 
-    err |= bufferWriteFormat(ctx, "%ld", keyValue.keylen);
-    err |= bufferWriteChar(ctx, ':');
-    err |= bufferWrite(ctx, keyValue.key, keyValue.keylen);
-    err |= encodeAny(ctx, keyValue.value);
+// encode dict with one more key, which value is written by writeValue instead of encodeAny,
+// so large values (torrent pieces) are written without building python objects.
+int encodeDictWithValue(Context *ctx, HPy obj, const char *key, HPy_ssize_t keylen,
+                        writeValueFunc writeValue, void *arg) {
+  returnIfError(bufferWrite(ctx, "d", 1));
 
-    if (err) {
-      debug_print("failed");
-      freeKeyValueList(list, count);
-      return 1;
-    }
+  struct keyValuePair *list = NULL;
+  HPy_ssize_t count = 0;
+  int err = buildDictKeyList(obj, &list, &count);
+
+  HPy_ssize_t i = 0;
+  while (!err && i < count && strCompare(list[i].key, list[i].keylen, key, keylen) < 0) {
+    i++;
+  }
+  if (!err && i < count && strCompare(list[i].key, list[i].keylen, key, keylen) == 0) {
+    bencodeError("find duplicated keys in dict");
+    err = 1;
   }
 
-  debug_print("1");
-  freeKeyValueList(list, count);
-  debug_print("2");
+  err = err || encodeKeyValuePairs(ctx, list, i);
+  err = err || bufferWriteFormat(ctx, "%zd:", keylen);
+  err = err || bufferWrite(ctx, key, keylen);
+  err = err || writeValue(ctx, arg);
+  err = err || encodeKeyValuePairs(ctx, list + i, count - i);
+
+  if (list != NULL) {
+    freeKeyValueList(list, count);
+  }
+  if (err) {
+    return 1;
+  }
 
   return bufferWrite(ctx, "e", 1);
 }
 
 static int encodeInt_slow(Context *ctx, HPy obj) {
+  statsInc(encode_int_slow);
   HPy fmt = PyUnicode_FromString("%d");
   HPy s = PyUnicode_Format(fmt, obj); // s = '%d" % i
   if (s == NULL) {
@@ -299,11 +492,72 @@ static int encodeInt_fast(Context *ctx, long long val) {
   return bufferWrite(ctx, "e", 1);
 }
 
+#ifdef BENCODE_HAS_INT128
+// int overflow long long but fit in int128, format it without creating python str object.
+// return -1 if obj doesn't fit in int128.
+static int encodeInt_128(Context *ctx, HPy obj) {
+  uint64_t low = PyLong_AsUnsignedLongLongMask(obj);
+  if (low == (uint64_t)-1 && PyErr_Occurred()) {
+    return 1;
+  }
+
+  HPy shift = PyLong_FromLong(64);
+  if (shift == NULL) {
+    return 1;
+  }
+
+  // python right shift is arithmetic, so high keeps the sign.
+  HPy highObj = PyNumber_Rshift(obj, shift);
+  Py_DecRef(shift);
+  if (highObj == NULL) {
+    return 1;
+  }
+
+  int overflow = 0;
+  long long high = PyLong_AsLongLongAndOverflow(highObj, &overflow);
+  Py_DecRef(highObj);
+  if (overflow) {
+    return -1;
+  }
+  if (high == -1 && PyErr_Occurred()) {
+    return 1;
+  }
+
+  statsInc(encode_int_128);
+  uint128_t val = ((uint128_t)(uint64_t)high << 64) | low;
+  int negative = high < 0;
+  if (negative) {
+    val = ~val + 1;
+  }
+
+  // 2^127 has 39 digits
+  char s[41];
+  size_t i = sizeof(s);
+  do {
+    s[--i] = '0' + (char)(val % 10);
+    val = val / 10;
+  } while (val);
+  if (negative) {
+    s[--i] = '-';
+  }
+
+  returnIfError(bufferWriteChar(ctx, 'i'));
+  returnIfError(bufferWrite(ctx, &s[i], sizeof(s) - i));
+  return bufferWriteChar(ctx, 'e');
+}
+#endif
+
 static int encodeInt(Context *ctx, HPy obj) {
   int overflow = 0;
   long long val = PyLong_AsLongLongAndOverflow(obj, &overflow);
   if (overflow) {
     PyErr_Clear();
+#ifdef BENCODE_HAS_INT128
+    int r = encodeInt_128(ctx, obj);
+    if (r != -1) {
+      return r;
+    }
+#endif
     // slow path for very long int
     return encodeInt_slow(ctx, obj);
   }
@@ -315,12 +569,15 @@ static int encodeInt(Context *ctx, HPy obj) {
 }
 
 static int encodeList(Context *ctx, HPy obj) {
-  HPy_ssize_t len = PyList_Size(obj);
   returnIfError(bufferWrite(ctx, "l", 1));
 
-  for (HPy_ssize_t i = 0; i < len; i++) {
+  // list may be mutated by python code called when encoding items.
+  for (HPy_ssize_t i = 0; i < PyList_Size(obj); i++) {
     HPy o = PyList_GetItem(obj, i);
-    returnIfError(encodeAny(ctx, o));
+    Py_INCREF(o);
+    int err = encodeAny(ctx, o);
+    Py_DecRef(o);
+    returnIfError(err);
   }
 
   return bufferWrite(ctx, "e", 1);
@@ -338,199 +595,179 @@ static int encodeTuple(Context *ctx, HPy obj) {
   return bufferWrite(ctx, "e", 1);
 }
 
-#if PY_MINOR_VERSION >= 10
-// types.MappingProxyType
-static int encodeMappingProxyType(Context *ctx, HPy obj) {
-  bufferWriteChar(ctx, 'd');
-  HPy_ssize_t size = PyObject_Size(obj);
-  if (size == 0) {
-    bufferWriteChar(ctx, 'e');
-    return 0;
-  }
-
+// types.MappingProxyType and collections.abc.Mapping
+static int encodeMapping(Context *ctx, HPy obj) {
+  statsInc(encode_dict);
   debug_print("try get items");
   HPy items = PyObject_CallMethod(obj, "items", NULL);
   if (items == NULL) {
-    if (PyErr_Occurred()) {
-      return 1;
-    }
-    runtimeError("failed to get items from MappingProxy");
     return 1;
   }
 
-  HPy iter = PyObject_GetIter(items);
+  // keep all key value tuples alive, items may be created on the fly.
+  HPy itemList = PySequence_List(items);
+  Py_DecRef(items);
+  if (itemList == NULL) {
+    return 1;
+  }
 
-  debug_print("get items ok");
+  returnIfError(bufferWriteChar(ctx, 'd'));
 
-  debug_print("create list");
-  KeyValuePair *list = malloc((size) * (sizeof(KeyValuePair)));
-  for (int i = 0; i < size; ++i) {
-    debug_print("%d/%d", i, size);
-    HPy keyValue = PyIter_Next(iter);
-    if (keyValue == NULL) {
-      Py_DecRef(keyValue);
-      if (PyErr_Occurred()) {
-        goto __CLEAN_UP;
-      }
-      runtimeError("failed to get key value tuple from items");
-      goto __CLEAN_UP;
-    }
+  HPy_ssize_t size = PyList_Size(itemList);
+  if (size == 0) {
+    Py_DecRef(itemList);
+    return bufferWriteChar(ctx, 'e');
+  }
 
-    debug_print("get key from keyValue tuple");
-    HPy key = PyTuple_GetItem(keyValue, 0);
-    if (key == NULL) {
-      Py_DecRef(keyValue);
-      if (PyErr_Occurred()) {
-        goto __CLEAN_UP;
-      }
-      runtimeError("failed to get keys from MappingProxy");
-      goto __CLEAN_UP;
-    }
+  KeyValuePair *list = calloc(size, sizeof(KeyValuePair));
+  if (list == NULL) {
+    Py_DecRef(itemList);
+    PyErr_SetNone(PyExc_MemoryError);
+    return 1;
+  }
 
-    HPy keyAsBytes = NULL;
-    if (PyUnicode_Check(key)) {
-      keyAsBytes = PyUnicode_AsUTF8String(key);
-    } else if (!PyBytes_Check(key)) {
-      bencodeError("dict key must be str or bytes");
-      Py_DecRef(keyValue);
+  for (HPy_ssize_t i = 0; i < size; ++i) {
+    HPy keyValue = PyList_GetItem(itemList, i);
+    if (!PyTuple_Check(keyValue) || PyTuple_Size(keyValue) != 2) {
+      runtimeError("mapping items() should return (key, value) tuples");
       goto __CLEAN_UP;
     }
 
-    debug_print("get value from keyValue tuple");
-    HPy value = PyTuple_GetItem(keyValue, 1);
-    if (value == NULL) {
-      Py_XDECREF(keyAsBytes);
-      Py_DecRef(keyValue);
-      runtimeError("failed to get value from MappingProxy");
+    if (setKeyValuePair(&list[i], PyTuple_GetItem(keyValue, 0), PyTuple_GetItem(keyValue, 1))) {
       goto __CLEAN_UP;
     }
+  }
 
-    if (keyAsBytes != NULL) {
-      list[i].key = PyBytes_AsString(keyAsBytes);
-      list[i].keylen = PyBytes_Size(keyAsBytes);
-      list[i].pyKey = keyAsBytes;
-    } else {
-      list[i].key = PyBytes_AsString(key);
-      list[i].keylen = PyBytes_Size(key);
-      list[i].pyKey = NULL;
-    }
-
-    list[i].value = value;
-    Py_DecRef(keyValue);
-  };
-
+  if (size > 1) {
+    statsInc(encode_dict_sort);
+  }
   qsort(list, size, sizeof(KeyValuePair), sortKeyValuePair);
 
-  if (checkKeys(list, size)) {
+  if (checkKeys(list, size) || encodeKeyValuePairs(ctx, list, size)) {
     goto __CLEAN_UP;
   }
 
-  for (HPy_ssize_t i = 0; i < size; i++) {
-    debug_print("encode key[%zd]", i);
-
-    struct keyValuePair keyValue = list[i];
-
-    int err = 0;
-    err |= bufferWriteFormat(ctx, "%ld", keyValue.keylen);
-    err |= bufferWriteChar(ctx, ':');
-    err |= bufferWrite(ctx, keyValue.key, keyValue.keylen);
-    err |= encodeAny(ctx, keyValue.value);
-
-    if (err) {
-      goto __CLEAN_UP;
-    }
-  }
-
-  Py_DecRef(items);
+  Py_DecRef(itemList);
   freeKeyValueList(list, size);
-  bufferWriteChar(ctx, 'e');
-  return 0;
+  return bufferWriteChar(ctx, 'e');
 
 __CLEAN_UP:;
-  Py_XDECREF(items);
-  if (list != NULL) {
-    freeKeyValueList(list, size);
-  }
-  Py_XDECREF(iter);
+  Py_DecRef(itemList);
+  freeKeyValueList(list, size);
   return 1;
 }
 
-#endif
+// collections.abc.Sequence and iterators, like generator.
+static int encodeSequence(Context *ctx, HPy obj) {
+  HPy iter = PyObject_GetIter(obj);
+  if (iter == NULL) {
+    return 1;
+  }
 
-#define encodeComposeObject(ctx, obj, encoder)                                                     \
-  do {                                                                                             \
-    debug_print("put object %p to seen", obj);                                                     \
-    int absent;                                                                                    \
-    kh_put_PTR(ctx->seen, (khint64_t)obj, &absent);                                                \
-    debug_print("after put object %p to seen", obj);                                               \
-    if (!absent) {                                                                                 \
-      debug_print("circular reference found");                                                     \
-      PyErr_SetString(PyExc_ValueError, "circular reference found");                               \
-      return 1;                                                                                    \
-    }                                                                                              \
-    int r = encoder(ctx, obj);                                                                     \
-    khint64_t key = kh_get_PTR(ctx->seen, (khint64_t)obj);                                         \
-    kh_del_PTR(ctx->seen, key);                                                                    \
-    return r;                                                                                      \
-  } while (0)
+  if (bufferWriteChar(ctx, 'l')) {
+    Py_DecRef(iter);
+    return 1;
+  }
 
-static int encodeAny(Context *ctx, HPy obj) {
-  if (obj == Py_True) {
-    return bufferWrite(ctx, "i1e", 3);
+  HPy item;
+  while ((item = PyIter_Next(iter)) != NULL) {
+    int err = encodeAny(ctx, item);
+    Py_DecRef(item);
+    if (err) {
+      Py_DecRef(iter);
+      return 1;
+    }
   }
 
-  if (obj == Py_False) {
-    return bufferWrite(ctx, "i0e", 3);
+  Py_DecRef(iter);
+  if (PyErr_Occurred()) {
+    return 1;
   }
 
-  if (PyBytes_Check(obj)) {
-    return encodeBytes(ctx, obj);
+  return bufferWriteChar(ctx, 'e');
+}
+
+// fields of a dataclass, as tuple of (name, utf-8 name) sorted in bencode key order.
+static HPy dataclassFields(HPy obj) {
+  HPy dataclasses = PyImport_ImportModule("dataclasses");
+  if (dataclasses == NULL) {
+    return NULL;
   }
 
-  if (PyUnicode_Check(obj)) {
-    return encodeStr(ctx, obj);
+  HPy fields = PyObject_CallMethod(dataclasses, "fields", "O", obj);
+  Py_DecRef(dataclasses);
+  if (fields == NULL) {
+    return NULL;
   }
 
-  if (PyLong_Check(obj)) {
-    return encodeInt(ctx, obj);
+  HPy_ssize_t count = PyTuple_Size(fields);
+  KeyValuePair *list = calloc(count + 1, sizeof(KeyValuePair));
+  if (list == NULL) {
+    Py_DecRef(fields);
+    PyErr_SetNone(PyExc_MemoryError);
+    return NULL;
   }
 
-  if (PyList_Check(obj)) {
-    encodeComposeObject(ctx, obj, encodeList);
+  HPy res = NULL;
+  for (HPy_ssize_t i = 0; i < count; i++) {
+    HPy name = PyObject_GetAttrString(PyTuple_GetItem(fields, i), "name");
+    if (name == NULL) {
+      goto __CLEAN_UP;
+    }
+    int err = setKeyValuePair(&list[i], name, name);
+    Py_DecRef(name);
+    if (err) {
+      goto __CLEAN_UP;
+    }
   }
 
-  if (PyTuple_Check(obj)) {
-    encodeComposeObject(ctx, obj, encodeTuple);
+  qsort(list, count, sizeof(KeyValuePair), sortKeyValuePair);
+
+  res = PyTuple_New(count);
+  if (res == NULL) {
+    goto __CLEAN_UP;
   }
 
-  if (PyDict_Check(obj)) {
-    encodeComposeObject(ctx, obj, encodeDict);
+  for (HPy_ssize_t i = 0; i < count; i++) {
+    HPy field = PyTuple_Pack(2, list[i].value, list[i].pyKey);
+    if (field == NULL) {
+      Py_CLEAR(res);
+      goto __CLEAN_UP;
+    }
+    PyTuple_SetItem(res, i, field);
   }
 
-  if (PyByteArray_Check(obj)) {
-    HPy_ssize_t size = PyByteArray_Size(obj);
-    const char *data = PyByteArray_AsString(obj);
-    if (data == NULL) {
+__CLEAN_UP:;
+  freeKeyValueList(list, count);
+  Py_DecRef(fields);
+  return res;
+}
+
+static int encodeDataclass(Context *ctx, HPy obj, HPy fields) {
+  returnIfError(bufferWriteChar(ctx, 'd'));
+
+  HPy_ssize_t count = PyTuple_Size(fields);
+  for (HPy_ssize_t i = 0; i < count; i++) {
+    HPy field = PyTuple_GetItem(fields, i);
+    HPy key = PyTuple_GetItem(field, 1);
+
+    HPy value = PyObject_GetAttr(obj, PyTuple_GetItem(field, 0));
+    if (value == NULL) {
       return 1;
     }
 
-    int err = bufferWriteFormat(ctx, "%zd", size);
+    int err = bufferWriteFormat(ctx, "%zd", PyBytes_Size(key));
     err = err || bufferWriteChar(ctx, ':');
-    return err || bufferWrite(ctx, data, size);
-  }
-
-#if PY_MINOR_VERSION >= 10
-
-  // types.MappingProxyType
-  debug_print("test if mapping proxy");
-  if (PyType_IsSubtype(obj->ob_type, &PyDictProxy_Type)) {
-    debug_print("encode mapping proxy");
-    encodeComposeObject(ctx, obj, encodeMappingProxyType);
+    err = err || bufferWrite(ctx, PyBytes_AsString(key), PyBytes_Size(key));
+    err = err || encodeAny(ctx, value);
+    Py_DecRef(value);
+    returnIfError(err);
   }
 
-#endif
+  return bufferWriteChar(ctx, 'e');
+}
 
-  // Unsupported type, raise TypeError
+static int unsupportedTypeError(HPy obj) {
   HPy typ = PyObject_Type(obj);
   if (typ == NULL) {
     runtimeError("failed to get type of object");
@@ -552,23 +789,1420 @@ static int encodeAny(Context *ctx, HPy obj) {
   return 1;
 }
 
-// mod is the module object
-static HPy bencode(HPy mod, HPy obj) {
-  int bufferAlloc = 0;
-  Context ctx = newContext(&bufferAlloc);
-  if (bufferAlloc) {
-    return NULL;
+// iterators are encoded as list, except files, which are iterators of lines.
+// return -1 on error.
+static int isListIterator(HPy obj) {
+  if (!PyIter_Check(obj)) {
+    return 0;
   }
 
-  // error when encoding
-  if (encodeAny(&ctx, obj)) {
-    freeContext(ctx);
-    return NULL;
+  int r = PyObject_IsInstance(obj, IOBaseType);
+  return r == -1 ? -1 : !r;
+}
+
+enum fallbackKind {
+  kindUnsupported,
+  kindEnum,
+  kindDataclass,
+  kindMapping,
+  kindSequence,
+  kindIterator,
+};
+
+static int classifyType(HPy obj, TypeEntry *entry) {
+  entry->kind = kindUnsupported;
+  entry->fields = NULL;
+
+  int r = PyObject_IsInstance(obj, EnumType);
+  if (r) {
+    entry->kind = kindEnum;
+    return r == -1;
   }
 
-  HPy res = PyBytes_FromStringAndSize(ctx.buf, ctx.index);
+  if (PyObject_HasAttrString((HPy)Py_TYPE(obj), "__dataclass_fields__")) {
+    entry->fields = dataclassFields(obj);
+    entry->kind = kindDataclass;
+    return entry->fields == NULL;
+  }
+
+  r = PyObject_IsInstance(obj, MappingABC);
+  if (r) {
+    entry->kind = kindMapping;
+    return r == -1;
+  }
+
+  r = PyObject_IsInstance(obj, SequenceABC);
+  if (r) {
+    entry->kind = kindSequence;
+    return r == -1;
+  }
+
+  r = isListIterator(obj);
+  if (r) {
+    entry->kind = kindIterator;
+    return r == -1;
+  }
+
+  return 0;
+}
+
+// type -> TypeEntry of objects not in fast path, shared by all calls and dropped as a whole when
+// it's full or when a class is registered to an ABC, which may change kind of cached types.
+// unsupported types are not cached, kind doesn't depend on `default`.
+#define typeCacheMaxSize 1024
+static khash_t(TYPE) * typeCache;
+// abc.get_cache_token() when typeCache was filled.
+static HPy typeCacheToken;
+
+static void releaseTypeEntry(TypeEntry *entry) {
+  Py_DecRef(entry->type);
+  Py_XDECREF(entry->fields);
+}
+
+static void clearTypeCache(void) {
+  for (khint_t k = kh_begin(typeCache); k != kh_end(typeCache); ++k) {
+    if (kh_exist(typeCache, k)) {
+      releaseTypeEntry(&kh_val(typeCache, k));
+    }
+  }
+  kh_clear(TYPE, typeCache);
+}
+
+// drop typeCache if ABC registrations changed since it was filled.
+static int checkTypeCacheToken(void) {
+  HPy token = PyObject_CallFunctionObjArgs(AbcCacheToken, NULL);
+  if (token == NULL) {
+    return 1;
+  }
+
+  int same = typeCacheToken != NULL && PyObject_RichCompareBool(token, typeCacheToken, Py_EQ);
+  if (same == -1) {
+    Py_DecRef(token);
+    return 1;
+  }
+  if (same) {
+    Py_DecRef(token);
+    return 0;
+  }
+
+  clearTypeCache();
+  Py_XDECREF(typeCacheToken);
+  typeCacheToken = token;
+  return 0;
+}
+
+// take entry, release it on error.
+static int cacheTypeEntry(HPy obj, TypeEntry *entry) {
+  entry->type = PyWeakref_NewRef((HPy)Py_TYPE(obj), NULL);
+  if (entry->type == NULL) {
+    Py_XDECREF(entry->fields);
+    return 1;
+  }
+
+  if (kh_size(typeCache) >= typeCacheMaxSize) {
+    clearTypeCache();
+  }
+
+  int absent;
+  khint_t k = kh_put(TYPE, typeCache, (khint64_t)Py_TYPE(obj), &absent);
+  if (absent < 0) {
+    releaseTypeEntry(entry);
+    PyErr_SetNone(PyExc_MemoryError);
+    return 1;
+  }
+  // entry of a dead type, or classifyType ran python code that cached same type already.
+  if (!absent) {
+    releaseTypeEntry(&kh_val(typeCache, k));
+  }
+  kh_val(typeCache, k) = *entry;
+  return 0;
+}
+
+// objects not handled by fast path, kind of type is cached in typeCache.
+static int encodeFallback(Context *ctx, HPy obj) {
+  statsInc(encode_fallback);
+  if (typeCache == NULL) {
+    typeCache = kh_init(TYPE);
+    if (typeCache == NULL) {
+      PyErr_SetNone(PyExc_MemoryError);
+      return 1;
+    }
+  }
+  returnIfError(checkTypeCacheToken());
+
+  // entries hold a weak reference to type, a dead one means address is reused by another type.
+  TypeEntry entry;
+  khint_t k = kh_get(TYPE, typeCache, (khint64_t)Py_TYPE(obj));
+  if (k != kh_end(typeCache) &&
+      PyWeakref_GetObject(kh_val(typeCache, k).type) == (HPy)Py_TYPE(obj)) {
+    entry = kh_val(typeCache, k);
+  } else {
+    if (classifyType(obj, &entry)) {
+      return 1;
+    }
+    if (entry.kind != kindUnsupported && cacheTypeEntry(obj, &entry)) {
+      return 1;
+    }
+  }
+
+  switch (entry.kind) {
+  case kindEnum: {
+    HPy value = PyObject_GetAttrString(obj, "value");
+    if (value == NULL) {
+      return 1;
+    }
+    int err = encodeAny(ctx, value);
+    Py_DecRef(value);
+    return err;
+  }
+  case kindDataclass: {
+    // nested values may drop typeCache, keep fields alive.
+    HPy fields = entry.fields;
+    Py_IncRef(fields);
+    int err = encodeDataclass(ctx, obj, fields);
+    Py_DecRef(fields);
+    return err;
+  }
+  case kindMapping:
+    return encodeMapping(ctx, obj);
+  case kindSequence:
+  case kindIterator:
+    return encodeSequence(ctx, obj);
+  }
+
+  if (ctx->defaultHook == NULL) {
+    return unsupportedTypeError(obj);
+  }
+
+  HPy value = PyObject_CallFunctionObjArgs(ctx->defaultHook, obj, NULL);
+  if (value == NULL) {
+    return 1;
+  }
+
+  int err = encodeAny(ctx, value);
+  Py_DecRef(value);
+  return err;
+}
+
+// push obj to current path, fail if it's already in path.
+// most data is shallow, so a linear scan of inline path is cheaper than hashing.
+static int enterObject(Context *ctx, HPy obj) {
+  if (ctx->noCircularCheck) {
+    if (ctx->depth >= encodeMaxDepth) {
+      PyErr_Format(PyExc_RecursionError, "max nesting depth %d exceeded", encodeMaxDepth);
+      return 1;
+    }
+    ctx->depth++;
+    return 0;
+  }
+
+  HPy_ssize_t n = ctx->depth < circularInlineDepth ? ctx->depth : circularInlineDepth;
+  for (HPy_ssize_t i = 0; i < n; i++) {
+    if (ctx->path[i] == obj) {
+      goto circular;
+    }
+  }
+
+  if (ctx->depth < circularInlineDepth) {
+    ctx->path[ctx->depth++] = obj;
+    return 0;
+  }
+
+  if (ctx->seen == NULL) {
+    ctx->seen = kh_init(PTR);
+    if (ctx->seen == NULL) {
+      PyErr_SetNone(PyExc_MemoryError);
+      return 1;
+    }
+  }
+
+  int absent;
+  kh_put_PTR(ctx->seen, (khint64_t)obj, &absent);
+  if (absent < 0) {
+    PyErr_SetNone(PyExc_MemoryError);
+    return 1;
+  }
+  if (!absent) {
+    goto circular;
+  }
+
+  ctx->depth++;
+  return 0;
+
+circular:
+  debug_print("circular reference found");
+  PyErr_SetString(PyExc_ValueError, "circular reference found");
+  return 1;
+}
+
+// pop obj pushed by enterObject.
+static void leaveObject(Context *ctx, HPy obj) {
+  ctx->depth--;
+  if (!ctx->noCircularCheck && ctx->depth >= circularInlineDepth) {
+    khint64_t key = kh_get_PTR(ctx->seen, (khint64_t)obj);
+    kh_del_PTR(ctx->seen, key);
+  }
+}
+
+#define encodeComposeObject(ctx, obj, encoder)                                                     \
+  do {                                                                                             \
+    if (enterObject(ctx, obj)) {                                                                   \
+      return 1;                                                                                    \
+    }                                                                                              \
+    int r = encoder(ctx, obj);                                                                     \
+    leaveObject(ctx, obj);                                                                         \
+    return r;                                                                                      \
+  } while (0)
+
+// encoded output cache, python type is at the end of this file.
+typedef struct encodeCache {
+  PyObject_HEAD;
+  // tuple -> bytes for tuples cached by value, id(obj) -> (obj, bytes) for objects cached by
+  // identity. in insertion order, oldest entries are dropped first.
+  HPy entries;
+  // objects marked by EncodeCache.mark, a reference is kept for each.
+  khash_t(PTR) * marked;
+  HPy_ssize_t maxSize;
+  HPy_ssize_t maxBytes;
+  HPy_ssize_t minBytes;
+  // total size of cached outputs.
+  HPy_ssize_t bytes;
+  HPy_ssize_t hits;
+  HPy_ssize_t misses;
+} EncodeCache;
+
+// set by module init.
+HPy EncodeCacheType;
+
+static int encodeObject(Context *ctx, HPy obj);
+
+static inline HPy cachedBytes(HPy value) {
+  return PyBytes_Check(value) ? value : PyTuple_GetItem(value, 1);
+}
+
+// drop oldest entry.
+static int encodeCacheEvict(EncodeCache *c) {
+  Py_ssize_t pos = 0;
+  HPy key;
+  HPy value;
+  if (!PyDict_Next(c->entries, &pos, &key, &value)) {
+    return 0;
+  }
+
+  c->bytes -= PyBytes_Size(cachedBytes(value));
+  Py_INCREF(key);
+  int err = PyDict_DelItem(c->entries, key);
+  Py_DecRef(key);
+  return err;
+}
+
+static int encodeCacheStore(EncodeCache *c, HPy key, HPy obj, const char *data, HPy_ssize_t size) {
+  if (size < c->minBytes || size > c->maxBytes || c->maxSize == 0) {
+    return 0;
+  }
+
+  // already stored by a nested call with same cache, like from default hook.
+  if (PyDict_GetItemWithError(c->entries, key) != NULL) {
+    return 0;
+  }
+  if (PyErr_Occurred()) {
+    return 1;
+  }
+
+  HPy encoded = PyBytes_FromStringAndSize(data, size);
+  if (encoded == NULL) {
+    return 1;
+  }
+
+  HPy value = encoded;
+  if (key != obj) {
+    value = PyTuple_Pack(2, obj, encoded);
+    Py_DecRef(encoded);
+    if (value == NULL) {
+      return 1;
+    }
+  }
+
+  int err = 0;
+  while (!err && PyDict_Size(c->entries) > 0 &&
+         (PyDict_Size(c->entries) >= c->maxSize || c->bytes + size > c->maxBytes)) {
+    err = encodeCacheEvict(c);
+  }
+
+  err = err || PyDict_SetItem(c->entries, key, value);
+  Py_DecRef(value);
+  if (!err) {
+    c->bytes += size;
+  }
+  return err;
+}
+
+// tuples nested deeper are not cached.
+#define plainTupleMaxDepth 16
+
+// tuple of exact str, bytes, int, bool and such tuples. equal plain tuples have same output,
+// while 1.0, Decimal(1) or objects passed to `default` may equal 1 but encode differently.
+static int isPlainTuple(HPy obj, int depth) {
+  if (!PyTuple_CheckExact(obj) || depth >= plainTupleMaxDepth) {
+    return 0;
+  }
+
+  HPy_ssize_t count = PyTuple_Size(obj);
+  for (HPy_ssize_t i = 0; i < count; i++) {
+    HPy item = PyTuple_GetItem(obj, i);
+    if (PyUnicode_CheckExact(item) || PyBytes_CheckExact(item) || PyLong_CheckExact(item) ||
+        item == Py_True || item == Py_False) {
+      continue;
+    }
+    if (!isPlainTuple(item, depth + 1)) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+// encode obj with ctx->cache, return -1 if obj is not cacheable.
+//
+// plain tuples are looked up by value, so cached output can't go stale.
+// marked objects are looked up by identity, caller promises they are not modified while cached.
+// types.MappingProxyType is a live view of its dict, so it's only cached when marked.
+static int encodeCached(Context *ctx, HPy obj) {
+  EncodeCache *c = ctx->cache;
+
+  HPy key;
+  if (kh_size(c->marked) != 0 && kh_get(PTR, c->marked, (khint64_t)obj) != kh_end(c->marked)) {
+    key = PyLong_FromVoidPtr(obj);
+  } else if (isPlainTuple(obj, 0)) {
+    key = obj;
+    Py_INCREF(key);
+  } else {
+    return -1;
+  }
+  if (key == NULL) {
+    return 1;
+  }
+
+  HPy value = PyDict_GetItemWithError(c->entries, key);
+  if (value != NULL) {
+    c->hits++;
+    Py_DecRef(key);
+    HPy encoded = cachedBytes(value);
+    return bufferWrite(ctx, PyBytes_AsString(encoded), PyBytes_Size(encoded));
+  }
+
+  if (PyErr_Occurred()) {
+    Py_DecRef(key);
+    return 1;
+  }
+
+  c->misses++;
+  size_t start = ctx->out.len;
+  int err = encodeObject(ctx, obj);
+  if (!err) {
+    err = encodeCacheStore(c, key, obj, ctx->out.buf + start, ctx->out.len - start);
+  }
+  Py_DecRef(key);
+  return err;
+}
+
+static int encodeAny(Context *ctx, HPy obj) {
+  if (obj == Py_True) {
+    return bufferWrite(ctx, "i1e", 3);
+  }
+
+  if (obj == Py_False) {
+    return bufferWrite(ctx, "i0e", 3);
+  }
+
+  if (PyBytes_Check(obj)) {
+    statsInc(encode_str);
+    return encodeBytes(ctx, obj);
+  }
+
+  if (PyUnicode_Check(obj)) {
+    statsInc(encode_str);
+    return encodeStr(ctx, obj);
+  }
+
+  if (PyLong_Check(obj)) {
+    statsInc(encode_int);
+    return encodeInt(ctx, obj);
+  }
+
+  if (ctx->cache != NULL) {
+    int r = encodeCached(ctx, obj);
+    if (r != -1) {
+      return r;
+    }
+  }
+
+  return encodeObject(ctx, obj);
+}
+
+// containers and other objects not handled by encodeAny.
+static int encodeObject(Context *ctx, HPy obj) {
+  if (PyList_Check(obj)) {
+    statsInc(encode_list);
+    encodeComposeObject(ctx, obj, encodeList);
+  }
+
+  if (PyTuple_Check(obj)) {
+    statsInc(encode_list);
+    encodeComposeObject(ctx, obj, encodeTuple);
+  }
+
+  if (PyDict_Check(obj)) {
+    statsInc(encode_dict);
+    encodeComposeObject(ctx, obj, encodeDict);
+  }
+
+  if (PyByteArray_Check(obj)) {
+    HPy_ssize_t size = PyByteArray_Size(obj);
+    const char *data = PyByteArray_AsString(obj);
+    if (data == NULL) {
+      return 1;
+    }
+
+    return bufferWriteString(ctx, obj, data, size);
+  }
+
+  if (Py_TYPE(obj) == (PyTypeObject *)CompactPeersType) {
+    return encodeCompactPeers(ctx, obj);
+  }
+
+#if PY_MINOR_VERSION >= 10
+
+  // types.MappingProxyType
+  debug_print("test if mapping proxy");
+  if (PyType_IsSubtype(obj->ob_type, &PyDictProxy_Type)) {
+    debug_print("encode mapping proxy");
+    encodeComposeObject(ctx, obj, encodeMapping);
+  }
+
+#endif
+
+#if PY_MINOR_VERSION >= 11
+  if (PyObject_CheckBuffer(obj)) {
+    return encodeBuffer(ctx, obj);
+  }
+#else
+  int r = encodeBuffer(ctx, obj);
+  if (r != -1) {
+    return r;
+  }
+#endif
+
+  // dataclass, Enum, Mapping, Sequence or `default` hook.
+  // default hook may return obj itself, check circular reference.
+  encodeComposeObject(ctx, obj, encodeFallback);
+}
+
+#define encodeEntry()                                                                              \
+  do {                                                                                             \
+    statsInc(encode_calls);                                                                        \
+    probe0(encode__entry);                                                                         \
+  } while (0)
+
+#define encodeReturn(size, ok)                                                                     \
+  do {                                                                                             \
+    if (ok) {                                                                                      \
+      statsAdd(encode_bytes, size);                                                                \
+      statsMax(encode_max_bytes, size);                                                            \
+    } else {                                                                                       \
+      statsInc(encode_errors);                                                                     \
+    }                                                                                              \
+    probe2(encode__return, size, ok);                                                              \
+  } while (0)
+
+// encode obj to ctx, for writers in other files.
+int encodeValue(Context *ctx, HPy obj) { return encodeAny(ctx, obj); }
+
+// mod is the module object
+static HPy bencode(HPy mod, HPy args, HPy kwargs) {
+  static char *kwlist[] = {"", "default", "size_hint", "check_circular", "cache", NULL};
+
+  HPy obj;
+  HPy defaultHook = Py_None;
+  HPy_ssize_t sizeHint = 0;
+  int checkCircular = 1;
+  HPy cache = Py_None;
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|$OnpO:bencode", kwlist, &obj, &defaultHook,
+                                   &sizeHint, &checkCircular, &cache)) {
+    return NULL;
+  }
+
+  if (sizeHint < 0) {
+    PyErr_SetString(PyExc_ValueError, "size_hint must not be negative");
+    return NULL;
+  }
+
+  if (cache != Py_None && Py_TYPE(cache) != (PyTypeObject *)EncodeCacheType) {
+    PyErr_Format(PyExc_TypeError, "cache must be EncodeCache or None, got %R", cache);
+    return NULL;
+  }
+
+  int bufferAlloc = 0;
+  Context ctx = newContext(&bufferAlloc, initialBufferSize(sizeHint));
+  if (bufferAlloc) {
+    return NULL;
+  }
+
+  if (defaultHook != Py_None) {
+    ctx.defaultHook = defaultHook;
+  }
+  ctx.noCircularCheck = !checkCircular;
+  if (cache != Py_None) {
+    ctx.cache = (EncodeCache *)cache;
+  }
+
+  encodeEntry();
+
+  // error when encoding
+  if (encodeAny(&ctx, obj)) {
+    freeContext(ctx);
+    encodeReturn(0, 0);
+    return NULL;
+  }
+
+  HPy res = PyBytes_FromStringAndSize(ctx.out.buf, ctx.out.len);
+  encodeReturn(ctx.out.len, res != NULL);
+
+  // caller with size_hint knows size of its output, don't mix it into estimate.
+  if (sizeHint == 0) {
+    recordOutputSize(ctx.out.len);
+  }
+
+  freeContext(ctx);
+
+  return res;
+}
+
+static HPy bencode_segments(HPy mod, HPy args, HPy kwargs) {
+  static char *kwlist[] = {"", "threshold", "default", "check_circular", NULL};
+
+  HPy obj;
+  HPy_ssize_t threshold = defaultSegmentThreshold;
+  HPy defaultHook = Py_None;
+  int checkCircular = 1;
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|n$Op:bencode_segments", kwlist, &obj,
+                                   &threshold, &defaultHook, &checkCircular)) {
+    return NULL;
+  }
+
+  int bufferAlloc = 0;
+  Context ctx = newContext(&bufferAlloc, defaultBufferSize);
+  if (bufferAlloc) {
+    return NULL;
+  }
+
+  if (defaultHook != Py_None) {
+    ctx.defaultHook = defaultHook;
+  }
+  ctx.noCircularCheck = !checkCircular;
+
+  ctx.segments = PyList_New(0);
+  if (ctx.segments == NULL) {
+    freeContext(ctx);
+    return NULL;
+  }
+  ctx.segmentThreshold = threshold;
+
+  encodeEntry();
+
+  if (encodeAny(&ctx, obj) || bufferFlushSegment(&ctx)) {
+    Py_DecRef(ctx.segments);
+    freeContext(ctx);
+    encodeReturn(0, 0);
+    return NULL;
+  }
+
+  HPy res = ctx.segments;
+  encodeReturn(ctx.segmentBytes, 1);
 
   freeContext(ctx);
 
   return res;
 }
+
+// streaming encoder, list, tuple, dict and iterators are walked with an explicit stack,
+// so encoding can stop when buffer is full and continue on next call.
+// other objects are encoded by encodeAny as a whole.
+
+enum streamFrameKind { frameList, frameTuple, frameIterator, frameDict };
+
+typedef struct streamFrame {
+  int kind;
+  // list, tuple or iterator
+  HPy obj;
+  HPy_ssize_t index;
+  // sorted items of dict
+  KeyValuePair *pairs;
+  HPy_ssize_t count;
+} StreamFrame;
+
+typedef struct encodeIterator {
+  PyObject_HEAD;
+  Context ctx;
+  HPy_ssize_t chunkSize;
+  // value to encode before continue with top frame.
+  HPy pending;
+  HPy defaultHook;
+  StreamFrame *frames;
+  HPy_ssize_t depth;
+  HPy_ssize_t capacity;
+  int done;
+} EncodeIterator;
+
+// set by module init.
+HPy EncodeIteratorType;
+
+static void streamFramePop(EncodeIterator *it) {
+  StreamFrame *f = &it->frames[--it->depth];
+  if (f->kind != frameIterator) {
+    leaveObject(&it->ctx, f->obj);
+  }
+
+  if (f->pairs != NULL) {
+    freeKeyValueList(f->pairs, f->count);
+  }
+  Py_XDECREF(f->obj);
+}
+
+static void encodeIteratorClear(EncodeIterator *it) {
+  while (it->depth > 0) {
+    streamFramePop(it);
+  }
+  Py_CLEAR(it->pending);
+  it->done = 1;
+}
+
+static int streamFramePush(EncodeIterator *it, int kind, HPy obj) {
+  if (it->depth == it->capacity) {
+    HPy_ssize_t capacity = it->capacity == 0 ? 16 : it->capacity * 2;
+    StreamFrame *frames = realloc(it->frames, capacity * sizeof(StreamFrame));
+    if (frames == NULL) {
+      PyErr_SetNone(PyExc_MemoryError);
+      return 1;
+    }
+    it->frames = frames;
+    it->capacity = capacity;
+  }
+
+  StreamFrame f = {.kind = kind, .obj = obj};
+  if (kind != frameIterator && enterObject(&it->ctx, obj)) {
+    return 1;
+  }
+
+  if (kind == frameDict && buildDictKeyList(obj, &f.pairs, &f.count)) {
+    if (f.pairs != NULL) {
+      freeKeyValueList(f.pairs, f.count);
+    }
+    leaveObject(&it->ctx, obj);
+    return 1;
+  }
+
+  Py_INCREF(obj);
+  it->frames[it->depth++] = f;
+
+  return bufferWriteChar(&it->ctx, kind == frameDict ? 'd' : 'l');
+}
+
+// start encoding obj, containers are pushed to stack instead of encoded recursively.
+static int streamValue(EncodeIterator *it, HPy obj) {
+  if (PyList_Check(obj)) {
+    statsInc(encode_list);
+    return streamFramePush(it, frameList, obj);
+  }
+
+  if (PyTuple_Check(obj)) {
+    statsInc(encode_list);
+    return streamFramePush(it, frameTuple, obj);
+  }
+
+  if (PyDict_Check(obj)) {
+    statsInc(encode_dict);
+    return streamFramePush(it, frameDict, obj);
+  }
+
+  int r = isListIterator(obj);
+  if (r) {
+    if (r == -1) {
+      return 1;
+    }
+    statsInc(encode_list);
+    return streamFramePush(it, frameIterator, obj);
+  }
+
+  return encodeAny(&it->ctx, obj);
+}
+
+// encode until buffer is not smaller than chunk size or value is finished.
+static int streamEncode(EncodeIterator *it) {
+  while (it->ctx.out.len < (size_t)it->chunkSize) {
+    if (it->pending != NULL) {
+      HPy obj = it->pending;
+      it->pending = NULL;
+      int err = streamValue(it, obj);
+      Py_DecRef(obj);
+      if (err) {
+        return 1;
+      }
+      continue;
+    }
+
+    if (it->depth == 0) {
+      it->done = 1;
+      return 0;
+    }
+
+    StreamFrame *f = &it->frames[it->depth - 1];
+    HPy next = NULL;
+    switch (f->kind) {
+    case frameList:
+      // list may be mutated by python code.
+      if (f->index < PyList_Size(f->obj)) {
+        next = PyList_GetItem(f->obj, f->index++);
+        Py_INCREF(next);
+      }
+      break;
+    case frameTuple:
+      if (f->index < PyTuple_Size(f->obj)) {
+        next = PyTuple_GetItem(f->obj, f->index++);
+        Py_INCREF(next);
+      }
+      break;
+    case frameIterator:
+      next = PyIter_Next(f->obj);
+      if (next == NULL && PyErr_Occurred()) {
+        return 1;
+      }
+      break;
+    case frameDict:
+      if (f->index < f->count) {
+        KeyValuePair *pair = &f->pairs[f->index++];
+        statsInc(encode_str);
+        returnIfError(bufferWriteFormat(&it->ctx, "%zd", pair->keylen));
+        returnIfError(bufferWriteChar(&it->ctx, ':'));
+        returnIfError(bufferWrite(&it->ctx, pair->key, pair->keylen));
+        next = pair->value;
+        Py_INCREF(next);
+      }
+      break;
+    }
+
+    if (next == NULL) {
+      streamFramePop(it);
+      returnIfError(bufferWriteChar(&it->ctx, 'e'));
+      continue;
+    }
+
+    it->pending = next;
+  }
+
+  return 0;
+}
+
+static HPy encodeIteratorNext(HPy self) {
+  EncodeIterator *it = (EncodeIterator *)self;
+  if (it->done && it->ctx.out.len == 0) {
+    return NULL;
+  }
+
+  if (!it->done && streamEncode(it)) {
+    encodeIteratorClear(it);
+    it->ctx.out.len = 0;
+    return NULL;
+  }
+
+  if (it->ctx.out.len == 0) {
+    return NULL;
+  }
+
+  HPy chunk = PyBytes_FromStringAndSize(it->ctx.out.buf, it->ctx.out.len);
+  it->ctx.out.len = 0;
+  return chunk;
+}
+
+static int encodeIteratorTraverse(HPy self, visitproc visit, void *arg) {
+  EncodeIterator *it = (EncodeIterator *)self;
+  Py_VISIT(Py_TYPE(self));
+  Py_VISIT(it->pending);
+  Py_VISIT(it->defaultHook);
+  for (HPy_ssize_t i = 0; i < it->depth; i++) {
+    StreamFrame *f = &it->frames[i];
+    Py_VISIT(f->obj);
+    for (HPy_ssize_t j = 0; f->pairs != NULL && j < f->count; j++) {
+      Py_VISIT(f->pairs[j].value);
+    }
+  }
+  return 0;
+}
+
+static int encodeIteratorTpClear(HPy self) {
+  EncodeIterator *it = (EncodeIterator *)self;
+  encodeIteratorClear(it);
+  it->ctx.defaultHook = NULL;
+  Py_CLEAR(it->defaultHook);
+  return 0;
+}
+
+static void encodeIteratorDealloc(HPy self) {
+  EncodeIterator *it = (EncodeIterator *)self;
+  PyObject_GC_UnTrack(self);
+  encodeIteratorClear(it);
+  free(it->frames);
+  Py_XDECREF(it->defaultHook);
+  freeContext(it->ctx);
+
+  PyTypeObject *tp = Py_TYPE(self);
+  freefunc tp_free = (freefunc)PyType_GetSlot(tp, Py_tp_free);
+  tp_free(self);
+  Py_DecRef((HPy)tp);
+}
+
+static PyType_Slot encodeIteratorSlots[] = {
+    {Py_tp_iter, PyObject_SelfIter},
+    {Py_tp_iternext, encodeIteratorNext},
+    {Py_tp_dealloc, encodeIteratorDealloc},
+    {Py_tp_traverse, encodeIteratorTraverse},
+    {Py_tp_clear, encodeIteratorTpClear},
+    {0, NULL},
+};
+
+PyType_Spec encodeIteratorSpec = {
+    .name = "bencode_c.EncodeIterator",
+    .basicsize = sizeof(EncodeIterator),
+    .itemsize = 0,
+    .flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC,
+    .slots = encodeIteratorSlots,
+};
+
+static HPy bencode_iter(HPy mod, HPy args, HPy kwargs) {
+  static char *kwlist[] = {"", "chunk_size", "default", "check_circular", NULL};
+
+  HPy obj;
+  HPy_ssize_t chunkSize = defaultSegmentThreshold;
+  HPy defaultHook = Py_None;
+  int checkCircular = 1;
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|n$Op:bencode_iter", kwlist, &obj, &chunkSize,
+                                   &defaultHook, &checkCircular)) {
+    return NULL;
+  }
+
+  if (chunkSize <= 0) {
+    PyErr_SetString(PyExc_ValueError, "chunk_size must be positive");
+    return NULL;
+  }
+
+  allocfunc alloc = (allocfunc)PyType_GetSlot((PyTypeObject *)EncodeIteratorType, Py_tp_alloc);
+  EncodeIterator *it = (EncodeIterator *)alloc((PyTypeObject *)EncodeIteratorType, 0);
+  if (it == NULL) {
+    return NULL;
+  }
+
+  int bufferAlloc = 0;
+  // a chunk may exceed chunk size by the last written value.
+  it->ctx = newContext(&bufferAlloc, initialBufferSize(chunkSize * 2));
+  if (bufferAlloc) {
+    Py_DecRef((HPy)it);
+    return NULL;
+  }
+
+  it->chunkSize = chunkSize;
+  it->ctx.noCircularCheck = !checkCircular;
+  if (defaultHook != Py_None) {
+    Py_INCREF(defaultHook);
+    it->defaultHook = defaultHook;
+    it->ctx.defaultHook = defaultHook;
+  }
+
+  Py_INCREF(obj);
+  it->pending = obj;
+
+  return (HPy)it;
+}
+
+// dict encoder of fixed keys, sorting and rendering keys are done once by compile_template.
+
+typedef struct encodeTemplate {
+  PyObject_HEAD;
+  // keys as given, sequence values are in this order.
+  HPy keys;
+  HPy_ssize_t count;
+  // index in keys of i-th sorted key.
+  HPy_ssize_t *order;
+  // "<len>:<key>" of sorted keys, i-th key is rendered[offsets[i]:offsets[i + 1]].
+  char *rendered;
+  HPy_ssize_t *offsets;
+  HPy defaultHook;
+  int noCircularCheck;
+  // size of last output, used as initial buffer size.
+  size_t lastSize;
+} EncodeTemplate;
+
+// set by module init.
+HPy EncodeTemplateType;
+
+PyDoc_STRVAR(__template_encode_doc__,
+             "encode(values: Sequence[Any] | dict[str | bytes, Any], /) -> bytes\n"
+             "--\n\n"
+             "encode a dict of template keys.\n\n"
+             "values is a tuple or list in same order as keys, or a dict of template keys. "
+             "keys with None value or missing from dict are omitted.");
+
+static HPy encodeTemplateEncode(HPy self, HPy values) {
+  EncodeTemplate *t = (EncodeTemplate *)self;
+
+  int isDict = PyDict_Check(values);
+  if (!isDict) {
+    if (!PyTuple_Check(values) && !PyList_Check(values)) {
+      PyErr_Format(PyExc_TypeError, "values must be tuple, list or dict, got %R", values);
+      return NULL;
+    }
+    HPy_ssize_t size = PyTuple_Check(values) ? PyTuple_Size(values) : PyList_Size(values);
+    if (size != t->count) {
+      PyErr_Format(PyExc_ValueError, "template has %zd keys, got %zd values", t->count, size);
+      return NULL;
+    }
+  }
+
+  int bufferAlloc = 0;
+  Context ctx = newContext(&bufferAlloc, initialBufferSize(t->lastSize));
+  if (bufferAlloc) {
+    return NULL;
+  }
+  ctx.defaultHook = t->defaultHook;
+  ctx.noCircularCheck = t->noCircularCheck;
+
+  encodeEntry();
+
+  int err = bufferWriteChar(&ctx, 'd');
+  HPy_ssize_t found = 0;
+  for (HPy_ssize_t i = 0; !err && i < t->count; i++) {
+    HPy_ssize_t index = t->order[i];
+    HPy value;
+    if (isDict) {
+      value = PyDict_GetItem(values, PyTuple_GetItem(t->keys, index));
+      found += value != NULL;
+    } else if (PyTuple_Check(values)) {
+      value = PyTuple_GetItem(values, index);
+    } else {
+      // list may be shortened by default hook.
+      value = PyList_GetItem(values, index);
+      if (value == NULL) {
+        err = 1;
+        break;
+      }
+    }
+
+    if (value == NULL || value == Py_None) {
+      continue;
+    }
+
+    Py_INCREF(value);
+    err = bufferWrite(&ctx, t->rendered + t->offsets[i], t->offsets[i + 1] - t->offsets[i]) ||
+          encodeAny(&ctx, value);
+    Py_DECREF(value);
+  }
+
+  if (!err && isDict && found != PyDict_Size(values)) {
+    PyErr_SetString(PyExc_ValueError, "dict has keys not in template");
+    err = 1;
+  }
+  err = err || bufferWriteChar(&ctx, 'e');
+
+  HPy res = NULL;
+  if (!err) {
+    res = PyBytes_FromStringAndSize(ctx.out.buf, ctx.out.len);
+    t->lastSize = ctx.out.len;
+  }
+  encodeReturn(ctx.out.len, res != NULL);
+  freeContext(ctx);
+  return res;
+}
+
+static HPy encodeTemplateGetKeys(HPy self, void *closure) {
+  EncodeTemplate *t = (EncodeTemplate *)self;
+  Py_INCREF(t->keys);
+  return t->keys;
+}
+
+static int encodeTemplateTraverse(HPy self, visitproc visit, void *arg) {
+  EncodeTemplate *t = (EncodeTemplate *)self;
+  Py_VISIT(Py_TYPE(self));
+  Py_VISIT(t->keys);
+  Py_VISIT(t->defaultHook);
+  return 0;
+}
+
+// keys are str or bytes, only default hook may be part of a cycle.
+static int encodeTemplateTpClear(HPy self) {
+  EncodeTemplate *t = (EncodeTemplate *)self;
+  Py_CLEAR(t->defaultHook);
+  return 0;
+}
+
+static void encodeTemplateDealloc(HPy self) {
+  EncodeTemplate *t = (EncodeTemplate *)self;
+  PyObject_GC_UnTrack(self);
+  Py_XDECREF(t->keys);
+  Py_XDECREF(t->defaultHook);
+  free(t->order);
+  free(t->rendered);
+  free(t->offsets);
+
+  PyTypeObject *tp = Py_TYPE(self);
+  freefunc tp_free = (freefunc)PyType_GetSlot(tp, Py_tp_free);
+  tp_free(self);
+  Py_DecRef((HPy)tp);
+}
+
+static PyMethodDef encodeTemplateMethods[] = {
+    {
+        .ml_name = "encode",
+        .ml_meth = (PyCFunction)(void (*)(void))encodeTemplateEncode,
+        .ml_flags = METH_O,
+        .ml_doc = __template_encode_doc__,
+    },
+    {NULL, NULL, 0, NULL},
+};
+
+static PyGetSetDef encodeTemplateGetSet[] = {
+    {"keys", (getter)encodeTemplateGetKeys, NULL, "keys as given to compile_template", NULL},
+    {NULL},
+};
+
+static PyType_Slot encodeTemplateSlots[] = {
+    {Py_tp_methods, encodeTemplateMethods},
+    {Py_tp_getset, encodeTemplateGetSet},
+    {Py_tp_dealloc, encodeTemplateDealloc},
+    {Py_tp_traverse, encodeTemplateTraverse},
+    {Py_tp_clear, encodeTemplateTpClear},
+    {0, NULL},
+};
+
+PyType_Spec encodeTemplateSpec = {
+    .name = "bencode_c.EncodeTemplate",
+    .basicsize = sizeof(EncodeTemplate),
+    .itemsize = 0,
+    .flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC,
+    .slots = encodeTemplateSlots,
+};
+
+// sort keys and render "<len>:<key>" of them.
+static int compileTemplateKeys(EncodeTemplate *t) {
+  HPy_ssize_t count = t->count;
+  KeyValuePair *pairs = calloc(count ? count : 1, sizeof(KeyValuePair));
+  t->order = malloc((count ? count : 1) * sizeof(HPy_ssize_t));
+  t->offsets = malloc((count + 1) * sizeof(HPy_ssize_t));
+  if (pairs == NULL || t->order == NULL || t->offsets == NULL) {
+    free(pairs);
+    PyErr_SetNone(PyExc_MemoryError);
+    return 1;
+  }
+
+  int err = 0;
+  size_t renderedSize = 0;
+  for (HPy_ssize_t i = 0; i < count; i++) {
+    // value is position of key.
+    HPy index = PyLong_FromSsize_t(i);
+    err = index == NULL || setKeyValuePair(&pairs[i], PyTuple_GetItem(t->keys, i), index);
+    Py_XDECREF(index);
+    if (err) {
+      goto __CLEAN_UP;
+    }
+    // max 20 digits of key length and ':'.
+    renderedSize += pairs[i].keylen + 21;
+  }
+
+  qsort(pairs, count, sizeof(KeyValuePair), sortKeyValuePair);
+
+  t->rendered = malloc(renderedSize ? renderedSize : 1);
+  if (t->rendered == NULL) {
+    PyErr_SetNone(PyExc_MemoryError);
+    err = 1;
+    goto __CLEAN_UP;
+  }
+
+  HPy_ssize_t offset = 0;
+  for (HPy_ssize_t i = 0; i < count; i++) {
+    if (i > 0 && strCompare(pairs[i - 1].key, pairs[i - 1].keylen, pairs[i].key,
+                            pairs[i].keylen) == 0) {
+      PyErr_Format(PyExc_ValueError, "duplicated key %R in template", pairs[i].pyKey);
+      err = 1;
+      goto __CLEAN_UP;
+    }
+
+    t->order[i] = PyLong_AsSsize_t(pairs[i].value);
+    t->offsets[i] = offset;
+    offset += snprintf(t->rendered + offset, 21, "%zd:", pairs[i].keylen);
+    memcpy(t->rendered + offset, pairs[i].key, pairs[i].keylen);
+    offset += pairs[i].keylen;
+  }
+  t->offsets[count] = offset;
+
+__CLEAN_UP:
+  freeKeyValueList(pairs, count);
+  return err;
+}
+
+static HPy compile_template(HPy mod, HPy args, HPy kwargs) {
+  static char *kwlist[] = {"", "default", "check_circular", NULL};
+
+  HPy keys;
+  HPy defaultHook = Py_None;
+  int checkCircular = 1;
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|$Op:compile_template", kwlist, &keys,
+                                   &defaultHook, &checkCircular)) {
+    return NULL;
+  }
+
+  allocfunc alloc = (allocfunc)PyType_GetSlot((PyTypeObject *)EncodeTemplateType, Py_tp_alloc);
+  EncodeTemplate *t = (EncodeTemplate *)alloc((PyTypeObject *)EncodeTemplateType, 0);
+  if (t == NULL) {
+    return NULL;
+  }
+
+  t->keys = PySequence_Tuple(keys);
+  if (t->keys == NULL) {
+    Py_DecRef((HPy)t);
+    return NULL;
+  }
+  t->count = PyTuple_Size(t->keys);
+  t->noCircularCheck = !checkCircular;
+  if (defaultHook != Py_None) {
+    Py_INCREF(defaultHook);
+    t->defaultHook = defaultHook;
+  }
+
+  if (compileTemplateKeys(t)) {
+    Py_DecRef((HPy)t);
+    return NULL;
+  }
+
+  return (HPy)t;
+}
+
+// EncodeCache python type, encoding part is encodeCached.
+
+static HPy encodeCacheNew(PyTypeObject *type, HPy args, HPy kwargs) {
+  static char *kwlist[] = {"maxsize", "max_bytes", "min_bytes", NULL};
+
+  HPy_ssize_t maxSize = 1024;
+  HPy_ssize_t maxBytes = 1024 * 1024;
+  HPy_ssize_t minBytes = 64;
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|n$nn:EncodeCache", kwlist, &maxSize, &maxBytes,
+                                   &minBytes)) {
+    return NULL;
+  }
+
+  if (maxSize < 0 || maxBytes < 0 || minBytes < 0) {
+    PyErr_SetString(PyExc_ValueError, "maxsize, max_bytes and min_bytes must not be negative");
+    return NULL;
+  }
+
+  allocfunc alloc = (allocfunc)PyType_GetSlot(type, Py_tp_alloc);
+  EncodeCache *c = (EncodeCache *)alloc(type, 0);
+  if (c == NULL) {
+    return NULL;
+  }
+
+  c->maxSize = maxSize;
+  c->maxBytes = maxBytes;
+  c->minBytes = minBytes;
+  c->entries = PyDict_New();
+  c->marked = kh_init(PTR);
+  if (c->entries == NULL || c->marked == NULL) {
+    if (c->marked == NULL) {
+      PyErr_SetNone(PyExc_MemoryError);
+    }
+    Py_DecRef((HPy)c);
+    return NULL;
+  }
+
+  return (HPy)c;
+}
+
+static int encodeCacheTraverse(HPy self, visitproc visit, void *arg) {
+  EncodeCache *c = (EncodeCache *)self;
+  Py_VISIT(Py_TYPE(self));
+  Py_VISIT(c->entries);
+  if (c->marked != NULL) {
+    for (khint_t k = kh_begin(c->marked); k != kh_end(c->marked); ++k) {
+      if (kh_exist(c->marked, k)) {
+        Py_VISIT((HPy)kh_key(c->marked, k));
+      }
+    }
+  }
+  return 0;
+}
+
+// drop marked objects and cached outputs, cache stays usable.
+static int encodeCacheTpClear(HPy self) {
+  EncodeCache *c = (EncodeCache *)self;
+  if (c->marked != NULL) {
+    for (khint_t k = kh_begin(c->marked); k != kh_end(c->marked); ++k) {
+      if (kh_exist(c->marked, k)) {
+        Py_DecRef((HPy)kh_key(c->marked, k));
+      }
+    }
+    kh_clear(PTR, c->marked);
+  }
+  if (c->entries != NULL) {
+    PyDict_Clear(c->entries);
+  }
+  c->bytes = 0;
+  return 0;
+}
+
+static void encodeCacheDealloc(HPy self) {
+  EncodeCache *c = (EncodeCache *)self;
+  PyObject_GC_UnTrack(self);
+  encodeCacheTpClear(self);
+  Py_XDECREF(c->entries);
+  if (c->marked != NULL) {
+    kh_destroy(PTR, c->marked);
+  }
+
+  PyTypeObject *tp = Py_TYPE(self);
+  freefunc tp_free = (freefunc)PyType_GetSlot(tp, Py_tp_free);
+  tp_free(self);
+  Py_DecRef((HPy)tp);
+}
+
+static HPy encodeCacheMark(HPy self, HPy obj) {
+  EncodeCache *c = (EncodeCache *)self;
+  if (PyBytes_Check(obj) || PyUnicode_Check(obj) || PyLong_Check(obj)) {
+    PyErr_Format(PyExc_TypeError, "str, bytes and int are not cached, got %R", obj);
+    return NULL;
+  }
+
+  int absent;
+  kh_put(PTR, c->marked, (khint64_t)obj, &absent);
+  if (absent < 0) {
+    PyErr_SetNone(PyExc_MemoryError);
+    return NULL;
+  }
+  if (absent) {
+    Py_INCREF(obj);
+  }
+
+  Py_INCREF(obj);
+  return obj;
+}
+
+static HPy encodeCacheUnmark(HPy self, HPy obj) {
+  EncodeCache *c = (EncodeCache *)self;
+  khint_t k = kh_get(PTR, c->marked, (khint64_t)obj);
+  if (k == kh_end(c->marked)) {
+    PyErr_SetObject(PyExc_KeyError, obj);
+    return NULL;
+  }
+
+  HPy key = PyLong_FromVoidPtr(obj);
+  if (key == NULL) {
+    return NULL;
+  }
+
+  HPy value = PyDict_GetItemWithError(c->entries, key);
+  int err = value == NULL && PyErr_Occurred();
+  if (value != NULL) {
+    c->bytes -= PyBytes_Size(cachedBytes(value));
+    err = PyDict_DelItem(c->entries, key);
+  }
+  Py_DecRef(key);
+  if (err) {
+    return NULL;
+  }
+
+  kh_del(PTR, c->marked, k);
+  Py_DecRef(obj);
+  Py_RETURN_NONE;
+}
+
+static HPy encodeCacheClear(HPy self, HPy unused) {
+  EncodeCache *c = (EncodeCache *)self;
+  PyDict_Clear(c->entries);
+  c->bytes = 0;
+  Py_RETURN_NONE;
+}
+
+static Py_ssize_t encodeCacheLen(HPy self) {
+  return PyDict_Size(((EncodeCache *)self)->entries);
+}
+
+static HPy encodeCacheGetHits(HPy self, void *closure) {
+  return PyLong_FromSsize_t(((EncodeCache *)self)->hits);
+}
+
+static HPy encodeCacheGetMisses(HPy self, void *closure) {
+  return PyLong_FromSsize_t(((EncodeCache *)self)->misses);
+}
+
+static HPy encodeCacheGetBytes(HPy self, void *closure) {
+  return PyLong_FromSsize_t(((EncodeCache *)self)->bytes);
+}
+
+static PyMethodDef encodeCacheMethods[] = {
+    {
+        .ml_name = "mark",
+        .ml_meth = (PyCFunction)(void (*)(void))encodeCacheMark,
+        .ml_flags = METH_O,
+        .ml_doc = "mark(obj: T, /) -> T\n"
+                  "--\n\n"
+                  "cache output of obj by identity, obj must not be modified until unmark. "
+                  "obj is returned.",
+    },
+    {
+        .ml_name = "unmark",
+        .ml_meth = (PyCFunction)(void (*)(void))encodeCacheUnmark,
+        .ml_flags = METH_O,
+        .ml_doc = "unmark(obj: Any, /) -> None\n"
+                  "--\n\n"
+                  "stop caching obj and drop its output, KeyError if obj is not marked.",
+    },
+    {
+        .ml_name = "clear",
+        .ml_meth = (PyCFunction)(void (*)(void))encodeCacheClear,
+        .ml_flags = METH_NOARGS,
+        .ml_doc = "clear() -> None\n"
+                  "--\n\n"
+                  "drop all cached outputs, marked objects stay marked.",
+    },
+    {NULL, NULL, 0, NULL},
+};
+
+static PyGetSetDef encodeCacheGetSet[] = {
+    {"hits", (getter)encodeCacheGetHits, NULL, "lookups found in cache", NULL},
+    {"misses", (getter)encodeCacheGetMisses, NULL, "lookups not found in cache", NULL},
+    {"nbytes", (getter)encodeCacheGetBytes, NULL, "total size of cached outputs", NULL},
+    {NULL},
+};
+
+static PyType_Slot encodeCacheSlots[] = {
+    {Py_tp_doc, "EncodeCache(maxsize: int = 1024, *, max_bytes: int = 1048576, "
+                "min_bytes: int = 64)\n"
+                "--\n\n"
+                "encoded output of immutable sub objects, for `bencode(cache=...)`.\n\n"
+                "tuples of str, bytes, int and such tuples are cached by value, "
+                "marked objects by identity. "
+                "outputs shorter than min_bytes are not cached, "
+                "oldest outputs are dropped when there are maxsize outputs or max_bytes bytes."},
+    {Py_tp_new, encodeCacheNew},
+    {Py_tp_dealloc, encodeCacheDealloc},
+    {Py_tp_traverse, encodeCacheTraverse},
+    {Py_tp_clear, encodeCacheTpClear},
+    {Py_sq_length, encodeCacheLen},
+    {Py_tp_methods, encodeCacheMethods},
+    {Py_tp_getset, encodeCacheGetSet},
+    {0, NULL},
+};
+
+PyType_Spec encodeCacheSpec = {
+    .name = "bencode_c.EncodeCache",
+    .basicsize = sizeof(EncodeCache),
+    .itemsize = 0,
+    .flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC,
+    .slots = encodeCacheSlots,
+};
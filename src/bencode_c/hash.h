@@ -0,0 +1,378 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// SHA-1 and SHA-256 for piece hashing of make_torrent, hashing run without GIL in worker threads so
+// hashlib can't be used.
+
+#define sha1DigestSize 20
+#define sha256DigestSize 32
+
+static inline uint32_t rotl32(uint32_t x, int n) { return (x << n) | (x >> (32 - n)); }
+
+static inline uint32_t rotr32(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+static inline uint32_t loadBE32(const unsigned char *p) {
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static inline void storeBE32(unsigned char *p, uint32_t v) {
+  p[0] = (unsigned char)(v >> 24);
+  p[1] = (unsigned char)(v >> 16);
+  p[2] = (unsigned char)(v >> 8);
+  p[3] = (unsigned char)v;
+}
+
+static inline void storeBE64(unsigned char *p, uint64_t v) {
+  storeBE32(p, (uint32_t)(v >> 32));
+  storeBE32(p + 4, (uint32_t)v);
+}
+
+// process blocks of 64 bytes.
+typedef void (*hashBlocksFunc)(uint32_t *h, const unsigned char *p, size_t blocks);
+
+typedef struct hashState {
+  uint32_t h[8];
+  uint64_t size;
+  unsigned char block[64];
+  size_t blockLen;
+  hashBlocksFunc blocks;
+} HashState;
+
+#define sha1Round(f, k)                                                                            \
+  do {                                                                                             \
+    uint32_t t = rotl32(a, 5) + (f) + e + (k) + w[i & 15];                                         \
+    e = d;                                                                                         \
+    d = c;                                                                                         \
+    c = rotl32(b, 30);                                                                             \
+    b = a;                                                                                         \
+    a = t;                                                                                         \
+  } while (0)
+
+// message schedule in a ring of 16 words.
+#define sha1Schedule()                                                                             \
+  (w[i & 15] = rotl32(w[(i + 13) & 15] ^ w[(i + 8) & 15] ^ w[(i + 2) & 15] ^ w[i & 15], 1))
+
+static void sha1BlocksPortable(uint32_t *h, const unsigned char *p, size_t blocks) {
+  for (; blocks; blocks--, p += 64) {
+    uint32_t w[16];
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    int i = 0;
+
+    for (; i < 16; i++) {
+      w[i] = loadBE32(p + i * 4);
+      sha1Round((b & c) | (~b & d), 0x5A827999);
+    }
+    for (; i < 20; i++) {
+      sha1Schedule();
+      sha1Round((b & c) | (~b & d), 0x5A827999);
+    }
+    for (; i < 40; i++) {
+      sha1Schedule();
+      sha1Round(b ^ c ^ d, 0x6ED9EBA1);
+    }
+    for (; i < 60; i++) {
+      sha1Schedule();
+      sha1Round((b & c) | (b & d) | (c & d), 0x8F1BBCDC);
+    }
+    for (; i < 80; i++) {
+      sha1Schedule();
+      sha1Round(b ^ c ^ d, 0xCA62C1D6);
+    }
+
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+  }
+}
+
+static const uint32_t sha256K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static void sha256BlocksPortable(uint32_t *h, const unsigned char *p, size_t blocks) {
+  for (; blocks; blocks--, p += 64) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++) {
+      w[i] = loadBE32(p + i * 4);
+    }
+    for (int i = 16; i < 64; i++) {
+      uint32_t s0 = rotr32(w[i - 15], 7) ^ rotr32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+      uint32_t s1 = rotr32(w[i - 2], 17) ^ rotr32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+      w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], hh = h[7];
+    for (int i = 0; i < 64; i++) {
+      uint32_t s1 = rotr32(e, 6) ^ rotr32(e, 11) ^ rotr32(e, 25);
+      uint32_t ch = (e & f) ^ (~e & g);
+      uint32_t t1 = hh + s1 + ch + sha256K[i] + w[i];
+      uint32_t s0 = rotr32(a, 2) ^ rotr32(a, 13) ^ rotr32(a, 22);
+      uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+      uint32_t t2 = s0 + maj;
+      hh = g;
+      g = f;
+      f = e;
+      e = d + t1;
+      d = c;
+      c = b;
+      b = a;
+      a = t1 + t2;
+    }
+
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+    h[5] += f;
+    h[6] += g;
+    h[7] += hh;
+  }
+}
+
+// x86 SHA extensions, selected at runtime by hashInit.
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define hashHaveShaNi 1
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define shaNiTarget
+#else
+#include <cpuid.h>
+#define shaNiTarget __attribute__((target("sha,ssse3,sse4.1")))
+#endif
+#include <immintrin.h>
+
+static int cpuHasShaNi(void) {
+  unsigned int r1[4] = {0}, r7[4] = {0};
+#ifdef _MSC_VER
+  int info[4];
+  __cpuid(info, 0);
+  if (info[0] < 7) {
+    return 0;
+  }
+  __cpuid(info, 1);
+  memcpy(r1, info, sizeof(info));
+  __cpuidex(info, 7, 0);
+  memcpy(r7, info, sizeof(info));
+#else
+  if (__get_cpuid_max(0, NULL) < 7) {
+    return 0;
+  }
+  __cpuid(1, r1[0], r1[1], r1[2], r1[3]);
+  __cpuid_count(7, 0, r7[0], r7[1], r7[2], r7[3]);
+#endif
+  // SSSE3 and SSE4.1 in ecx of leaf 1, SHA in ebx of leaf 7.
+  return (r1[2] & (1u << 9)) && (r1[2] & (1u << 19)) && (r7[1] & (1u << 29));
+}
+
+// rounds must be an immediate, so 20 groups of 4 rounds are unrolled by function.
+#define sha1NiGroups(func)                                                                         \
+  for (int j = 0; j < 5; j++, g++) {                                                               \
+    if (g >= 4) {                                                                                  \
+      m[g & 3] = _mm_sha1msg2_epu32(                                                               \
+          _mm_xor_si128(_mm_sha1msg1_epu32(m[g & 3], m[(g + 1) & 3]), m[(g + 2) & 3]),             \
+          m[(g + 3) & 3]);                                                                         \
+    }                                                                                              \
+    __m128i x = g == 0 ? _mm_add_epi32(e, m[0]) : _mm_sha1nexte_epu32(e, m[g & 3]);                \
+    e = abcd;                                                                                      \
+    abcd = _mm_sha1rnds4_epu32(abcd, x, func);                                                     \
+  }
+
+static shaNiTarget void sha1BlocksShaNi(uint32_t *h, const unsigned char *p, size_t blocks) {
+  // reverse bytes of 16, first word in highest lane.
+  const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+  __m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)h), 0x1B);
+  __m128i e0 = _mm_set_epi32((int)h[4], 0, 0, 0);
+
+  for (; blocks; blocks--, p += 64) {
+    __m128i abcdSave = abcd;
+    __m128i e = e0;
+    __m128i m[4];
+    for (int i = 0; i < 4; i++) {
+      m[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + i * 16)), mask);
+    }
+
+    int g = 0;
+    sha1NiGroups(0);
+    sha1NiGroups(1);
+    sha1NiGroups(2);
+    sha1NiGroups(3);
+
+    e0 = _mm_sha1nexte_epu32(e, e0);
+    abcd = _mm_add_epi32(abcd, abcdSave);
+  }
+
+  _mm_storeu_si128((__m128i *)h, _mm_shuffle_epi32(abcd, 0x1B));
+  h[4] = (uint32_t)_mm_extract_epi32(e0, 3);
+}
+
+static shaNiTarget void sha256BlocksShaNi(uint32_t *h, const unsigned char *p, size_t blocks) {
+  // reverse bytes in each word.
+  const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+  // state as ABEF and CDGH.
+  __m128i t = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)h), 0xB1);
+  __m128i s1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)(h + 4)), 0x1B);
+  __m128i s0 = _mm_alignr_epi8(t, s1, 8);
+  s1 = _mm_blend_epi16(s1, t, 0xF0);
+
+  for (; blocks; blocks--, p += 64) {
+    __m128i s0Save = s0;
+    __m128i s1Save = s1;
+    __m128i m[4];
+
+    for (int g = 0; g < 16; g++) {
+      if (g < 4) {
+        m[g] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + g * 16)), mask);
+      } else {
+        __m128i w = _mm_sha256msg1_epu32(m[g & 3], m[(g + 1) & 3]);
+        w = _mm_add_epi32(w, _mm_alignr_epi8(m[(g + 3) & 3], m[(g + 2) & 3], 4));
+        m[g & 3] = _mm_sha256msg2_epu32(w, m[(g + 3) & 3]);
+      }
+      __m128i k = _mm_add_epi32(m[g & 3], _mm_loadu_si128((const __m128i *)(sha256K + g * 4)));
+      s1 = _mm_sha256rnds2_epu32(s1, s0, k);
+      s0 = _mm_sha256rnds2_epu32(s0, s1, _mm_shuffle_epi32(k, 0x0E));
+    }
+
+    s0 = _mm_add_epi32(s0, s0Save);
+    s1 = _mm_add_epi32(s1, s1Save);
+  }
+
+  t = _mm_shuffle_epi32(s0, 0x1B);
+  s1 = _mm_shuffle_epi32(s1, 0xB1);
+  _mm_storeu_si128((__m128i *)h, _mm_blend_epi16(t, s1, 0xF0));
+  _mm_storeu_si128((__m128i *)(h + 4), _mm_alignr_epi8(s1, t, 8));
+}
+
+#endif
+
+static hashBlocksFunc sha1Blocks = sha1BlocksPortable;
+static hashBlocksFunc sha256Blocks = sha256BlocksPortable;
+
+// select block functions for current cpu, call before starting hash threads.
+static void hashInit(void) {
+#ifdef hashHaveShaNi
+  if (cpuHasShaNi()) {
+    sha1Blocks = sha1BlocksShaNi;
+    sha256Blocks = sha256BlocksShaNi;
+  }
+#endif
+}
+
+static void hashUpdate(HashState *s, const unsigned char *data, size_t len) {
+  s->size += len;
+
+  if (s->blockLen) {
+    size_t n = 64 - s->blockLen < len ? 64 - s->blockLen : len;
+    memcpy(s->block + s->blockLen, data, n);
+    s->blockLen += n;
+    data += n;
+    len -= n;
+    if (s->blockLen < 64) {
+      return;
+    }
+    s->blocks(s->h, s->block, 1);
+    s->blockLen = 0;
+  }
+
+  if (len >= 64) {
+    s->blocks(s->h, data, len / 64);
+    data += len / 64 * 64;
+    len %= 64;
+  }
+
+  memcpy(s->block, data, len);
+  s->blockLen = len;
+}
+
+// both use same padding, 0x80, zeros, then 64 bits big endian message length in bits.
+static void hashFinal(HashState *s, unsigned char *out, int words) {
+  uint64_t bits = s->size * 8;
+
+  s->block[s->blockLen++] = 0x80;
+  if (s->blockLen > 56) {
+    memset(s->block + s->blockLen, 0, 64 - s->blockLen);
+    s->blocks(s->h, s->block, 1);
+    s->blockLen = 0;
+  }
+  memset(s->block + s->blockLen, 0, 56 - s->blockLen);
+  storeBE64(s->block + 56, bits);
+  s->blocks(s->h, s->block, 1);
+
+  for (int i = 0; i < words; i++) {
+    storeBE32(out + i * 4, s->h[i]);
+  }
+}
+
+static void sha1Init(HashState *s) {
+  static const uint32_t init[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+  memcpy(s->h, init, sizeof(init));
+  s->size = 0;
+  s->blockLen = 0;
+  s->blocks = sha1Blocks;
+}
+
+static void sha256Init(HashState *s) {
+  static const uint32_t init[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                   0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+  memcpy(s->h, init, sizeof(init));
+  s->size = 0;
+  s->blockLen = 0;
+  s->blocks = sha256Blocks;
+}
+
+static void sha1(const unsigned char *data, size_t len, unsigned char *out) {
+  HashState s;
+  sha1Init(&s);
+  hashUpdate(&s, data, len);
+  hashFinal(&s, out, 5);
+}
+
+static void sha256(const unsigned char *data, size_t len, unsigned char *out) {
+  HashState s;
+  sha256Init(&s);
+  hashUpdate(&s, data, len);
+  hashFinal(&s, out, 8);
+}
+
+// sha256 of two concatenated hashes, node of merkle tree.
+static void sha256Pair(const unsigned char *left, const unsigned char *right, unsigned char *out) {
+  unsigned char buf[sha256DigestSize * 2];
+  memcpy(buf, left, sha256DigestSize);
+  memcpy(buf + sha256DigestSize, right, sha256DigestSize);
+  sha256(buf, sizeof(buf), out);
+}
+
+// reduce count hashes in place to root of a tree with `levels` levels above them,
+// missing nodes are pad, which is root of an empty subtree at the same level.
+static void merkleRoot(unsigned char *hashes, size_t count, int levels, const unsigned char *pad,
+                       unsigned char *out) {
+  unsigned char p[sha256DigestSize];
+  memcpy(p, pad, sha256DigestSize);
+
+  for (int l = 0; l < levels; l++) {
+    size_t next = (count + 1) / 2;
+    for (size_t i = 0; i < next; i++) {
+      const unsigned char *left = hashes + 2 * i * sha256DigestSize;
+      const unsigned char *right = 2 * i + 1 < count ? left + sha256DigestSize : p;
+      sha256Pair(left, right, hashes + i * sha256DigestSize);
+    }
+    sha256Pair(p, p, p);
+    count = next;
+  }
+
+  memcpy(out, hashes, sha256DigestSize);
+}
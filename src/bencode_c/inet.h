@@ -0,0 +1,290 @@
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+
+#include "common.h"
+
+// compact peer info (BEP 5, BEP 32), 4 or 16 bytes address followed by 2 bytes port in network
+// byte order.
+
+#define compactPeerV4Size 6
+#define compactPeerV6Size 18
+// max length of text address, without null terminator.
+#define ipv6TextSize 45
+
+static inline int readPort(const unsigned char *b) { return (b[0] << 8) | b[1]; }
+
+static inline void writePort(unsigned char *b, int port) {
+  b[0] = (unsigned char)(port >> 8);
+  b[1] = (unsigned char)port;
+}
+
+// format 4 bytes address, out should have 16 bytes. return length.
+// called for every peer and node, so not using snprintf.
+static int formatIPv4(const unsigned char *b, char *out) {
+  int n = 0;
+  for (int i = 0; i < 4; i++) {
+    unsigned int v = b[i];
+    if (v >= 100) {
+      out[n++] = (char)('0' + v / 100);
+    }
+    if (v >= 10) {
+      out[n++] = (char)('0' + v / 10 % 10);
+    }
+    out[n++] = (char)('0' + v % 10);
+    out[n++] = '.';
+  }
+  out[--n] = 0;
+  return n;
+}
+
+// format 16 bytes address in RFC 5952 form, out should have 46 bytes. return length.
+static int formatIPv6(const unsigned char *b, char *out) {
+  unsigned int words[8];
+  for (int i = 0; i < 8; i++) {
+    words[i] = (b[i * 2] << 8) | b[i * 2 + 1];
+  }
+
+  // longest run of at least 2 zero words is replaced by "::", first one if there is a tie.
+  int bestStart = -1, bestLen = 1;
+  for (int i = 0; i < 8;) {
+    if (words[i] != 0) {
+      i++;
+      continue;
+    }
+    int j = i;
+    while (j < 8 && words[j] == 0) {
+      j++;
+    }
+    if (j - i > bestLen) {
+      bestStart = i;
+      bestLen = j - i;
+    }
+    i = j;
+  }
+
+  int n = 0;
+  for (int i = 0; i < 8; i++) {
+    if (i == bestStart) {
+      out[n++] = ':';
+      if (i == 0) {
+        out[n++] = ':';
+      }
+      i += bestLen - 1;
+      continue;
+    }
+    n += snprintf(out + n, ipv6TextSize + 1 - n, "%x", words[i]);
+    if (i != 7) {
+      out[n++] = ':';
+    }
+  }
+  out[n] = 0;
+
+  return n;
+}
+
+// parse dotted decimal address. return 0 on success.
+static int parseIPv4(const char *s, Py_ssize_t len, unsigned char *out) {
+  Py_ssize_t i = 0;
+  for (int part = 0; part < 4; part++) {
+    if (part != 0) {
+      if (i >= len || s[i] != '.') {
+        return 1;
+      }
+      i++;
+    }
+
+    Py_ssize_t start = i;
+    unsigned int value = 0;
+    while (i < len && s[i] >= '0' && s[i] <= '9' && i - start < 3) {
+      value = value * 10 + (s[i] - '0');
+      i++;
+    }
+    // no leading zeros, same as python ipaddress.
+    if (i == start || value > 255 || (s[start] == '0' && i - start > 1)) {
+      return 1;
+    }
+    out[part] = (unsigned char)value;
+  }
+
+  return i != len;
+}
+
+static int hexValue(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+// parse text form of ipv6 address, with optional "::" and ipv4 suffix. return 0 on success.
+static int parseIPv6(const char *s, Py_ssize_t len, unsigned char *out) {
+  unsigned char words[16];
+  int count = 0;
+  int gap = -1;
+  Py_ssize_t i = 0;
+
+  if (len >= 2 && s[0] == ':' && s[1] == ':') {
+    gap = 0;
+    i = 2;
+  } else if (len >= 1 && s[0] == ':') {
+    return 1;
+  }
+
+  while (i < len) {
+    if (count == 16) {
+      return 1;
+    }
+
+    Py_ssize_t start = i;
+    unsigned int value = 0;
+    while (i < len && hexValue(s[i]) >= 0 && i - start < 4) {
+      value = (value << 4) | hexValue(s[i]);
+      i++;
+    }
+
+    if (i < len && s[i] == '.') {
+      // ipv4 suffix take last 4 bytes.
+      if (count > 12 || parseIPv4(s + start, len - start, words + count)) {
+        return 1;
+      }
+      count += 4;
+      i = len;
+      break;
+    }
+
+    if (i == start) {
+      return 1;
+    }
+    words[count++] = (unsigned char)(value >> 8);
+    words[count++] = (unsigned char)value;
+
+    if (i == len) {
+      break;
+    }
+    if (s[i] != ':') {
+      return 1;
+    }
+    i++;
+    if (i < len && s[i] == ':') {
+      if (gap >= 0) {
+        return 1;
+      }
+      gap = count;
+      i++;
+    } else if (i == len) {
+      // trailing single ':'
+      return 1;
+    }
+  }
+
+  if (gap < 0) {
+    if (count != 16) {
+      return 1;
+    }
+    memcpy(out, words, 16);
+    return 0;
+  }
+
+  // "::" should stand for at least one zero word.
+  if (count > 14) {
+    return 1;
+  }
+  memset(out, 0, 16);
+  memcpy(out, words, gap);
+  memcpy(out + 16 - (count - gap), words + gap, count - gap);
+  return 0;
+}
+
+// set (ip: str, port: int) of compact peer info to tuple t at offset.
+static int compactPeerToTupleItems(const unsigned char *b, int v6, HPy t, Py_ssize_t offset) {
+  char text[ipv6TextSize + 1];
+  int n = v6 ? formatIPv6(b, text) : formatIPv4(b, text);
+
+  HPy ip = PyUnicode_FromStringAndSize(text, n);
+  if (ip == NULL) {
+    return 1;
+  }
+  PyTuple_SetItem(t, offset, ip);
+
+  HPy port = PyLong_FromLong(readPort(b + (v6 ? 16 : 4)));
+  if (port == NULL) {
+    return 1;
+  }
+  PyTuple_SetItem(t, offset + 1, port);
+  return 0;
+}
+
+// (ip: str, port: int) from compact peer info.
+static HPy compactPeerToTuple(const unsigned char *b, int v6) {
+  HPy t = PyTuple_New(2);
+  if (t == NULL) {
+    return NULL;
+  }
+
+  if (compactPeerToTupleItems(b, v6, t, 0)) {
+    Py_DecRef(t);
+    return NULL;
+  }
+  return t;
+}
+
+// write compact form of ip (str) and port (int) to out, which should have 18 bytes.
+// return size written, or 0 with python exception set.
+static int compactPeerFromObjects(HPy ip, HPy port, unsigned char *out) {
+  if (!PyUnicode_Check(ip)) {
+    PyErr_Format(PyExc_TypeError, "ip must be str, got %R", ip);
+    return 0;
+  }
+
+  long p = PyLong_AsLong(port);
+  if (p == -1 && PyErr_Occurred()) {
+    return 0;
+  }
+  if (p < 0 || p > 65535) {
+    PyErr_Format(PyExc_ValueError, "port %ld out of range", p);
+    return 0;
+  }
+
+#if PY_MINOR_VERSION >= 10
+  // utf-8 of ascii str is its own data, no allocation.
+  Py_ssize_t len;
+  const char *s = PyUnicode_AsUTF8AndSize(ip, &len);
+  if (s == NULL) {
+    return 0;
+  }
+#else
+  HPy b = PyUnicode_AsUTF8String(ip);
+  if (b == NULL) {
+    return 0;
+  }
+  const char *s = PyBytes_AsString(b);
+  Py_ssize_t len = PyBytes_Size(b);
+#endif
+
+  int size = 0;
+  if (memchr(s, ':', len) != NULL) {
+    if (!parseIPv6(s, len, out)) {
+      writePort(out + 16, (int)p);
+      size = compactPeerV6Size;
+    }
+  } else if (!parseIPv4(s, len, out)) {
+    writePort(out + 4, (int)p);
+    size = compactPeerV4Size;
+  }
+#if PY_MINOR_VERSION < 10
+  Py_DecRef(b);
+#endif
+
+  if (size == 0) {
+    PyErr_Format(PyExc_ValueError, "invalid ip address %R", ip);
+  }
+  return size;
+}
@@ -0,0 +1,908 @@
+// DHT KRPC messages (BEP 5), decoded to a struct sequence instead of generic dict.
+
+#include "common.h"
+#include "decode.h"
+#include "inet.h"
+#include "stats.h"
+
+#ifdef __GNUC__
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-function"
+#pragma GCC diagnostic ignored "-Wunused-variable"
+#endif
+
+#include "ctx.h"
+
+#ifdef __GNUC__
+#pragma GCC diagnostic pop
+#endif
+
+extern HPy BencodeDecodeError;
+extern HPy BencodeEncodeError;
+
+static HPy decode_krpc(HPy self, HPy b);
+static HPy encode_krpc(HPy self, HPy args, HPy kwargs);
+
+#define nodeIdSize 20
+#define compactNodeV4Size 26
+#define compactNodeV6Size 38
+
+enum krpcField {
+  fieldT,
+  fieldY,
+  fieldQ,
+  fieldId,
+  fieldTarget,
+  fieldInfoHash,
+  fieldToken,
+  fieldPort,
+  fieldImpliedPort,
+  fieldNodes,
+  fieldNodes6,
+  fieldValues,
+  fieldError,
+  fieldV,
+  krpcFieldCount,
+};
+
+static PyStructSequence_Field krpcFields[] = {
+    {"t", "transaction id"},
+    {"y", "message type, b'q', b'r' or b'e'"},
+    {"q", "query method name"},
+    {"id", "node id of sender, in 'a' of query or 'r' of response"},
+    {"target", "node id to find, find_node query"},
+    {"info_hash", "get_peers and announce_peer query"},
+    {"token", "get_peers response and announce_peer query"},
+    {"port", "announce_peer query"},
+    {"implied_port", "announce_peer query"},
+    {"nodes", "list of (node_id, ip, port) from compact node info"},
+    {"nodes6", "list of (node_id, ip, port) from ipv6 compact node info, BEP 32"},
+    {"values", "list of (ip, port) from compact peer info"},
+    {"error", "(code, message) of error message"},
+    {"v", "client version"},
+    {NULL, NULL},
+};
+
+static PyStructSequence_Desc krpcMessageDesc = {
+    .name = "bencode_c.KrpcMessage",
+    .doc = "DHT KRPC message, fields not in message are None.",
+    .fields = krpcFields,
+    .n_in_sequence = krpcFieldCount,
+};
+
+// set by module init.
+HPy KrpcMessageType;
+
+PyDoc_STRVAR(__decode_krpc_doc__,
+             "decode_krpc(b, /) -> KrpcMessage\n"
+             "--\n\n"
+             "decode a DHT KRPC message.\n\n"
+             "message shape is validated, 't' and 'y' are required, query need 'q' and 'a', "
+             "response need 'r' and error need 'e'. "
+             "node ids and info hash must be 20 bytes. "
+             "compact nodes and peers are split to tuples. unknown keys are validated and "
+             "ignored.");
+PyDoc_STRVAR(__encode_krpc_doc__,
+             "encode_krpc(msg: KrpcMessage | None = None, /, **fields) -> bytes\n"
+             "--\n\n"
+             "encode a DHT KRPC message, fields are same as KrpcMessage and override msg.\n\n"
+             "id, target, info_hash, token, port and implied_port are put in 'a' for query, "
+             "id, nodes, nodes6, token and values in 'r' for response. "
+             "BencodeEncodeError is raised for fields not of message type y.");
+PyMethodDef krpcImpl[] = {{
+                              .ml_name = "decode_krpc",
+                              .ml_meth = (PyCFunction)(void (*)(void))decode_krpc,
+                              .ml_flags = METH_O,
+                              .ml_doc = __decode_krpc_doc__,
+                          },
+                          {
+                              .ml_name = "encode_krpc",
+                              .ml_meth = (PyCFunction)(void (*)(void))encode_krpc,
+                              .ml_flags = METH_VARARGS | METH_KEYWORDS,
+                              .ml_doc = __encode_krpc_doc__,
+                          },
+                          {NULL, NULL, 0, NULL}};
+
+// strings that appear in almost every message, shared instead of allocated per message.
+static const char *const commonStrings[] = {
+    "q",        "r", "e", "ping", "find_node", "get_peers", "announce_peer", "get", "put",
+    "sample_infohashes",
+};
+#define commonStringCount (sizeof(commonStrings) / sizeof(commonStrings[0]))
+static HPy commonBytes[commonStringCount];
+
+int krpcInit(HPy m) {
+  KrpcMessageType = (HPy)PyStructSequence_NewType(&krpcMessageDesc);
+  if (KrpcMessageType == NULL) {
+    return 1;
+  }
+
+  Py_INCREF(KrpcMessageType);
+  if (PyModule_AddObject(m, "KrpcMessage", KrpcMessageType) < 0) {
+    Py_DecRef(KrpcMessageType);
+    return 1;
+  }
+
+  for (size_t i = 0; i < commonStringCount; i++) {
+    commonBytes[i] = PyBytes_FromString(commonStrings[i]);
+    if (commonBytes[i] == NULL) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+#define krpcError(format, ...)                                                                     \
+  PyErr_Format(BencodeDecodeError, "invalid krpc message, " format, ##__VA_ARGS__)
+
+static HPy bytesOrCommon(const char *s, Py_ssize_t len) {
+  for (size_t i = 0; i < commonStringCount; i++) {
+    if (strlen(commonStrings[i]) == (size_t)len && memcmp(commonStrings[i], s, len) == 0) {
+      Py_INCREF(commonBytes[i]);
+      return commonBytes[i];
+    }
+  }
+
+  return PyBytes_FromStringAndSize(s, len);
+}
+
+static void setField(HPy *fields, int i, HPy value) {
+  Py_XDECREF(fields[i]);
+  fields[i] = value;
+}
+
+// string value at index, checked against expected size if not 0.
+static HPy readString(const char *buf, Py_ssize_t *index, Py_ssize_t size, const char *key,
+                      Py_ssize_t expected) {
+  if (*index >= size || buf[*index] < '0' || buf[*index] > '9') {
+    krpcError("'%s' must be a string", key);
+    return NULL;
+  }
+
+  Py_ssize_t start, len;
+  if (decodeBytesSpan(buf, index, size, &start, &len, 0)) {
+    return NULL;
+  }
+
+  if (expected && len != expected) {
+    krpcError("'%s' must be %zd bytes, got %zd", key, expected, len);
+    return NULL;
+  }
+
+  return bytesOrCommon(&buf[start], len);
+}
+
+static HPy readInt(const char *buf, Py_ssize_t *index, Py_ssize_t size, const char *key) {
+  if (*index >= size || buf[*index] != 'i') {
+    krpcError("'%s' must be an int", key);
+    return NULL;
+  }
+
+  return decodeInt(buf, index, size, 0);
+}
+
+// list of (node_id, ip, port) from concatenated compact node info.
+static HPy readNodes(const char *buf, Py_ssize_t *index, Py_ssize_t size, const char *key,
+                     int v6) {
+  if (*index >= size || buf[*index] < '0' || buf[*index] > '9') {
+    krpcError("'%s' must be a string", key);
+    return NULL;
+  }
+
+  Py_ssize_t start, len;
+  if (decodeBytesSpan(buf, index, size, &start, &len, 0)) {
+    return NULL;
+  }
+
+  Py_ssize_t nodeSize = v6 ? compactNodeV6Size : compactNodeV4Size;
+  if (len % nodeSize != 0) {
+    krpcError("length of '%s' must be multiple of %zd, got %zd", key, nodeSize, len);
+    return NULL;
+  }
+
+  HPy nodes = PyList_New(len / nodeSize);
+  if (nodes == NULL) {
+    return NULL;
+  }
+
+  const unsigned char *p = (const unsigned char *)&buf[start];
+  for (Py_ssize_t i = 0; i < len / nodeSize; i++, p += nodeSize) {
+    HPy node = PyTuple_New(3);
+    if (node == NULL) {
+      Py_DecRef(nodes);
+      return NULL;
+    }
+    PyList_SetItem(nodes, i, node);
+
+    HPy id = PyBytes_FromStringAndSize((const char *)p, nodeIdSize);
+    if (id == NULL) {
+      Py_DecRef(nodes);
+      return NULL;
+    }
+    PyTuple_SetItem(node, 0, id);
+
+    if (compactPeerToTupleItems(p + nodeIdSize, v6, node, 1)) {
+      Py_DecRef(nodes);
+      return NULL;
+    }
+  }
+
+  return nodes;
+}
+
+// list of (ip, port) from list of compact peer info, ipv4 or ipv6.
+static HPy readValues(const char *buf, Py_ssize_t *index, Py_ssize_t size) {
+  if (*index >= size || buf[*index] != 'l') {
+    krpcError("'values' must be a list");
+    return NULL;
+  }
+  *index = *index + 1;
+
+  HPy values = PyList_New(0);
+  if (values == NULL) {
+    return NULL;
+  }
+
+  while (1) {
+    if (*index >= size) {
+      krpcError("bytes end when decoding 'values'");
+      goto __Error;
+    }
+
+    if (buf[*index] == 'e') {
+      break;
+    }
+
+    if (buf[*index] < '0' || buf[*index] > '9') {
+      krpcError("item of 'values' must be a string, index %zd", *index);
+      goto __Error;
+    }
+
+    Py_ssize_t start, len;
+    if (decodeBytesSpan(buf, index, size, &start, &len, 0)) {
+      goto __Error;
+    }
+
+    if (len != compactPeerV4Size && len != compactPeerV6Size) {
+      krpcError("item of 'values' must be 6 or 18 bytes, got %zd", len);
+      goto __Error;
+    }
+
+    HPy peer = compactPeerToTuple((const unsigned char *)&buf[start], len == compactPeerV6Size);
+    if (peer == NULL) {
+      goto __Error;
+    }
+
+    int err = PyList_Append(values, peer);
+    Py_DecRef(peer);
+    if (err) {
+      goto __Error;
+    }
+  }
+
+  *index = *index + 1;
+  return values;
+
+__Error:
+  Py_DecRef(values);
+  return NULL;
+}
+
+static HPy readError(const char *buf, Py_ssize_t *index, Py_ssize_t size) {
+  if (*index >= size || buf[*index] != 'l') {
+    krpcError("'e' must be a list");
+    return NULL;
+  }
+  *index = *index + 1;
+
+  HPy code = readInt(buf, index, size, "e[0]");
+  if (code == NULL) {
+    return NULL;
+  }
+
+  HPy message = readString(buf, index, size, "e[1]", 0);
+  if (message == NULL) {
+    Py_DecRef(code);
+    return NULL;
+  }
+
+  if (*index >= size || buf[*index] != 'e') {
+    Py_DecRef(code);
+    Py_DecRef(message);
+    krpcError("'e' must be a list of 2 items");
+    return NULL;
+  }
+  *index = *index + 1;
+
+  return Py_BuildValue("(NN)", code, message);
+}
+
+#define keyIs(s) (keyLen == sizeof(s) - 1 && memcmp(key, s, sizeof(s) - 1) == 0)
+
+// fields in 'a' of query or 'r' of response.
+static int readBody(const char *buf, Py_ssize_t *index, Py_ssize_t size, HPy *fields,
+                    const char *name) {
+  if (*index >= size || buf[*index] != 'd') {
+    krpcError("'%s' must be a dict", name);
+    return 1;
+  }
+  *index = *index + 1;
+
+  const char *lastKey = NULL;
+  Py_ssize_t lastKeyLen = 0;
+  while (1) {
+    if (*index >= size) {
+      krpcError("bytes end when decoding '%s'", name);
+      return 1;
+    }
+
+    if (buf[*index] == 'e') {
+      break;
+    }
+
+    Py_ssize_t keyStart, keyLen;
+    if (decodeBytesSpan(buf, index, size, &keyStart, &keyLen, 0)) {
+      return 1;
+    }
+    const char *key = &buf[keyStart];
+    if (checkKeyOrder(lastKey, lastKeyLen, key, keyLen, *index)) {
+      return 1;
+    }
+    lastKey = key;
+    lastKeyLen = keyLen;
+
+    int field = -1;
+    HPy value = NULL;
+    if (keyIs("id")) {
+      field = fieldId;
+      value = readString(buf, index, size, "id", nodeIdSize);
+    } else if (keyIs("target")) {
+      field = fieldTarget;
+      value = readString(buf, index, size, "target", nodeIdSize);
+    } else if (keyIs("info_hash")) {
+      field = fieldInfoHash;
+      value = readString(buf, index, size, "info_hash", nodeIdSize);
+    } else if (keyIs("token")) {
+      field = fieldToken;
+      value = readString(buf, index, size, "token", 0);
+    } else if (keyIs("port")) {
+      field = fieldPort;
+      value = readInt(buf, index, size, "port");
+    } else if (keyIs("implied_port")) {
+      field = fieldImpliedPort;
+      value = readInt(buf, index, size, "implied_port");
+    } else if (keyIs("nodes")) {
+      field = fieldNodes;
+      value = readNodes(buf, index, size, "nodes", 0);
+    } else if (keyIs("nodes6")) {
+      field = fieldNodes6;
+      value = readNodes(buf, index, size, "nodes6", 1);
+    } else if (keyIs("values")) {
+      field = fieldValues;
+      value = readValues(buf, index, size);
+    } else if (skipAny(buf, index, size, 2)) {
+      return 1;
+    } else {
+      continue;
+    }
+
+    if (value == NULL) {
+      return 1;
+    }
+    setField(fields, field, value);
+  }
+
+  *index = *index + 1;
+  return 0;
+}
+
+static int readMessage(const char *buf, Py_ssize_t size, HPy *fields) {
+  if (size == 0 || buf[0] != 'd') {
+    krpcError("message must be a dict");
+    return 1;
+  }
+
+  Py_ssize_t index = 1;
+  const char *lastKey = NULL;
+  Py_ssize_t lastKeyLen = 0;
+  int hasBody = 0;
+  while (1) {
+    if (index >= size) {
+      krpcError("bytes end when decoding dict");
+      return 1;
+    }
+
+    if (buf[index] == 'e') {
+      break;
+    }
+
+    Py_ssize_t keyStart, keyLen;
+    if (decodeBytesSpan(buf, &index, size, &keyStart, &keyLen, 0)) {
+      return 1;
+    }
+    const char *key = &buf[keyStart];
+    if (checkKeyOrder(lastKey, lastKeyLen, key, keyLen, index)) {
+      return 1;
+    }
+    lastKey = key;
+    lastKeyLen = keyLen;
+
+    int field = -1;
+    HPy value = NULL;
+    if (keyIs("t")) {
+      field = fieldT;
+      value = readString(buf, &index, size, "t", 0);
+    } else if (keyIs("y")) {
+      field = fieldY;
+      value = readString(buf, &index, size, "y", 1);
+    } else if (keyIs("q")) {
+      field = fieldQ;
+      value = readString(buf, &index, size, "q", 0);
+    } else if (keyIs("v")) {
+      field = fieldV;
+      value = readString(buf, &index, size, "v", 0);
+    } else if (keyIs("e")) {
+      field = fieldError;
+      value = readError(buf, &index, size);
+    } else if (keyIs("a") || keyIs("r")) {
+      if (readBody(buf, &index, size, fields, keyIs("a") ? "a" : "r")) {
+        return 1;
+      }
+      hasBody |= keyIs("a") ? 1 : 2;
+      continue;
+    } else if (skipAny(buf, &index, size, 1)) {
+      return 1;
+    } else {
+      continue;
+    }
+
+    if (value == NULL) {
+      return 1;
+    }
+    setField(fields, field, value);
+  }
+
+  if (index + 1 != size) {
+    krpcError("parse end at index %zd but total bytes length %zd", index + 1, size);
+    return 1;
+  }
+
+  if (fields[fieldT] == NULL || fields[fieldY] == NULL) {
+    krpcError("missing 't' or 'y'");
+    return 1;
+  }
+
+  switch (PyBytes_AsString(fields[fieldY])[0]) {
+  case 'q':
+    if (fields[fieldQ] == NULL || !(hasBody & 1)) {
+      krpcError("query must have 'q' and 'a'");
+      return 1;
+    }
+    break;
+  case 'r':
+    if (!(hasBody & 2)) {
+      krpcError("response must have 'r'");
+      return 1;
+    }
+    break;
+  case 'e':
+    if (fields[fieldError] == NULL) {
+      krpcError("error must have 'e'");
+      return 1;
+    }
+    return 0;
+  default:
+    krpcError("unknown message type %R", fields[fieldY]);
+    return 1;
+  }
+
+  if (fields[fieldId] == NULL) {
+    krpcError("missing node id");
+    return 1;
+  }
+
+  return 0;
+}
+
+static HPy decode_krpc(HPy self, HPy b) {
+#if PY_MINOR_VERSION >= 11
+  Py_buffer view;
+  if (PyObject_GetBuffer(b, &view, PyBUF_SIMPLE)) {
+    return NULL;
+  }
+  const char *buf = view.buf;
+  Py_ssize_t size = view.len;
+#else
+  // buffer protocol is not in limited api before 3.11.
+  if (!PyBytes_Check(b)) {
+    PyErr_SetString(PyExc_TypeError, "can only decode bytes");
+    return NULL;
+  }
+  const char *buf = PyBytes_AsString(b);
+  Py_ssize_t size = PyBytes_Size(b);
+#endif
+
+  statsInc(decode_calls);
+  statsAdd(decode_bytes, size);
+  probe1(decode__entry, size);
+
+  HPy fields[krpcFieldCount] = {NULL};
+  HPy res = NULL;
+  if (readMessage(buf, size, fields)) {
+    goto __CLEAN_UP;
+  }
+
+  res = PyStructSequence_New((PyTypeObject *)KrpcMessageType);
+  if (res == NULL) {
+    goto __CLEAN_UP;
+  }
+
+  for (int i = 0; i < krpcFieldCount; i++) {
+    if (fields[i] == NULL) {
+      Py_INCREF(Py_None);
+      fields[i] = Py_None;
+    }
+    // steal reference
+    PyStructSequence_SetItem(res, i, fields[i]);
+    fields[i] = NULL;
+  }
+
+__CLEAN_UP:
+  for (int i = 0; i < krpcFieldCount; i++) {
+    Py_XDECREF(fields[i]);
+  }
+
+  if (res == NULL) {
+    statsInc(decode_errors);
+  }
+  probe2(decode__return, size, res != NULL);
+
+#if PY_MINOR_VERSION >= 11
+  PyBuffer_Release(&view);
+#endif
+  return res;
+}
+
+// encoder
+
+static int writeString(Context *ctx, const char *key, HPy value, Py_ssize_t expected) {
+  HPy b;
+  if (PyBytes_Check(value)) {
+    b = value;
+    Py_INCREF(b);
+  } else if (PyUnicode_Check(value)) {
+    b = PyUnicode_AsUTF8String(value);
+    if (b == NULL) {
+      return 1;
+    }
+  } else {
+    PyErr_Format(PyExc_TypeError, "'%s' must be bytes or str, got %R", key, value);
+    return 1;
+  }
+
+  Py_ssize_t len = PyBytes_Size(b);
+  if (expected && len != expected) {
+    Py_DecRef(b);
+    PyErr_Format(BencodeEncodeError, "'%s' must be %zd bytes, got %zd", key, expected, len);
+    return 1;
+  }
+
+  int err = bufferWriteFormat(ctx, "%zd:", len) || bufferWrite(ctx, PyBytes_AsString(b), len);
+  Py_DecRef(b);
+  return err;
+}
+
+static int writeInt(Context *ctx, const char *key, HPy value) {
+  if (!PyLong_Check(value)) {
+    PyErr_Format(PyExc_TypeError, "'%s' must be int, got %R", key, value);
+    return 1;
+  }
+
+  long long v = PyLong_AsLongLong(value);
+  if (v == -1 && PyErr_Occurred()) {
+    return 1;
+  }
+
+  return bufferWriteFormat(ctx, "i%llde", v);
+}
+
+// write a list of (node_id, ip, port) as concatenated compact node info.
+static int writeNodes(Context *ctx, const char *key, HPy nodes, int v6) {
+  HPy seq = PySequence_Fast(nodes, "nodes must be a sequence");
+  if (seq == NULL) {
+    return 1;
+  }
+
+  Py_ssize_t count = PySequence_Size(seq);
+  Py_ssize_t nodeSize = v6 ? compactNodeV6Size : compactNodeV4Size;
+  if (bufferWriteFormat(ctx, "%zd:", count * nodeSize) || bufferGrow(ctx, count * nodeSize)) {
+    Py_DecRef(seq);
+    return 1;
+  }
+
+  for (Py_ssize_t i = 0; i < count; i++) {
+    HPy node = PySequence_GetItem(seq, i);
+    if (node == NULL) {
+      Py_DecRef(seq);
+      return 1;
+    }
+
+    HPy id;
+    HPy ip;
+    HPy port;
+    if (!PyArg_ParseTuple(node, "OOO;node must be (node_id, ip, port)", &id, &ip, &port)) {
+      Py_DecRef(node);
+      Py_DecRef(seq);
+      return 1;
+    }
+
+    unsigned char out[compactNodeV6Size];
+    int peerSize = 0;
+    if (!PyBytes_Check(id) || PyBytes_Size(id) != nodeIdSize) {
+      PyErr_Format(BencodeEncodeError, "node id in '%s' must be 20 bytes, got %R", key, id);
+    } else {
+      memcpy(out, PyBytes_AsString(id), nodeIdSize);
+      peerSize = compactPeerFromObjects(ip, port, out + nodeIdSize);
+    }
+    Py_DecRef(node);
+
+    if (peerSize == 0) {
+      Py_DecRef(seq);
+      return 1;
+    }
+
+    if (peerSize + nodeIdSize != nodeSize) {
+      Py_DecRef(seq);
+      PyErr_Format(BencodeEncodeError, "'%s' must only contain %s address", key,
+                   v6 ? "ipv6" : "ipv4");
+      return 1;
+    }
+    memcpy(ctx->out.buf + ctx->out.len, out, nodeSize);
+    ctx->out.len += nodeSize;
+  }
+
+  Py_DecRef(seq);
+  return 0;
+}
+
+// write a list of (ip, port) as list of compact peer info.
+static int writeValues(Context *ctx, HPy values) {
+  HPy seq = PySequence_Fast(values, "values must be a sequence");
+  if (seq == NULL) {
+    return 1;
+  }
+
+  if (bufferWriteChar(ctx, 'l')) {
+    Py_DecRef(seq);
+    return 1;
+  }
+
+  Py_ssize_t count = PySequence_Size(seq);
+  for (Py_ssize_t i = 0; i < count; i++) {
+    HPy peer = PySequence_GetItem(seq, i);
+    if (peer == NULL) {
+      Py_DecRef(seq);
+      return 1;
+    }
+
+    HPy ip;
+    HPy port;
+    unsigned char out[compactPeerV6Size];
+    int size = 0;
+    if (PyArg_ParseTuple(peer, "OO;peer must be (ip, port)", &ip, &port)) {
+      size = compactPeerFromObjects(ip, port, out);
+    }
+    Py_DecRef(peer);
+
+    if (size == 0 || bufferWriteFormat(ctx, "%d:", size) ||
+        bufferWrite(ctx, (const char *)out, size)) {
+      Py_DecRef(seq);
+      return 1;
+    }
+  }
+
+  Py_DecRef(seq);
+  return bufferWriteChar(ctx, 'e');
+}
+
+static int writeErrorList(Context *ctx, HPy error) {
+  HPy code;
+  HPy message;
+  if (!PyArg_ParseTuple(error, "OO;error must be (code, message)", &code, &message)) {
+    return 1;
+  }
+
+  return bufferWriteChar(ctx, 'l') || writeInt(ctx, "error code", code) ||
+         writeString(ctx, "error message", message, 0) || bufferWriteChar(ctx, 'e');
+}
+
+#define has(field) (fields[field] != Py_None)
+
+#define fieldBit(field) (1u << (field))
+#define commonFields (fieldBit(fieldT) | fieldBit(fieldY) | fieldBit(fieldV))
+
+// fields written for each message type, others are rejected instead of silently dropped.
+static const unsigned int queryFields = commonFields | fieldBit(fieldQ) | fieldBit(fieldId) |
+                                        fieldBit(fieldTarget) | fieldBit(fieldInfoHash) |
+                                        fieldBit(fieldToken) | fieldBit(fieldPort) |
+                                        fieldBit(fieldImpliedPort);
+static const unsigned int responseFields = commonFields | fieldBit(fieldId) | fieldBit(fieldNodes) |
+                                           fieldBit(fieldNodes6) | fieldBit(fieldToken) |
+                                           fieldBit(fieldValues);
+static const unsigned int errorFields = commonFields | fieldBit(fieldError);
+
+#define writeKey(s) bufferWrite(ctx, s, sizeof(s) - 1)
+
+// keys are written in sorted order.
+static int writeMessage(Context *ctx, HPy *fields) {
+  if (!has(fieldT) || !has(fieldY)) {
+    PyErr_SetString(BencodeEncodeError, "'t' and 'y' are required");
+    return 1;
+  }
+
+  HPy y = fields[fieldY];
+  char type = 0;
+  if (PyBytes_Check(y) && PyBytes_Size(y) == 1) {
+    type = PyBytes_AsString(y)[0];
+  } else if (PyUnicode_Check(y) && PyUnicode_GetLength(y) == 1) {
+    // compare as Py_UCS4 so non-ascii chars can't truncate to a valid type.
+    Py_UCS4 c = PyUnicode_ReadChar(y, 0);
+    if (c == 'q' || c == 'r' || c == 'e') {
+      type = (char)c;
+    }
+  }
+  if (type != 'q' && type != 'r' && type != 'e') {
+    PyErr_Format(BencodeEncodeError, "'y' must be 'q', 'r' or 'e', got %R", y);
+    return 1;
+  }
+
+  unsigned int allowed = type == 'q' ? queryFields : type == 'r' ? responseFields : errorFields;
+  for (int i = 0; i < krpcFieldCount; i++) {
+    if (has(i) && !(allowed & fieldBit(i))) {
+      PyErr_Format(BencodeEncodeError, "'%s' is not a field of '%c' message", krpcFields[i].name,
+                   type);
+      return 1;
+    }
+  }
+
+  if (type == 'q' && !has(fieldQ)) {
+    PyErr_SetString(BencodeEncodeError, "query must have 'q'");
+    return 1;
+  }
+  if (type == 'e' && !has(fieldError)) {
+    PyErr_SetString(BencodeEncodeError, "error must have 'error'");
+    return 1;
+  }
+  if (type != 'e' && !has(fieldId)) {
+    PyErr_SetString(BencodeEncodeError, "query and response must have 'id'");
+    return 1;
+  }
+
+  returnIfError(bufferWriteChar(ctx, 'd'));
+
+  if (type == 'q') {
+    returnIfError(writeKey("1:ad"));
+    returnIfError(writeKey("2:id") || writeString(ctx, "id", fields[fieldId], nodeIdSize));
+    if (has(fieldImpliedPort)) {
+      returnIfError(writeKey("12:implied_port") ||
+                    writeInt(ctx, "implied_port", fields[fieldImpliedPort]));
+    }
+    if (has(fieldInfoHash)) {
+      returnIfError(writeKey("9:info_hash") ||
+                    writeString(ctx, "info_hash", fields[fieldInfoHash], nodeIdSize));
+    }
+    if (has(fieldPort)) {
+      returnIfError(writeKey("4:port") || writeInt(ctx, "port", fields[fieldPort]));
+    }
+    if (has(fieldTarget)) {
+      returnIfError(writeKey("6:target") ||
+                    writeString(ctx, "target", fields[fieldTarget], nodeIdSize));
+    }
+    if (has(fieldToken)) {
+      returnIfError(writeKey("5:token") || writeString(ctx, "token", fields[fieldToken], 0));
+    }
+    returnIfError(bufferWriteChar(ctx, 'e'));
+  }
+
+  if (type == 'e') {
+    returnIfError(writeKey("1:e") || writeErrorList(ctx, fields[fieldError]));
+  }
+
+  if (type == 'q') {
+    returnIfError(writeKey("1:q") || writeString(ctx, "q", fields[fieldQ], 0));
+  }
+
+  if (type == 'r') {
+    returnIfError(writeKey("1:rd"));
+    returnIfError(writeKey("2:id") || writeString(ctx, "id", fields[fieldId], nodeIdSize));
+    if (has(fieldNodes)) {
+      returnIfError(writeKey("5:nodes") || writeNodes(ctx, "nodes", fields[fieldNodes], 0));
+    }
+    if (has(fieldNodes6)) {
+      returnIfError(writeKey("6:nodes6") || writeNodes(ctx, "nodes6", fields[fieldNodes6], 1));
+    }
+    if (has(fieldToken)) {
+      returnIfError(writeKey("5:token") || writeString(ctx, "token", fields[fieldToken], 0));
+    }
+    if (has(fieldValues)) {
+      returnIfError(writeKey("6:values") || writeValues(ctx, fields[fieldValues]));
+    }
+    returnIfError(bufferWriteChar(ctx, 'e'));
+  }
+
+  returnIfError(writeKey("1:t") || writeString(ctx, "t", fields[fieldT], 0));
+  if (has(fieldV)) {
+    returnIfError(writeKey("1:v") || writeString(ctx, "v", fields[fieldV], 0));
+  }
+  returnIfError(writeKey("1:y1:") || bufferWriteChar(ctx, type));
+
+  return bufferWriteChar(ctx, 'e');
+}
+
+static HPy encode_krpc(HPy self, HPy args, HPy kwargs) {
+  HPy msg = Py_None;
+  if (!PyArg_ParseTuple(args, "|O:encode_krpc", &msg)) {
+    return NULL;
+  }
+
+  // borrowed
+  HPy fields[krpcFieldCount];
+  for (int i = 0; i < krpcFieldCount; i++) {
+    fields[i] = Py_None;
+  }
+
+  if (msg != Py_None) {
+    if (!PyObject_TypeCheck(msg, (PyTypeObject *)KrpcMessageType)) {
+      PyErr_Format(PyExc_TypeError, "msg must be KrpcMessage, got %R", msg);
+      return NULL;
+    }
+    for (int i = 0; i < krpcFieldCount; i++) {
+      fields[i] = PyStructSequence_GetItem(msg, i);
+    }
+  }
+
+  if (kwargs != NULL) {
+    Py_ssize_t pos = 0;
+    HPy key;
+    HPy value;
+    while (PyDict_Next(kwargs, &pos, &key, &value)) {
+      int found = 0;
+      for (int i = 0; i < krpcFieldCount; i++) {
+        if (PyUnicode_CompareWithASCIIString(key, krpcFields[i].name) == 0) {
+          fields[i] = value;
+          found = 1;
+          break;
+        }
+      }
+      if (!found) {
+        PyErr_Format(PyExc_TypeError, "encode_krpc() got an unexpected keyword argument %R", key);
+        return NULL;
+      }
+    }
+  }
+
+  int bufferAlloc = 0;
+  Context ctx = newContext(&bufferAlloc, minBufferSize);
+  if (bufferAlloc) {
+    return NULL;
+  }
+
+  statsInc(encode_calls);
+  probe0(encode__entry);
+
+  HPy res = NULL;
+  if (!writeMessage(&ctx, fields)) {
+    res = PyBytes_FromStringAndSize(ctx.out.buf, ctx.out.len);
+  }
+
+  if (res != NULL) {
+    statsAdd(encode_bytes, ctx.out.len);
+  } else {
+    statsInc(encode_errors);
+  }
+  probe2(encode__return, ctx.out.len, res != NULL);
+
+  freeContext(ctx);
+  return res;
+}
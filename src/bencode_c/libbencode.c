@@ -0,0 +1,356 @@
+// python independent part of bencode-c, see libbencode.h.
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libbencode.h"
+
+#ifdef __GNUC__
+static int setError(BencodeError *err, size_t index, const char *format, ...)
+    __attribute__((format(printf, 3, 4)));
+#endif
+
+static int setError(BencodeError *err, size_t index, const char *format, ...) {
+  if (err != NULL) {
+    va_list args;
+    va_start(args, format);
+    vsnprintf(err->message, sizeof(err->message), format, args);
+    va_end(args);
+    err->index = index;
+  }
+  return 1;
+}
+
+int bencodeParseInt(const char *buf, size_t size, size_t *index, int lenient, BencodeInt *out,
+                    BencodeError *err) {
+  const char *e = memchr(buf + *index + 1, 'e', size - *index - 1);
+  if (e == NULL) {
+    return setError(err, *index, "invalid int, missing 'e': %zu", *index);
+  }
+  size_t end = e - buf;
+
+  // malformed 'ie'
+  if (*index + 1 == end) {
+    return setError(err, end, "invalid int, found 'ie': %zu", end);
+  }
+
+  // i1234e
+  // i-1234e
+  //  ^ i
+  size_t i = *index + 1;
+  int negative = buf[i] == '-';
+  if (negative) {
+    if (i + 1 == end) {
+      return setError(err, i, "invalid int, found 'i-e': %zu", i);
+    }
+    if (buf[i + 1] == '0' && !lenient) {
+      return setError(err, i, "invalid int, '-0' found at %zu", i);
+    }
+  } else if (buf[i] == '0' && !lenient && i + 1 != end) {
+    return setError(err, i, "invalid int, non-zero int should not start with '0'. found at %zu",
+                    i);
+  }
+
+  uint64_t val = 0;
+  int overflow = 0;
+  for (size_t j = i + negative; j < end; j++) {
+    unsigned c = (unsigned char)buf[j] - '0';
+    if (c > 9) {
+      return setError(err, j, "invalid int, '%c' found at %zu", buf[j], j);
+    }
+    // val * 10 + c > UINT64_MAX
+    if (val > (UINT64_MAX - c) / 10) {
+      overflow = 1;
+    }
+    val = val * 10 + c;
+  }
+
+  // -2^63 is the smallest int64.
+  if (negative && val > (uint64_t)INT64_MAX + 1) {
+    overflow = 1;
+  }
+
+  *out = (BencodeInt){
+      .negative = negative,
+      .magnitude = val,
+      .overflow = overflow,
+      .body = &buf[i],
+      .bodyLen = end - i,
+  };
+  *index = end + 1;
+  return 0;
+}
+
+int bencodeParseString(const char *buf, size_t size, size_t *index, int lenient, size_t *start,
+                       size_t *len, BencodeError *err) {
+  size_t i = *index;
+  size_t l = 0;
+  for (; i < size && buf[i] >= '0' && buf[i] <= '9'; i++) {
+    l = l * 10 + (buf[i] - '0');
+    // length can't be larger than remaining bytes, this also prevents l from overflow.
+    if (l > size - i) {
+      return setError(err, *index, "bytes length overflow, index %zu", *index);
+    }
+  }
+
+  if (i == *index) {
+    return setError(err, *index, "invalid string, missing length: index %zu", *index);
+  }
+
+  if (i == size) {
+    return setError(err, *index, "invalid string, missing ':': index %zu", *index);
+  }
+
+  if (buf[i] != ':') {
+    return setError(err, i, "invalid bytes length, found '%c' at %zu", buf[i], i);
+  }
+
+  if (buf[*index] == '0' && *index + 1 != i && !lenient) {
+    return setError(err, *index, "invalid bytes length, found at %zu", *index);
+  }
+
+  if (i + l >= size) {
+    return setError(err, *index, "bytes length overflow, index %zu", *index);
+  }
+
+  *index = i + l + 1;
+  *start = i + 1;
+  *len = l;
+  return 0;
+}
+
+int bencodeCheckKeyOrder(const char *lastKey, size_t lastKeyLen, const char *key, size_t keyLen,
+                         size_t index, BencodeError *err) {
+  if (lastKey == NULL) {
+    return 0;
+  }
+
+  int r = bencodeKeyCompare(key, keyLen, lastKey, lastKeyLen);
+  if (r < 0) {
+    return setError(err, index, "invalid dict, key not sorted. index %zu", index);
+  }
+  if (r == 0) {
+    return setError(err, index, "invalid dict, find duplicated keys %.*s. index %zu", (int)keyLen,
+                    key, index);
+  }
+
+  return 0;
+}
+
+// bencodeSkip is bencodeParse without handler.
+static int parseAny(const char *buf, size_t size, size_t *index, int depth,
+                    const BencodeHandler *h, void *user, BencodeError *err);
+
+static int stopped(BencodeError *err, size_t index) {
+  return setError(err, index, "stopped by handler at %zu", index);
+}
+
+static int parseContainer(const char *buf, size_t size, size_t *index, int depth,
+                          const BencodeHandler *h, void *user, BencodeError *err) {
+  if (depth >= bencodeMaxDepth) {
+    return setError(err, *index, "max nesting depth %d exceeded, index %zu", bencodeMaxDepth,
+                    *index);
+  }
+
+  int isDict = buf[*index] == 'd';
+  if (h != NULL) {
+    int (*begin)(void *) = isDict ? h->onDictBegin : h->onListBegin;
+    if (begin != NULL && begin(user)) {
+      return stopped(err, *index);
+    }
+  }
+
+  const char *lastKey = NULL;
+  size_t lastKeyLen = 0;
+
+  *index = *index + 1;
+  while (1) {
+    if (*index >= size) {
+      return setError(err, *index, "bytes end when decoding %s", isDict ? "dict" : "list");
+    }
+
+    if (buf[*index] == 'e') {
+      break;
+    }
+
+    if (isDict) {
+      size_t keyStart, keyLen;
+      if (bencodeParseString(buf, size, index, 0, &keyStart, &keyLen, err)) {
+        return 1;
+      }
+      if (bencodeCheckKeyOrder(lastKey, lastKeyLen, &buf[keyStart], keyLen, *index, err)) {
+        return 1;
+      }
+      lastKey = &buf[keyStart];
+      lastKeyLen = keyLen;
+
+      if (h != NULL && h->onDictKey != NULL && h->onDictKey(user, lastKey, keyLen)) {
+        return stopped(err, keyStart);
+      }
+    }
+
+    if (parseAny(buf, size, index, depth + 1, h, user, err)) {
+      return 1;
+    }
+  }
+
+  if (h != NULL && h->onEnd != NULL && h->onEnd(user)) {
+    return stopped(err, *index);
+  }
+
+  *index = *index + 1;
+  return 0;
+}
+
+static int parseAny(const char *buf, size_t size, size_t *index, int depth,
+                    const BencodeHandler *h, void *user, BencodeError *err) {
+  if (*index >= size) {
+    return setError(err, *index, "bytes end unexpectedly, index %zu", *index);
+  }
+
+  char c = buf[*index];
+  if (c == 'i') {
+    size_t start = *index;
+    BencodeInt v;
+    if (bencodeParseInt(buf, size, index, 0, &v, err)) {
+      return 1;
+    }
+    if (h != NULL && h->onInt != NULL && h->onInt(user, &v)) {
+      return stopped(err, start);
+    }
+    return 0;
+  }
+
+  if (c >= '0' && c <= '9') {
+    size_t start, len;
+    if (bencodeParseString(buf, size, index, 0, &start, &len, err)) {
+      return 1;
+    }
+    if (h != NULL && h->onString != NULL && h->onString(user, &buf[start], len)) {
+      return stopped(err, start);
+    }
+    return 0;
+  }
+
+  if (c != 'l' && c != 'd') {
+    return setError(err, *index, "invalid bencode prefix '%c', index %zu", c, *index);
+  }
+
+  return parseContainer(buf, size, index, depth, h, user, err);
+}
+
+int bencodeSkip(const char *buf, size_t size, size_t *index, int depth, BencodeError *err) {
+  return parseAny(buf, size, index, depth, NULL, NULL, err);
+}
+
+int bencodeSkipValidated(const char *buf, size_t size, size_t *index, BencodeError *err) {
+  size_t i = *index;
+  size_t depth = 0;
+  do {
+    if (i >= size) {
+      return setError(err, i, "bytes end unexpectedly, index %zu", i);
+    }
+
+    char c = buf[i];
+    if (c == 'l' || c == 'd') {
+      depth++;
+      i++;
+    } else if (c == 'e' && depth > 0) {
+      depth--;
+      i++;
+    } else if (c == 'i') {
+      const char *e = memchr(buf + i, 'e', size - i);
+      if (e == NULL) {
+        return setError(err, i, "invalid int, missing 'e': %zu", i);
+      }
+      i = e - buf + 1;
+    } else if (c >= '0' && c <= '9') {
+      // dict keys are skipped as strings, no need to tell them from values.
+      size_t start, len;
+      if (bencodeParseString(buf, size, &i, 1, &start, &len, err)) {
+        return 1;
+      }
+    } else {
+      return setError(err, i, "invalid bencode prefix '%c', index %zu", c, i);
+    }
+  } while (depth > 0);
+
+  *index = i;
+  return 0;
+}
+
+int bencodeParse(const char *buf, size_t size, size_t *index, const BencodeHandler *handler,
+                 void *user, BencodeError *err) {
+  return parseAny(buf, size, index, 0, handler, user, err);
+}
+
+int bencodeWriterInit(BencodeWriter *w, size_t cap) {
+  if (cap < 16) {
+    cap = 16;
+  }
+
+  w->buf = malloc(cap);
+  w->len = 0;
+  w->cap = w->buf == NULL ? 0 : cap;
+  return w->buf == NULL;
+}
+
+void bencodeWriterFree(BencodeWriter *w) {
+  free(w->buf);
+  w->buf = NULL;
+  w->len = 0;
+  w->cap = 0;
+}
+
+int bencodeWriterReserve(BencodeWriter *w, size_t size) {
+  if (w->len + size <= w->cap) {
+    return 0;
+  }
+
+  size_t cap = w->cap * 2 + size;
+  char *buf = realloc(w->buf, cap);
+  if (buf == NULL) {
+    return 1;
+  }
+  w->buf = buf;
+  w->cap = cap;
+  return 0;
+}
+
+int bencodeWriteRaw(BencodeWriter *w, const char *s, size_t len) {
+  if (bencodeWriterReserve(w, len)) {
+    return 1;
+  }
+  memcpy(w->buf + w->len, s, len);
+  w->len += len;
+  return 0;
+}
+
+int bencodeWriteInt(BencodeWriter *w, int64_t value) {
+  // 'i' + 19 digits with sign + 'e' + '\0'
+  if (bencodeWriterReserve(w, 23)) {
+    return 1;
+  }
+  w->len += snprintf(w->buf + w->len, 23, "i%" PRId64 "e", value);
+  return 0;
+}
+
+int bencodeWriteString(BencodeWriter *w, const char *s, size_t len) {
+  // 20 digits + ':' + '\0'
+  if (bencodeWriterReserve(w, 22 + len)) {
+    return 1;
+  }
+  w->len += snprintf(w->buf + w->len, 22, "%zu:", len);
+  memcpy(w->buf + w->len, s, len);
+  w->len += len;
+  return 0;
+}
+
+int bencodeWriteListBegin(BencodeWriter *w) { return bencodeWriteRaw(w, "l", 1); }
+
+int bencodeWriteDictBegin(BencodeWriter *w) { return bencodeWriteRaw(w, "d", 1); }
+
+int bencodeWriteEnd(BencodeWriter *w) { return bencodeWriteRaw(w, "e", 1); }
@@ -0,0 +1,126 @@
+// python independent bencode parser and writer.
+//
+// the extension builds python objects on top of it,
+// other programs link `bencode` or `bencode_shared` target of CMakeLists.txt without python.
+//
+// all functions return 0 on success, non-zero on error with message in BencodeError.
+// input is strict canonical bencode unless `lenient` is set.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define bencodeMaxDepth 1000
+
+typedef struct bencodeError {
+  // index of input where error is found.
+  size_t index;
+  char message[256];
+} BencodeError;
+
+// int value of input.
+// `overflow` is set if it doesn't fit in uint64 (or int64 when negative),
+// then body[0:bodyLen] is the text between 'i' and 'e' for arbitrary precision parsing.
+typedef struct bencodeInt {
+  int negative;
+  uint64_t magnitude;
+  int overflow;
+  const char *body;
+  size_t bodyLen;
+} BencodeInt;
+
+// SAX callbacks of bencodeParse, NULL callbacks are skipped.
+// non-zero return value stop parsing.
+typedef struct bencodeHandler {
+  int (*onInt)(void *user, const BencodeInt *value);
+  int (*onString)(void *user, const char *s, size_t len);
+  int (*onListBegin)(void *user);
+  int (*onDictBegin)(void *user);
+  // key is followed by its value.
+  int (*onDictKey)(void *user, const char *key, size_t len);
+  // end of list or dict.
+  int (*onEnd)(void *user);
+} BencodeHandler;
+
+// growable output buffer.
+typedef struct bencodeWriter {
+  char *buf;
+  size_t len;
+  size_t cap;
+} BencodeWriter;
+
+// compare dict keys as raw bytes, shorter key is smaller if it's a prefix of another.
+static inline int bencodeKeyCompare(const char *a, size_t aLen, const char *b, size_t bLen) {
+  int r = memcmp(a, b, aLen < bLen ? aLen : bLen);
+  if (r != 0) {
+    return r;
+  }
+
+  return aLen < bLen ? -1 : aLen > bLen;
+}
+
+// set out if value of int fits in int64, return 1 if it doesn't.
+static inline int bencodeIntToInt64(const BencodeInt *v, int64_t *out) {
+  if (v->overflow || (!v->negative && v->magnitude > INT64_MAX)) {
+    return 1;
+  }
+
+  if (!v->negative) {
+    *out = (int64_t)v->magnitude;
+  } else if (v->magnitude > INT64_MAX) {
+    // -2^63, can't be negated from positive int64.
+    *out = INT64_MIN;
+  } else {
+    *out = -(int64_t)v->magnitude;
+  }
+  return 0;
+}
+
+// int at index ('i'), index is moved to end of it.
+// lenient: accept leading zeros and '-0'.
+int bencodeParseInt(const char *buf, size_t size, size_t *index, int lenient, BencodeInt *out,
+                    BencodeError *err);
+
+// string at index, set start and len to the span of its content, index is moved to end of it.
+// lenient: accept leading zeros in length.
+int bencodeParseString(const char *buf, size_t size, size_t *index, int lenient, size_t *start,
+                       size_t *len, BencodeError *err);
+
+// key must be larger than last key of dict, lastKey is NULL for first key.
+int bencodeCheckKeyOrder(const char *lastKey, size_t lastKeyLen, const char *key, size_t keyLen,
+                         size_t index, BencodeError *err);
+
+// validate value at index and move index to end of it,
+// depth is nesting level of the value, string contents are not read.
+int bencodeSkip(const char *buf, size_t size, size_t *index, int depth, BencodeError *err);
+
+// move index to end of a value already validated by bencodeSkip, like a value of a memory mapped
+// file walked again. only bounds are checked, nesting is not limited and no recursion is used.
+int bencodeSkipValidated(const char *buf, size_t size, size_t *index, BencodeError *err);
+
+// parse value at index and call handler, index is moved to end of it.
+// data after the value is not read, caller should check index == size for a whole input.
+int bencodeParse(const char *buf, size_t size, size_t *index, const BencodeHandler *handler,
+                 void *user, BencodeError *err);
+
+int bencodeWriterInit(BencodeWriter *w, size_t cap);
+void bencodeWriterFree(BencodeWriter *w);
+// make room for size more bytes.
+int bencodeWriterReserve(BencodeWriter *w, size_t size);
+int bencodeWriteRaw(BencodeWriter *w, const char *s, size_t len);
+int bencodeWriteInt(BencodeWriter *w, int64_t value);
+int bencodeWriteString(BencodeWriter *w, const char *s, size_t len);
+// keys of dict must be written in sorted order, see bencodeKeyCompare.
+int bencodeWriteListBegin(BencodeWriter *w);
+int bencodeWriteDictBegin(BencodeWriter *w);
+int bencodeWriteEnd(BencodeWriter *w);
+
+#ifdef __cplusplus
+}
+#endif
@@ -20,13 +20,11 @@ static int inline _u64_mul_overflow(uint64_t a, uint64_t b, uint64_t *res) {
   }
 
   *res = a * b;
-  return !(a / b != *res);
+  return *res / b != a;
 }
 
 static int inline _i64_add_overflow(int64_t a, int64_t b, int64_t *res) {
-  if (a > 0 && b > LLONG_MAX - a) {
-    return -1;
-  } else if (a < 0 && b < LLONG_MAX - a) {
+  if ((b > 0 && a > LLONG_MAX - b) || (b < 0 && a < LLONG_MIN - b)) {
     return -1;
   }
 
@@ -34,17 +32,30 @@ static int inline _i64_add_overflow(int64_t a, int64_t b, int64_t *res) {
   return 0;
 }
 
+// check before multiply, signed overflow is undefined behavior.
 static int inline _i64_mul_overflow(int64_t a, int64_t b, int64_t *res) {
   if (a == 0 || b == 0) {
     *res = 0;
     return 0;
   }
 
-  int64_t result = a * b;
-  if (a == result / b) {
-    *res = result;
-    return 0;
+  int of;
+  if (a > 0) {
+    of = b > 0 ? a > LLONG_MAX / b : b < LLONG_MIN / a;
   } else {
+    of = b > 0 ? a < LLONG_MIN / b : a < LLONG_MAX / b;
+  }
+  if (of) {
     return 1;
   }
+
+  *res = a * b;
+  return 0;
 }
+
+// 128 bits integer is a compiler extension, MSVC doesn't have it.
+#if defined(__SIZEOF_INT128__)
+#define BENCODE_HAS_INT128 1
+typedef __int128 int128_t;
+typedef unsigned __int128 uint128_t;
+#endif
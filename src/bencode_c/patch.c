@@ -0,0 +1,471 @@
+// patch dict keys of encoded bencode, untouched values are copied as they are without decoding.
+
+#include <stdio.h>
+
+#include "common.h"
+#include "decode.h"
+#include "stats.h"
+
+#ifdef __GNUC__
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-function"
+#pragma GCC diagnostic ignored "-Wunused-variable"
+#endif
+
+#include "ctx.h"
+#include "str.h"
+
+#ifdef __GNUC__
+#pragma GCC diagnostic pop
+#endif
+
+extern HPy BencodeDecodeError;
+
+// encode.c
+extern int encodeValue(Context *ctx, HPy obj);
+
+static HPy bpatch(HPy self, HPy args, HPy kwargs);
+
+PyDoc_STRVAR(__bpatch_doc__,
+             "bpatch(b, patches, /, *, delete=()) -> bytes\n"
+             "--\n\n"
+             "set or delete dict keys in encoded bencode without decoding it.\n\n"
+             "patches is a mapping of path to new value, delete is a collection of paths.\n"
+             "a path is a sequence of dict keys (bytes or str), or a single key.\n"
+             "new keys are inserted in sorted order, missing dicts on the path are created, "
+             "deleting a missing key does nothing.\n"
+             "everything not on the paths is copied byte by byte, so `info` dict stay same if no "
+             "path goes into it.");
+PyMethodDef patchImpl[] = {{
+                               .ml_name = "bpatch",
+                               .ml_meth = (PyCFunction)(void (*)(void))bpatch,
+                               .ml_flags = METH_VARARGS | METH_KEYWORDS,
+                               .ml_doc = __bpatch_doc__,
+                           },
+                           {NULL, NULL, 0, NULL}};
+
+#define patchError(format, ...) PyErr_Format(BencodeDecodeError, format, ##__VA_ARGS__)
+
+#define patchMaxDepth 1000
+
+// zero value is patchDict, for root node.
+enum patchKind { patchDict, patchSet, patchDelete };
+
+typedef struct patchNode {
+  int kind;
+  // "<len>:<key>", key starts at key + headerLen.
+  const char *key;
+  Py_ssize_t headerLen;
+  Py_ssize_t keyLen;
+  // encoded value of patchSet, offset in values buffer.
+  Py_ssize_t valueOffset;
+  Py_ssize_t valueLen;
+  // patchDict, sorted by key before patching.
+  struct patchNode *children;
+  Py_ssize_t count;
+  Py_ssize_t cap;
+} PatchNode;
+
+// output is a list of spans of input, encoded values and keys,
+// copied to bytes object of exact size at the end.
+typedef struct span {
+  const char *p;
+  Py_ssize_t len;
+} Span;
+
+typedef struct patchContext {
+  PatchNode root;
+  // encoded values of all patches.
+  Context values;
+  // own rendered keys.
+  HPy keys;
+  Span *spans;
+  Py_ssize_t count;
+  Py_ssize_t cap;
+  Py_ssize_t size;
+} PatchContext;
+
+static void freePatchNode(PatchNode *node) {
+  for (Py_ssize_t i = 0; i < node->count; i++) {
+    freePatchNode(&node->children[i]);
+  }
+  free(node->children);
+}
+
+static void freePatchContext(PatchContext *p) {
+  freePatchNode(&p->root);
+  freeContext(p->values);
+  Py_XDECREF(p->keys);
+  free(p->spans);
+}
+
+static int sortPatchNode(const void *a, const void *b) {
+  const PatchNode *x = a;
+  const PatchNode *y = b;
+  return strCompare(x->key + x->headerLen, x->keyLen, y->key + y->headerLen, y->keyLen);
+}
+
+static void sortPatchTree(PatchNode *node) {
+  qsort(node->children, node->count, sizeof(PatchNode), sortPatchNode);
+  for (Py_ssize_t i = 0; i < node->count; i++) {
+    sortPatchTree(&node->children[i]);
+  }
+}
+
+static PatchNode *patchChild(PatchContext *p, PatchNode *node, HPy o) {
+  HPy b;
+  if (PyBytes_Check(o)) {
+    Py_INCREF(o);
+    b = o;
+  } else if (PyUnicode_Check(o)) {
+    b = PyUnicode_AsUTF8String(o);
+    if (b == NULL) {
+      return NULL;
+    }
+  } else {
+    PyErr_Format(PyExc_TypeError, "path item must be bytes or str, got %R", o);
+    return NULL;
+  }
+
+  // rendered once, inserted keys are copied as is.
+  HPy key = PyBytes_FromFormat("%zd:", PyBytes_Size(b));
+  if (key != NULL) {
+    PyBytes_Concat(&key, b);
+  }
+  Py_DecRef(b);
+  if (key == NULL) {
+    return NULL;
+  }
+
+  int err = PyList_Append(p->keys, key);
+  Py_DecRef(key);
+  if (err) {
+    return NULL;
+  }
+
+  const char *rendered = PyBytes_AsString(key);
+  Py_ssize_t len = PyBytes_Size(key);
+  Py_ssize_t headerLen = (const char *)memchr(rendered, ':', len) - rendered + 1;
+
+  for (Py_ssize_t i = 0; i < node->count; i++) {
+    PatchNode *child = &node->children[i];
+    if (child->keyLen == len - headerLen &&
+        memcmp(child->key + child->headerLen, rendered + headerLen, child->keyLen) == 0) {
+      return child;
+    }
+  }
+
+  if (node->count == node->cap) {
+    Py_ssize_t cap = node->cap ? node->cap * 2 : 4;
+    PatchNode *children = realloc(node->children, sizeof(PatchNode) * cap);
+    if (children == NULL) {
+      PyErr_SetNone(PyExc_MemoryError);
+      return NULL;
+    }
+    node->children = children;
+    node->cap = cap;
+  }
+
+  PatchNode *child = &node->children[node->count++];
+  *child = (PatchNode){
+      .kind = patchDict,
+      .key = rendered,
+      .headerLen = headerLen,
+      .keyLen = len - headerLen,
+  };
+  return child;
+}
+
+// add path to tree, value is NULL to delete it.
+static int addPatch(PatchContext *p, HPy path, HPy value) {
+  HPy steps;
+  if (PyBytes_Check(path) || PyUnicode_Check(path)) {
+    steps = PyTuple_Pack(1, path);
+  } else {
+    steps = PySequence_Tuple(path);
+  }
+  if (steps == NULL) {
+    return 1;
+  }
+
+  Py_ssize_t len = PyTuple_Size(steps);
+  if (len == 0 || len >= patchMaxDepth) {
+    PyErr_Format(PyExc_ValueError, "path length must be between 1 and %d, got %R",
+                 patchMaxDepth - 1, path);
+    goto __Error;
+  }
+
+  PatchNode *node = &p->root;
+  for (Py_ssize_t i = 0; i < len; i++) {
+    if (node->kind != patchDict) {
+      goto __Conflict;
+    }
+    node = patchChild(p, node, PyTuple_GetItem(steps, i));
+    if (node == NULL) {
+      goto __Error;
+    }
+  }
+
+  // new node is an empty patchDict.
+  if (node->kind != patchDict || node->count != 0 || node->valueLen != 0) {
+    goto __Conflict;
+  }
+
+  if (value == NULL) {
+    node->kind = patchDelete;
+    // mark node as used, so same path can't be added twice.
+    node->valueLen = -1;
+  } else {
+    node->kind = patchSet;
+    node->valueOffset = p->values.out.len;
+    if (encodeValue(&p->values, value)) {
+      goto __Error;
+    }
+    node->valueLen = p->values.out.len - node->valueOffset;
+  }
+
+  Py_DecRef(steps);
+  return 0;
+
+__Conflict:
+  PyErr_Format(PyExc_ValueError, "path %R conflicts with another path", path);
+__Error:
+  Py_DecRef(steps);
+  return 1;
+}
+
+static int parsePatches(PatchContext *p, HPy patches, HPy delete) {
+  HPy items = PyMapping_Items(patches);
+  if (items == NULL) {
+    return 1;
+  }
+
+  for (Py_ssize_t i = 0; i < PyList_Size(items); i++) {
+    HPy item = PyList_GetItem(items, i);
+    if (addPatch(p, PyTuple_GetItem(item, 0), PyTuple_GetItem(item, 1))) {
+      Py_DecRef(items);
+      return 1;
+    }
+  }
+  Py_DecRef(items);
+
+  if (delete == NULL) {
+    return 0;
+  }
+
+  HPy seq = PySequence_List(delete);
+  if (seq == NULL) {
+    return 1;
+  }
+
+  for (Py_ssize_t i = 0; i < PyList_Size(seq); i++) {
+    if (addPatch(p, PyList_GetItem(seq, i), NULL)) {
+      Py_DecRef(seq);
+      return 1;
+    }
+  }
+  Py_DecRef(seq);
+  return 0;
+}
+
+static int emit(PatchContext *p, const char *s, Py_ssize_t len) {
+  if (len == 0) {
+    return 0;
+  }
+
+  p->size += len;
+  // continuous input.
+  if (p->count != 0 && p->spans[p->count - 1].p + p->spans[p->count - 1].len == s) {
+    p->spans[p->count - 1].len += len;
+    return 0;
+  }
+
+  if (p->count == p->cap) {
+    Py_ssize_t cap = p->cap ? p->cap * 2 : 32;
+    Span *spans = realloc(p->spans, sizeof(Span) * cap);
+    if (spans == NULL) {
+      PyErr_SetNone(PyExc_MemoryError);
+      return 1;
+    }
+    p->spans = spans;
+    p->cap = cap;
+  }
+
+  p->spans[p->count++] = (Span){.p = s, .len = len};
+  return 0;
+}
+
+static int hasSet(PatchNode *node) {
+  if (node->kind != patchDict) {
+    return node->kind == patchSet;
+  }
+  for (Py_ssize_t i = 0; i < node->count; i++) {
+    if (hasSet(&node->children[i])) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// key and value of a node not in input, children of new dict are all inserted.
+// dict with only deleted keys is not created.
+static int emitInsert(PatchContext *p, PatchNode *node) {
+  if (!hasSet(node)) {
+    return 0;
+  }
+
+  returnIfError(emit(p, node->key, node->headerLen + node->keyLen));
+  if (node->kind == patchSet) {
+    return emit(p, p->values.out.buf + node->valueOffset, node->valueLen);
+  }
+
+  returnIfError(emit(p, "d", 1));
+  for (Py_ssize_t i = 0; i < node->count; i++) {
+    returnIfError(emitInsert(p, &node->children[i]));
+  }
+  return emit(p, "e", 1);
+}
+
+// merge sorted keys of dict at index with children of node.
+static int patchDictAt(PatchContext *p, PatchNode *node, const char *buf, Py_ssize_t *index,
+                       Py_ssize_t size, int depth) {
+  if (buf[*index] != 'd') {
+    patchError("expect dict to patch keys in it, index %zd", *index);
+    return 1;
+  }
+
+  if (depth >= patchMaxDepth) {
+    patchError("max nesting depth %d exceeded, index %zd", patchMaxDepth, *index);
+    return 1;
+  }
+
+  returnIfError(emit(p, &buf[*index], 1));
+
+  const char *lastKey = NULL;
+  Py_ssize_t lastKeyLen = 0;
+  Py_ssize_t next = 0;
+
+  *index = *index + 1;
+  while (1) {
+    if (*index >= size) {
+      patchError("bytes end when decoding dict");
+      return 1;
+    }
+
+    if (buf[*index] == 'e') {
+      break;
+    }
+
+    Py_ssize_t entryStart = *index;
+    Py_ssize_t keyStart, keyLen;
+    returnIfError(decodeBytesSpan(buf, index, size, &keyStart, &keyLen, 0));
+    returnIfError(checkKeyOrder(lastKey, lastKeyLen, &buf[keyStart], keyLen, *index));
+    lastKey = &buf[keyStart];
+    lastKeyLen = keyLen;
+
+    int r = 1;
+    for (; next < node->count; next++) {
+      PatchNode *child = &node->children[next];
+      r = strCompare(child->key + child->headerLen, child->keyLen, &buf[keyStart], keyLen);
+      if (r >= 0) {
+        break;
+      }
+      returnIfError(emitInsert(p, child));
+    }
+
+    if (*index >= size) {
+      patchError("bytes end when decoding dict");
+      return 1;
+    }
+
+    if (next == node->count || r != 0) {
+      returnIfError(skipAny(buf, index, size, depth + 1));
+      returnIfError(emit(p, &buf[entryStart], *index - entryStart));
+      continue;
+    }
+
+    PatchNode *child = &node->children[next++];
+    if (child->kind == patchDict) {
+      returnIfError(emit(p, &buf[entryStart], *index - entryStart));
+      returnIfError(patchDictAt(p, child, buf, index, size, depth + 1));
+      continue;
+    }
+
+    // replaced or deleted value, still validated.
+    returnIfError(skipAny(buf, index, size, depth + 1));
+    if (child->kind == patchSet) {
+      returnIfError(emit(p, child->key, child->headerLen + child->keyLen));
+      returnIfError(emit(p, p->values.out.buf + child->valueOffset, child->valueLen));
+    }
+  }
+
+  for (; next < node->count; next++) {
+    returnIfError(emitInsert(p, &node->children[next]));
+  }
+
+  returnIfError(emit(p, &buf[*index], 1));
+  *index = *index + 1;
+  return 0;
+}
+
+static HPy bpatch(HPy self, HPy args, HPy kwargs) {
+  static char *kwlist[] = {"", "", "delete", NULL};
+
+  HPy b;
+  HPy patches;
+  HPy delete = NULL;
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|$O:bpatch", kwlist, &b, &patches, &delete)) {
+    return NULL;
+  }
+
+  if (!PyBytes_Check(b)) {
+    PyErr_SetString(PyExc_TypeError, "can only patch bytes");
+    return NULL;
+  }
+
+  Py_ssize_t size = PyBytes_Size(b);
+  if (size == 0) {
+    patchError("can't decode empty bytes");
+    return NULL;
+  }
+  const char *buf = PyBytes_AsString(b);
+
+  int err = 0;
+  PatchContext p = {.values = newContext(&err, minBufferSize)};
+  if (err) {
+    return NULL;
+  }
+
+  HPy res = NULL;
+  p.keys = PyList_New(0);
+  if (p.keys == NULL || parsePatches(&p, patches, delete)) {
+    goto __CLEAN_UP;
+  }
+  sortPatchTree(&p.root);
+
+  Py_ssize_t index = 0;
+  if (patchDictAt(&p, &p.root, buf, &index, size, 0)) {
+    goto __CLEAN_UP;
+  }
+
+  if (index != size) {
+    patchError("invalid bencode data, parse end at index %zd but total bytes length %zd", index,
+               size);
+    goto __CLEAN_UP;
+  }
+
+  res = PyBytes_FromStringAndSize(NULL, p.size);
+  if (res == NULL) {
+    goto __CLEAN_UP;
+  }
+
+  char *out = PyBytes_AsString(res);
+  for (Py_ssize_t i = 0; i < p.count; i++) {
+    memcpy(out, p.spans[i].p, p.spans[i].len);
+    out += p.spans[i].len;
+  }
+
+__CLEAN_UP:
+  freePatchContext(&p);
+  return res;
+}
@@ -0,0 +1,328 @@
+// compact peer lists of tracker responses (BEP 23, BEP 7), packed from (ip, port) tuples.
+
+#include "common.h"
+#include "inet.h"
+#include "stats.h"
+
+#ifdef __GNUC__
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-function"
+#pragma GCC diagnostic ignored "-Wunused-variable"
+#endif
+
+#include "ctx.h"
+
+#ifdef __GNUC__
+#pragma GCC diagnostic pop
+#endif
+
+static HPy pack_peers(HPy self, HPy args, HPy kwargs);
+static HPy unpack_peers(HPy self, HPy args, HPy kwargs);
+
+PyDoc_STRVAR(__pack_peers_doc__,
+             "pack_peers(peers: Sequence[tuple[str, int]], /, *, ipv6: bool = False) -> bytes\n"
+             "--\n\n"
+             "pack (ip, port) to compact peer string, 6 bytes per ipv4 peer or 18 bytes per "
+             "ipv6 peer.\n\n"
+             "all addresses must be ipv4, or ipv6 if ipv6 is True.");
+PyDoc_STRVAR(__unpack_peers_doc__,
+             "unpack_peers(b: bytes, /, *, ipv6: bool = False) -> list[tuple[str, int]]\n"
+             "--\n\n"
+             "unpack compact peer string to list of (ip, port).");
+PyMethodDef peersImpl[] = {{
+                               .ml_name = "pack_peers",
+                               .ml_meth = (PyCFunction)(void (*)(void))pack_peers,
+                               .ml_flags = METH_VARARGS | METH_KEYWORDS,
+                               .ml_doc = __pack_peers_doc__,
+                           },
+                           {
+                               .ml_name = "unpack_peers",
+                               .ml_meth = (PyCFunction)(void (*)(void))unpack_peers,
+                               .ml_flags = METH_VARARGS | METH_KEYWORDS,
+                               .ml_doc = __unpack_peers_doc__,
+                           },
+                           {NULL, NULL, 0, NULL}};
+
+// list of peers packed when encoded, so packed string is written to output buffer directly.
+typedef struct compactPeers {
+  PyObject_HEAD;
+  // list or tuple of (ip, port)
+  HPy peers;
+  int v6;
+} CompactPeers;
+
+// set by module init.
+HPy CompactPeersType;
+
+// pack peer (ip, port) to out. return 0 on success.
+static int packPeer(HPy peer, int v6, unsigned char *out) {
+  HPy ip;
+  HPy port;
+  if (PyTuple_Check(peer) && PyTuple_Size(peer) == 2) {
+    ip = PyTuple_GetItem(peer, 0);
+    port = PyTuple_GetItem(peer, 1);
+  } else if (!PyArg_ParseTuple(peer, "OO;peer must be (ip, port)", &ip, &port)) {
+    return 1;
+  }
+
+  // out only has room for one peer of expected family.
+  unsigned char packed[compactPeerV6Size];
+  int size = compactPeerFromObjects(ip, port, packed);
+  if (size == 0) {
+    return 1;
+  }
+  if (size != (v6 ? compactPeerV6Size : compactPeerV4Size)) {
+    PyErr_Format(PyExc_ValueError, "%R is not an %s address", ip, v6 ? "ipv6" : "ipv4");
+    return 1;
+  }
+  memcpy(out, packed, size);
+  return 0;
+}
+
+// pack peers of list or tuple seq to out, which has room for all of them.
+static int packPeers(HPy seq, int v6, unsigned char *out, Py_ssize_t count) {
+  int peerSize = v6 ? compactPeerV6Size : compactPeerV4Size;
+  int isList = PyList_Check(seq);
+  for (Py_ssize_t i = 0; i < count; i++) {
+    // peer may be removed from list by __index__ of port.
+    HPy peer = isList ? PyList_GetItem(seq, i) : PyTuple_GetItem(seq, i);
+    if (peer == NULL) {
+      return 1;
+    }
+    Py_INCREF(peer);
+    int err = packPeer(peer, v6, out + i * peerSize);
+    Py_DecRef(peer);
+    if (err) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static Py_ssize_t seqSize(HPy seq) {
+  return PyList_Check(seq) ? PyList_Size(seq) : PyTuple_Size(seq);
+}
+
+// called by encodeAny, write packed peers as a string.
+int encodeCompactPeers(Context *ctx, HPy obj) {
+  CompactPeers *p = (CompactPeers *)obj;
+  Py_ssize_t count = seqSize(p->peers);
+  Py_ssize_t size = count * (p->v6 ? compactPeerV6Size : compactPeerV4Size);
+
+  statsInc(encode_str);
+  returnIfError(bufferWriteFormat(ctx, "%zd:", size));
+  returnIfError(bufferGrow(ctx, size));
+  returnIfError(packPeers(p->peers, p->v6, (unsigned char *)ctx->out.buf + ctx->out.len, count));
+  ctx->out.len += size;
+  return 0;
+}
+
+static HPy pack_peers(HPy self, HPy args, HPy kwargs) {
+  static char *kwlist[] = {"", "ipv6", NULL};
+
+  HPy peers;
+  int v6 = 0;
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|$p:pack_peers", kwlist, &peers, &v6)) {
+    return NULL;
+  }
+
+  HPy seq = PySequence_Fast(peers, "peers must be a sequence");
+  if (seq == NULL) {
+    return NULL;
+  }
+
+  Py_ssize_t count = seqSize(seq);
+  HPy res = PyBytes_FromStringAndSize(NULL, count * (v6 ? compactPeerV6Size : compactPeerV4Size));
+  if (res != NULL && packPeers(seq, v6, (unsigned char *)PyBytes_AsString(res), count)) {
+    Py_CLEAR(res);
+  }
+  Py_DecRef(seq);
+  return res;
+}
+
+static HPy unpack_peers(HPy self, HPy args, HPy kwargs) {
+  static char *kwlist[] = {"", "ipv6", NULL};
+
+  HPy b;
+  int v6 = 0;
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|$p:unpack_peers", kwlist, &b, &v6)) {
+    return NULL;
+  }
+
+#if PY_MINOR_VERSION >= 11
+  Py_buffer view;
+  if (PyObject_GetBuffer(b, &view, PyBUF_SIMPLE)) {
+    return NULL;
+  }
+  const unsigned char *buf = view.buf;
+  Py_ssize_t size = view.len;
+#else
+  // buffer protocol is not in limited api before 3.11.
+  if (!PyBytes_Check(b)) {
+    PyErr_SetString(PyExc_TypeError, "can only unpack bytes");
+    return NULL;
+  }
+  const unsigned char *buf = (const unsigned char *)PyBytes_AsString(b);
+  Py_ssize_t size = PyBytes_Size(b);
+#endif
+
+  int peerSize = v6 ? compactPeerV6Size : compactPeerV4Size;
+  HPy res = NULL;
+  if (size % peerSize != 0) {
+    PyErr_Format(PyExc_ValueError, "compact peers length %zd is not a multiple of %d", size,
+                 peerSize);
+    goto __CLEAN_UP;
+  }
+
+  res = PyList_New(size / peerSize);
+  if (res == NULL) {
+    goto __CLEAN_UP;
+  }
+  for (Py_ssize_t i = 0; i < size / peerSize; i++) {
+    HPy peer = compactPeerToTuple(buf + i * peerSize, v6);
+    if (peer == NULL) {
+      Py_CLEAR(res);
+      goto __CLEAN_UP;
+    }
+    PyList_SetItem(res, i, peer);
+  }
+
+__CLEAN_UP:
+#if PY_MINOR_VERSION >= 11
+  PyBuffer_Release(&view);
+#endif
+  return res;
+}
+
+static HPy compactPeersNew(PyTypeObject *type, HPy args, HPy kwargs) {
+  static char *kwlist[] = {"", "ipv6", NULL};
+
+  HPy peers;
+  int v6 = 0;
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|$p:CompactPeers", kwlist, &peers, &v6)) {
+    return NULL;
+  }
+
+  HPy seq = PySequence_Fast(peers, "peers must be a sequence");
+  if (seq == NULL) {
+    return NULL;
+  }
+
+  allocfunc alloc = (allocfunc)PyType_GetSlot(type, Py_tp_alloc);
+  CompactPeers *p = (CompactPeers *)alloc(type, 0);
+  if (p == NULL) {
+    Py_DecRef(seq);
+    return NULL;
+  }
+  p->peers = seq;
+  p->v6 = v6;
+  return (HPy)p;
+}
+
+static int compactPeersTraverse(HPy self, visitproc visit, void *arg) {
+  Py_VISIT(Py_TYPE(self));
+  Py_VISIT(((CompactPeers *)self)->peers);
+  return 0;
+}
+
+// peers may contain self, replace it with an empty tuple so object stays usable.
+static int compactPeersTpClear(HPy self) {
+  CompactPeers *p = (CompactPeers *)self;
+  HPy empty = PyTuple_New(0);
+  if (empty == NULL) {
+    PyErr_Clear();
+    return 0;
+  }
+
+  HPy peers = p->peers;
+  p->peers = empty;
+  Py_XDECREF(peers);
+  return 0;
+}
+
+static void compactPeersDealloc(HPy self) {
+  PyObject_GC_UnTrack(self);
+  Py_XDECREF(((CompactPeers *)self)->peers);
+
+  PyTypeObject *tp = Py_TYPE(self);
+  freefunc tp_free = (freefunc)PyType_GetSlot(tp, Py_tp_free);
+  tp_free(self);
+  Py_DecRef((HPy)tp);
+}
+
+static Py_ssize_t compactPeersLen(HPy self) { return seqSize(((CompactPeers *)self)->peers); }
+
+static HPy compactPeersBytes(HPy self, HPy unused) {
+  CompactPeers *p = (CompactPeers *)self;
+  Py_ssize_t count = seqSize(p->peers);
+  HPy res =
+      PyBytes_FromStringAndSize(NULL, count * (p->v6 ? compactPeerV6Size : compactPeerV4Size));
+  if (res != NULL && packPeers(p->peers, p->v6, (unsigned char *)PyBytes_AsString(res), count)) {
+    Py_CLEAR(res);
+  }
+  return res;
+}
+
+static HPy compactPeersGetPeers(HPy self, void *closure) {
+  HPy peers = ((CompactPeers *)self)->peers;
+  Py_INCREF(peers);
+  return peers;
+}
+
+static HPy compactPeersGetIPv6(HPy self, void *closure) {
+  return PyBool_FromLong(((CompactPeers *)self)->v6);
+}
+
+static PyMethodDef compactPeersMethods[] = {
+    {
+        .ml_name = "__bytes__",
+        .ml_meth = (PyCFunction)(void (*)(void))compactPeersBytes,
+        .ml_flags = METH_NOARGS,
+        .ml_doc = "packed compact peer string",
+    },
+    {NULL, NULL, 0, NULL},
+};
+
+static PyGetSetDef compactPeersGetSet[] = {
+    {"peers", (getter)compactPeersGetPeers, NULL, "list or tuple of (ip, port)", NULL},
+    {"ipv6", (getter)compactPeersGetIPv6, NULL, "peers are ipv6 addresses", NULL},
+    {NULL},
+};
+
+static PyType_Slot compactPeersSlots[] = {
+    {Py_tp_doc, "CompactPeers(peers: Sequence[tuple[str, int]], /, *, ipv6: bool = False)\n"
+                "--\n\n"
+                "peer list encoded as compact peer string by bencode, "
+                "peers are packed to output buffer when encoded."},
+    {Py_tp_new, compactPeersNew},
+    {Py_tp_dealloc, compactPeersDealloc},
+    {Py_tp_traverse, compactPeersTraverse},
+    {Py_tp_clear, compactPeersTpClear},
+    {Py_sq_length, compactPeersLen},
+    {Py_tp_methods, compactPeersMethods},
+    {Py_tp_getset, compactPeersGetSet},
+    {0, NULL},
+};
+
+static PyType_Spec compactPeersSpec = {
+    .name = "bencode_c.CompactPeers",
+    .basicsize = sizeof(CompactPeers),
+    .itemsize = 0,
+    .flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC,
+    .slots = compactPeersSlots,
+};
+
+int peersInit(HPy m) {
+  CompactPeersType = PyType_FromSpec(&compactPeersSpec);
+  if (CompactPeersType == NULL) {
+    return 1;
+  }
+
+  Py_INCREF(CompactPeersType);
+  if (PyModule_AddObject(m, "CompactPeers", CompactPeersType) < 0) {
+    Py_DecRef(CompactPeersType);
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,75 @@
+#include <string.h>
+
+#include "common.h"
+#include "stats.h"
+
+static HPy stats(HPy mod, HPy unused);
+static HPy resetStats(HPy mod, HPy unused);
+
+PyDoc_STRVAR(__stats_doc__, "stats() -> dict[str, int]\n"
+                            "--\n\n"
+                            "counters of decoder and encoder since import or last "
+                            "reset_stats().\n\n"
+                            "empty dict if extension is not built with BENCODE_STATS=1.");
+PyDoc_STRVAR(__reset_stats_doc__, "reset_stats() -> None\n"
+                                  "--\n\n"
+                                  "set all counters to 0.");
+PyMethodDef statsImpl[] = {{
+                               .ml_name = "stats",
+                               .ml_meth = (PyCFunction)(void (*)(void))stats,
+                               .ml_flags = METH_NOARGS,
+                               .ml_doc = __stats_doc__,
+                           },
+                           {
+                               .ml_name = "reset_stats",
+                               .ml_meth = (PyCFunction)(void (*)(void))resetStats,
+                               .ml_flags = METH_NOARGS,
+                               .ml_doc = __reset_stats_doc__,
+                           },
+                           {NULL, NULL, 0, NULL}};
+
+#ifdef BENCODE_STATS
+
+BencodeStats bencodeStats;
+
+static int setCounter(HPy d, const char *name, uint64_t value) {
+  HPy v = PyLong_FromUnsignedLongLong(value);
+  if (v == NULL) {
+    return 1;
+  }
+
+  int err = PyDict_SetItemString(d, name, v);
+  Py_DecRef(v);
+  return err;
+}
+
+#endif
+
+static HPy stats(HPy mod, HPy unused) {
+  HPy d = PyDict_New();
+  if (d == NULL) {
+    return NULL;
+  }
+
+#ifdef BENCODE_STATS
+  // copy first, so values in one result are from same moment.
+  BencodeStats snapshot = bencodeStats;
+
+#define statsSet(name)                                                                             \
+  if (setCounter(d, #name, snapshot.name)) {                                                       \
+    Py_DecRef(d);                                                                                  \
+    return NULL;                                                                                   \
+  }
+  BENCODE_STATS_FIELDS(statsSet)
+#undef statsSet
+#endif
+
+  return d;
+}
+
+static HPy resetStats(HPy mod, HPy unused) {
+#ifdef BENCODE_STATS
+  memset(&bencodeStats, 0, sizeof(bencodeStats));
+#endif
+  Py_RETURN_NONE;
+}
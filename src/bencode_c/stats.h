@@ -0,0 +1,79 @@
+#pragma once
+
+#include <stdint.h>
+
+// counters and probes for profiling, both compiled out by default.
+//
+// BENCODE_STATS: count calls, bytes and objects, read by `_bencode.stats()`.
+//   counters are not atomic, they are only exact when GIL is enabled.
+// BENCODE_USDT: systemtap/bpftrace probes `bencode:decode__entry(size)`,
+//   `bencode:decode__return(size, ok)`, `bencode:encode__entry()` and
+//   `bencode:encode__return(size, ok)`.
+
+#define BENCODE_STATS_FIELDS(X)                                                                    \
+  X(decode_calls)                                                                                  \
+  X(decode_errors)                                                                                 \
+  X(decode_bytes)                                                                                  \
+  X(decode_int)                                                                                    \
+  X(decode_bigint)                                                                                 \
+  X(decode_str)                                                                                    \
+  X(decode_list)                                                                                   \
+  X(decode_dict)                                                                                   \
+  X(encode_calls)                                                                                  \
+  X(encode_errors)                                                                                 \
+  X(encode_bytes)                                                                                  \
+  X(encode_max_bytes)                                                                              \
+  X(encode_int)                                                                                    \
+  X(encode_int_128)                                                                                \
+  X(encode_int_slow)                                                                               \
+  X(encode_str)                                                                                    \
+  X(encode_list)                                                                                   \
+  X(encode_dict)                                                                                   \
+  X(encode_dict_sort)                                                                              \
+  X(encode_fallback)                                                                               \
+  X(encode_segments)                                                                               \
+  X(buffer_grow)                                                                                   \
+  X(buffer_grow_bytes)
+
+#ifdef BENCODE_STATS
+
+#define statsField(name) uint64_t name;
+typedef struct bencodeStats {
+  BENCODE_STATS_FIELDS(statsField)
+} BencodeStats;
+#undef statsField
+
+extern BencodeStats bencodeStats;
+
+#define statsAdd(name, n) (bencodeStats.name += (uint64_t)(n))
+#define statsMax(name, n)                                                                          \
+  do {                                                                                             \
+    if ((uint64_t)(n) > bencodeStats.name) {                                                       \
+      bencodeStats.name = (uint64_t)(n);                                                           \
+    }                                                                                              \
+  } while (0)
+
+#else
+
+#define statsAdd(name, n)
+#define statsMax(name, n)
+
+#endif
+
+#define statsInc(name) statsAdd(name, 1)
+
+#ifdef BENCODE_USDT
+
+#include <sys/sdt.h>
+
+#define probe0(name) DTRACE_PROBE(bencode, name)
+#define probe1(name, a) DTRACE_PROBE1(bencode, name, a)
+#define probe2(name, a, b) DTRACE_PROBE2(bencode, name, a, b)
+
+#else
+
+#define probe0(name)
+#define probe1(name, a)
+#define probe2(name, a, b)
+
+#endif
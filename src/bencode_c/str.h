@@ -1,19 +1,26 @@
 #pragma once
 
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include <Python.h>
 
+#include "libbencode.h"
+
 typedef struct str {
   char *str;
   Py_ssize_t size;
 } Str;
 
 static int va_str_printf(Str *ss, const char *format, va_list args) {
-  size_t size = vsnprintf(NULL, 0, format, args) + 1;
+  // args can only be consumed once.
+  va_list args2;
+  va_copy(args2, args);
+  size_t size = vsnprintf(NULL, 0, format, args2) + 1;
+  va_end(args2);
   if (size == 0) {
     PyErr_SetString(PyExc_RuntimeError, "snprintf return unexpected value");
     return 1;
@@ -34,19 +41,72 @@ static int va_str_printf(Str *ss, const char *format, va_list args) {
 }
 
 static int strCompare(const char *s1, size_t len1, const char *s2, size_t len2) {
-  size_t min_len = (len1 < len2) ? len1 : len2;
-  int result = strncmp(s1, s2, min_len);
+  // keys are raw bytes, may contain '\0'
+  return bencodeKeyCompare(s1, len1, s2, len2);
+}
 
-  if (result != 0) {
-    return result;
-  }
+// same rules as python strict utf-8 decoder, reject overlong, surrogate and > U+10FFFF.
+static int isValidUTF8(const char *str, Py_ssize_t len) {
+  const unsigned char *s = (const unsigned char *)str;
+  Py_ssize_t i = 0;
 
-  // first min_len have same characters.
-  if (len1 < len2) {
-    return -1;
-  } else if (len1 > len2) {
-    return 1;
-  } else {
-    return 0;
+  while (i < len) {
+    // fast path for ascii, 8 bytes at once
+    if (i + 8 <= len) {
+      uint64_t chunk;
+      memcpy(&chunk, &s[i], 8);
+      if ((chunk & 0x8080808080808080ULL) == 0) {
+        i += 8;
+        continue;
+      }
+    }
+
+    unsigned char c = s[i];
+    if (c < 0x80) {
+      i++;
+      continue;
+    }
+
+    Py_ssize_t n;
+    unsigned char lo = 0x80, hi = 0xBF; // range of first continuation byte
+    if (c >= 0xC2 && c <= 0xDF) {
+      n = 1;
+    } else if (c == 0xE0) {
+      n = 2;
+      lo = 0xA0;
+    } else if (c == 0xED) {
+      n = 2;
+      hi = 0x9F;
+    } else if (c >= 0xE1 && c <= 0xEF) {
+      n = 2;
+    } else if (c == 0xF0) {
+      n = 3;
+      lo = 0x90;
+    } else if (c >= 0xF1 && c <= 0xF3) {
+      n = 3;
+    } else if (c == 0xF4) {
+      n = 3;
+      hi = 0x8F;
+    } else {
+      return 0;
+    }
+
+    if (i + n >= len) {
+      return 0;
+    }
+
+    if (s[i + 1] < lo || s[i + 1] > hi) {
+      return 0;
+    }
+
+    for (Py_ssize_t j = 2; j <= n; j++) {
+      if ((s[i + j] & 0xC0) != 0x80) {
+        return 0;
+      }
+    }
+
+    i += n + 1;
   }
+
+  return 1;
 }
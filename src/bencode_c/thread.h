@@ -0,0 +1,82 @@
+#pragma once
+
+// minimal native threads for make_torrent workers, pthreads or win32.
+
+#ifdef _WIN32
+
+#define WIN32_LEAN_AND_MEAN
+#include <process.h>
+#include <windows.h>
+
+typedef HANDLE Thread;
+typedef CRITICAL_SECTION Mutex;
+typedef unsigned threadResult;
+#define threadCall __stdcall
+
+#else
+
+#include <pthread.h>
+
+typedef pthread_t Thread;
+typedef pthread_mutex_t Mutex;
+typedef void *threadResult;
+#define threadCall
+
+#endif
+
+typedef threadResult(threadCall *threadFunc)(void *arg);
+
+// return 0 on success.
+static int threadStart(Thread *t, threadFunc func, void *arg) {
+#ifdef _WIN32
+  uintptr_t h = _beginthreadex(NULL, 0, func, arg, 0, NULL);
+  if (h == 0) {
+    return 1;
+  }
+  *t = (HANDLE)h;
+  return 0;
+#else
+  return pthread_create(t, NULL, func, arg) != 0;
+#endif
+}
+
+static void threadJoin(Thread t) {
+#ifdef _WIN32
+  WaitForSingleObject(t, INFINITE);
+  CloseHandle(t);
+#else
+  pthread_join(t, NULL);
+#endif
+}
+
+static void mutexInit(Mutex *m) {
+#ifdef _WIN32
+  InitializeCriticalSection(m);
+#else
+  pthread_mutex_init(m, NULL);
+#endif
+}
+
+static void mutexDestroy(Mutex *m) {
+#ifdef _WIN32
+  DeleteCriticalSection(m);
+#else
+  pthread_mutex_destroy(m);
+#endif
+}
+
+static void mutexLock(Mutex *m) {
+#ifdef _WIN32
+  EnterCriticalSection(m);
+#else
+  pthread_mutex_lock(m);
+#endif
+}
+
+static void mutexUnlock(Mutex *m) {
+#ifdef _WIN32
+  LeaveCriticalSection(m);
+#else
+  pthread_mutex_unlock(m);
+#endif
+}
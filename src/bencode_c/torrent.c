@@ -0,0 +1,850 @@
+// build .torrent (BEP 3, BEP 52 and hybrid) with pieces hashed by native threads.
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "common.h"
+#include "hash.h"
+#include "stats.h"
+#include "thread.h"
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef __GNUC__
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-function"
+#pragma GCC diagnostic ignored "-Wunused-variable"
+#endif
+
+#include "ctx.h"
+
+#ifdef __GNUC__
+#pragma GCC diagnostic pop
+#endif
+
+// encode.c
+extern int encodeDictWithValue(Context *ctx, HPy obj, const char *key, HPy_ssize_t keylen,
+                               writeValueFunc writeValue, void *arg);
+
+static HPy make_torrent(HPy self, HPy args, HPy kwargs);
+static HPy hash_selftest(HPy self, HPy data);
+
+PyDoc_STRVAR(__make_torrent_doc__,
+             "_make_torrent(files, name, piece_length, /, *, version=1, threads=1, "
+             "fields=None, info=None) -> bytes\n"
+             "--\n\n"
+             "hash files and encode a torrent, use bencode_c.make_torrent instead.\n\n"
+             "files: list of (path, path components, size), components is empty for single "
+             "file torrent.\n"
+             "version: 1 for BEP 3, 2 for BEP 52, 3 for hybrid.\n"
+             "fields, info: extra keys of torrent and info dict.");
+
+PyDoc_STRVAR(__hash_selftest_doc__,
+             "_hash_selftest(data, /) -> tuple[bytes, bytes, bytes, bytes]\n"
+             "--\n\n"
+             "sha1 and sha256 of data by portable code, then by functions selected for current "
+             "cpu, for tests only.");
+PyMethodDef torrentImpl[] = {{
+                                 .ml_name = "_make_torrent",
+                                 .ml_meth = (PyCFunction)(void (*)(void))make_torrent,
+                                 .ml_flags = METH_VARARGS | METH_KEYWORDS,
+                                 .ml_doc = __make_torrent_doc__,
+                             },
+                             {
+                                 .ml_name = "_hash_selftest",
+                                 .ml_meth = (PyCFunction)hash_selftest,
+                                 .ml_flags = METH_O,
+                                 .ml_doc = __hash_selftest_doc__,
+                             },
+                             {NULL, NULL, 0, NULL}};
+
+// v2 leaf block size.
+#define merkleBlockSize 16384
+#define minPieceLength merkleBlockSize
+
+#define versionV1 1
+#define versionV2 2
+
+#ifdef _WIN32
+typedef wchar_t pathChar;
+#else
+typedef char pathChar;
+#endif
+
+typedef struct torrentFile {
+  // borrowed from input, for error message.
+  HPy pathObj;
+  // file system encoded path, owned.
+  pathChar *path;
+  HPy components;
+  int64_t size;
+  // offset in concatenated content, files are aligned to pieces in v2 and hybrid.
+  int64_t offset;
+} TorrentFile;
+
+enum workerError {
+  workerOk,
+  workerOSError,
+  workerShortFile,
+  workerNoMemory,
+};
+
+typedef struct torrentJob {
+  TorrentFile *files;
+  Py_ssize_t fileCount;
+  int64_t pieceLength;
+  int64_t totalSize;
+  int64_t pieceCount;
+  int version;
+  // merkle levels from 16KiB blocks to pieces.
+  int pieceLevels;
+
+  // v1, sha1 of each piece.
+  unsigned char *pieces;
+  // v2, merkle root of each piece, used for files larger than a piece.
+  unsigned char *pieceLayer;
+  // v2, pieces root of files not larger than a piece.
+  unsigned char *fileRoots;
+
+  Mutex lock;
+  int64_t nextPiece;
+  enum workerError err;
+  int errNo;
+  Py_ssize_t errFile;
+} TorrentJob;
+
+typedef struct worker {
+  TorrentJob *job;
+  unsigned char *buf;
+  unsigned char *leaves;
+  Py_ssize_t openFile;
+  int fd;
+} Worker;
+
+static void workerFail(Worker *w, enum workerError err, int errNo, Py_ssize_t file) {
+  TorrentJob *job = w->job;
+  mutexLock(&job->lock);
+  if (job->err == workerOk) {
+    job->err = err;
+    job->errNo = errNo;
+    job->errFile = file;
+  }
+  mutexUnlock(&job->lock);
+}
+
+static int fileOpen(const pathChar *path) {
+#ifdef _WIN32
+  return _wopen(path, _O_RDONLY | _O_BINARY | _O_SEQUENTIAL);
+#else
+  int fd = open(path, O_RDONLY);
+#if defined(POSIX_FADV_SEQUENTIAL)
+  if (fd >= 0) {
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  }
+#endif
+  return fd;
+#endif
+}
+
+static void fileClose(int fd) {
+#ifdef _WIN32
+  _close(fd);
+#else
+  close(fd);
+#endif
+}
+
+// read size bytes at offset, return bytes read, less than size at end of file, -1 on error.
+static int64_t fileReadAt(int fd, unsigned char *buf, int64_t size, int64_t offset) {
+  int64_t done = 0;
+#ifdef _WIN32
+  if (_lseeki64(fd, offset, SEEK_SET) < 0) {
+    return -1;
+  }
+#endif
+  while (done < size) {
+#ifdef _WIN32
+    int n = _read(fd, buf + done, (unsigned int)(size - done));
+#else
+    ssize_t n = pread(fd, buf + done, size - done, offset + done);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+#endif
+    if (n < 0) {
+      return -1;
+    }
+    if (n == 0) {
+      break;
+    }
+    done += n;
+  }
+  return done;
+}
+
+// read part of a file to dst. return 0 on success.
+static int workerRead(Worker *w, Py_ssize_t i, int64_t offset, unsigned char *dst, int64_t size) {
+  if (w->openFile != i) {
+    if (w->fd >= 0) {
+      fileClose(w->fd);
+    }
+    w->openFile = i;
+    w->fd = fileOpen(w->job->files[i].path);
+    if (w->fd < 0) {
+      workerFail(w, workerOSError, errno, i);
+      return 1;
+    }
+  }
+
+  int64_t n = fileReadAt(w->fd, dst, size, offset);
+  if (n < 0) {
+    workerFail(w, workerOSError, errno, i);
+    return 1;
+  }
+  if (n != size) {
+    workerFail(w, workerShortFile, 0, i);
+    return 1;
+  }
+  return 0;
+}
+
+// file containing content at offset, or first file after it.
+static Py_ssize_t findFile(TorrentJob *job, int64_t offset) {
+  Py_ssize_t lo = 0, hi = job->fileCount;
+  while (lo < hi) {
+    Py_ssize_t mid = lo + (hi - lo) / 2;
+    if (job->files[mid].offset + job->files[mid].size <= offset) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+static int ceilLog2(int64_t n) {
+  int l = 0;
+  while (((int64_t)1 << l) < n) {
+    l++;
+  }
+  return l;
+}
+
+static const unsigned char zeroHash[sha256DigestSize] = {0};
+
+static int hashPiece(Worker *w, int64_t piece) {
+  TorrentJob *job = w->job;
+  int64_t start = piece * job->pieceLength;
+  int64_t end = start + job->pieceLength < job->totalSize ? start + job->pieceLength
+                                                          : job->totalSize;
+
+  // gaps between files are padding of hybrid torrent.
+  int64_t pos = start;
+  Py_ssize_t first = findFile(job, start);
+  for (Py_ssize_t i = first; i < job->fileCount && job->files[i].offset < end; i++) {
+    TorrentFile *f = &job->files[i];
+    if (f->size == 0) {
+      continue;
+    }
+    int64_t from = f->offset > pos ? f->offset : pos;
+    int64_t to = f->offset + f->size < end ? f->offset + f->size : end;
+    memset(w->buf + (pos - start), 0, from - pos);
+    if (workerRead(w, i, from - f->offset, w->buf + (from - start), to - from)) {
+      return 1;
+    }
+    pos = to;
+  }
+  memset(w->buf + (pos - start), 0, end - pos);
+
+  if (job->version & versionV1) {
+    sha1(w->buf, end - start, job->pieces + piece * sha1DigestSize);
+  }
+
+  if (job->version & versionV2) {
+    // files are aligned to pieces, so piece is content of one file and maybe padding.
+    TorrentFile *f = &job->files[first];
+    int64_t size = f->offset + f->size - start;
+    if (size > end - start) {
+      size = end - start;
+    }
+
+    int64_t blocks = (size + merkleBlockSize - 1) / merkleBlockSize;
+    for (int64_t b = 0; b < blocks; b++) {
+      int64_t n = size - b * merkleBlockSize;
+      sha256(w->buf + b * merkleBlockSize, n < merkleBlockSize ? n : merkleBlockSize,
+             w->leaves + b * sha256DigestSize);
+    }
+
+    if (f->size <= job->pieceLength) {
+      merkleRoot(w->leaves, blocks, ceilLog2(blocks), zeroHash,
+                 job->fileRoots + first * sha256DigestSize);
+    } else {
+      merkleRoot(w->leaves, blocks, job->pieceLevels, zeroHash,
+                 job->pieceLayer + piece * sha256DigestSize);
+    }
+  }
+
+  return 0;
+}
+
+static threadResult threadCall hashWorker(void *arg) {
+  Worker *w = (Worker *)arg;
+  TorrentJob *job = w->job;
+
+  w->openFile = -1;
+  w->fd = -1;
+  w->buf = malloc(job->pieceLength);
+  w->leaves = malloc(job->pieceLength / merkleBlockSize * sha256DigestSize);
+  if (w->buf == NULL || w->leaves == NULL) {
+    workerFail(w, workerNoMemory, 0, 0);
+  }
+
+  // pieces are taken in order, so concurrent reads stay close to each other.
+  for (;;) {
+    mutexLock(&job->lock);
+    int64_t piece = job->nextPiece++;
+    int stop = job->err != workerOk || piece >= job->pieceCount;
+    mutexUnlock(&job->lock);
+
+    if (stop || hashPiece(w, piece)) {
+      break;
+    }
+  }
+
+  if (w->fd >= 0) {
+    fileClose(w->fd);
+  }
+  free(w->buf);
+  free(w->leaves);
+  return (threadResult)0;
+}
+
+// hash all pieces with count threads, calling thread is one of them.
+// return 0 on success, or 1 with python exception set.
+static int runWorkers(TorrentJob *job, int count) {
+  Worker *workers = calloc(count, sizeof(Worker));
+  Thread *threads = calloc(count, sizeof(Thread));
+  if (workers == NULL || threads == NULL) {
+    free(workers);
+    free(threads);
+    PyErr_NoMemory();
+    return 1;
+  }
+
+  int started = 1;
+
+  Py_BEGIN_ALLOW_THREADS;
+  for (int i = 0; i < count; i++) {
+    workers[i].job = job;
+  }
+  for (; started < count; started++) {
+    // if a thread can't be started, the job is still done by started ones.
+    if (threadStart(&threads[started], hashWorker, &workers[started])) {
+      break;
+    }
+  }
+  hashWorker(&workers[0]);
+  for (int i = 1; i < started; i++) {
+    threadJoin(threads[i]);
+  }
+  Py_END_ALLOW_THREADS;
+
+  free(workers);
+  free(threads);
+
+  switch (job->err) {
+  case workerOk:
+    return 0;
+  case workerNoMemory:
+    PyErr_NoMemory();
+    return 1;
+  case workerOSError:
+    errno = job->errNo;
+    PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, job->files[job->errFile].pathObj);
+    return 1;
+  case workerShortFile:
+    PyErr_Format(PyExc_OSError, "file %R is smaller than its size when hashing started",
+                 job->files[job->errFile].pathObj);
+    return 1;
+  }
+
+  return 0;
+}
+
+static void freeFiles(TorrentFile *files, Py_ssize_t count) {
+  for (Py_ssize_t i = 0; i < count; i++) {
+#ifdef _WIN32
+    PyMem_Free(files[i].path);
+#else
+    free(files[i].path);
+#endif
+  }
+  free(files);
+}
+
+static pathChar *fsPath(HPy path) {
+#ifdef _WIN32
+  return PyUnicode_AsWideCharString(path, NULL);
+#else
+  HPy b = PyUnicode_EncodeFSDefault(path);
+  if (b == NULL) {
+    return NULL;
+  }
+  Py_ssize_t len = PyBytes_Size(b);
+  char *s = malloc(len + 1);
+  if (s == NULL) {
+    PyErr_NoMemory();
+  } else {
+    memcpy(s, PyBytes_AsString(b), len + 1);
+  }
+  Py_DecRef(b);
+  return s;
+#endif
+}
+
+static int parseFiles(HPy list, TorrentJob *job) {
+  if (!PyList_Check(list)) {
+    PyErr_SetString(PyExc_TypeError, "files must be a list");
+    return 1;
+  }
+
+  job->fileCount = PyList_Size(list);
+  job->files = calloc(job->fileCount ? job->fileCount : 1, sizeof(TorrentFile));
+  if (job->files == NULL) {
+    PyErr_NoMemory();
+    return 1;
+  }
+
+  int aligned = (job->version & versionV2) != 0;
+  int64_t offset = 0;
+  for (Py_ssize_t i = 0; i < job->fileCount; i++) {
+    TorrentFile *f = &job->files[i];
+    long long size;
+    if (!PyArg_ParseTuple(PyList_GetItem(list, i), "UO!L", &f->pathObj, &PyList_Type,
+                          &f->components, &size)) {
+      return 1;
+    }
+    if (size < 0) {
+      PyErr_SetString(PyExc_ValueError, "file size must not be negative");
+      return 1;
+    }
+
+    f->path = fsPath(f->pathObj);
+    if (f->path == NULL) {
+      return 1;
+    }
+
+    // v2 hash files separately, so every file start at a new piece.
+    // padding is only added before a non empty file.
+    if (aligned && size != 0 && offset % job->pieceLength != 0) {
+      offset += job->pieceLength - offset % job->pieceLength;
+    }
+    f->size = size;
+    f->offset = offset;
+    offset += size;
+  }
+
+  job->totalSize = offset;
+  job->pieceCount = (offset + job->pieceLength - 1) / job->pieceLength;
+  return 0;
+}
+
+static int dictSetSteal(HPy d, const char *key, HPy value) {
+  if (value == NULL) {
+    return 1;
+  }
+  int err = PyDict_SetItemString(d, key, value);
+  Py_DecRef(value);
+  return err;
+}
+
+// v1 'files' list, with BEP 47 padding files in hybrid torrent.
+static HPy buildFileList(TorrentJob *job) {
+  HPy list = PyList_New(0);
+  if (list == NULL) {
+    return NULL;
+  }
+
+  int64_t end = 0;
+  for (Py_ssize_t i = 0; i < job->fileCount; i++) {
+    TorrentFile *f = &job->files[i];
+    if (f->offset > end) {
+      int64_t padSize = f->offset - end;
+      HPy pad = PyDict_New();
+      if (pad == NULL) {
+        goto __Error;
+      }
+      HPy path = Py_BuildValue("[sN]", ".pad", PyUnicode_FromFormat("%lld", (long long)padSize));
+      int err = dictSetSteal(pad, "path", path) ||
+                dictSetSteal(pad, "attr", PyBytes_FromString("p")) ||
+                dictSetSteal(pad, "length", PyLong_FromLongLong(padSize)) ||
+                PyList_Append(list, pad);
+      Py_DecRef(pad);
+      if (err) {
+        goto __Error;
+      }
+    }
+
+    HPy item = PyDict_New();
+    if (item == NULL) {
+      goto __Error;
+    }
+    Py_INCREF(f->components);
+    int err = dictSetSteal(item, "length", PyLong_FromLongLong(f->size)) ||
+              dictSetSteal(item, "path", f->components) || PyList_Append(list, item);
+    Py_DecRef(item);
+    if (err) {
+      goto __Error;
+    }
+    end = f->offset + f->size;
+  }
+
+  return list;
+
+__Error:
+  Py_DecRef(list);
+  return NULL;
+}
+
+static HPy pieceHashBytes(const unsigned char *h) {
+  return PyBytes_FromStringAndSize((const char *)h, sha256DigestSize);
+}
+
+// v2 'file tree' and top level 'piece layers'.
+static int buildFileTree(TorrentJob *job, HPy name, HPy tree, HPy layers) {
+  Py_ssize_t maxPieces = 0;
+  for (Py_ssize_t i = 0; i < job->fileCount; i++) {
+    int64_t n = (job->files[i].size + job->pieceLength - 1) / job->pieceLength;
+    maxPieces = n > maxPieces ? n : maxPieces;
+  }
+
+  unsigned char *scratch = malloc((maxPieces ? maxPieces : 1) * sha256DigestSize);
+  if (scratch == NULL) {
+    PyErr_NoMemory();
+    return 1;
+  }
+
+  // root of a piece which is all padding, pad of upper levels.
+  unsigned char padPiece[sha256DigestSize];
+  memcpy(padPiece, zeroHash, sha256DigestSize);
+  for (int l = 0; l < job->pieceLevels; l++) {
+    sha256Pair(padPiece, padPiece, padPiece);
+  }
+
+  for (Py_ssize_t i = 0; i < job->fileCount; i++) {
+    TorrentFile *f = &job->files[i];
+
+    // {"": {"length": size, "pieces root": root}}, meta is borrowed from leaf.
+    HPy leaf = PyDict_New();
+    if (leaf == NULL) {
+      goto __Error;
+    }
+    HPy meta = PyDict_New();
+    if (dictSetSteal(leaf, "", meta) ||
+        dictSetSteal(meta, "length", PyLong_FromLongLong(f->size))) {
+      Py_DecRef(leaf);
+      goto __Error;
+    }
+
+    if (f->size > job->pieceLength) {
+      int64_t first = f->offset / job->pieceLength;
+      int64_t count = (f->size + job->pieceLength - 1) / job->pieceLength;
+      const unsigned char *layer = job->pieceLayer + first * sha256DigestSize;
+      unsigned char root[sha256DigestSize];
+      memcpy(scratch, layer, count * sha256DigestSize);
+      merkleRoot(scratch, count, ceilLog2(count), padPiece, root);
+
+      HPy key = pieceHashBytes(root);
+      HPy value = PyBytes_FromStringAndSize((const char *)layer, count * sha256DigestSize);
+      int err = key == NULL || value == NULL || PyDict_SetItem(layers, key, value) ||
+                PyDict_SetItemString(meta, "pieces root", key);
+      Py_XDECREF(key);
+      Py_XDECREF(value);
+      if (err) {
+        Py_DecRef(leaf);
+        goto __Error;
+      }
+    } else if (f->size != 0) {
+      if (dictSetSteal(meta, "pieces root",
+                       pieceHashBytes(job->fileRoots + i * sha256DigestSize))) {
+        Py_DecRef(leaf);
+        goto __Error;
+      }
+    }
+
+    // single file torrent is a tree of one file named as torrent.
+    HPy node = tree;
+    Py_ssize_t depth = PyList_Size(f->components);
+    HPy fileName = depth ? PyList_GetItem(f->components, depth - 1) : name;
+    for (Py_ssize_t d = 0; d + 1 < depth; d++) {
+      HPy part = PyList_GetItem(f->components, d);
+      HPy child = PyDict_GetItem(node, part);
+      if (child == NULL) {
+        child = PyDict_New();
+        if (child == NULL || PyDict_SetItem(node, part, child)) {
+          Py_XDECREF(child);
+          Py_DecRef(leaf);
+          goto __Error;
+        }
+        Py_DecRef(child);
+      } else if (!PyDict_Check(child)) {
+        PyErr_Format(PyExc_ValueError, "path %R is both a file and a directory", part);
+        Py_DecRef(leaf);
+        goto __Error;
+      }
+      node = child;
+    }
+
+    if (PyDict_GetItem(node, fileName) != NULL) {
+      PyErr_Format(PyExc_ValueError, "duplicated file path %R", fileName);
+      Py_DecRef(leaf);
+      goto __Error;
+    }
+    int err = PyDict_SetItem(node, fileName, leaf);
+    Py_DecRef(leaf);
+    if (err) {
+      goto __Error;
+    }
+  }
+
+  free(scratch);
+  return 0;
+
+__Error:
+  free(scratch);
+  return 1;
+}
+
+static int writePieces(Context *ctx, void *arg) {
+  TorrentJob *job = (TorrentJob *)arg;
+  HPy_ssize_t size = job->pieceCount * sha1DigestSize;
+  returnIfError(bufferWriteFormat(ctx, "%zd:", size));
+  return bufferWrite(ctx, (const char *)job->pieces, size);
+}
+
+typedef struct infoArg {
+  TorrentJob *job;
+  HPy info;
+} InfoArg;
+
+static int writeMetaVersion(Context *ctx, void *arg) { return bufferWrite(ctx, "i2e", 3); }
+
+static int writeInfo(Context *ctx, void *arg) {
+  InfoArg *a = (InfoArg *)arg;
+  if (a->job->version & versionV1) {
+    return encodeDictWithValue(ctx, a->info, "pieces", 6, writePieces, a->job);
+  }
+  // v2 only info has no pieces, and 'meta version' is not in info dict.
+  return encodeDictWithValue(ctx, a->info, "meta version", 12, writeMetaVersion, NULL);
+}
+
+static HPy buildInfo(TorrentJob *job, HPy extra, HPy name, HPy layers) {
+  HPy info = extra == Py_None ? PyDict_New() : PyDict_Copy(extra);
+  if (info == NULL) {
+    return NULL;
+  }
+
+  Py_INCREF(name);
+  if (dictSetSteal(info, "name", name) ||
+      dictSetSteal(info, "piece length", PyLong_FromLongLong(job->pieceLength))) {
+    goto __Error;
+  }
+
+  if (job->version & versionV1) {
+    // single file torrent has no path components.
+    int single = job->fileCount == 1 && PyList_Size(job->files[0].components) == 0;
+    if (single ? dictSetSteal(info, "length", PyLong_FromLongLong(job->files[0].size))
+               : dictSetSteal(info, "files", buildFileList(job))) {
+      goto __Error;
+    }
+  }
+
+  if (job->version & versionV2) {
+    HPy tree = PyDict_New();
+    if (tree == NULL) {
+      goto __Error;
+    }
+    if (dictSetSteal(info, "file tree", tree) || buildFileTree(job, name, tree, layers)) {
+      goto __Error;
+    }
+    if ((job->version & versionV1) &&
+        dictSetSteal(info, "meta version", PyLong_FromLong(2))) {
+      goto __Error;
+    }
+  }
+
+  return info;
+
+__Error:
+  Py_DecRef(info);
+  return NULL;
+}
+
+static HPy make_torrent(HPy self, HPy args, HPy kwargs) {
+  static char *kwlist[] = {"", "", "", "version", "threads", "fields", "info", NULL};
+
+  HPy files;
+  HPy name;
+  long long pieceLength;
+  int version = versionV1;
+  int threads = 1;
+  HPy fields = Py_None;
+  HPy infoExtra = Py_None;
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OUL|$iiOO:_make_torrent", kwlist, &files, &name,
+                                   &pieceLength, &version, &threads, &fields, &infoExtra)) {
+    return NULL;
+  }
+
+  if (pieceLength < minPieceLength || (pieceLength & (pieceLength - 1)) != 0) {
+    PyErr_SetString(PyExc_ValueError, "piece_length must be a power of 2 and at least 16 KiB");
+    return NULL;
+  }
+  if (version < versionV1 || version > (versionV1 | versionV2)) {
+    PyErr_SetString(PyExc_ValueError, "version must be 1, 2 or 3 (hybrid)");
+    return NULL;
+  }
+  if (threads < 1) {
+    PyErr_SetString(PyExc_ValueError, "threads must be positive");
+    return NULL;
+  }
+  if ((fields != Py_None && !PyDict_Check(fields)) ||
+      (infoExtra != Py_None && !PyDict_Check(infoExtra))) {
+    PyErr_SetString(PyExc_TypeError, "fields and info must be dict or None");
+    return NULL;
+  }
+
+  TorrentJob job = {
+      .pieceLength = pieceLength,
+      .version = version,
+      .pieceLevels = ceilLog2(pieceLength / merkleBlockSize),
+  };
+  HPy info = NULL;
+  HPy torrent = NULL;
+  HPy layers = NULL;
+  HPy res = NULL;
+
+  if (parseFiles(files, &job)) {
+    goto __CLEAN_UP;
+  }
+
+  size_t pieceSlots = job.pieceCount ? job.pieceCount : 1;
+  job.pieces = malloc(pieceSlots * sha1DigestSize);
+  job.pieceLayer = malloc(pieceSlots * sha256DigestSize);
+  job.fileRoots = malloc((job.fileCount ? job.fileCount : 1) * sha256DigestSize);
+  if (job.pieces == NULL || job.pieceLayer == NULL || job.fileRoots == NULL) {
+    PyErr_NoMemory();
+    goto __CLEAN_UP;
+  }
+
+  if (threads > job.pieceCount) {
+    threads = job.pieceCount ? (int)job.pieceCount : 1;
+  }
+
+  hashInit();
+  mutexInit(&job.lock);
+  int err = runWorkers(&job, threads);
+  mutexDestroy(&job.lock);
+  if (err) {
+    goto __CLEAN_UP;
+  }
+
+  layers = PyDict_New();
+  if (layers == NULL) {
+    goto __CLEAN_UP;
+  }
+  info = buildInfo(&job, infoExtra, name, layers);
+  if (info == NULL) {
+    goto __CLEAN_UP;
+  }
+
+  torrent = fields == Py_None ? PyDict_New() : PyDict_Copy(fields);
+  if (torrent == NULL) {
+    goto __CLEAN_UP;
+  }
+  if ((job.version & versionV2) && PyDict_SetItemString(torrent, "piece layers", layers)) {
+    goto __CLEAN_UP;
+  }
+
+  int bufferAlloc = 0;
+  Context ctx = newContext(&bufferAlloc, initialBufferSize(job.pieceCount * sha1DigestSize +
+                                                           job.fileCount * 64 + 1024));
+  if (bufferAlloc) {
+    goto __CLEAN_UP;
+  }
+
+  InfoArg arg = {.job = &job, .info = info};
+  if (!encodeDictWithValue(&ctx, torrent, "info", 4, writeInfo, &arg)) {
+    res = PyBytes_FromStringAndSize(ctx.out.buf, ctx.out.len);
+  }
+  freeContext(ctx);
+
+__CLEAN_UP:
+  Py_XDECREF(info);
+  Py_XDECREF(torrent);
+  Py_XDECREF(layers);
+  if (job.files != NULL) {
+    freeFiles(job.files, job.fileCount);
+  }
+  free(job.pieces);
+  free(job.pieceLayer);
+  free(job.fileRoots);
+  return res;
+}
+
+// data is fed in two updates split off block boundary, so buffered path of hashUpdate runs too.
+static void hashWith(HashState *s, hashBlocksFunc blocks, const unsigned char *data, size_t len,
+                     unsigned char *out, int words) {
+  size_t split = len / 3;
+  s->blocks = blocks;
+  hashUpdate(s, data, split);
+  hashUpdate(s, data + split, len - split);
+  hashFinal(s, out, words);
+}
+
+static HPy hash_selftest(HPy self, HPy data) {
+#if PY_MINOR_VERSION >= 11
+  Py_buffer view;
+  if (PyObject_GetBuffer(data, &view, PyBUF_SIMPLE)) {
+    return NULL;
+  }
+  const unsigned char *p = (const unsigned char *)view.buf;
+  size_t len = (size_t)view.len;
+#else
+  // buffer protocol is not in limited api before 3.11.
+  if (!PyBytes_Check(data)) {
+    PyErr_SetString(PyExc_TypeError, "data must be bytes");
+    return NULL;
+  }
+  const unsigned char *p = (const unsigned char *)PyBytes_AsString(data);
+  size_t len = (size_t)PyBytes_Size(data);
+#endif
+
+  unsigned char out[4][sha256DigestSize];
+  HashState s;
+
+  hashInit();
+  sha1Init(&s);
+  hashWith(&s, sha1BlocksPortable, p, len, out[0], 5);
+  sha256Init(&s);
+  hashWith(&s, sha256BlocksPortable, p, len, out[1], 8);
+  sha1Init(&s);
+  hashWith(&s, sha1Blocks, p, len, out[2], 5);
+  sha256Init(&s);
+  hashWith(&s, sha256Blocks, p, len, out[3], 8);
+#if PY_MINOR_VERSION >= 11
+  PyBuffer_Release(&view);
+#endif
+
+  return Py_BuildValue("(NNNN)", PyBytes_FromStringAndSize((const char *)out[0], sha1DigestSize),
+                       PyBytes_FromStringAndSize((const char *)out[1], sha256DigestSize),
+                       PyBytes_FromStringAndSize((const char *)out[2], sha1DigestSize),
+                       PyBytes_FromStringAndSize((const char *)out[3], sha256DigestSize));
+}
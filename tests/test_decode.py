@@ -1,8 +1,19 @@
+from array import array
 from typing import Any
 
 import pytest
 
-from bencode_c import BencodeDecodeError, bdecode
+from bencode_c import (
+    BencodeDecodeError,
+    Decoder,
+    bcanonicalize,
+    bdecode,
+    bdecode_columns,
+    bdecode_prefix,
+    bdecode_select,
+    bencode,
+)
+from bencode_c._bencode import __BUILD_PY_MINOR_VERSION__
 
 
 def test_non_bytes_input():
@@ -13,6 +24,13 @@ def test_non_bytes_input():
         bdecode(1)  # type: ignore
 
 
+def test_error_message():
+    with pytest.raises(
+        BencodeDecodeError, match="parse end at index 3 but total bytes length 6"
+    ):
+        bdecode(b"i1ei2e")
+
+
 @pytest.mark.parametrize(
     ["raw", "expected"],
     [
@@ -72,6 +90,17 @@ def test_decode_str():
         # directory keys not sorted for {'foo': 1, 'spam': 2}
         b"d3:foo4:spam3:bari42e",
         b"d3:foo4:spam3:bari42ee",
+        b"i-e",
+        b"d:i1ee",  # missing key length
+        b"l1:ai1e",  # missing list end
+        b"d1:ai1e",  # missing dict end
+        b"d1:a",  # missing dict value
+        b"99999999999999999999999999:a",  # length overflow
+        b"9223372036854775807:a",
+        b"1",
+        b"1" * 100,
+        b"i1844674407370955161600x0e",  # invalid char after overflow
+        b"i-92233720368547758090000000000000000000000a0e",
     ],
 )
 def test_bad_case(raw: bytes):
@@ -104,6 +133,18 @@ def test_list(raw: bytes, expected: Any):
         # long long int range -9223372036854775808, 9223372036854775807
         (b"i-9223372036854775808e", -9223372036854775808),
         (b"i9223372036854775808e", 9223372036854775808),
+        (b"i20000000000000000000e", 20000000000000000000),
+        # int128 range
+        (b"i-9223372036854775809e", -9223372036854775809),
+        (b"i170141183460469231731687303715884105727e", 2**127 - 1),
+        (b"i-170141183460469231731687303715884105728e", -(2**127)),
+        (b"i340282366920938463463374607431768211455e", 2**128 - 1),
+        (b"i99999999999999999999999999999999999999e", 10**38 - 1),
+        # larger than int128, decoded in chunks
+        (b"i340282366920938463463374607431768211456e", 2**128),
+        (b"i100000000000000000000000000000000000000e", 10**38),
+        (b"i-" + b"1234567890" * 10 + b"e", -int("1234567890" * 10)),
+        (b"i1" + b"0" * 200 + b"e", 10**200),
         (b"le", []),
         (b"l4:spam4:eggse", [b"spam", b"eggs"]),
         # (b"de", {}),
@@ -125,14 +166,368 @@ def test_decode1():
     }
 
 
-#
-#
-# @pytest.mark.parametrize(
-#     ["raw", "expected"],
-#     [
-#         (b"d3:cow3:moo4:spam4:eggse", {"cow": b"moo", "spam": b"eggs"}),
-#         (b"d4:spaml1:a1:bee", {"spam": [b"a", b"b"]}),
-#     ],
-# )
-# def test_dict_str_key(raw: bytes, expected: Any):
-#     assert bdecode(raw, str_key=True) == expected
+@pytest.mark.parametrize(
+    ["raw", "expected"],
+    [
+        (b"d3:cow3:moo4:spam4:eggse", {"cow": b"moo", "spam": b"eggs"}),
+        (b"d4:spaml1:a1:bee", {"spam": [b"a", b"b"]}),
+        # invalid utf-8 key fallback to bytes
+        (b"d1:\xff1:ae", {b"\xff": b"a"}),
+    ],
+)
+def test_dict_str_key(raw: bytes, expected: Any):
+    assert bdecode(raw, str_key=True) == expected
+
+
+def test_str_value_all():
+    raw = b"d4:name6:\xe4\xbd\xa0\xe5\xa5\xbd4:pathl1:a1:be6:pieces2:\xff\xfee"
+    assert bdecode(raw, str_value=True) == {
+        b"name": "你好",
+        b"pieces": b"\xff\xfe",
+        b"path": ["a", "b"],
+    }
+    assert bdecode(raw, str_key=True, str_value=True) == {
+        "name": "你好",
+        "pieces": b"\xff\xfe",
+        "path": ["a", "b"],
+    }
+
+
+def test_str_value_keys():
+    raw = b"d8:announce3:url4:infod4:name1:n4:pathl1:ae6:pieces1:pee"
+    assert bdecode(raw, str_value=[b"announce", "path"]) == {
+        b"announce": "url",
+        b"info": {b"name": b"n", b"path": ["a"], b"pieces": b"p"},
+    }
+
+    with pytest.raises(TypeError):
+        bdecode(raw, str_value=[1])
+
+
+@pytest.mark.parametrize(
+    "raw",
+    [
+        b"\xc0\x80",  # overlong
+        b"\xed\xa0\x80",  # surrogate
+        b"\xf4\x90\x80\x80",  # > U+10FFFF
+        b"\xe4\xbd",  # truncated
+        b"abcdefgh\xe4",
+    ],
+)
+def test_str_value_invalid_utf8(raw: bytes):
+    assert bdecode(str(len(raw)).encode() + b":" + raw, str_value=True) == raw
+
+
+def test_binary_key_order():
+    assert bdecode(b"d2:\x00ai1e2:\x00bi2ee") == {b"\x00a": 1, b"\x00b": 2}
+
+    with pytest.raises(BencodeDecodeError):
+        bdecode(b"d2:\x00bi1e2:\x00ai2ee")
+
+
+def test_max_depth():
+    assert bdecode(b"l" * 1000 + b"e" * 1000)
+
+    with pytest.raises(BencodeDecodeError, match="max nesting depth"):
+        bdecode(b"l" * 1001 + b"e" * 1001)
+
+    with pytest.raises(BencodeDecodeError, match="max nesting depth"):
+        bdecode(b"l" * 1_000_000)
+
+    with pytest.raises(BencodeDecodeError, match="max nesting depth"):
+        bdecode(b"d1:a" * 1_000_000)
+
+
+def test_bytes_as_memoryview():
+    raw = b"d5:filesl4:spame6:pieces20:" + b"x" * 20 + b"e"
+    value = bdecode(raw, bytes_as_memoryview=True)
+
+    assert list(value) == [b"files", b"pieces"]
+    pieces = value[b"pieces"]
+    assert isinstance(pieces, memoryview)
+    assert pieces.readonly
+    assert pieces.obj is raw
+    assert pieces == b"x" * 20
+    assert value[b"files"][0] == b"spam"
+
+
+def test_memoryview_threshold():
+    raw = b"d5:filesl4:spame6:pieces20:" + b"x" * 20 + b"e"
+    value = bdecode(raw, bytes_as_memoryview=True, memoryview_threshold=10)
+
+    assert isinstance(value[b"pieces"], memoryview)
+    assert type(value[b"files"][0]) is bytes
+
+
+def test_memoryview_str_value():
+    raw = b"d4:name4:spam6:pieces2:\xff\xffe"
+    value = bdecode(raw, bytes_as_memoryview=True, str_value=True)
+
+    assert value[b"name"] == "spam"
+    assert isinstance(value[b"pieces"], memoryview)
+
+
+SELECT_RAW = bencode(
+    {
+        b"announce": b"http://tracker",
+        b"announce-list": [[b"a", b"b"], [b"c"]],
+        b"info": {
+            b"files": [
+                {b"length": 1, b"path": [b"a"]},
+                {b"length": 2, b"path": [b"b", b"c"]},
+                {b"path": [b"d"]},
+            ],
+            b"name": b"dir",
+            b"pieces": b"x" * 40,
+        },
+    }
+)
+
+
+@pytest.mark.parametrize(
+    ["path", "expected"],
+    [
+        ((), bdecode(SELECT_RAW)),
+        ((b"info", b"name"), b"dir"),
+        (("info", "name"), b"dir"),
+        ((b"announce-list",), [[b"a", b"b"], [b"c"]]),
+        ((b"announce-list", 1, 0), b"c"),
+        ((b"info", b"files", ..., b"length"), [1, 2]),
+        ((b"info", b"files", ..., b"path", ...), [b"a", b"b", b"c", b"d"]),
+        ((b"info", ...), [bdecode(SELECT_RAW)[b"info"][b"files"], b"dir", b"x" * 40]),
+        ((b"info", b"missing"), None),
+        ((b"info", b"name", b"not-dict"), None),
+        ((b"announce-list", 5), None),
+        ((b"info", 0), None),
+        ((b"missing", ...), []),
+    ],
+)
+def test_bdecode_select(path, expected):
+    assert bdecode_select(SELECT_RAW, [path]) == [expected]
+
+
+def test_bdecode_select_multiple_paths():
+    assert bdecode_select(
+        SELECT_RAW,
+        [(b"info", b"name"), (b"info",), (b"info", b"files", 1, b"length")],
+    ) == [b"dir", bdecode(SELECT_RAW)[b"info"], 2]
+    assert bdecode_select(SELECT_RAW, []) == []
+
+
+@pytest.mark.parametrize(
+    "raw",
+    [
+        b"",
+        b"d4:infod4:name3:dire",
+        b"d4:infod4:name3:dire1:ai1ee",
+        b"d4:infod4:name3:diree1",
+        b"d4:infod1:bi1e1:ai1eee",
+        b"d4:infod4:name3:dir5:piecei-0eee",
+    ],
+)
+def test_bdecode_select_invalid(raw):
+    with pytest.raises(BencodeDecodeError):
+        bdecode_select(raw, [(b"info", b"name")])
+
+
+def test_bdecode_select_invalid_path():
+    with pytest.raises(TypeError):
+        bdecode_select(SELECT_RAW, [(1.0,)])
+    with pytest.raises(ValueError):
+        bdecode_select(SELECT_RAW, [(b"announce-list", -1)])
+    with pytest.raises(TypeError):
+        bdecode_select(SELECT_RAW, [1])
+
+
+def test_bdecode_columns():
+    columns = bdecode_columns(
+        SELECT_RAW,
+        (b"info", b"files"),
+        {b"length": int, "path": object, b"attr": bytes},
+    )
+    assert columns == {
+        b"length": array("q", [1, 2, 0]),
+        "path": [[b"a"], [b"b", b"c"], [b"d"]],
+        b"attr": [None, None, None],
+    }
+
+    raw = bencode(
+        [[{b"a": -(2**63), b"s": "\u4e2d"}], [{b"a": 2**63 - 1, b"s": b"\xff"}]]
+    )
+    assert bdecode_columns(raw, [...], {b"a": int, b"s": str}) == {
+        b"a": array("q", [-(2**63), 2**63 - 1]),
+        b"s": ["\u4e2d", b"\xff"],
+    }
+    assert bdecode_columns(SELECT_RAW, (b"missing",), {b"length": int}) == {
+        b"length": array("q")
+    }
+
+
+def test_bdecode_columns_default():
+    raw = bencode([{b"mtime": 0, b"name": b""}, {}])
+    fields = {b"mtime": (int, -1), b"name": (bytes, b"?"), b"x": (object, [])}
+    assert bdecode_columns(raw, (), fields) == {
+        b"mtime": array("q", [0, -1]),
+        b"name": [b"", b"?"],
+        b"x": [[], []],
+    }
+
+
+@pytest.mark.parametrize(
+    ["raw", "exc"],
+    [
+        (b"d1:ai1ee", BencodeDecodeError),
+        (b"li1ee", BencodeDecodeError),
+        (b"ld1:a1:xee", BencodeDecodeError),
+        (b"ld1:ai01eee", BencodeDecodeError),
+        (b"ld1:ai-0eee", BencodeDecodeError),
+        (b"ld1:bi1e1:ai1eee", BencodeDecodeError),
+        (b"ld1:ai1ee", BencodeDecodeError),
+        (b"ld1:ai9223372036854775808eee", OverflowError),
+    ],
+)
+def test_bdecode_columns_invalid(raw, exc):
+    with pytest.raises(exc):
+        bdecode_columns(raw, (), {b"a": int})
+
+
+def test_bdecode_columns_invalid_fields():
+    with pytest.raises(TypeError):
+        bdecode_columns(SELECT_RAW, (), {b"a": float})
+    with pytest.raises(ValueError):
+        bdecode_columns(SELECT_RAW, (), {b"a": int, "a": bytes})
+    with pytest.raises(TypeError):
+        bdecode_columns(SELECT_RAW, (), {b"a": (int, None)})
+    with pytest.raises(TypeError):
+        bdecode_columns(SELECT_RAW, (), {b"a": (int, "0")})
+    with pytest.raises(OverflowError):
+        bdecode_columns(SELECT_RAW, (), {b"a": (int, 2**63)})
+
+
+@pytest.mark.parametrize(
+    ["raw", "expected", "canonical"],
+    [
+        (b"i007e", 7, b"i7e"),
+        (b"i-007e", -7, b"i-7e"),
+        (b"i-0e", 0, b"i0e"),
+        (b"i000e", 0, b"i0e"),
+        (b"i00000000000000000000000000000000000000001e", 1, b"i1e"),
+        (b"004:spam", b"spam", b"4:spam"),
+        (b"d1:bi1e1:ai2ee", {b"b": 1, b"a": 2}, b"d1:ai2e1:bi1ee"),
+        (b"d1:ai1e1:ai2ee", {b"a": 2}, b"d1:ai2ee"),
+        (b"d1:bi1e1:ai1e1:bi2ee", {b"b": 2, b"a": 1}, b"d1:ai1e1:bi2ee"),
+        (
+            b"ld01:bd1:zi0e1:yi01ee1:ai1eee",
+            [{b"b": {b"z": 0, b"y": 1}, b"a": 1}],
+            b"ld1:ai1e1:bd1:yi1e1:zi0eeee",
+        ),
+        (b"d1:ai1e1:bi2ee", {b"a": 1, b"b": 2}, b"d1:ai1e1:bi2ee"),
+    ],
+)
+def test_lenient(raw, expected, canonical):
+    assert bdecode(raw, strict=False) == expected
+    assert bcanonicalize(raw) == canonical
+    assert bdecode(canonical) == bdecode(canonical, strict=False)
+    assert bcanonicalize(canonical) == canonical
+
+
+@pytest.mark.parametrize(
+    "raw",
+    [b"", b"i-e", b"ie", b"i1", b"d1:ai1e", b"di1ei1ee", b"l", b"5:spam", b"i1ei2e", b"x"],
+)
+def test_bcanonicalize_invalid(raw):
+    with pytest.raises(BencodeDecodeError):
+        bcanonicalize(raw)
+    with pytest.raises(BencodeDecodeError):
+        bdecode(raw, strict=False)
+
+
+def test_bdecode_prefix():
+    # BEP 9 ut_metadata data message, dict followed by metadata piece.
+    header = b"d8:msg_typei1e5:piecei0e10:total_sizei3ee"
+    msg = header + b"abc"
+    value, end = bdecode_prefix(msg)
+    assert value == {b"msg_type": 1, b"piece": 0, b"total_size": 3}
+    assert end == len(header)
+    assert msg[end:] == b"abc"
+
+    assert bdecode_prefix(b"xxi1e", 2) == (1, 5)
+    assert bdecode_prefix(b"4:spam", str_value=True) == ("spam", 6)
+
+    value, end = bdecode_prefix(b"\x00" + b"5:hello!", 1, bytes_as_memoryview=True)
+    assert isinstance(value, memoryview)
+    assert value == b"hello"
+    assert end == 8
+
+
+@pytest.mark.parametrize(
+    ["raw", "offset"],
+    [(b"", 0), (b"i1e", 3), (b"i1e", -1), (b"i1", 0), (b"l1:a", 0), (b"xi1e", 0)],
+)
+def test_bdecode_prefix_invalid(raw: bytes, offset: int):
+    with pytest.raises(BencodeDecodeError):
+        bdecode_prefix(raw, offset)
+
+
+@pytest.mark.skipif(
+    __BUILD_PY_MINOR_VERSION__ < 11,
+    reason="buffer protocol is only in limited api since 3.11",
+)
+def test_bdecode_prefix_buffer():
+    buf = bytearray(b"d1:ai1eeXYZ")
+    value, end = bdecode_prefix(memoryview(buf))
+    assert value == {b"a": 1}
+    assert buf[end:] == b"XYZ"
+
+
+def test_decoder_cache():
+    d = Decoder(2, str_key=True)
+    raw = bencode({"interval": 1800, "peers": [{"ip": b"1.2.3.4"}]})
+
+    r1 = d.decode(raw)
+    # a different bytes object of same content.
+    r2 = d.decode(bytes(bytearray(raw)))
+    assert r1 == r2 == {"interval": 1800, "peers": [{"ip": b"1.2.3.4"}]}
+    assert (d.hits, d.misses, len(d)) == (1, 1, 1)
+
+    # dicts and lists are copied, cached result is not changed by caller.
+    assert r1 is not r2 and r1["peers"][0] is not r2["peers"][0]
+    r1["peers"].append(1)
+    assert d.decode(raw) == r2
+
+    # least recently used is dropped.
+    d.decode(b"i1e")
+    d.decode(raw)
+    d.decode(b"i2e")
+    assert len(d) == 2
+    d.decode(raw)
+    assert d.hits == 4
+
+    d.clear()
+    assert len(d) == 0
+
+
+def test_decoder_frozen():
+    d = Decoder(frozen=True)
+    raw = bencode({"files": [{"length": 1, "path": [b"a"]}]})
+
+    r = d.decode(raw)
+    assert d.decode(raw) is r
+    assert r == {b"files": ({b"length": 1, b"path": (b"a",)},)}
+    with pytest.raises(TypeError):
+        r[b"files"] = ()  # type: ignore
+
+    assert Decoder(0, frozen=True).decode(b"li1ee") == (1,)
+
+
+@pytest.mark.parametrize("cache_size", [0, 1])
+def test_decoder_error(cache_size: int):
+    d = Decoder(cache_size, strict=False)
+    assert d.decode(b"d1:bi1e1:ai02ee") == {b"b": 1, b"a": 2}
+
+    with pytest.raises(BencodeDecodeError):
+        d.decode(b"i1")
+    with pytest.raises(TypeError):
+        d.decode("i1e")  # type: ignore
+    with pytest.raises(ValueError):
+        Decoder(-1)
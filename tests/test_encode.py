@@ -1,15 +1,31 @@
 from __future__ import annotations
 
+import array
 import collections
+import dataclasses
+from decimal import Decimal
+import enum
+import gc
+import io
+import mmap
 from pathlib import Path
 import sys
 import types
 from typing import Any
+import weakref
 
 import bencode_c
 import pytest
 
-from bencode_c import BencodeEncodeError, bencode
+from bencode_c import (
+    BencodeEncodeError,
+    EncodeCache,
+    bdecode,
+    bencode,
+    bencode_iter,
+    bencode_segments,
+    compile_template,
+)
 from bencode_c._bencode import __BUILD_PY_MINOR_VERSION__
 
 
@@ -113,6 +129,10 @@ def test_duplicated_type_keys():
         bencode({"string_key": 1, b"string_key": 2, "1": 2})
 
 
+def test_binary_keys():
+    assert bencode({b"\x00b": 2, b"\x00a": 1}) == b"d2:\x00ai1e2:\x00bi2ee"
+
+
 def test_dict_int_keys():
     with pytest.raises(BencodeEncodeError):
         bencode({1: 2})
@@ -141,6 +161,13 @@ def test_dict_int_keys():
         # slow path overflow c long long
         (9223372036854775808, b"i9223372036854775808e"),  # longlong int +1
         (18446744073709551616, b"i18446744073709551616e"),  # unsigned long long +1
+        (-9223372036854775809, b"i-9223372036854775809e"),
+        (2**127 - 1, b"i170141183460469231731687303715884105727e"),
+        (-(2**127), b"i-170141183460469231731687303715884105728e"),
+        # larger than int128
+        (2**127, b"i170141183460469231731687303715884105728e"),
+        (-(2**127) - 1, b"i-170141183460469231731687303715884105729e"),
+        (10**60, b"i1" + b"0" * 60 + b"e"),
         (bytearray([1, 2, 3]), b"3:" + b"\x01\x02\x03"),
     ],
     ids=lambda val: f"raw={val[0]!r} expected={val[1]!r}",
@@ -177,3 +204,579 @@ def test_mapping_proxy():
     assert (
         bencode(types.MappingProxyType({b"spam": [b"a", b"b"]})) == b"d4:spaml1:a1:bee"
     )
+
+
+@pytest.mark.parametrize(
+    ["raw", "expected"],
+    [
+        (memoryview(b"abc"), b"3:abc"),
+        (memoryview(b"abcdef")[1:3], b"2:bc"),
+        (memoryview(bytearray(b"")), b"0:"),
+        (array.array("B", [1, 2, 3]), b"3:\x01\x02\x03"),
+        (array.array("H", [1]), b"2:" + array.array("H", [1]).tobytes()),
+        ({"pieces": memoryview(b"\x00" * 40)}, b"d6:pieces40:" + b"\x00" * 40 + b"e"),
+    ],
+)
+def test_encode_buffer(raw: Any, expected: bytes):
+    assert bencode(raw) == expected
+
+
+def test_encode_mmap():
+    m = mmap.mmap(-1, 8)
+    m.write(b"12345678")
+    try:
+        assert bencode(m) == b"8:12345678"
+    finally:
+        m.close()
+
+
+def test_encode_segments():
+    pieces = b"\x01" * 100
+    value = {
+        "info": {"name": "a", "pieces": pieces, "piece length": 16},
+        "z": [b"x" * 200],
+    }
+    segments = bencode_segments(value, threshold=100)
+    assert b"".join(segments) == bencode(value)
+    assert any(s is pieces for s in segments)
+    assert [len(s) for s in segments] == [
+        len(b"d4:infod4:name1:a12:piece lengthi16e6:pieces100:"),
+        100,
+        len(b"e1:zl200:"),
+        200,
+        len(b"ee"),
+    ]
+
+
+def test_encode_segments_small():
+    assert bencode_segments({"a": b"b" * 10}) == [b"d1:a10:" + b"b" * 10 + b"e"]
+
+
+def test_encode_segments_buffer():
+    b = bytearray(b"\x00" * 10)
+    segments = bencode_segments([b], threshold=1)
+    assert len(segments) == 3
+    assert isinstance(segments[1], memoryview)
+    assert b"".join(segments) == b"l10:" + b"\x00" * 10 + b"e"
+
+
+class Color(enum.Enum):
+    red = "r"
+    green = 2
+
+
+class Flag(enum.IntEnum):
+    a = 1
+
+
+@dataclasses.dataclass
+class File:
+    path: list
+    length: int
+    md5sum: Any = None
+    unused: dataclasses.InitVar[int] = 0
+
+
+class Info(collections.abc.Mapping):
+    def __init__(self, **kwargs):
+        self._data = kwargs
+
+    def __getitem__(self, key):
+        return self._data[key]
+
+    def __iter__(self):
+        return iter(self._data)
+
+    def __len__(self):
+        return len(self._data)
+
+
+class Pieces(collections.abc.Sequence):
+    def __getitem__(self, index):
+        return [b"a", b"b"][index]
+
+    def __len__(self):
+        return 2
+
+
+@pytest.mark.parametrize(
+    ["raw", "expected"],
+    [
+        (Color.red, b"1:r"),
+        ([Color.green, Flag.a], b"li2ei1ee"),
+        (
+            File(path=["a", "b"], length=3, md5sum=b""),
+            b"d6:lengthi3e6:md5sum0:4:pathl1:a1:bee",
+        ),
+        (
+            [File(["a"], 1, 1), File(["b"], 2, 2)],
+            b"ld6:lengthi1e6:md5sumi1e4:pathl1:aee"
+            b"d6:lengthi2e6:md5sumi2e4:pathl1:beee",
+        ),
+        (Info(name="n", length=1), b"d6:lengthi1e4:name1:ne"),
+        (Info(), b"de"),
+        (Pieces(), b"l1:a1:be"),
+        (collections.OrderedDict(b=1, a=2), b"d1:ai2e1:bi1ee"),
+    ],
+)
+def test_encode_fallback(raw: Any, expected: bytes):
+    assert bencode(raw) == expected
+
+
+def test_encode_default():
+    class Peer:
+        def __init__(self, ip):
+            self.ip = ip
+
+    assert bencode([Peer("a"), Peer("b")], default=lambda o: o.ip) == b"l1:a1:be"
+    assert bencode({2, 1}, default=sorted) == b"li1ei2ee"
+
+    with pytest.raises(TypeError):
+        bencode(Peer("a"))
+
+    with pytest.raises(ValueError, match="circular reference found"):
+        bencode(Peer("a"), default=lambda o: o)
+
+    with pytest.raises(ZeroDivisionError):
+        bencode(Peer("a"), default=lambda o: 1 / 0)
+
+
+def test_encode_type_cache(monkeypatch):
+    # kind of type is cached across calls, dataclass fields are only read once.
+    @dataclasses.dataclass
+    class Node:
+        name: str
+
+    assert bencode(Node("a")) == b"d4:name1:ae"
+    monkeypatch.setattr(dataclasses, "fields", None)
+    assert bencode(Node("b")) == b"d4:name1:be"
+
+
+def test_encode_type_cache_ref():
+    # cache doesn't keep types alive.
+    Node = dataclasses.make_dataclass("Node", ["name"])
+    assert bencode(Node("a")) == b"d4:name1:ae"
+    ref = weakref.ref(Node)
+    del Node
+    gc.collect()
+    assert ref() is None
+
+
+def test_encode_type_cache_abc():
+    class Items:
+        def __getitem__(self, index):
+            return [1, 2][index]
+
+        def __len__(self):
+            return 2
+
+    with pytest.raises(TypeError):
+        bencode(Items())
+    collections.abc.Sequence.register(Items)
+    assert bencode(Items()) == b"li1ei2ee"
+
+    class Pairs(Items):
+        pass
+
+    assert bencode(Pairs()) == b"li1ei2ee"
+    # kind of cached type changes after register.
+    collections.abc.Mapping.register(Pairs)
+    Pairs.items = lambda self: [("a", 1)]
+    assert bencode(Pairs()) == b"d1:ai1ee"
+
+
+def test_encode_mapping_invalid_key():
+    m = Info()
+    m._data = {1: 2}
+    with pytest.raises(BencodeEncodeError):
+        bencode(m)
+
+    m._data = {"a": 1, b"a": 2}
+    with pytest.raises(BencodeEncodeError):
+        bencode(m)
+
+
+@pytest.mark.parametrize("size_hint", [0, 1, 10, 4096, 1 << 20])
+def test_encode_size_hint(size_hint):
+    value = {"pieces": b"x" * 100000, "files": [{"length": i} for i in range(100)]}
+    assert bencode(value, size_hint=size_hint) == bencode(value)
+
+
+def test_encode_size_hint_negative():
+    with pytest.raises(ValueError):
+        bencode(1, size_hint=-1)
+
+
+def test_encode_mixed_sizes():
+    # estimate of output size follow previous outputs.
+    large = {"pieces": b"x" * (4 << 20)}
+    small = {"peers": b"1234567"}
+    for _ in range(20):
+        assert bencode(large) == b"d6:pieces4194304:" + b"x" * (4 << 20) + b"e"
+        assert bencode(small) == b"d5:peers7:1234567e"
+
+
+def test_encode_generator():
+    assert bencode((i for i in range(3))) == b"li0ei1ei2ee"
+    assert bencode({"a": iter([b"x", [1]])}) == b"d1:al1:xli1eeee"
+    assert bencode(map(str, range(2))) == b"l1:01:1e"
+
+
+def test_encode_file():
+    # files are iterators of lines, they are not encoded as list.
+    with pytest.raises(TypeError):
+        bencode(io.BytesIO(b"a\nb\n"))
+    with pytest.raises(TypeError):
+        list(bencode_iter([io.StringIO("a")]))
+    assert bencode(io.BytesIO(b"a"), default=lambda f: f.read()) == b"1:a"
+
+
+@pytest.mark.parametrize("chunk_size", [1, 7, 100, 65536])
+def test_encode_iter(chunk_size):
+    value = {
+        "info": {"name": "a", "pieces": b"\x01" * 100, "piece length": 16},
+        "files": [{"length": i, "path": ["a", str(i)]} for i in range(50)],
+        "t": (1, -2, 1 << 70),
+    }
+    chunks = list(bencode_iter(value, chunk_size=chunk_size))
+    assert b"".join(chunks) == bencode(value)
+    # a chunk may exceed chunk size by one string or int.
+    assert all(len(c) < chunk_size + 110 for c in chunks)
+
+
+def test_encode_iter_lazy():
+    consumed = []
+
+    def files():
+        for i in range(1000):
+            consumed.append(i)
+            yield {"length": i}
+
+    it = bencode_iter({"files": files()}, chunk_size=100)
+    assert next(it).startswith(b"d5:filesl")
+    assert len(consumed) < 20
+    rest = b"".join(it)
+    assert len(consumed) == 1000
+    assert rest.endswith(b"d6:lengthi999eeee")
+
+
+def test_encode_iter_error():
+    def items():
+        yield 1
+        raise KeyError("boom")
+
+    it = bencode_iter([b"x" * 10, items()], chunk_size=4)
+    with pytest.raises(KeyError):
+        list(it)
+    assert list(it) == []
+
+    with pytest.raises(TypeError):
+        list(bencode_iter([object()]))
+
+    with pytest.raises(ValueError):
+        bencode_iter(1, chunk_size=0)
+
+
+def test_encode_iter_circular():
+    d: dict = {}
+    d["a"] = [d]
+    with pytest.raises(ValueError, match="circular reference found"):
+        list(bencode_iter(d, chunk_size=1))
+
+    shared = [1]
+    assert b"".join(bencode_iter([shared, shared])) == b"lli1eeli1eee"
+
+
+def test_encode_iter_default():
+    class Peer:
+        def compact(self):
+            return b"123456"
+
+    value = {"peers": [Peer(), Peer()]}
+    chunks = bencode_iter(value, chunk_size=2, default=Peer.compact)
+    assert b"".join(chunks) == bencode(value, default=Peer.compact)
+
+
+def test_encode_iter_gc():
+    class Box:
+        it: Any
+
+    # reference cycles through pending value, stack frames and default hook.
+    def pending(box):
+        return bencode_iter([box], default=lambda o: 1)
+
+    def frame(box):
+        it = bencode_iter({"a": [1, box]}, chunk_size=1, default=lambda o: 1)
+        assert next(it) == b"d"
+        return it
+
+    def hook(box):
+        return bencode_iter(1, default=lambda o: box)
+
+    for make in [pending, frame, hook]:
+        box = Box()
+        box.it = make(box)
+        ref = weakref.ref(box)
+        del box
+        gc.collect()
+        assert ref() is None, make
+
+
+def test_circular_deep():
+    # deeper than inline path of circular reference check.
+    d: dict = {}
+    inner = d
+    for _ in range(100):
+        inner["a"] = {}
+        inner = inner["a"]
+    assert bencode(d) == b"d1:a" * 100 + b"de" + b"e" * 100
+
+    inner["a"] = d
+    with pytest.raises(ValueError, match="circular reference found"):
+        bencode(d)
+
+    inner["a"] = [inner]
+    with pytest.raises(ValueError, match="circular reference found"):
+        bencode(d)
+
+    shared = [1]
+    value = [[shared, [shared]] for _ in range(40)]
+    nested: list = []
+    for v in value:
+        nested = [nested, v]
+    assert bdecode(bencode(nested)) == nested
+
+
+def test_no_check_circular():
+    value = {"a": [{"b": [1, 2]}] * 3}
+    assert bencode(value, check_circular=False) == bencode(value)
+    assert bencode_segments(value, check_circular=False) == bencode_segments(value)
+
+    d: dict = {}
+    d["a"] = [d]
+    with pytest.raises(RecursionError):
+        bencode(d, check_circular=False)
+    with pytest.raises(RecursionError):
+        list(bencode_iter(d, check_circular=False))
+
+
+ANNOUNCE_KEYS = [
+    "interval",
+    "min interval",
+    "complete",
+    "incomplete",
+    "peers",
+    "peers6",
+]
+
+
+def test_template():
+    t = compile_template(ANNOUNCE_KEYS)
+    assert t.keys == tuple(ANNOUNCE_KEYS)
+
+    values = [1800, 900, 5, 2, b"\x01" * 12, b"\x02" * 36]
+    expected = bencode(dict(zip(ANNOUNCE_KEYS, values)))
+    assert t.encode(values) == expected
+    assert t.encode(tuple(values)) == expected
+    assert t.encode(dict(zip(ANNOUNCE_KEYS, values))) == expected
+
+    # None and missing keys are omitted.
+    values[5] = None
+    assert t.encode(values) == bencode(dict(zip(ANNOUNCE_KEYS[:5], values[:5])))
+    assert t.encode({"interval": 1}) == b"d8:intervali1ee"
+    assert t.encode({}) == b"de"
+
+
+def test_template_keys():
+    t = compile_template([b"b", "a", "\u00e9", b"ab"])
+    assert t.encode([1, 2, 3, 4]) == b"d1:ai2e2:abi4e1:bi1e2:\xc3\xa9i3ee"
+    assert compile_template([]).encode(()) == b"de"
+
+    with pytest.raises(ValueError):
+        compile_template(["a", b"a"])
+    with pytest.raises(BencodeEncodeError):
+        compile_template([1])
+
+
+def test_template_error():
+    t = compile_template(["a", "b"], default=lambda v: sorted(v))
+    assert t.encode([{3, 1}, 1]) == b"d1:ali1ei3ee1:bi1ee"
+
+    with pytest.raises(ValueError):
+        t.encode([1])
+    with pytest.raises(ValueError):
+        t.encode({"a": 1, "c": 2})
+    with pytest.raises(TypeError):
+        t.encode(1)
+    with pytest.raises(TypeError):
+        compile_template(["a"]).encode([object()])
+
+    v: list = []
+    v.append(v)
+    with pytest.raises(ValueError):
+        compile_template(["a"]).encode([v])
+
+
+def test_template_gc():
+    class Box:
+        template: Any
+
+    # default hook refers back to template.
+    box = Box()
+    box.template = compile_template(["a"], default=lambda v, box=box: 1)
+    assert box.template.encode([object()]) == b"d1:ai1ee"
+    ref = weakref.ref(box)
+    del box
+    gc.collect()
+    assert ref() is None
+
+
+def test_cache():
+    cache = EncodeCache(min_bytes=0)
+    stats = (b"info-hash" * 4, 10, 20, ("tracker", True))
+    expected = bencode({"a": stats, "b": [stats]})
+
+    assert bencode({"a": stats, "b": [stats]}, cache=cache) == expected
+    assert (cache.hits, cache.misses) == (1, 2)
+    assert len(cache) == 2
+    assert cache.nbytes == len(bencode(stats)) + len(bencode(stats[3]))
+
+    # equal tuples share output.
+    assert bencode(tuple(list(stats)), cache=cache) == bencode(stats)
+    assert cache.hits == 2
+
+    cache.clear()
+    assert len(cache) == 0 and cache.nbytes == 0
+
+
+def test_cache_only_immutable_tuples():
+    cache = EncodeCache(min_bytes=0)
+    inner = [1]
+    v = (1, inner)
+    assert bencode(v, cache=cache) == b"li1eli1eee"
+    inner.append(2)
+    assert bencode(v, cache=cache) == b"li1eli1ei2eee"
+
+    # hashable but mutable.
+    @dataclasses.dataclass(eq=False)
+    class Stats:
+        count: int
+
+    s = Stats(1)
+    assert bencode((s,), cache=cache) == b"ld5:counti1eee"
+    s.count = 2
+    assert bencode((s,), cache=cache) == b"ld5:counti2eee"
+    assert len(cache) == 0
+
+
+def test_cache_equal_tuples():
+    cache = EncodeCache(min_bytes=0)
+    assert bencode((1, 2, "x" * 10), cache=cache) == b"li1ei2e10:xxxxxxxxxxe"
+
+    # equal to cached tuple, but items are not encoded same as int.
+    with pytest.raises(TypeError):
+        bencode((1.0, 2, "x" * 10), cache=cache)
+    v = bencode((1.0, 2, "x" * 10), cache=cache, default=str)
+    assert v == b"l3:1.0i2e10:xxxxxxxxxxe"
+    v = bencode((Decimal(1), 2, "x" * 10), cache=cache, default=str)
+    assert v == b"l1:1i2e10:xxxxxxxxxxe"
+    assert len(cache) == 1
+
+
+def test_cache_mark():
+    cache = EncodeCache(min_bytes=0)
+    config = {"interval": 1800}
+    assert cache.mark(config) is config
+    expected = b"ld8:intervali1800eed8:intervali1800eee"
+    assert bencode([config, config], cache=cache) == expected
+    assert (cache.hits, cache.misses) == (1, 1)
+
+    # marked objects are cached by identity, caller promise not to modify them.
+    config["interval"] = 900
+    assert bencode(config, cache=cache) == b"d8:intervali1800ee"
+
+    cache.unmark(config)
+    assert len(cache) == 0
+    assert bencode(config, cache=cache) == b"d8:intervali900ee"
+
+    with pytest.raises(KeyError):
+        cache.unmark(config)
+    with pytest.raises(TypeError):
+        cache.mark(b"a")
+
+
+def test_cache_gc():
+    class Box:
+        cache: EncodeCache
+
+    # reference cycles through marked objects and their cached outputs.
+    for encode in [False, True]:
+        box = Box()
+        box.cache = EncodeCache(min_bytes=0)
+        value = box.cache.mark([box])
+        if encode:
+            bencode(value, cache=box.cache, default=lambda o: 1)
+            assert len(box.cache) == 1
+        ref = weakref.ref(box)
+        del box, value
+        gc.collect()
+        assert ref() is None, encode
+
+
+def test_cache_mapping_proxy():
+    cache = EncodeCache(min_bytes=0)
+    d = {"min interval": 60}
+    proxy = types.MappingProxyType(d)
+
+    # proxy is a view of a dict that may change, not cached unless marked.
+    expected = b"ld12:min intervali60eed12:min intervali60eee"
+    assert bencode([proxy, proxy], cache=cache) == expected
+    d["min interval"] = 30
+    assert bencode(proxy, cache=cache) == b"d12:min intervali30ee"
+    assert len(cache) == 0
+
+    cache.mark(proxy)
+    expected = b"ld12:min intervali30eed12:min intervali30eee"
+    assert bencode([proxy, proxy], cache=cache) == expected
+    assert (cache.hits, cache.misses) == (1, 1)
+
+
+def test_cache_limits():
+    cache = EncodeCache(2, max_bytes=100, min_bytes=10)
+    a = (b"a" * 10,)
+    b = (b"b" * 10,)
+    c = (b"c" * 10,)
+
+    bencode([a, b, c, (1,)], cache=cache)
+    # oldest is dropped, short output is not cached.
+    assert len(cache) == 2
+    bencode(b, cache=cache)
+    bencode(c, cache=cache)
+    bencode(a, cache=cache)
+    assert cache.hits == 2
+
+    cache = EncodeCache(max_bytes=30, min_bytes=0)
+    bencode([a, b, c, (b"d" * 40,)], cache=cache)
+    # 15 bytes each, output larger than max_bytes is not cached.
+    assert cache.nbytes == 30
+    assert len(cache) == 2
+
+    assert len(EncodeCache(0)) == 0
+    bencode([a, a], cache=EncodeCache(0))
+
+    with pytest.raises(ValueError):
+        EncodeCache(-1)
+    with pytest.raises(TypeError):
+        bencode(a, cache={})
+
+
+def test_cache_error():
+    cache = EncodeCache(min_bytes=0)
+    with pytest.raises(TypeError):
+        bencode((1, object()), cache=cache)
+    assert len(cache) == 0
+
+    v = cache.mark([])
+    v.append(v)
+    with pytest.raises(ValueError):
+        bencode(v, cache=cache)
@@ -0,0 +1,190 @@
+import pytest
+
+from bencode_c import (
+    BencodeDecodeError,
+    BencodeEncodeError,
+    KrpcMessage,
+    bdecode,
+    bencode,
+    decode_krpc,
+    encode_krpc,
+)
+
+NODE_ID = b"abcdefghij0123456789"
+INFO_HASH = b"mnopqrstuvwxyz123456"
+
+
+def test_decode_query():
+    raw = (
+        b"d1:ad2:id20:abcdefghij012345678912:implied_porti1e9:info_hash20:"
+        b"mnopqrstuvwxyz1234564:porti6881e5:token8:aoeusnthe"
+        b"1:q13:announce_peer1:t2:aa1:y1:qe"
+    )
+    msg = decode_krpc(raw)
+    assert isinstance(msg, KrpcMessage)
+    assert msg.t == b"aa"
+    assert msg.y == b"q"
+    assert msg.q == b"announce_peer"
+    assert msg.id == NODE_ID
+    assert msg.info_hash == INFO_HASH
+    assert msg.port == 6881
+    assert msg.implied_port == 1
+    assert msg.token == b"aoeusnth"
+    assert msg.nodes is None
+    assert encode_krpc(msg) == raw
+
+
+def test_decode_response():
+    raw = bencode(
+        {
+            "t": b"aa",
+            "y": "r",
+            "v": b"UT01",
+            "r": {
+                "id": NODE_ID,
+                "nodes": INFO_HASH + bytes([1, 2, 3, 4, 0x1A, 0xE1]),
+                "nodes6": INFO_HASH + bytes(15) + b"\x01\x1a\xe1",
+                "values": [
+                    bytes([10, 0, 0, 1, 0, 80]),
+                    bytes.fromhex("20010db8") + bytes(14),
+                ],
+                "token": b"tok",
+                "unknown": [1, {"a": 2}],
+            },
+            "ip": bytes(6),
+        }
+    )
+    msg = decode_krpc(raw)
+    assert msg.y == b"r"
+    assert msg.q is None
+    assert msg.v == b"UT01"
+    assert msg.nodes == [(INFO_HASH, "1.2.3.4", 6881)]
+    assert msg.nodes6 == [(INFO_HASH, "::1", 6881)]
+    assert msg.values == [("10.0.0.1", 80), ("2001:db8::", 0)]
+
+    # unknown keys are dropped.
+    value = bdecode(raw)
+    del value[b"ip"]
+    del value[b"r"][b"unknown"]
+    assert encode_krpc(msg) == bencode(value)
+
+
+def test_decode_error():
+    msg = decode_krpc(b"d1:eli201e23:A Generic Error Ocurrede1:t2:aa1:y1:ee")
+    assert msg.y == b"e"
+    assert msg.error == (201, b"A Generic Error Ocurred")
+    assert encode_krpc(msg) == b"d1:eli201e23:A Generic Error Ocurrede1:t2:aa1:y1:ee"
+
+
+@pytest.mark.parametrize(
+    "raw",
+    [
+        b"",
+        b"le",
+        b"d1:t2:aae",
+        # trailing data
+        b"d1:eli201e1:xe1:t2:aa1:y1:eeX",
+        # missing 'a'
+        b"d1:q4:ping1:t2:aa1:y1:qe",
+        # missing id
+        b"d1:ade1:q4:ping1:t2:aa1:y1:qe",
+        # short id
+        b"d1:ad2:id3:abce1:q4:ping1:t2:aa1:y1:qe",
+        # unsorted keys
+        b"d1:y1:q1:t2:aa1:q4:ping1:ad2:id20:abcdefghij0123456789ee",
+        # unknown type
+        b"d1:rd2:id20:abcdefghij0123456789e1:t2:aa1:y1:xe",
+        # nodes length
+        b"d1:rd2:id20:abcdefghij01234567895:nodes3:abce1:t2:aa1:y1:re",
+        # values item length
+        b"d1:rd2:id20:abcdefghij01234567896:valuesl3:abcee1:t2:aa1:y1:re",
+        b"d1:rd2:id20:abcdefghij01234567894:porti01ee1:t2:aa1:y1:re",
+        b"d1:eli201ee1:t2:aa1:y1:ee",
+    ],
+)
+def test_decode_invalid(raw: bytes):
+    with pytest.raises(BencodeDecodeError):
+        decode_krpc(raw)
+
+
+def test_encode_fields():
+    raw = encode_krpc(
+        t=b"aa",
+        y="q",
+        q="find_node",
+        id=NODE_ID,
+        target=INFO_HASH,
+    )
+    assert raw == bencode(
+        {
+            "t": b"aa",
+            "y": "q",
+            "q": "find_node",
+            "a": {"id": NODE_ID, "target": INFO_HASH},
+        }
+    )
+
+    msg = decode_krpc(raw)
+    assert encode_krpc(msg, t=b"bb") == raw.replace(b"1:t2:aa", b"1:t2:bb")
+
+
+def test_encode_peers():
+    values = [("1.2.3.4", 1), ("255.255.255.255", 65535), ("::ffff:1.2.3.4", 2)]
+    nodes6 = [(NODE_ID, "2001:db8::1", 6881), (INFO_HASH, "fe80::", 1)]
+    raw = encode_krpc(t=b"a", y=b"r", id=NODE_ID, values=values, nodes6=nodes6)
+    msg = decode_krpc(raw)
+    assert msg.values == [
+        ("1.2.3.4", 1),
+        ("255.255.255.255", 65535),
+        ("::ffff:102:304", 2),
+    ]
+    assert msg.nodes6 == nodes6
+
+
+@pytest.mark.parametrize(
+    ["fields", "exc"],
+    [
+        ({"t": b"a"}, BencodeEncodeError),
+        ({"t": b"a", "y": b"x", "id": NODE_ID}, BencodeEncodeError),
+        ({"t": b"a", "y": "\u0171", "q": b"ping", "id": NODE_ID}, BencodeEncodeError),
+        ({"t": b"a", "y": b"q", "id": NODE_ID}, BencodeEncodeError),
+        ({"t": b"a", "y": b"r"}, BencodeEncodeError),
+        ({"t": b"a", "y": b"r", "id": b"short"}, BencodeEncodeError),
+        ({"t": 1, "y": b"r", "id": NODE_ID}, TypeError),
+        ({"t": b"a", "y": b"r", "id": NODE_ID, "values": [("1.2.3", 1)]}, ValueError),
+        (
+            {"t": b"a", "y": b"r", "id": NODE_ID, "values": [("1.2.3.4", 70000)]},
+            ValueError,
+        ),
+        ({"t": b"a", "y": b"r", "id": NODE_ID, "values": [("1:::2", 1)]}, ValueError),
+        (
+            {"t": b"a", "y": b"r", "id": NODE_ID, "nodes": [(NODE_ID, "::1", 1)]},
+            BencodeEncodeError,
+        ),
+        ({"t": b"a", "y": b"r", "id": NODE_ID, "unknown": 1}, TypeError),
+        # fields of other message types.
+        (
+            {"t": b"a", "y": "q", "q": b"ping", "id": NODE_ID, "nodes": []},
+            BencodeEncodeError,
+        ),
+        (
+            {"t": b"a", "y": "q", "q": b"ping", "id": NODE_ID, "values": []},
+            BencodeEncodeError,
+        ),
+        (
+            {"t": b"a", "y": b"r", "id": NODE_ID, "target": NODE_ID},
+            BencodeEncodeError,
+        ),
+        (
+            {"t": b"a", "y": b"r", "id": NODE_ID, "info_hash": NODE_ID},
+            BencodeEncodeError,
+        ),
+        (
+            {"t": b"a", "y": b"e", "error": (201, b"x"), "id": NODE_ID},
+            BencodeEncodeError,
+        ),
+    ],
+)
+def test_encode_invalid(fields, exc):
+    with pytest.raises(exc):
+        encode_krpc(**fields)
@@ -0,0 +1,221 @@
+import hashlib
+import os
+import random
+
+import pytest
+
+from bencode_c import bdecode, make_torrent
+from bencode_c._bencode import _hash_selftest
+
+PIECE = 16384 * 4
+
+
+def _randbytes(rand, n):
+    return rand.getrandbits(n * 8).to_bytes(n, "little")
+
+
+def _merkle(hashes, count, pad):
+    hashes = hashes + [pad] * (count - len(hashes))
+    while len(hashes) > 1:
+        hashes = [
+            hashlib.sha256(hashes[i] + hashes[i + 1]).digest()
+            for i in range(0, len(hashes), 2)
+        ]
+    return hashes[0]
+
+
+def _pow2(n):
+    p = 1
+    while p < n:
+        p *= 2
+    return p
+
+
+def _v2(data, piece_length):
+    """pieces root and piece layer of a file, by hashlib."""
+    blocks = [
+        hashlib.sha256(data[i : i + 16384]).digest() for i in range(0, len(data), 16384)
+    ]
+    if len(data) <= piece_length:
+        return _merkle(blocks, _pow2(len(blocks)), bytes(32)), None
+
+    per_piece = piece_length // 16384
+    layer = [
+        _merkle(blocks[i : i + per_piece], per_piece, bytes(32))
+        for i in range(0, len(blocks), per_piece)
+    ]
+    pad = _merkle([], per_piece, bytes(32))
+    return _merkle(layer, _pow2(len(layer)), pad), b"".join(layer)
+
+
+def _v1_pieces(data, piece_length):
+    return b"".join(
+        hashlib.sha1(data[i : i + piece_length]).digest()
+        for i in range(0, len(data), piece_length)
+    )
+
+
+@pytest.fixture()
+def tree(tmp_path):
+    rand = random.Random(42)
+    files = {
+        ("a.bin",): _randbytes(rand, PIECE * 3 + 100),
+        ("empty",): b"",
+        ("sub", "b.bin"): _randbytes(rand, 1000),
+        ("sub", "c.bin"): _randbytes(rand, PIECE),
+        ("sub", "deep", "d.bin"): _randbytes(rand, PIECE * 2 + 16384 * 2 + 5),
+    }
+    root = tmp_path / "root"
+    for parts, data in files.items():
+        p = root.joinpath(*parts)
+        p.parent.mkdir(parents=True, exist_ok=True)
+        p.write_bytes(data)
+    return root, files
+
+
+def test_v1_single_file(tmp_path):
+    data = _randbytes(random.Random(1), PIECE * 5 + 77)
+    p = tmp_path / "file.bin"
+    p.write_bytes(data)
+
+    t = bdecode(make_torrent(p, PIECE, announce="http://tracker/announce"))
+    assert t[b"announce"] == b"http://tracker/announce"
+    assert t[b"info"] == {
+        b"length": len(data),
+        b"name": b"file.bin",
+        b"piece length": PIECE,
+        b"pieces": _v1_pieces(data, PIECE),
+    }
+
+
+@pytest.mark.parametrize("threads", [1, 2, 7])
+def test_v1_directory(tree, threads):
+    root, files = tree
+    t = bdecode(make_torrent(root, PIECE, threads=threads, private=True))
+    info = t[b"info"]
+    assert info[b"name"] == b"root"
+    assert info[b"private"] == 1
+    assert info[b"files"] == [
+        {b"length": len(data), b"path": [p.encode() for p in parts]}
+        for parts, data in sorted(files.items())
+    ]
+    content = b"".join(data for _, data in sorted(files.items()))
+    assert info[b"pieces"] == _v1_pieces(content, PIECE)
+
+
+@pytest.mark.parametrize("version", [2, "hybrid"])
+def test_v2_directory(tree, version):
+    root, files = tree
+    t = bdecode(make_torrent(root, PIECE, version=version, threads=3))
+    info = t[b"info"]
+    assert info[b"meta version"] == 2
+
+    layers = {}
+    for parts, data in files.items():
+        node = info[b"file tree"]
+        for part in parts:
+            node = node[part.encode()]
+        if not data:
+            assert node[b""] == {b"length": 0}
+            continue
+        pieces_root, layer = _v2(data, PIECE)
+        assert node[b""] == {b"length": len(data), b"pieces root": pieces_root}
+        if layer is not None:
+            layers[pieces_root] = layer
+    assert t[b"piece layers"] == layers
+
+    if version == 2:
+        assert b"pieces" not in info
+        assert b"files" not in info
+        return
+
+    # hybrid, v1 files are padded to pieces.
+    content = b""
+    expected = []
+    for parts, data in sorted(files.items()):
+        if data and len(content) % PIECE:
+            pad = PIECE - len(content) % PIECE
+            expected.append(
+                {b"attr": b"p", b"length": pad, b"path": [b".pad", str(pad).encode()]}
+            )
+            content += bytes(pad)
+        expected.append({b"length": len(data), b"path": [p.encode() for p in parts]})
+        content += data
+    assert info[b"files"] == expected
+    assert info[b"pieces"] == _v1_pieces(content, PIECE)
+
+
+def test_v2_single_file(tmp_path):
+    data = _randbytes(random.Random(2), 16384 * 3 + 1)
+    p = tmp_path / "small.bin"
+    p.write_bytes(data)
+
+    t = bdecode(make_torrent(p, PIECE, version=2))
+    pieces_root, _ = _v2(data, PIECE)
+    assert t[b"info"][b"file tree"] == {
+        b"small.bin": {b"": {b"length": len(data), b"pieces root": pieces_root}}
+    }
+    assert t[b"piece layers"] == {}
+
+
+def test_canonical(tree):
+    root, _ = tree
+    raw = make_torrent(
+        root,
+        PIECE,
+        version="hybrid",
+        comment="c",
+        created_by="bencode-c",
+        creation_date=1700000000,
+        url_list=["http://a/"],
+        announce_list=[["http://a"], ["http://b"]],
+        source="s",
+    )
+    assert bdecode(raw, strict=True)
+    assert raw == make_torrent(
+        root,
+        PIECE,
+        version="hybrid",
+        comment="c",
+        created_by="bencode-c",
+        creation_date=1700000000,
+        url_list=["http://a/"],
+        announce_list=[["http://a"], ["http://b"]],
+        source="s",
+        threads=1,
+    )
+
+
+def test_invalid(tmp_path):
+    p = tmp_path / "f"
+    p.write_bytes(b"1")
+    with pytest.raises(ValueError):
+        make_torrent(p, 1000)
+    with pytest.raises(ValueError):
+        make_torrent(p, 8192)
+    with pytest.raises(ValueError):
+        make_torrent(p, PIECE, version=3)
+    with pytest.raises(FileNotFoundError):
+        make_torrent(tmp_path / "missing", PIECE)
+
+
+def test_file_shrink(tmp_path):
+    from bencode_c._bencode import _make_torrent
+
+    p = tmp_path / "f"
+    p.write_bytes(b"1" * 100)
+    with pytest.raises(OSError, match="smaller"):
+        _make_torrent([(str(p), [], 200)], "f", PIECE)
+
+    os.remove(p)
+    with pytest.raises(FileNotFoundError):
+        _make_torrent([(str(p), [], 100)], "f", PIECE, threads=2)
+
+
+@pytest.mark.parametrize("size", [0, 1, 55, 56, 63, 64, 65, 119, 128, 1000, 16384 + 7])
+def test_hash_portable(size):
+    # portable code is not used by make_torrent on cpu with sha extensions.
+    data = _randbytes(random.Random(size), size)
+    sha1 = hashlib.sha1(data).digest()
+    sha256 = hashlib.sha256(data).digest()
+    assert _hash_selftest(data) == (sha1, sha256, sha1, sha256)
@@ -0,0 +1,86 @@
+import pytest
+
+from bencode_c import BencodeDecodeError, bdecode, bencode, bpatch
+
+TORRENT = {
+    b"announce": b"http://old/announce",
+    b"announce-list": [[b"http://old/announce"]],
+    b"comment": b"old",
+    b"info": {
+        b"files": [{b"length": 1, b"path": [b"a"]}, {b"length": 2, b"path": [b"b"]}],
+        b"name": b"dir",
+        b"piece length": 16384,
+        b"pieces": b"x" * 20,
+    },
+}
+RAW = bencode(TORRENT)
+
+
+def test_bpatch():
+    patched = bpatch(
+        RAW,
+        {
+            "announce": "http://new/announce",
+            b"announce-list": [["http://new/announce"]],
+            ("created by",): "bencode-c",
+        },
+        delete=["comment"],
+    )
+
+    expected = dict(TORRENT)
+    expected[b"announce"] = b"http://new/announce"
+    expected[b"announce-list"] = [[b"http://new/announce"]]
+    expected[b"created by"] = b"bencode-c"
+    del expected[b"comment"]
+    assert patched == bencode(expected)
+    assert bencode(TORRENT[b"info"]) in patched
+
+
+INFO = TORRENT[b"info"]
+
+
+@pytest.mark.parametrize(
+    ["patches", "delete", "expected"],
+    [
+        ({}, (), TORRENT),
+        (
+            {(b"info", b"name"): b"new"},
+            (),
+            {**TORRENT, b"info": {**INFO, b"name": b"new"}},
+        ),
+        ({("a", "b", "c"): 1}, (), {**TORRENT, b"a": {b"b": {b"c": 1}}}),
+        ({}, [("missing",), ("a", "b")], TORRENT),
+        (
+            {},
+            [(b"info", b"files")],
+            {**TORRENT, b"info": {k: v for k, v in INFO.items() if k != b"files"}},
+        ),
+        ({b"zzz": [1, {"k": "v"}]}, (), {**TORRENT, b"zzz": [1, {b"k": b"v"}]}),
+    ],
+)
+def test_bpatch_paths(patches, delete, expected):
+    assert bpatch(RAW, patches, delete=delete) == bencode(expected)
+
+
+@pytest.mark.parametrize(
+    "raw",
+    [b"", b"li1ee", b"d1:bi1e1:ai1ee", b"d1:ai01ee", b"d1:ai1eex", b"d1:a"],
+)
+def test_bpatch_invalid(raw):
+    with pytest.raises(BencodeDecodeError):
+        bpatch(raw, {"c": 1})
+
+
+def test_bpatch_invalid_patches():
+    with pytest.raises(ValueError):
+        bpatch(RAW, {("a",): 1, ("a", "b"): 2})
+    with pytest.raises(ValueError):
+        bpatch(RAW, {"a": 1}, delete=["a"])
+    with pytest.raises(ValueError):
+        bpatch(RAW, {(): 1})
+    with pytest.raises(TypeError):
+        bpatch(RAW, {(1,): 1})
+    with pytest.raises(TypeError):
+        bpatch(RAW, {"a": object()})
+    with pytest.raises(BencodeDecodeError):
+        bpatch(RAW, {("comment", "a"): 1})
@@ -0,0 +1,105 @@
+import gc
+import weakref
+
+import pytest
+
+from bencode_c import (
+    BencodeEncodeError,
+    CompactPeers,
+    bdecode,
+    bencode,
+    bencode_iter,
+    pack_peers,
+    unpack_peers,
+)
+
+PEERS = [("1.2.3.4", 6881), ("255.255.255.255", 0), ("10.0.0.1", 65535)]
+PEERS6 = [("2001:db8::1", 6881), ("::", 1), ("fe80::1:2:3:4", 65535)]
+
+
+def test_pack():
+    packed = pack_peers(PEERS)
+    assert packed == (
+        b"\x01\x02\x03\x04\x1a\xe1"
+        b"\xff\xff\xff\xff\x00\x00"
+        b"\x0a\x00\x00\x01\xff\xff"
+    )
+    assert unpack_peers(packed) == PEERS
+    assert pack_peers(tuple(PEERS)) == packed
+    assert pack_peers([]) == b""
+
+    packed6 = pack_peers(PEERS6, ipv6=True)
+    assert len(packed6) == 18 * 3
+    assert unpack_peers(packed6, ipv6=True) == PEERS6
+
+
+@pytest.mark.parametrize(
+    ["peers", "ipv6", "exc"],
+    [
+        ([("2001:db8::1", 1)], False, ValueError),
+        ([("1.2.3.4", 1)], True, ValueError),
+        ([("1.2.3", 1)], False, ValueError),
+        ([("1.2.3.4", 65536)], False, ValueError),
+        ([("1.2.3.4",)], False, TypeError),
+        ([(b"1.2.3.4", 1)], False, TypeError),
+        (1, False, TypeError),
+    ],
+)
+def test_pack_error(peers, ipv6, exc):
+    with pytest.raises(exc):
+        pack_peers(peers, ipv6=ipv6)
+    with pytest.raises(exc):
+        bencode({"peers": CompactPeers(peers, ipv6=ipv6)})
+
+
+def test_unpack_error():
+    with pytest.raises(ValueError):
+        unpack_peers(b"12345")
+    with pytest.raises(ValueError):
+        unpack_peers(bytes(6), ipv6=True)
+
+
+def test_encode_compact_peers():
+    peers = CompactPeers(PEERS)
+    peers6 = CompactPeers(PEERS6, ipv6=True)
+    assert len(peers) == 3
+    assert bytes(peers6) == pack_peers(PEERS6, ipv6=True)
+
+    value = {"interval": 1800, "peers": peers, "peers6": peers6}
+    expected = bencode(
+        {
+            "interval": 1800,
+            "peers": pack_peers(PEERS),
+            "peers6": pack_peers(PEERS6, ipv6=True),
+        }
+    )
+    assert bencode(value) == expected
+    assert b"".join(bencode_iter(value, chunk_size=8)) == expected
+    assert bdecode(expected)[b"peers6"] == pack_peers(PEERS6, ipv6=True)
+    assert bencode(CompactPeers([])) == b"0:"
+
+
+def test_compact_peers_mutation():
+    peers = list(PEERS)
+    value = CompactPeers(peers)
+    # packed when encoded.
+    peers.pop()
+    assert bencode(value) == b"12:" + pack_peers(PEERS[:2])
+
+    assert value.peers is peers
+    assert value.ipv6 is False
+    with pytest.raises(BencodeEncodeError):
+        bencode({CompactPeers(PEERS): 1})
+
+
+def test_compact_peers_gc():
+    class Box:
+        peers: CompactPeers
+
+    box = Box()
+    peers = [("1.2.3.4", 1), box]
+    box.peers = CompactPeers(peers)
+    ref = weakref.ref(box)
+    del box, peers
+    gc.collect()
+    assert ref() is None
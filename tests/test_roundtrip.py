@@ -0,0 +1,103 @@
+import random
+from typing import Any
+
+import pytest
+
+from bencode_c import (
+    BencodeDecodeError,
+    bcanonicalize,
+    bdecode,
+    bencode,
+    bencode_iter,
+)
+
+
+def random_value(r: random.Random, depth: int = 0) -> Any:
+    kind = r.randrange(4 if depth < 4 else 2)
+    if kind == 0:
+        return r.choice(
+            [0, 1, -1, r.getrandbits(r.randint(1, 200)) * r.choice([1, -1])]
+        )
+    if kind == 1:
+        return bytes(r.getrandbits(8) for _ in range(r.randint(0, 20)))
+    if kind == 2:
+        return [random_value(r, depth + 1) for _ in range(r.randint(0, 5))]
+    return {
+        bytes(r.getrandbits(8) for _ in range(r.randint(0, 4))): random_value(
+            r, depth + 1
+        )
+        for _ in range(r.randint(0, 5))
+    }
+
+
+@pytest.mark.parametrize("seed", range(20))
+def test_roundtrip(seed: int):
+    r = random.Random(seed)
+    for _ in range(100):
+        value = random_value(r)
+        raw = bencode(value)
+        assert bdecode(raw) == value
+        assert bencode(bdecode(raw)) == raw
+        assert bencode(bdecode(raw, str_key=True, str_value=True)) == raw
+
+
+@pytest.mark.parametrize("seed", range(20))
+def test_mutated_input(seed: int):
+    # decoder only accept canonical bencode, so decoded value must encode to same bytes.
+    r = random.Random(seed)
+    for _ in range(200):
+        raw = bytearray(bencode(random_value(r)))
+        for _ in range(r.randint(1, 3)):
+            op = r.randrange(3)
+            pos = r.randrange(len(raw) + 1)
+            if op == 0 and pos < len(raw):
+                raw[pos] = r.choice(b"0123456789-:ilde\x00\xff")
+            elif op == 1:
+                raw.insert(pos, r.choice(b"0123456789-:ilde"))
+            elif pos < len(raw):
+                del raw[pos]
+
+        try:
+            value = bdecode(bytes(raw))
+        except BencodeDecodeError:
+            continue
+
+        assert bencode(value) == raw
+
+
+def non_canonical(r: random.Random, value: Any) -> bytes:
+    """encode with shuffled dict keys and leading zeros."""
+    zeros = b"0" * r.randrange(3)
+    if isinstance(value, int):
+        sign = b"-" if value < 0 or r.random() < 0.1 and value == 0 else b""
+        return b"i" + sign + zeros + str(abs(value)).encode() + b"e"
+    if isinstance(value, bytes):
+        return zeros + str(len(value)).encode() + b":" + value
+    if isinstance(value, list):
+        return b"l" + b"".join(non_canonical(r, v) for v in value) + b"e"
+    items = list(value.items())
+    r.shuffle(items)
+    return (
+        b"d"
+        + b"".join(non_canonical(r, k) + non_canonical(r, v) for k, v in items)
+        + b"e"
+    )
+
+
+@pytest.mark.parametrize("seed", range(20))
+def test_canonicalize(seed: int):
+    r = random.Random(seed)
+    for _ in range(100):
+        value = random_value(r)
+        raw = non_canonical(r, value)
+        assert bdecode(raw, strict=False) == value
+        assert bcanonicalize(raw) == bencode(value)
+
+
+@pytest.mark.parametrize("seed", range(10))
+def test_encode_iter(seed: int):
+    r = random.Random(seed)
+    for _ in range(50):
+        value = random_value(r)
+        chunk_size = r.choice([1, 3, 16, 1024])
+        assert b"".join(bencode_iter(value, chunk_size=chunk_size)) == bencode(value)
@@ -0,0 +1,56 @@
+import pytest
+
+from bencode_c import bdecode, bencode, reset_stats, stats
+
+enabled = bool(stats())
+
+
+def test_stats_disabled():
+    if enabled:
+        pytest.skip("built with BENCODE_STATS")
+
+    reset_stats()
+    bencode({"a": [1, b"b"]})
+    assert stats() == {}
+
+
+@pytest.mark.skipif(not enabled, reason="built without BENCODE_STATS")
+def test_stats_decode():
+    reset_stats()
+    assert all(v == 0 for v in stats().values())
+
+    bdecode(b"d1:ai1e1:bl1:c1:dee")
+    with pytest.raises(Exception):
+        bdecode(b"l")
+
+    s = stats()
+    assert s["decode_calls"] == 2
+    assert s["decode_errors"] == 1
+    assert s["decode_bytes"] == 20
+    assert s["decode_dict"] == 1
+    assert s["decode_list"] == 2
+    assert s["decode_int"] == 1
+    assert s["decode_str"] == 4
+
+
+@pytest.mark.skipif(not enabled, reason="built without BENCODE_STATS")
+def test_stats_encode():
+    value = {"b": 1, "a": [2**70, b"x" * 10000]}
+    size = len(bencode(value))
+
+    reset_stats()
+    bencode(value)
+    with pytest.raises(TypeError):
+        bencode(object())
+
+    s = stats()
+    assert s["encode_calls"] == 2
+    assert s["encode_errors"] == 1
+    assert s["encode_bytes"] == s["encode_max_bytes"] == size
+    assert s["encode_dict"] == 1
+    assert s["encode_dict_sort"] == 1
+    assert s["encode_list"] == 1
+    assert s["encode_int"] == 2
+    assert s["encode_int_128"] + s["encode_int_slow"] == 1
+    assert s["encode_str"] == 3  # including keys
+    assert s["buffer_grow"] >= 1
@@ -1,7 +1,10 @@
 import hashlib
 from pathlib import Path
 
-from bencode_c import bdecode, bencode
+import pytest
+
+from bencode_c import BencodeDecodeError, LazyDict, LazyList, bdecode, bencode, bload
+from bencode_c._bencode import _lazy_children
 
 
 def test_get_torrent_info_hash():
@@ -16,3 +19,107 @@ def test_get_torrent_info_hash():
             hashlib.sha1(bencode(data[b"info"])).hexdigest()
             == "a7838b75c42b612da3b6cc99beed4ecb2d04cff2"
         )
+
+
+def test_bload_info_hash():
+    torrent = bload(
+        Path(__file__).joinpath(
+            "../fixtures/ubuntu-22.04.2-desktop-amd64.iso.torrent.bin"
+        ).resolve()
+    )
+
+    assert isinstance(torrent, LazyDict)
+    assert isinstance(torrent[b"info"][b"pieces"], memoryview)
+    assert (
+        hashlib.sha1(torrent.raw(b"info")).hexdigest()
+        == "a7838b75c42b612da3b6cc99beed4ecb2d04cff2"
+    )
+    assert (
+        hashlib.sha1(bencode(torrent[b"info"])).hexdigest()
+        == "a7838b75c42b612da3b6cc99beed4ecb2d04cff2"
+    )
+
+
+def test_bload_same_as_bdecode():
+    for file in Path(__file__).parent.joinpath("fixtures").iterdir():
+        raw = file.read_bytes()
+        assert bencode(bload(file)) == raw
+        assert set(bload(file)) == set(bdecode(raw))
+
+
+def test_bload_values(tmp_path):
+    value = {
+        b"a": [1, -2, b"", b"spam", [], {}],
+        b"b": {b"c": 2**80, b"d": [[b"x"]]},
+    }
+    file = tmp_path.joinpath("value.bencode")
+    file.write_bytes(bencode(value))
+
+    loaded = bload(file)
+    assert isinstance(loaded[b"a"], LazyList)
+    assert len(loaded[b"a"]) == 6
+    assert loaded[b"a"][0] == 1
+    assert loaded[b"a"][-5] == -2
+    assert loaded[b"a"][1:3] == [-2, b""]
+    assert bytes(loaded[b"a"][3]) == b"spam"
+    assert loaded[b"a"].raw(3) == b"4:spam"
+    assert loaded[b"b"][b"c"] == 2**80
+    assert bytes(loaded[b"b"][b"d"][0][0]) == b"x"
+    assert loaded[b"b"] is loaded[b"b"]
+    with pytest.raises(KeyError):
+        loaded[b"missing"]
+
+    # mapping is kept alive by values
+    pieces = loaded[b"a"][3]
+    del loaded
+    assert bytes(pieces) == b"spam"
+
+
+def test_bload_scalar(tmp_path):
+    file = tmp_path.joinpath("value.bencode")
+    file.write_bytes(b"i42e")
+    assert bload(file) == 42
+
+    file.write_bytes(b"4:spam")
+    assert bytes(bload(file)) == b"spam"
+
+
+@pytest.mark.parametrize(
+    "raw",
+    [
+        b"",
+        b"d",
+        b"i1e1",
+        b"d1:bi1e1:ai1ee",
+        b"d1:ai1e1:ai1ee",
+        b"l4:spae",
+        b"l" * 2000 + b"e" * 2000,
+        b"d1:al1:be",
+    ],
+)
+def test_bload_invalid(tmp_path, raw):
+    file = tmp_path.joinpath("value.bencode")
+    file.write_bytes(raw)
+    with pytest.raises(BencodeDecodeError):
+        bload(file)
+
+
+def test_bload_error_message(tmp_path):
+    path = tmp_path.joinpath("a.torrent")
+    path.write_bytes(b"li1e")
+    with pytest.raises(BencodeDecodeError, match="bytes end when decoding list"):
+        bload(path)
+
+
+def test_lazy_children_trusted():
+    raw = b"d1:bli1ee1:ai-0ee"
+    with pytest.raises(BencodeDecodeError):
+        _lazy_children(raw, 0)
+
+    assert _lazy_children(raw, 0, False) == (len(raw), [(b"b", 4, 9), (b"a", 12, 16)])
+    assert _lazy_children(raw, 4, False) == (9, [(5, 8)])
+    assert _lazy_children(b"l" * 2000 + b"e" * 2000, 0, False)[0] == 4000
+
+    for raw in [b"d1:al1:be", b"l4:spae", b"li1", b"lx"]:
+        with pytest.raises(BencodeDecodeError):
+            _lazy_children(raw, 0, False)